@@ -10,7 +10,15 @@
 // XMODEM, ZMODEM, ACORN, LTE, V-41-MSB
 #define     CRC_START_XMODEM        0x0000
 
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
 extern uint16_t crc16_ccitt(const uint8_t *buf, uint16_t size, const uint16_t start);
 
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
 #endif // _CRC16_H
 
@@ -0,0 +1,21 @@
+#ifndef _CRC32_H
+#define _CRC32_H
+
+#include <stdint.h>
+
+// IEEE 802.3, same as zlib crc32()
+#define     CRC32_START             0x00000000
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+// Chainable: crc32_ieee(b2, n2, crc32_ieee(b1, n1, CRC32_START)) is the
+// CRC of b1 followed by b2
+extern uint32_t crc32_ieee(const uint8_t *buf, uint32_t size, const uint32_t crc);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif // _CRC32_H
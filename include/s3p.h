@@ -10,27 +10,80 @@
 #include <stdbool.h>
 
 /** @brief S3P library version */
-#define S3P_VERSION           0x0100    // 1.00
+#define S3P_VERSION           0x0101    // 1.01
 
-/** @brief Max serial frame size */
+/** @brief Max packet size carried by frames of _frame_size bytes (COBS
+ * overhead and delimiter excluded) */
+#define S3P_PKT_SIZE(_frame_size)   ((_frame_size) - 1 - ((_frame_size) + 253) / 254)
+/** @brief Max data (payload) size carried by frames of _frame_size bytes */
+#define S3P_DATA_SIZE(_frame_size)  (S3P_PKT_SIZE(_frame_size) - 8)
+/** @brief Max upload/download chunk size carried by frames of _frame_size
+ * bytes */
+#define S3P_CHUNK_SIZE(_frame_size) (S3P_DATA_SIZE(_frame_size) - 6)
+/** @brief Max serial frame size, default for every link */
 #define S3P_MAX_FRAME_SIZE    1024
-/** @brief Max packet size */
-#define S3P_MAX_PKT_SIZE      1018
-/** @brief Max data (payload) size */
-#define S3P_MAX_DATA_SIZE     1010
-/** @brief Max size of an upload/download chunk */
-#define S3P_MAX_CHUNK_SIZE    1004
+/** @brief Max packet size (1018) */
+#define S3P_MAX_PKT_SIZE      S3P_PKT_SIZE(S3P_MAX_FRAME_SIZE)
+/** @brief Max data (payload) size (1010) */
+#define S3P_MAX_DATA_SIZE     S3P_DATA_SIZE(S3P_MAX_FRAME_SIZE)
+/** @brief Max size of an upload/download chunk (1004) */
+#define S3P_MAX_CHUNK_SIZE    S3P_CHUNK_SIZE(S3P_MAX_FRAME_SIZE)
+/** @brief Ceiling of the frame size negotiated through #PT_S3P_INFO,
+ * buffers of links using jumbo frames must be sized from it */
+#ifndef S3P_JUMBO_FRAME_SIZE
+#define S3P_JUMBO_FRAME_SIZE  8192
+#endif
+/** @brief Max packet size of links using jumbo frames */
+#define S3P_JUMBO_PKT_SIZE    S3P_PKT_SIZE(S3P_JUMBO_FRAME_SIZE)
+/** @brief Worst case encoded frame length (COBS overhead and delimiter
+ * included) for a packet carrying _data_len bytes of payload */
+#define S3P_FRAME_LEN(_data_len)  ((_data_len) + 8 + ((_data_len) + 8 + 253) / 254 + 1)
 /** @brief Frame COBS delimiter */
 #define S3P_COBS_DELIM        0x00
 /** @brief Macro to mask sequence from flags_seq packet field */
 #define S3P_SEQ_MASKED(_s)    ((_s) & 0x0F)
+/** @brief Sequence mask of flags_seq on links with extended sequence
+ * (#S3P_CAP_EXT_SEQ): the reserved bits 7:4 become the sequence MSB */
+#define S3P_SEQ_EXT_MASK      0xFF
 /** @brief Size of a single reg value returned by a PT_READ_REGS_RESP
  * response */
 #define S3P_SER_ITEM_SIZE     7
 /** @brief Max size of any 'name' field in a request/response */
 #define S3P_MAX_NAME_SIZE     32
+/** @brief Max number of block digests in a #PT_VMEM_HASHES_RESP response */
+#define S3P_MAX_HASHES        ((S3P_MAX_DATA_SIZE - 2) / 4)
+/** @brief #PT_VMEM_CRC digest type: CRC32 IEEE 802.3 (zlib) */
+#define S3P_DIGEST_CRC32      0
+/** @brief Max compressed stream size in a #PT_READ_VMEM_LZ_RESP response */
+#define S3P_MAX_LZ_READ_SIZE  (S3P_MAX_DATA_SIZE - 3)
+/** @brief Max compressed stream size in a #PT_WRITE_VMEM_LZ request */
+#define S3P_MAX_LZ_WRITE_SIZE (S3P_MAX_DATA_SIZE - 6)
+/** @brief #PT_S3P_INFO_RESP capability: #PT_VMEM_CRC supported */
+#define S3P_CAP_VMEM_CRC      0x0001
+/** @brief #PT_S3P_INFO_RESP capability: #PT_VMEM_HASHES supported */
+#define S3P_CAP_VMEM_HASHES   0x0002
+/** @brief #PT_S3P_INFO_RESP capability: #PT_READ_VMEM_LZ and
+ * #PT_WRITE_VMEM_LZ supported */
+#define S3P_CAP_VMEM_LZ       0x0004
+/** @brief #PT_S3P_INFO_RESP capability: the node copies back all of
+ * flags_seq, allowing 8 bits (extended) sequence numbers */
+#define S3P_CAP_EXT_SEQ       0x0008
+/** @brief #PT_S3P_INFO_RESP capability: #PT_GROUP_READ supported */
+#define S3P_CAP_GROUP_READ    0x0010
+/** @brief #PT_S3P_INFO_RESP capability: #PT_SUBSCRIBE and #PT_TELEMETRY
+ * supported */
+#define S3P_CAP_TELEMETRY     0x0020
+/** @brief #PT_S3P_INFO_RESP capability: a request with side effects
+ * received again (same src, type and sequence) is answered with the last
+ * response, not executed twice */
+#define S3P_CAP_DEDUP         0x0040
 /** @brief Dummy node id value */
 #define S3P_ID_NONE           0
+/** @brief Broadcast node id, accepted only for #PT_GROUP_READ by nodes
+ * supporting it (#s3p_link_t group_read) */
+#define S3P_ID_BROADCAST      255
+/** @brief #PT_GROUP_READ slot time unit, us */
+#define S3P_SLOT_UNIT_US      10
 /** @brief Dummy sequence value */
 #define S3P_SEQ_NONE          0
 
@@ -53,6 +106,8 @@
 #define S3P_ERR_NO_VMEM       106
 /** @brief The spcified cmd_id in a PT_EXEC_CMD request is not supported */
 #define S3P_ERR_NO_CMD        107
+/** @brief No resources left for the request (e.g. subscriptions) */
+#define S3P_ERR_BUSY          108
 
 /**
  * @brief S3P packet struct definition
@@ -72,8 +127,43 @@ typedef struct {
     uint8_t *buf;
     /// Pointer to the Data section of packet
     uint8_t *data;
+    /// Sequence, i.e. flags_seq masked by the link sequence mask
+    /// (#S3P_LINK_SEQ_MASK). Set by #s3p_init_pkt and the parse
+    /// functions, not used by the make functions. Last, not to move the
+    /// v1.0 fields
+    uint8_t seq;
 } s3p_packet_t;
 
+/**
+ * @brief S3P link (serial line) state, optional
+ *
+ * Used by the s3p_link_* variants of the frame functions. A zero
+ * initialized link behaves as the plain functions.
+*/
+typedef struct {
+    /// Statistics updated by the frame functions, NULL to disable
+    struct s3p_stats *stats;
+    /// Max frame size, #S3P_MAX_FRAME_SIZE up to #S3P_JUMBO_FRAME_SIZE.
+    /// 0 for #S3P_MAX_FRAME_SIZE. Frame and packet buffers used on the
+    /// link must be sized accordingly
+    uint16_t frame_size;
+    /// Extended (8 bits) sequence, only if the remote node advertises
+    /// #S3P_CAP_EXT_SEQ
+    bool ext_seq;
+    /// Node side: also accept #PT_GROUP_READ requests to
+    /// #S3P_ID_BROADCAST, only if the node advertises #S3P_CAP_GROUP_READ
+    bool group_read;
+} s3p_link_t;
+
+/** @brief Max frame size of a link */
+#define S3P_LINK_FRAME_SIZE(_link)  ((_link)->frame_size ? \
+        (_link)->frame_size : S3P_MAX_FRAME_SIZE)
+/** @brief Sequence mask of a link */
+#define S3P_LINK_SEQ_MASK(_link)    ((_link)->ext_seq ? S3P_SEQ_EXT_MASK : \
+        S3P_SEQ_MASKED(0xFF))
+/** @brief Next sequence number of a link, wrapping around */
+#define S3P_LINK_SEQ_NEXT(_link, _seq)  (((_seq) + 1) & S3P_LINK_SEQ_MASK(_link))
+
 /**
  * @brief S3P ParadigmaTech custom request/reponse codes
 */
@@ -108,6 +198,32 @@ typedef enum {
     PT_WRITE_STR_REG      = 0x1C,
     /// Write string reg response
     PT_WRITE_STR_REG_RESP = 0x1D,
+    /// VMEM range digest request
+    PT_VMEM_CRC           = 0x1E,
+    /// VMEM range digest response
+    PT_VMEM_CRC_RESP      = 0x1F,
+    /// VMEM per-block digests request
+    PT_VMEM_HASHES        = 0x20,
+    /// VMEM per-block digests response
+    PT_VMEM_HASHES_RESP   = 0x21,
+    /// Compressed VMEM read request
+    PT_READ_VMEM_LZ       = 0x22,
+    /// Compressed VMEM read response
+    PT_READ_VMEM_LZ_RESP  = 0x23,
+    /// Compressed VMEM write request
+    PT_WRITE_VMEM_LZ      = 0x24,
+    /// Compressed VMEM write response
+    PT_WRITE_VMEM_LZ_RESP = 0x25,
+    /// Group (broadcast) read regs request, time slotted responses
+    PT_GROUP_READ         = 0x26,
+    /// Group read regs response, same as #PT_READ_REGS_RESP
+    PT_GROUP_READ_RESP    = 0x27,
+    /// Periodic telemetry subscribe request
+    PT_SUBSCRIBE          = 0x28,
+    /// Periodic telemetry subscribe response
+    PT_SUBSCRIBE_RESP     = 0x29,
+    /// Unsolicited telemetry sample, node to manager
+    PT_TELEMETRY          = 0x2A,
     /// S3P version, register and VMEM table information request
     PT_S3P_INFO           = 0x30,
     /// S3P version, register and VMEM table information response
@@ -132,6 +248,24 @@ typedef enum {
     CT_REBOOT = 0x11,
 } cmd_type_t;
 
+/**
+ * @brief Result of a frame decoding
+*/
+typedef enum {
+    /// Frame decoded and CRC verified
+    S3P_FRAME_OK = 0,
+    /// COBS decoding failed
+    S3P_FRAME_COBS_ERR,
+    /// Decoded packet shorter than header and CRC
+    S3P_FRAME_SIZE_ERR,
+    /// CRC mismatch
+    S3P_FRAME_CRC_ERR,
+} s3p_frame_status_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
 /**
  * @brief Set S3P internal debug level
  * @param level Debug level, 0 (default) to disable all output
@@ -150,6 +284,34 @@ extern void s3p_set_debug_level(const int level);
 extern bool s3p_parse_frame(s3p_packet_t *pkt, const uint8_t dst_id,
         const uint8_t *frame_buf, uint16_t len);
 
+/**
+ * @brief Decode a received frame into a #s3p_packet_t structure,
+ * regardless of its destination.
+ *
+ * Same as #s3p_parse_frame without the dst_id filter, and reporting the
+ * reason of a failure. Useful for bus monitors and offline analysis.
+ *
+ * @param pkt Packet initialized by a call to #s3p_init_pkt
+ * @param frame_buf Received frame, delimiter excluded
+ * @param len Frame length
+ * @return #S3P_FRAME_OK if decoding was successful
+*/
+extern s3p_frame_status_t s3p_decode_frame(s3p_packet_t *pkt,
+        const uint8_t *frame_buf, uint16_t len);
+
+/**
+ * @brief Same as #s3p_decode_frame, accepting packets up to the link frame
+ * size. Statistics are not updated
+ * @param link Pointer to link state
+ * @param pkt Packet with a buffer of at least
+ * S3P_PKT_SIZE(#S3P_LINK_FRAME_SIZE) bytes
+ * @param frame_buf Received frame, delimiter excluded
+ * @param len Frame length
+ * @return #S3P_FRAME_OK if decoding was successful
+*/
+extern s3p_frame_status_t s3p_link_decode_frame(const s3p_link_t *link,
+        s3p_packet_t *pkt, const uint8_t *frame_buf, uint16_t len);
+
 /**
  * @brief Initialize a #s3p_packet_t structure to be used for sending or
  * receiving a frame
@@ -163,7 +325,8 @@ extern bool s3p_parse_frame(s3p_packet_t *pkt, const uint8_t dst_id,
  * @param dst_id Destination node id
  * @param flags_seq Flags (currently not used and resereved) and
  * sequence values. Use #S3P_SEQ_MASKED macro to truncate the passed
- * sequence number to the correct number of bits
+ * sequence number to the correct number of bits, or #S3P_LINK_SEQ_NEXT
+ * on links that may use extended sequence
 */
 extern void s3p_init_pkt(s3p_packet_t *pkt, uint8_t *pkt_buf,
         const uint8_t src_id, const uint8_t dst_id,
@@ -179,6 +342,47 @@ extern void s3p_init_pkt(s3p_packet_t *pkt, uint8_t *pkt_buf,
 */
 extern uint16_t s3p_make_frame(uint8_t *frame_buf, const s3p_packet_t *pkt_out);
 
+/**
+ * @brief Same as #s3p_parse_frame, also updating the link statistics
+ * and accepting packets up to the link frame size. pkt->seq is masked
+ * by the link sequence mask. #PT_GROUP_READ packets to #S3P_ID_BROADCAST
+ * are accepted as well if the link group_read flag is set
+ * @param link Pointer to link state
+ * @param pkt Packet initialized by a call to #s3p_init_pkt, with a buffer
+ * of at least S3P_PKT_SIZE(#S3P_LINK_FRAME_SIZE) bytes
+ * @param dst_id Expected destination id
+ * @param frame_buf Received frame, delimiter excluded
+ * @param len Frame length
+ * @return true if parsing was successful
+*/
+extern bool s3p_link_parse_frame(s3p_link_t *link, s3p_packet_t *pkt,
+        const uint8_t dst_id, const uint8_t *frame_buf, uint16_t len);
+
+/**
+ * @brief Same as #s3p_make_frame, also updating the link statistics
+ * and allowing frames up to the link frame size
+ * @param link Pointer to link state
+ * @param frame_buf Frame buffer, at least #S3P_LINK_FRAME_SIZE bytes
+ * @param pkt_out Pointer to packet structure to be encoded
+ * @return Size of the encoded frame, 0 in case of encoding error
+*/
+extern uint16_t s3p_link_make_frame(s3p_link_t *link, uint8_t *frame_buf,
+        const s3p_packet_t *pkt_out);
+
+/**
+ * @brief Response slot of a node to a #PT_GROUP_READ request
+ *
+ * Nodes addressed by the request must start their response delay_us
+ * after the end (delimiter) of the request frame.
+ *
+ * @param pkt_in Parsed #PT_GROUP_READ request
+ * @param node_id Id of the node
+ * @param delay_us Filled with the response delay, us
+ * @return true if the node is addressed and must reply
+*/
+extern bool s3p_group_slot(const s3p_packet_t *pkt_in, const uint8_t node_id,
+        uint32_t *delay_us);
+
 /**
  * @brief Helper function to decode error codes to string
  * @param code Error code
@@ -186,5 +390,16 @@ extern uint16_t s3p_make_frame(uint8_t *frame_buf, const s3p_packet_t *pkt_out);
 */
 extern const char *s3p_err_str(const uint8_t code);
 
+/**
+ * @brief Helper function to decode packet types to string
+ * @param type Packet type
+ * @return Const char pointer to a null terminated string
+*/
+extern const char *s3p_type_str(const uint8_t type);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
 #endif // _S3P_H
 
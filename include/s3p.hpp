@@ -0,0 +1,651 @@
+/**
+@file s3p.hpp
+@brief S3P C++ layer, header only
+
+C++17 layer over the C library, for C++ managers and node firmware:
+
+- #s3p::crc16: CRC16 CCITT over a table generated at compile time,
+  usable in constant expressions
+- #s3p::Reg: register descriptors (id, value type, flags) as types, so
+  that value type tags and item encoding/decoding are resolved at compile
+  time, and writing a read only register does not compile
+- #s3p::packet_view: zero copy view over the buffer of a #s3p_packet_t,
+  with typed accessors and request/response builders
+
+Spans are std::span with C++20, a minimal equivalent with C++17. Frames
+are still encoded and decoded by the C codec (#s3p_make_frame and
+friends), link the same objects as a C application.
+*/
+
+#ifndef _S3P_HPP
+#define _S3P_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <type_traits>
+#if __cplusplus >= 202002L
+#include <bit>
+#include <span>
+#endif
+#include "s3p.h"
+#include "crc16.h"
+#include "value.h"
+
+// Float to raw bits in constant expressions: std::bit_cast with C++20, the
+// builtin behind it with C++17 on GCC 11+ and Clang
+#if __cplusplus >= 202002L
+#define S3P_BIT_CAST(_to, _v)   std::bit_cast<_to>(_v)
+#elif defined(__has_builtin)
+#if __has_builtin(__builtin_bit_cast)
+#define S3P_BIT_CAST(_to, _v)   __builtin_bit_cast(_to, _v)
+#endif
+#endif
+
+namespace s3p {
+
+#if __cplusplus >= 202002L
+template <typename T>
+using span = std::span<T>;
+#else
+/**
+ * @brief Subset of std::span, C++17 only
+*/
+template <typename T>
+class span {
+public:
+    constexpr span() noexcept : ptr_(nullptr), size_(0) {}
+    constexpr span(T *ptr, const std::size_t size) noexcept :
+        ptr_(ptr), size_(size) {}
+    template <std::size_t N>
+    constexpr span(T (&arr)[N]) noexcept : ptr_(arr), size_(N) {}
+    template <typename U, std::size_t N, typename = std::enable_if_t<
+        std::is_convertible_v<U (*)[], T (*)[]>>>
+    constexpr span(std::array<U, N> &arr) noexcept :
+        ptr_(arr.data()), size_(N) {}
+    template <typename U, typename = std::enable_if_t<
+        std::is_convertible_v<U (*)[], T (*)[]>>>
+    constexpr span(const span<U> &other) noexcept :
+        ptr_(other.data()), size_(other.size()) {}
+
+    constexpr T *data() const noexcept { return ptr_; }
+    constexpr std::size_t size() const noexcept { return size_; }
+    constexpr bool empty() const noexcept { return !size_; }
+    constexpr T &operator[](const std::size_t i) const { return ptr_[i]; }
+    constexpr T *begin() const noexcept { return ptr_; }
+    constexpr T *end() const noexcept { return ptr_ + size_; }
+    constexpr span first(const std::size_t n) const { return { ptr_, n }; }
+    constexpr span subspan(const std::size_t off,
+            const std::size_t n = SIZE_MAX) const
+    {
+        return { ptr_ + off, n == SIZE_MAX ? size_ - off : n };
+    }
+
+private:
+    T *ptr_;
+    std::size_t size_;
+};
+#endif
+
+/*****************************************************************************
+ * CRC16
+ ****************************************************************************/
+
+namespace detail {
+
+// Same table as crc16.c: CCITT polynomial 0x1021, MSB first
+constexpr std::array<uint16_t, 256> make_crc16_table(const uint16_t poly)
+{
+    std::array<uint16_t, 256> table{};
+
+    for (unsigned i=0; i<256; i++) {
+        uint16_t crc = i << 8;
+        for (int bit=0; bit<8; bit++)
+            crc = (crc & 0x8000) ? (crc << 1) ^ poly : crc << 1;
+        table[i] = crc;
+    }
+    return table;
+}
+
+inline constexpr std::array<uint16_t, 256> crc16_table =
+    make_crc16_table(0x1021);
+
+inline constexpr uint8_t crc16_check[] = { '1', '2', '3', '4', '5', '6',
+    '7', '8', '9' };
+
+} // namespace detail
+
+/**
+ * @brief CRC16 CCITT, same as #crc16_ccitt
+ * @param buf Data
+ * @param size Data size
+ * @param crc Start value, e.g. #CRC_START_CCITT_1D0F as in frames, or the
+ * CRC of the previous data to chain
+ * @return CRC
+*/
+constexpr uint16_t crc16(const uint8_t *buf, std::size_t size,
+        uint16_t crc = CRC_START_CCITT_1D0F) noexcept
+{
+    while (size--)
+        crc = (crc << 8) ^ detail::crc16_table[(uint8_t)(crc >> 8) ^ *buf++];
+    return crc;
+}
+
+/**
+ * @brief CRC16 CCITT of a span, see #crc16
+*/
+constexpr uint16_t crc16(const span<const uint8_t> buf,
+        const uint16_t crc = CRC_START_CCITT_1D0F) noexcept
+{
+    return crc16(buf.data(), buf.size(), crc);
+}
+
+static_assert(crc16(detail::crc16_check, 9, CRC_START_CCITT_1D0F) == 0xE5CC,
+        "CRC16 AUG-CCITT check value");
+static_assert(crc16(detail::crc16_check, 9, CRC_START_CCITT_FFFF) == 0x29B1,
+        "CRC16 CCITT-FALSE check value");
+
+/*****************************************************************************
+ * Values and registers
+ ****************************************************************************/
+
+/**
+ * @brief Hex shown value: Reg<Id, hex<uint16_t>> is a #VT_X16 register
+*/
+template <typename U>
+struct hex {
+    static_assert(std::is_unsigned_v<U> && sizeof(U) <= 4,
+            "hex<> of uint8_t, uint16_t or uint32_t");
+    /// Value
+    U value;
+
+    constexpr bool operator==(const hex &other) const noexcept
+    {
+        return value == other.value;
+    }
+    constexpr bool operator!=(const hex &other) const noexcept
+    {
+        return value != other.value;
+    }
+};
+
+/**
+ * @brief Value type tag of a C++ type, undefined for the types without
+ * one (e.g. Reg<1, double> does not compile)
+*/
+template <typename T>
+struct value_traits;
+
+#define S3P_VALUE_TRAITS(_type, _vt) \
+    template <> \
+    struct value_traits<_type> { \
+        static constexpr value_type_t vt = _vt; \
+    };
+
+S3P_VALUE_TRAITS(uint8_t,        VT_U8)
+S3P_VALUE_TRAITS(int8_t,         VT_I8)
+S3P_VALUE_TRAITS(hex<uint8_t>,   VT_X8)
+S3P_VALUE_TRAITS(uint16_t,       VT_U16)
+S3P_VALUE_TRAITS(int16_t,        VT_I16)
+S3P_VALUE_TRAITS(hex<uint16_t>,  VT_X16)
+S3P_VALUE_TRAITS(uint32_t,       VT_U32)
+S3P_VALUE_TRAITS(int32_t,        VT_I32)
+S3P_VALUE_TRAITS(hex<uint32_t>,  VT_X32)
+S3P_VALUE_TRAITS(float,          VT_FLT)
+
+#undef S3P_VALUE_TRAITS
+
+/**
+ * @brief Raw (serialized) value of a typed value. Signed values are sign
+ * extended
+*/
+template <typename T>
+constexpr uint32_t to_raw(const T v) noexcept
+{
+    if constexpr (std::is_same_v<T, float>) {
+#ifdef S3P_BIT_CAST
+        return S3P_BIT_CAST(uint32_t, v);
+#else
+        uint32_t raw = 0;
+        std::memcpy(&raw, &v, sizeof(raw));
+        return raw;
+#endif
+    }
+    else if constexpr (std::is_class_v<T>) {
+        return v.value;
+    }
+    else {
+        return static_cast<uint32_t>(v);
+    }
+}
+
+/**
+ * @brief Typed value of a raw value, only the bits of T are used
+*/
+template <typename T>
+constexpr T from_raw(const uint32_t raw) noexcept
+{
+    if constexpr (std::is_same_v<T, float>) {
+#ifdef S3P_BIT_CAST
+        return S3P_BIT_CAST(float, raw);
+#else
+        float v = 0;
+        std::memcpy(&v, &raw, sizeof(v));
+        return v;
+#endif
+    }
+    else if constexpr (std::is_class_v<T>) {
+        return T{ static_cast<decltype(T::value)>(raw) };
+    }
+    else {
+        return static_cast<T>(raw);
+    }
+}
+
+/** @brief Register flags (#PT_REG_INFO_RESP): none */
+inline constexpr uint16_t F_NONE = 0x0000;
+/** @brief Register flags: mutable (R/W) */
+inline constexpr uint16_t F_MUTABLE = 0x0001;
+/** @brief Register flags: persistent (saved across reboots) */
+inline constexpr uint16_t F_PERSIST = 0x0002;
+
+/**
+ * @brief Register descriptor
+ *
+ * E.g. `using Temp = s3p::Reg<12, float>;` then `Temp::item(21.5f)` is
+ * the serialized item, `Temp::vt` is #VT_FLT, all at compile time. Float
+ * items need a bit cast: C++20, or C++17 on GCC 11+ and Clang.
+ *
+ * @tparam Id Register id
+ * @tparam T Value type, see #value_traits
+ * @tparam Flags #F_MUTABLE, #F_PERSIST
+*/
+template <uint16_t Id, typename T, uint16_t Flags = F_NONE>
+struct Reg {
+    /// Value type
+    using type = T;
+    /// Register id
+    static constexpr uint16_t id = Id;
+    /// Value type tag
+    static constexpr value_type_t vt = value_traits<T>::vt;
+    /// Flags
+    static constexpr uint16_t flags = Flags;
+    /// Writable by a manager
+    static constexpr bool is_mutable = Flags & F_MUTABLE;
+
+    /**
+     * @brief Serialized item, as in #PT_READ_REGS_RESP
+     * @param v Value
+     * @return Id, type and raw value, big endian
+    */
+    static constexpr std::array<uint8_t, S3P_SER_ITEM_SIZE> item(
+            const T v) noexcept
+    {
+        const uint32_t raw = to_raw(v);
+        return { { uint8_t(Id >> 8), uint8_t(Id), uint8_t(vt),
+            uint8_t(raw >> 24), uint8_t(raw >> 16), uint8_t(raw >> 8),
+            uint8_t(raw) } };
+    }
+
+    /**
+     * @brief Value of a raw value
+    */
+    static constexpr T decode(const uint32_t raw) noexcept
+    {
+        return from_raw<T>(raw);
+    }
+};
+
+/*****************************************************************************
+ * Packet views
+ ****************************************************************************/
+
+/**
+ * @brief View of a serialized item (#S3P_SER_ITEM_SIZE bytes)
+*/
+class item_view {
+public:
+    constexpr explicit item_view(const uint8_t *p) noexcept : p_(p) {}
+
+    /// Register id
+    constexpr uint16_t id() const noexcept { return p_[0] << 8 | p_[1]; }
+    /// Value type tag
+    constexpr value_type_t vt() const noexcept { return value_type_t(p_[2]); }
+    /// Raw value
+    constexpr uint32_t raw() const noexcept
+    {
+        return uint32_t(p_[3]) << 24 | uint32_t(p_[4]) << 16 |
+            uint32_t(p_[5]) << 8 | p_[6];
+    }
+
+    /**
+     * @brief Value of the item as register R
+     * @return The value, nothing if id or value type do not match
+    */
+    template <typename R>
+    constexpr std::optional<typename R::type> as() const noexcept
+    {
+        if (id() != R::id || vt() != R::vt)
+            return std::nullopt;
+        return R::decode(raw());
+    }
+
+private:
+    const uint8_t *p_;
+};
+
+/**
+ * @brief Item list view, iterable
+*/
+class item_list {
+public:
+    /// Forward iterator over the items
+    class iterator {
+    public:
+        constexpr explicit iterator(const uint8_t *p) noexcept : p_(p) {}
+        constexpr item_view operator*() const noexcept { return item_view(p_); }
+        constexpr iterator &operator++() noexcept
+        {
+            p_ += S3P_SER_ITEM_SIZE;
+            return *this;
+        }
+        constexpr bool operator!=(const iterator &other) const noexcept
+        {
+            return p_ != other.p_;
+        }
+
+    private:
+        const uint8_t *p_;
+    };
+
+    constexpr explicit item_list(const span<const uint8_t> data) noexcept :
+        data_(data) {}
+
+    /// Whole items, a trailing partial item is ignored
+    constexpr std::size_t size() const noexcept
+    {
+        return data_.size() / S3P_SER_ITEM_SIZE;
+    }
+    /// The list size is a multiple of #S3P_SER_ITEM_SIZE
+    constexpr bool valid() const noexcept
+    {
+        return !(data_.size() % S3P_SER_ITEM_SIZE);
+    }
+    constexpr item_view operator[](const std::size_t i) const noexcept
+    {
+        return item_view(data_.data() + i * S3P_SER_ITEM_SIZE);
+    }
+    constexpr iterator begin() const noexcept { return iterator(data_.data()); }
+    constexpr iterator end() const noexcept
+    {
+        return iterator(data_.data() + size() * S3P_SER_ITEM_SIZE);
+    }
+
+    /**
+     * @brief Find register R in the list
+     * @return The value, nothing if missing or of another type
+    */
+    template <typename R>
+    constexpr std::optional<typename R::type> get() const noexcept
+    {
+        for (const item_view item : *this) {
+            if (item.id() == R::id)
+                return item.template as<R>();
+        }
+        return std::nullopt;
+    }
+
+private:
+    span<const uint8_t> data_;
+};
+
+/**
+ * @brief Zero copy view over a #s3p_packet_t and its buffer
+ *
+ * The packet is initialized and framed by the C functions (#s3p_init_pkt,
+ * #s3p_make_frame, #s3p_decode_frame...), the view reads and writes the
+ * data field in place. Appends fail, returning false, once the packet
+ * buffer is full.
+*/
+class packet_view {
+public:
+    /**
+     * @param pkt Packet, initialized by #s3p_init_pkt
+     * @param buf_size Size of the packet buffer, e.g. #S3P_JUMBO_PKT_SIZE
+     * on links using jumbo frames
+    */
+    explicit packet_view(s3p_packet_t &pkt,
+            const std::size_t buf_size = S3P_MAX_PKT_SIZE) noexcept :
+        pkt_(&pkt), buf_size_(buf_size) {}
+
+    /// Packet type (#pkt_type_t)
+    uint8_t type() const noexcept { return pkt_->type; }
+    /// Source node id
+    uint8_t src() const noexcept { return pkt_->src_id; }
+    /// Destination node id
+    uint8_t dst() const noexcept { return pkt_->dst_id; }
+    /// Sequence
+    uint8_t seq() const noexcept { return pkt_->seq; }
+    /// Underlying packet
+    s3p_packet_t &packet() const noexcept { return *pkt_; }
+
+    /// Whole packet buffer, header and CRC included
+    span<uint8_t> buf() const noexcept { return { pkt_->buf, buf_size_ }; }
+    /// Data (payload)
+    span<uint8_t> data() const noexcept
+    {
+        return { pkt_->data, pkt_->data_len };
+    }
+    /// Max data size
+    std::size_t capacity() const noexcept { return buf_size_ - 8; }
+
+    /**
+     * @brief Result code of a response, first data byte
+     * @return Code, #S3P_ERR_SIZE if there is no data
+    */
+    uint8_t result() const noexcept
+    {
+        return pkt_->data_len ? pkt_->data[0] : S3P_ERR_SIZE;
+    }
+
+    /**
+     * @brief Big endian field of the data
+     * @tparam U uint8_t, uint16_t or uint32_t
+     * @param off Data offset
+     * @return Field value, nothing if past the data
+    */
+    template <typename U>
+    std::optional<U> get(const std::size_t off) const noexcept
+    {
+        static_assert(std::is_unsigned_v<U> && sizeof(U) <= 4,
+                "get<> of uint8_t, uint16_t or uint32_t");
+        if (off + sizeof(U) > pkt_->data_len)
+            return std::nullopt;
+        uint32_t v = 0;
+        for (std::size_t i=0; i<sizeof(U); i++)
+            v = v << 8 | pkt_->data[off + i];
+        return U(v);
+    }
+
+    /**
+     * @brief Item list of the data, e.g. of a #PT_READ_REGS_RESP
+     * @param off Data offset of the list, 1 to skip the result code
+    */
+    item_list items(const std::size_t off = 1) const noexcept
+    {
+        const std::size_t len = off < pkt_->data_len ?
+            pkt_->data_len - off : 0;
+        return item_list({ pkt_->data + (len ? off : 0), len });
+    }
+
+    /**
+     * @brief Value of register R in a #PT_READ_REGS_RESP, #PT_TELEMETRY...
+     * @param off Data offset of the item list
+     * @return The value, nothing if missing, of another type or the
+     * response is an error
+    */
+    template <typename R>
+    std::optional<typename R::type> reg(const std::size_t off = 1) const
+        noexcept
+    {
+        if (off && result() != S3P_ERR_NONE)
+            return std::nullopt;
+        return items(off).template get<R>();
+    }
+
+    /**
+     * @brief Append a big endian field to the data
+     * @tparam U uint8_t, uint16_t or uint32_t
+    */
+    template <typename U>
+    bool put(const U v) noexcept
+    {
+        static_assert(std::is_unsigned_v<U> && sizeof(U) <= 4,
+                "put<> of uint8_t, uint16_t or uint32_t");
+        if (pkt_->data_len + sizeof(U) > capacity())
+            return false;
+        for (std::size_t i=sizeof(U); i>0; i--)
+            pkt_->data[pkt_->data_len++] = uint8_t(v >> (8 * (i - 1)));
+        return true;
+    }
+
+    /**
+     * @brief Append the item of register R, e.g. to a #PT_READ_REGS_RESP
+    */
+    template <typename R>
+    bool put_item(const typename R::type v) noexcept
+    {
+        constexpr std::size_t size = S3P_SER_ITEM_SIZE;
+        if (pkt_->data_len + size > capacity())
+            return false;
+        const auto item = R::item(v);
+        std::memcpy(pkt_->data + pkt_->data_len, item.data(), size);
+        pkt_->data_len += size;
+        return true;
+    }
+
+    /**
+     * @brief Make a #PT_READ_REGS request, from register R on
+     * @param cnt Registers count
+    */
+    template <typename R>
+    bool read_regs(const uint16_t cnt = 1) noexcept
+    {
+        pkt_->type = PT_READ_REGS;
+        pkt_->data_len = 0;
+        return put(R::id) && put(cnt);
+    }
+
+    /**
+     * @brief Make a #PT_WRITE_REG request, only for mutable registers
+    */
+    template <typename R>
+    bool write_reg(const typename R::type v) noexcept
+    {
+        static_assert(R::is_mutable, "write_reg<> of a read only register");
+        pkt_->type = PT_WRITE_REG;
+        pkt_->data_len = 0;
+        return put_item<R>(v);
+    }
+
+private:
+    s3p_packet_t *pkt_;
+    std::size_t buf_size_;
+};
+
+/**
+ * @brief Packet with its own buffer
+ * @tparam N Buffer size, at least #S3P_MAX_PKT_SIZE (cleared by
+ * #s3p_init_pkt)
+*/
+template <std::size_t N = S3P_MAX_PKT_SIZE>
+struct packet {
+    static_assert(N >= S3P_MAX_PKT_SIZE, "packet<> smaller than "
+            "S3P_MAX_PKT_SIZE");
+    /// Packet
+    s3p_packet_t pkt;
+    /// Buffer
+    std::array<uint8_t, N> buf;
+
+    packet(const uint8_t src_id = S3P_ID_NONE,
+            const uint8_t dst_id = S3P_ID_NONE,
+            const uint8_t flags_seq = S3P_SEQ_NONE) noexcept
+    {
+        s3p_init_pkt(&pkt, buf.data(), src_id, dst_id, flags_seq);
+    }
+    packet(const packet &) = delete;
+    packet &operator=(const packet &) = delete;
+
+    /// View of the packet
+    packet_view view() noexcept { return packet_view(pkt, N); }
+};
+
+/*****************************************************************************
+ * Frames, C codec
+ ****************************************************************************/
+
+/**
+ * @brief Encode a packet, see #s3p_link_make_frame
+ * @param link Link state
+ * @param frame Frame buffer, at least the link frame size
+ * @param pkt Packet
+ * @return Frame size, 0 on error or if frame is too small
+*/
+inline uint16_t make_frame(s3p_link_t &link, const span<uint8_t> frame,
+        const s3p_packet_t &pkt) noexcept
+{
+    if (frame.size() < std::size_t(S3P_LINK_FRAME_SIZE(&link)))
+        return 0;
+    return s3p_link_make_frame(&link, frame.data(), &pkt);
+}
+
+/**
+ * @brief Encode a packet, see #s3p_make_frame
+ * @param frame Frame buffer, at least #S3P_MAX_FRAME_SIZE bytes
+ * @param pkt Packet
+ * @return Frame size, 0 on error or if frame is too small
+*/
+inline uint16_t make_frame(const span<uint8_t> frame,
+        const s3p_packet_t &pkt) noexcept
+{
+    if (frame.size() < S3P_MAX_FRAME_SIZE)
+        return 0;
+    return s3p_make_frame(frame.data(), &pkt);
+}
+
+/**
+ * @brief Decode a frame, see #s3p_link_decode_frame
+ * @param link Link state
+ * @param pkt Packet with a buffer of at least the link packet size
+ * @param frame Frame, delimiter excluded
+ * @return #S3P_FRAME_OK if decoding was successful
+*/
+inline s3p_frame_status_t decode_frame(const s3p_link_t &link,
+        s3p_packet_t &pkt, const span<const uint8_t> frame) noexcept
+{
+    if (frame.size() > UINT16_MAX)
+        return S3P_FRAME_SIZE_ERR;
+    return s3p_link_decode_frame(&link, &pkt, frame.data(),
+            uint16_t(frame.size()));
+}
+
+/**
+ * @brief Decode a frame, see #s3p_decode_frame
+ * @param pkt Packet with a buffer of at least #S3P_MAX_PKT_SIZE bytes
+ * @param frame Frame, delimiter excluded
+ * @return #S3P_FRAME_OK if decoding was successful
+*/
+inline s3p_frame_status_t decode_frame(s3p_packet_t &pkt,
+        const span<const uint8_t> frame) noexcept
+{
+    const s3p_link_t link = {};
+    return decode_frame(link, pkt, frame);
+}
+
+} // namespace s3p
+
+#undef S3P_BIT_CAST
+
+#endif // _S3P_HPP
@@ -0,0 +1,19 @@
+/**
+@file s3p_atomic.h
+@brief Atomic types shared by C11 and C++ node side code
+*/
+
+#ifndef _S3P_ATOMIC_H
+#define _S3P_ATOMIC_H
+
+#ifdef __cplusplus
+#include <atomic>
+/** @brief Atomic type, C11 or C++ */
+#define S3P_ATOMIC(_t)        std::atomic<_t>
+#else
+#include <stdatomic.h>
+/** @brief Atomic type, C11 or C++ */
+#define S3P_ATOMIC(_t)        _Atomic _t
+#endif
+
+#endif // _S3P_ATOMIC_H
@@ -0,0 +1,78 @@
+/**
+@file s3p_items.h
+@brief S3P register item list batch decoder
+
+Decodes the #S3P_SER_ITEM_SIZE bytes items of a #PT_READ_REGS_RESP like
+item list (id u16, type u8, raw value u32, big endian) into caller
+provided arrays, one per field, ready for bulk processing. Values are
+kept raw, whatever their type.
+
+On x86 with GCC/Clang the items are gathered 4 at a time with SSSE3
+byte shuffles when the CPU supports them (checked once at run time, or
+never with S3P_ITEMS_NO_SIMD defined), elsewhere a portable loop with
+unaligned loads and byte swaps is used.
+*/
+
+#ifndef _S3P_ITEMS_H
+#define _S3P_ITEMS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "s3p.h"
+
+/** @brief Max items in a packet data field of a given frame size */
+#define S3P_ITEMS_MAX(_frame_size)  (S3P_DATA_SIZE(_frame_size) / \
+        S3P_SER_ITEM_SIZE)
+
+/**
+ * @brief Item list decoded as structure of arrays
+*/
+typedef struct {
+    /// Register ids
+    uint16_t *ids;
+    /// Value types (value_type_t)
+    uint8_t *types;
+    /// Raw values, as serialized
+    uint32_t *values;
+    /// Arrays size, items
+    uint16_t size;
+} s3p_items_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * @brief Decode an item list
+ * @param items Destination arrays
+ * @param data Item list
+ * @param len Item list size, a multiple of #S3P_SER_ITEM_SIZE
+ * @return Items decoded, -1 if len is not a multiple of
+ * #S3P_SER_ITEM_SIZE or the items don't fit in the arrays
+*/
+extern int32_t s3p_items_decode(s3p_items_t *items, const uint8_t *data,
+        const uint16_t len);
+
+/**
+ * @brief Decode the item list of a packet, from a data offset
+ * @param items Destination arrays
+ * @param pkt Packet, e.g. a #PT_READ_REGS_RESP
+ * @param offset Item list offset in the data field, e.g. 1 to skip the
+ * result code
+ * @return Items decoded, -1 as #s3p_items_decode or if offset is past the
+ * data
+*/
+extern int32_t s3p_items_decode_pkt(s3p_items_t *items,
+        const s3p_packet_t *pkt, const uint16_t offset);
+
+/**
+ * @brief Tell if the SIMD decoder is in use
+ * @return true if the items are decoded with SSSE3
+*/
+extern bool s3p_items_simd(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif // _S3P_ITEMS_H
@@ -0,0 +1,144 @@
+/**
+@file s3p_lz.h
+@brief S3P VMEM compression (RLE + LZ with a 256 bytes window)
+
+Byte oriented stream of tokens, selected by the first (control) byte:
+
+    0x00..0x7F  c, lit[c+1]             literals, 1..128 bytes
+    0x80..0xBF  c, n, v                 run of ((c & 0x3F) << 8 | n) + 4
+                                        bytes of value v, 4..16387 bytes
+    0xC0..0xFF  c, d                    copy (c & 0x3F) + 3 bytes from d + 1
+                                        bytes back, 3..66 bytes
+
+The encoder needs a caller provided #s3p_lz_enc_t (512 bytes), the
+decoder a #s3p_lz_dec_t (about 260 bytes) whatever the stream size, so
+that nodes can stream decoded data straight to VMEM.
+*/
+
+#ifndef _S3P_LZ_H
+#define _S3P_LZ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/** @brief Match window size, bytes */
+#define S3P_LZ_WINDOW         256
+/** @brief Encoder hash table size, entries (power of 2) */
+#ifndef S3P_LZ_HASH_SIZE
+#define S3P_LZ_HASH_SIZE      256
+#endif
+/** @brief Max literals per token */
+#define S3P_LZ_LIT_MAX        128
+/** @brief Min/max run length */
+#define S3P_LZ_RUN_MIN        4
+#define S3P_LZ_RUN_MAX        (0x3FFF + S3P_LZ_RUN_MIN)
+/** @brief Min/max match length */
+#define S3P_LZ_MATCH_MIN      3
+#define S3P_LZ_MATCH_MAX      (0x3F + S3P_LZ_MATCH_MIN)
+/** @brief Worst case encoded size of len bytes (all literals) */
+#define S3P_LZ_BOUND(_len)    ((_len) + ((_len) + S3P_LZ_LIT_MAX - 1) / \
+        S3P_LZ_LIT_MAX)
+
+/**
+ * @brief Encoder state
+*/
+typedef struct {
+    /// Last position + 1 of every 3 bytes hash, 0 if none
+    uint16_t hash[S3P_LZ_HASH_SIZE];
+} s3p_lz_enc_t;
+
+/**
+ * @brief Decoder output callback
+ * @param ctx User context
+ * @param off Offset of buf in the decoded stream
+ * @param buf Decoded data
+ * @param len Decoded data size
+ * @return false to abort decoding
+*/
+typedef bool (*s3p_lz_sink_t)(void *ctx, const uint32_t off,
+        const uint8_t *buf, const uint16_t len);
+
+/**
+ * @brief Decoder state
+*/
+typedef struct {
+    /// Last decoded bytes, also the output buffer
+    uint8_t win[S3P_LZ_WINDOW];
+    /// Decoded bytes count
+    uint32_t pos;
+    /// Decoded bytes count passed to sink
+    uint32_t flushed;
+    /// Output callback
+    s3p_lz_sink_t sink;
+    /// Output callback context
+    void *ctx;
+} s3p_lz_dec_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * @brief Compress a buffer, as much of it as fits in the destination
+ * @param enc Pointer to encoder state, no init required
+ * @param src Data to compress
+ * @param src_len Data size, max 65535
+ * @param dst Destination buffer
+ * @param dst_size Destination buffer size
+ * @param consumed Filled with the count of source bytes encoded in dst,
+ * src_len if the whole source fits
+ * @return Encoded size
+*/
+extern uint16_t s3p_lz_encode(s3p_lz_enc_t *enc, const uint8_t *src,
+        const uint16_t src_len, uint8_t *dst, const uint16_t dst_size,
+        uint16_t *consumed);
+
+/**
+ * @brief Init a streaming decoder
+ * @param dec Pointer to decoder state
+ * @param sink Output callback, called every #S3P_LZ_WINDOW decoded bytes
+ * and by #s3p_lz_dec_finish
+ * @param ctx Output callback context
+*/
+extern void s3p_lz_dec_init(s3p_lz_dec_t *dec, s3p_lz_sink_t sink,
+        void *ctx);
+
+/**
+ * @brief Decode a complete stream
+ *
+ * Tokens never span calls: every call must carry whole tokens, as the
+ * data field of a single packet does.
+ *
+ * @param dec Pointer to decoder state
+ * @param src Encoded data
+ * @param len Encoded data size
+ * @param max_out Max decoded size, decoding fails beyond it
+ * @return true on success, false on malformed stream, output limit or
+ * sink abort
+*/
+extern bool s3p_lz_decode(s3p_lz_dec_t *dec, const uint8_t *src,
+        const uint16_t len, const uint32_t max_out);
+
+/**
+ * @brief Flush the decoded bytes not yet passed to sink
+ * @param dec Pointer to decoder state
+ * @return Decoded size, -1 on sink abort
+*/
+extern int32_t s3p_lz_dec_finish(s3p_lz_dec_t *dec);
+
+/**
+ * @brief Decode a complete stream into a buffer
+ * @param src Encoded data
+ * @param len Encoded data size
+ * @param dst Destination buffer
+ * @param dst_size Destination buffer size
+ * @return Decoded size, -1 on malformed stream or overflow
+*/
+extern int32_t s3p_lz_decode_buf(const uint8_t *src, const uint16_t len,
+        uint8_t *dst, const uint32_t dst_size);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif // _S3P_LZ_H
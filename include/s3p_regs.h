@@ -0,0 +1,225 @@
+/**
+@file s3p_regs.h
+@brief S3P node side lock-free register store
+
+The node registers live in a table of constant descriptors (it can stay in
+flash), sorted by id, and an array of values the application updates from
+tasks and ISRs while the protocol handler serves #PT_READ_REGS,
+#PT_GROUP_READ, #PT_WRITE_REG and #PT_REG_INFO. Nothing is ever locked:
+the handler never fails with #S3P_ERR_NO_LOCK and never delays a writer.
+
+- Registers updated one at a time are a single 32 bits atomic value: a
+  read gets the old or the new value, never a mix.
+- Registers that must be read together (e.g. the three axes of a vector)
+  form a block. A block is guarded by a sequence latch: two copies of its
+  values, the writer updating one copy while readers use the other. A
+  reader retries only if an update of the block started meanwhile, and a
+  reader preempting a writer (handler in an ISR, writer in a task) reads
+  the copy not being written without retrying.
+
+Each block, and each register outside blocks, must have a single writer
+at a time: the application for measurements, the handler for the
+#S3P_REG_F_MUTABLE registers written by the manager. Registers are
+updated with #s3p_regs_set, or #s3p_regs_set_block for a whole block.
+*/
+
+#ifndef _S3P_REGS_H
+#define _S3P_REGS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "s3p.h"
+#include "s3p_atomic.h"
+#include "value.h"
+
+/** @brief #PT_REG_INFO_RESP register flag: none */
+#define S3P_REG_F_NONE        0x0000
+/** @brief #PT_REG_INFO_RESP register flag: mutable (R/W) */
+#define S3P_REG_F_MUTABLE     0x0001
+/** @brief #PT_REG_INFO_RESP register flag: persistent */
+#define S3P_REG_F_PERSIST     0x0002
+/** @brief Block index of the registers outside blocks */
+#define S3P_REGS_NO_BLOCK     0xFF
+
+/**
+ * @brief Register descriptor, constant
+*/
+typedef struct {
+    /// Register id, strictly increasing along the table
+    uint16_t id;
+    /// Value type (#value_type_t), scalar types only
+    uint8_t vt;
+    /// Register group id
+    uint8_t group_id;
+    /// S3P_REG_F_* flags
+    uint16_t flags;
+    /// Block index, #S3P_REGS_NO_BLOCK if the register is not in a block
+    uint8_t block;
+    /// Name, up to #S3P_MAX_NAME_SIZE - 1 characters
+    const char *name;
+} s3p_reg_desc_t;
+
+/**
+ * @brief Register value, raw as on the wire (right aligned)
+ *
+ * Registers outside blocks use v[0] only, block registers both copies.
+*/
+typedef struct {
+    S3P_ATOMIC(uint32_t) v[2];
+} s3p_reg_val_t;
+
+/**
+ * @brief Block of registers read together, consecutive in the table
+*/
+typedef struct {
+    /// Table index of the first register
+    uint16_t first;
+    /// Registers count
+    uint16_t cnt;
+    /// Latch sequence: readers use the copy seq & 1, the writer the other
+    S3P_ATOMIC(uint32_t) seq;
+} s3p_reg_block_t;
+
+/**
+ * @brief Validate a write of the manager to a mutable register
+ * @param ctx User context
+ * @param idx Table index of the register
+ * @param raw Raw value to be written
+ * @return #S3P_ERR_NONE to store the value, or the error code of the
+ * #PT_WRITE_REG_RESP response
+*/
+typedef uint8_t (*s3p_regs_write_t)(void *ctx, const uint16_t idx,
+        const uint32_t raw);
+
+/**
+ * @brief Register store
+*/
+typedef struct {
+    /// Descriptors, sorted by id
+    const s3p_reg_desc_t *desc;
+    /// Values, one per descriptor
+    s3p_reg_val_t *vals;
+    /// Registers count
+    uint16_t cnt;
+    /// Blocks, indexed by s3p_reg_desc_t::block
+    s3p_reg_block_t *blocks;
+    /// Blocks count
+    uint8_t blocks_cnt;
+    /// Write validation, NULL to accept every write to mutable registers
+    s3p_regs_write_t write;
+    /// Write validation context
+    void *ctx;
+} s3p_regs_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * @brief Init the store, all values 0
+ *
+ * The blocks are set up from the descriptors, the registers of a block
+ * being consecutive in the table.
+ *
+ * @param regs Pointer to store
+ * @param desc Descriptors, sorted by id
+ * @param vals Values, cnt entries
+ * @param cnt Registers count
+ * @param blocks Blocks, blocks_cnt entries (NULL if none)
+ * @param blocks_cnt Blocks count
+ * @return false if the ids are not increasing, a block index is out of
+ * range or the registers of a block are not consecutive
+*/
+extern bool s3p_regs_init(s3p_regs_t *regs, const s3p_reg_desc_t *desc,
+        s3p_reg_val_t *vals, const uint16_t cnt, s3p_reg_block_t *blocks,
+        const uint8_t blocks_cnt);
+
+/**
+ * @brief Table index of a register
+ * @param regs Pointer to store
+ * @param id Register id
+ * @return Table index, -1 if the register does not exist
+*/
+extern int s3p_regs_find(const s3p_regs_t *regs, const uint16_t id);
+
+/**
+ * @brief Update a register, wait free
+ *
+ * For a block register the whole block is republished, the other values
+ * unchanged.
+ *
+ * @param regs Pointer to store
+ * @param idx Table index
+ * @param raw Raw value
+*/
+extern void s3p_regs_set(s3p_regs_t *regs, const uint16_t idx,
+        const uint32_t raw);
+
+/**
+ * @brief Update all the registers of a block at once, wait free
+ * @param regs Pointer to store
+ * @param block Block index
+ * @param raw Raw values, one per block register
+*/
+extern void s3p_regs_set_block(s3p_regs_t *regs, const uint8_t block,
+        const uint32_t *raw);
+
+/**
+ * @brief Read a register, wait free
+ * @param regs Pointer to store
+ * @param idx Table index
+ * @return Raw value
+*/
+extern uint32_t s3p_regs_get(const s3p_regs_t *regs, const uint16_t idx);
+
+/**
+ * @brief Serialize registers into a #PT_READ_REGS_RESP item list
+ *
+ * Missing ids in the range are skipped. The registers of a block are
+ * a snapshot of the same block update.
+ *
+ * @param regs Pointer to store
+ * @param first_id First register id
+ * @param regs_cnt Registers count (ids)
+ * @param buf Destination buffer
+ * @param size Destination buffer size, registers past it are not read
+ * @return Bytes written, #S3P_SER_ITEM_SIZE per register
+*/
+extern uint16_t s3p_regs_read(const s3p_regs_t *regs, const uint16_t first_id,
+        const uint16_t regs_cnt, uint8_t *buf, const uint16_t size);
+
+/**
+ * @brief #s3p_regs_read as a #s3p_telem_read_t serializer, ctx being the
+ * store
+*/
+extern uint16_t s3p_regs_telem_read(void *ctx, const uint16_t first_reg,
+        const uint16_t regs_cnt, uint8_t *buf, const uint16_t size);
+
+/**
+ * @brief Serve a register request
+ *
+ * Handles #PT_READ_REGS, #PT_GROUP_READ, #PT_WRITE_REG and #PT_REG_INFO,
+ * other packet types are left to the caller. Other requests to
+ * #S3P_ID_BROADCAST are not served. Reads never fail for concurrency
+ * reasons: there is no #S3P_ERR_NO_LOCK.
+ *
+ * @param regs Pointer to store
+ * @param node_id Node id, source of the response
+ * @param pkt_in Parsed request
+ * @param pkt_out Packet initialized by a call to #s3p_init_pkt, filled
+ * with the response
+ * @param data_size Max data size of pkt_out
+ * @param delay_us Filled with the response delay, us: the response must
+ * start delay_us after the end (delimiter) of the request frame, i.e.
+ * the #PT_GROUP_READ slot (#s3p_group_slot), 0 for the other requests
+ * @return true if pkt_out holds a response to send
+*/
+extern bool s3p_regs_handle(s3p_regs_t *regs, const uint8_t node_id,
+        const s3p_packet_t *pkt_in, s3p_packet_t *pkt_out,
+        const uint16_t data_size, uint32_t *delay_us);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif // _S3P_REGS_H
@@ -0,0 +1,106 @@
+/**
+@file s3p_rto.h
+@brief S3P adaptive response timeout estimator
+*/
+
+#ifndef _S3P_RTO_H
+#define _S3P_RTO_H
+
+#include <stdint.h>
+
+/** @brief Lower bound of a computed response timeout in ms */
+#define S3P_RTO_MIN_MS        5
+/** @brief Upper bound of a computed response timeout in ms */
+#define S3P_RTO_MAX_MS        10000
+/** @brief Node processing time assumed before the first RTT sample, ms */
+#define S3P_RTO_INIT_MS       1000
+/** @brief Clock granularity added to the variance term, us */
+#define S3P_RTO_GRANULARITY_US  1000
+/** @brief Default number of retransmissions after the first attempt */
+#define S3P_RTO_DEF_RETRIES   2
+
+/**
+ * @brief Per node round trip time state
+ *
+ * RTT samples are stored without the on-wire time of request and
+ * response, so that the estimate only tracks node processing and line
+ * turnaround, and can be reused for frames of any length.
+*/
+typedef struct {
+    /// Smoothed RTT (wire time excluded), us
+    uint32_t srtt_us;
+    /// RTT mean deviation, us
+    uint32_t rttvar_us;
+    /// Non zero once at least one sample has been collected
+    uint8_t valid;
+} s3p_rto_node_t;
+
+/**
+ * @brief Per link timeout estimator state
+*/
+typedef struct {
+    /// Link baud rate
+    uint32_t baud;
+    /// Bits per byte on the wire (start + data + parity + stop)
+    uint8_t bits_per_byte;
+    /// Retry budget, i.e. number of retransmissions after a timeout
+    uint8_t retries;
+    /// Per node state, indexed by node id
+    s3p_rto_node_t nodes[256];
+} s3p_rto_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * @brief Initialize a link timeout estimator
+ * @param rto Pointer to estimator state
+ * @param baud Link baud rate
+ * @param bits_per_byte Bits per byte on the wire, e.g. 10 for 8N1
+ * @param retries Retry budget (see #S3P_RTO_DEF_RETRIES)
+*/
+extern void s3p_rto_init(s3p_rto_t *rto, const uint32_t baud,
+        const uint8_t bits_per_byte, const uint8_t retries);
+
+/**
+ * @brief Expected on-wire time of a frame
+ * @param rto Pointer to estimator state
+ * @param frame_len Encoded frame length in bytes (delimiter included)
+ * @return Transmission time in us
+*/
+extern uint32_t s3p_rto_wire_us(const s3p_rto_t *rto, const uint32_t frame_len);
+
+/**
+ * @brief Add a RTT sample for a node
+ * @param rto Pointer to estimator state
+ * @param node_id Remote node id
+ * @param rtt_us Measured time from request write to response parsed
+ * @param req_len Request frame length in bytes
+ * @param resp_len Response frame length in bytes
+*/
+extern void s3p_rto_update(s3p_rto_t *rto, const uint8_t node_id,
+        const uint32_t rtt_us, const uint32_t req_len, const uint32_t resp_len);
+
+/**
+ * @brief Compute the response timeout for a request
+ *
+ * The timeout is the wire time of request and expected response plus
+ * srtt + 4 * rttvar, doubled for every retransmission and clamped to
+ * #S3P_RTO_MIN_MS .. #S3P_RTO_MAX_MS.
+ *
+ * @param rto Pointer to estimator state
+ * @param node_id Remote node id
+ * @param req_len Request frame length in bytes
+ * @param resp_len Expected response frame length in bytes
+ * @param attempt Attempt number, 0 for the first transmission
+ * @return Timeout in ms
+*/
+extern uint32_t s3p_rto_timeout_ms(const s3p_rto_t *rto, const uint8_t node_id,
+        const uint32_t req_len, const uint32_t resp_len, const uint8_t attempt);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif // _S3P_RTO_H
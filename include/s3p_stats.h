@@ -0,0 +1,141 @@
+/**
+@file s3p_stats.h
+@brief S3P link statistics and latency histograms
+*/
+
+#ifndef _S3P_STATS_H
+#define _S3P_STATS_H
+
+#include <stdint.h>
+
+/** @brief Cache line size used to pad per-thread statistics */
+#ifndef S3P_CACHE_LINE
+#define S3P_CACHE_LINE        64
+#endif
+/** @brief Alignment specifier, C11 or C++ */
+#ifdef __cplusplus
+#define S3P_ALIGNAS(_n)       alignas(_n)
+#else
+#define S3P_ALIGNAS(_n)       _Alignas(_n)
+#endif
+/** @brief Histogram sub-buckets per power of two, as a bit count. 3 bits
+ * (8 sub-buckets) gives a worst case relative error of 12.5% */
+#ifndef S3P_HIST_SUB_BITS
+#define S3P_HIST_SUB_BITS     3
+#endif
+/** @brief Histogram range as a bit count, values (us) above
+ * 2^S3P_HIST_MAX_BITS are accounted in the last bucket */
+#ifndef S3P_HIST_MAX_BITS
+#define S3P_HIST_MAX_BITS     24
+#endif
+/** @brief Number of buckets of a latency histogram */
+#define S3P_HIST_BUCKETS      ((S3P_HIST_MAX_BITS - S3P_HIST_SUB_BITS + 1) << \
+        S3P_HIST_SUB_BITS)
+/** @brief Number of latency histograms, one per request/response pair */
+#define S3P_STATS_TYPES       32
+/** @brief Histogram slot of a packet type (request and response share
+ * the same slot) */
+#define S3P_STATS_TYPE_IDX(_t)  (((_t) >> 1) & (S3P_STATS_TYPES - 1))
+/** @brief Number of COBS decode failure counters, one per
+ * cobs_decode_status bit */
+#define S3P_STATS_COBS_BITS   4
+
+/**
+ * @brief Link counters
+*/
+typedef struct {
+    /// Frames sent
+    uint32_t frames_tx;
+    /// Frames received
+    uint32_t frames_rx;
+    /// Bytes sent, delimiters included
+    uint64_t bytes_tx;
+    /// Bytes received, delimiters included
+    uint64_t bytes_rx;
+    /// COBS decode failures, by cobs_decode_status bit (0x01 .. 0x08)
+    uint32_t cobs_err[S3P_STATS_COBS_BITS];
+    /// Packets shorter than header and CRC
+    uint32_t size_err;
+    /// CRC mismatches
+    uint32_t crc_err;
+    /// Packets for other destinations
+    uint32_t dst_err;
+    /// Response timeouts (application)
+    uint32_t timeouts;
+    /// Responses with unexpected sequence (application)
+    uint32_t seq_err;
+    /// Retransmitted requests (application)
+    uint32_t retries;
+} s3p_counters_t;
+
+/**
+ * @brief Log-linear (HDR-style) latency histogram
+*/
+typedef struct {
+    /// Samples count
+    uint32_t cnt;
+    /// Minimum sample, us
+    uint32_t min_us;
+    /// Maximum sample, us
+    uint32_t max_us;
+    /// Sum of samples, us
+    uint64_t sum_us;
+    /// Buckets
+    uint32_t buckets[S3P_HIST_BUCKETS];
+} s3p_hist_t;
+
+/**
+ * @brief Link statistics
+ *
+ * Statistics are not atomic: every thread driving a link should update
+ * its own instance, then readers aggregate them with #s3p_stats_merge.
+ * Instances are cache line aligned, so that per-thread instances do not
+ * share lines.
+*/
+typedef struct s3p_stats {
+    /// Counters
+    S3P_ALIGNAS(S3P_CACHE_LINE) s3p_counters_t cnt;
+    /// Round trip latencies, indexed by #S3P_STATS_TYPE_IDX
+    s3p_hist_t lat[S3P_STATS_TYPES];
+} s3p_stats_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * @brief Reset statistics
+ * @param stats Pointer to statistics
+*/
+extern void s3p_stats_init(s3p_stats_t *stats);
+
+/**
+ * @brief Add a round trip latency sample
+ * @param stats Pointer to statistics
+ * @param type Request (or response) packet type
+ * @param us Latency in us
+*/
+extern void s3p_stats_latency(s3p_stats_t *stats, const uint8_t type,
+        const uint32_t us);
+
+/**
+ * @brief Accumulate statistics into another instance
+ * @param dst Pointer to destination statistics
+ * @param src Pointer to statistics to add
+*/
+extern void s3p_stats_merge(s3p_stats_t *dst, const s3p_stats_t *src);
+
+/**
+ * @brief Get a percentile from a latency histogram
+ * @param hist Pointer to histogram
+ * @param pct Percentile, 0.0 to 100.0
+ * @return Upper bound of the bucket holding the percentile, us, clamped
+ * to the maximum sample. 0 if the histogram is empty
+*/
+extern uint32_t s3p_hist_percentile(const s3p_hist_t *hist, const float pct);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif // _S3P_STATS_H
@@ -0,0 +1,127 @@
+/**
+@file s3p_telem.h
+@brief S3P node side periodic telemetry scheduler
+
+A manager subscribes to a register set with #PT_SUBSCRIBE, then the node
+pushes it every period as unsolicited #PT_TELEMETRY frames, without
+further requests. Full-duplex links only: on half-duplex buses the
+unsolicited frames would collide with requests.
+*/
+
+#ifndef _S3P_TELEM_H
+#define _S3P_TELEM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "s3p.h"
+
+/** @brief Max active subscriptions per node */
+#ifndef S3P_TELEM_MAX_SUBS
+#define S3P_TELEM_MAX_SUBS    4
+#endif
+/** @brief Minimum subscription period, ms */
+#ifndef S3P_TELEM_MIN_PERIOD_MS
+#define S3P_TELEM_MIN_PERIOD_MS  10
+#endif
+/** @brief #PT_SUBSCRIBE flag: send a sample only if the values changed */
+#define S3P_TELEM_F_ON_CHANGE 0x01
+/** @brief #PT_TELEMETRY header size: sub id, sample seq, node time */
+#define S3P_TELEM_HDR_SIZE    7
+
+/**
+ * @brief Serialize registers into a #PT_READ_REGS_RESP like item list
+ * @param ctx User context
+ * @param first_reg First register id
+ * @param regs_cnt Registers count
+ * @param buf Destination buffer
+ * @param size Destination buffer size
+ * @return Bytes written, #S3P_SER_ITEM_SIZE per register
+*/
+typedef uint16_t (*s3p_telem_read_t)(void *ctx, const uint16_t first_reg,
+        const uint16_t regs_cnt, uint8_t *buf, const uint16_t size);
+
+/**
+ * @brief Subscription
+*/
+typedef struct {
+    /// Subscriber (manager) id, #S3P_ID_NONE if the slot is free
+    uint8_t dst_id;
+    /// Subscription id, chosen by the subscriber
+    uint8_t sub_id;
+    /// S3P_TELEM_F_* flags
+    uint8_t flags;
+    /// First register id
+    uint16_t first_reg;
+    /// Registers count
+    uint16_t regs_cnt;
+    /// Period, ms
+    uint16_t period_ms;
+    /// Sample sequence, incremented on every sample sent
+    uint16_t seq;
+    /// Next sample due time, ms
+    uint32_t next_ms;
+    /// CRC of the last sample values, for #S3P_TELEM_F_ON_CHANGE
+    uint16_t last_crc;
+} s3p_sub_t;
+
+/**
+ * @brief Telemetry scheduler state
+*/
+typedef struct {
+    /// Subscriptions
+    s3p_sub_t subs[S3P_TELEM_MAX_SUBS];
+    /// Registers serializer
+    s3p_telem_read_t read;
+    /// Registers serializer context
+    void *ctx;
+} s3p_telem_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * @brief Init the scheduler, no subscriptions
+ * @param telem Pointer to scheduler state
+ * @param read Registers serializer
+ * @param ctx Registers serializer context
+*/
+extern void s3p_telem_init(s3p_telem_t *telem, s3p_telem_read_t read,
+        void *ctx);
+
+/**
+ * @brief Handle a #PT_SUBSCRIBE request
+ *
+ * A period of 0 cancels the subscription. Subscribing again with the same
+ * subscriber and subscription ids replaces the subscription.
+ *
+ * @param telem Pointer to scheduler state
+ * @param pkt_in Parsed #PT_SUBSCRIBE request
+ * @param now_ms Node time, ms
+ * @return Result code for the #PT_SUBSCRIBE_RESP response
+*/
+extern uint8_t s3p_telem_subscribe(s3p_telem_t *telem,
+        const s3p_packet_t *pkt_in, const uint32_t now_ms);
+
+/**
+ * @brief Build the next due #PT_TELEMETRY packet, if any
+ *
+ * To be called from the node main loop, until it returns false. The
+ * packet is then encoded and sent as any other response.
+ *
+ * @param telem Pointer to scheduler state
+ * @param now_ms Node time, ms
+ * @param src_id Node id
+ * @param pkt_out Packet initialized by a call to #s3p_init_pkt, filled
+ * with the sample
+ * @param data_size Max data size of pkt_out
+ * @return true if pkt_out holds a sample to send
+*/
+extern bool s3p_telem_poll(s3p_telem_t *telem, const uint32_t now_ms,
+        const uint8_t src_id, s3p_packet_t *pkt_out, const uint16_t data_size);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif // _S3P_TELEM_H
@@ -0,0 +1,112 @@
+/**
+@file s3p_txq.h
+@brief S3P transmit queue, batching frames into a single write
+
+Frames are encoded in place at the queue tail, each one ending with its
+#S3P_COBS_DELIM, so that the queued frames are a single contiguous
+buffer handed to one write call on flush. A flush happens on an explicit
+doorbell (#s3p_txq_flush), when the next frame would not fit, when the
+queued bytes reach the size threshold, or when the oldest queued frame
+is older than the time threshold (#s3p_txq_poll).
+*/
+
+#ifndef _S3P_TXQ_H
+#define _S3P_TXQ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "s3p.h"
+
+/**
+ * @brief Queue output callback, sending the queued frames
+ * @param ctx User context
+ * @param buf Queued frames
+ * @param len Queued frames size
+ * @return true if the whole buffer was sent
+*/
+typedef bool (*s3p_txq_write_t)(void *ctx, const uint8_t *buf,
+        const uint32_t len);
+
+/**
+ * @brief Transmit queue state
+*/
+typedef struct {
+    /// Queue buffer, at least #S3P_LINK_FRAME_SIZE bytes
+    uint8_t *buf;
+    /// Queue buffer size
+    uint32_t size;
+    /// Queued bytes
+    uint32_t len;
+    /// Queued frames
+    uint16_t frames;
+    /// Flush when at least this many bytes are queued, 0 to disable
+    uint32_t flush_size;
+    /// Flush when the oldest frame is queued since this many ms, 0 to
+    /// flush only on doorbell or size
+    uint32_t flush_ms;
+    /// Time the oldest queued frame was pushed, ms
+    uint32_t first_ms;
+    /// Output callback
+    s3p_txq_write_t write;
+    /// Output callback context
+    void *ctx;
+    /// Write calls
+    uint32_t writes;
+} s3p_txq_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * @brief Init an empty queue
+ * @param txq Pointer to queue state
+ * @param buf Queue buffer
+ * @param size Queue buffer size
+ * @param flush_size Size threshold, bytes, 0 to disable
+ * @param flush_ms Time threshold, ms, 0 to disable
+ * @param write Output callback
+ * @param ctx Output callback context
+*/
+extern void s3p_txq_init(s3p_txq_t *txq, uint8_t *buf, const uint32_t size,
+        const uint32_t flush_size, const uint32_t flush_ms,
+        s3p_txq_write_t write, void *ctx);
+
+/**
+ * @brief Encode a packet at the queue tail, as #s3p_link_make_frame
+ *
+ * The queue is flushed first if the frame may not fit, and after the
+ * frame if the size threshold is reached.
+ *
+ * @param txq Pointer to queue state
+ * @param link Pointer to link state
+ * @param pkt_out Pointer to packet structure to be encoded
+ * @param now_ms Current time, ms, for the time threshold
+ * @param frame If not NULL, filled with the encoded frame address, valid
+ * until the next push or flush
+ * @return Size of the encoded frame, 0 in case of encoding or write error
+*/
+extern uint16_t s3p_txq_push(s3p_txq_t *txq, s3p_link_t *link,
+        const s3p_packet_t *pkt_out, const uint32_t now_ms,
+        const uint8_t **frame);
+
+/**
+ * @brief Doorbell: send all the queued frames with a single write
+ * @param txq Pointer to queue state
+ * @return true on success or empty queue. The queue is emptied anyway
+*/
+extern bool s3p_txq_flush(s3p_txq_t *txq);
+
+/**
+ * @brief Flush the queue if the time threshold expired
+ * @param txq Pointer to queue state
+ * @param now_ms Current time, ms
+ * @return false on write error
+*/
+extern bool s3p_txq_poll(s3p_txq_t *txq, const uint32_t now_ms);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif // _S3P_TXQ_H
@@ -0,0 +1,213 @@
+/**
+@file s3p_uart.h
+@brief S3P node side DMA UART driver: circular DMA receive, double buffered
+DMA transmit
+
+The CPU never handles single bytes, neither in interrupts nor in the main
+loop:
+
+- Receive: the DMA writes the line into a circular buffer, for good. The
+  idle line, half transfer and transfer complete interrupts only call
+  #s3p_uart_rx_event, which reads the DMA position and stamps the bytes
+  with the interrupt time, e.g. for the #PT_GROUP_READ slots. The main loop
+  (#s3p_uart_recv) looks for the frame delimiters with memchr() and parses
+  the frames in place, copying only the frames wrapping around the end of
+  the buffer.
+- Transmit: frames are encoded straight into one of two DMA buffers. While
+  the DMA sends one buffer, the next frames are appended to the other,
+  which the transfer complete interrupt (#s3p_uart_tx_done) sends next.
+
+The main loop and the interrupts share no lock: the interrupts may preempt
+the main loop anywhere, or run on another thread (see the Linux stand-in
+in s3psh/uart_posix.c).
+
+The receive buffer size is a power of two, large enough for the bytes
+received while the main loop is busy plus a frame being assembled: at
+least two link frame sizes (#S3P_LINK_FRAME_SIZE). Each transmit buffer
+must hold a link frame.
+*/
+
+#ifndef _S3P_UART_H
+#define _S3P_UART_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "s3p.h"
+#include "s3p_atomic.h"
+
+/** @brief Receive interrupt times kept, a power of two. A frame parsed
+ * more interrupts than this after its end gets the time of the oldest
+ * one kept, i.e. a late time */
+#define S3P_UART_RX_STAMPS    16
+
+/**
+ * @brief Hardware abstraction, implemented by the port
+*/
+typedef struct {
+    /**
+     * @brief Start the circular DMA reception into buf, never stopped.
+     * The idle line, half transfer and transfer complete interrupts call
+     * #s3p_uart_rx_event
+     * @param hw Port context
+     * @param buf Receive buffer
+     * @param size Receive buffer size
+     * @return true on success
+    */
+    bool (*rx_start)(void *hw, uint8_t *buf, const uint16_t size);
+    /**
+     * @brief DMA write position in the receive buffer (buffer size minus
+     * the DMA remaining count), 0 to size - 1. Called from the
+     * interrupts, and from the main loop to check that a frame was not
+     * overwritten while being parsed
+     * @param hw Port context
+    */
+    uint16_t (*rx_pos)(void *hw);
+    /**
+     * @brief Start a DMA transmit, the transfer complete interrupt calls
+     * #s3p_uart_tx_done. Called from the main loop and from
+     * #s3p_uart_tx_done
+     * @param hw Port context
+     * @param buf Bytes to send, untouched until the transfer completes
+     * @param len Bytes count
+     * @return true on success
+    */
+    bool (*tx_start)(void *hw, const uint8_t *buf, const uint16_t len);
+} s3p_uart_hal_t;
+
+/**
+ * @brief Driver state
+*/
+typedef struct {
+    /// Port
+    const s3p_uart_hal_t *hal;
+    /// Port context
+    void *hw;
+
+    /// Receive buffer, written by the DMA
+    uint8_t *rx_buf;
+    /// Receive buffer size
+    uint16_t rx_size;
+    /// Bytes received, updated by #s3p_uart_rx_event
+    S3P_ATOMIC(uint32_t) rx_head;
+    /// Last DMA position seen by #s3p_uart_rx_event
+    uint16_t rx_dma_pos;
+    /// Bytes scanned for delimiters
+    uint32_t rx_tail;
+    /// First byte of the frame being received
+    uint32_t rx_frame;
+    /// Dropping bytes up to the next delimiter (overrun, oversized frame)
+    bool rx_skip;
+    /// Last receive interrupts: bytes received and time, by interrupt
+    /// count
+    struct {
+        S3P_ATOMIC(uint32_t) head;
+        S3P_ATOMIC(uint32_t) us;
+    } rx_stamps[S3P_UART_RX_STAMPS];
+    /// rx_stamps sequence lock: twice the receive interrupts that received
+    /// bytes, odd while a stamp is written
+    S3P_ATOMIC(uint32_t) rx_stamps_seq;
+    /// Time of the receive interrupt that ended the last frame returned by
+    /// #s3p_uart_recv, us
+    uint32_t rx_us;
+    /// Buffer for the frames wrapping around the receive buffer end
+    uint8_t *lin_buf;
+    /// Wrapped frames buffer size, max frame size
+    uint16_t lin_size;
+
+    /// Transmit buffers
+    uint8_t *tx_buf[2];
+    /// Size of each transmit buffer
+    uint16_t tx_size;
+    /// Buffer being filled (bit 31) and its queued bytes (bits 15:0)
+    S3P_ATOMIC(uint32_t) tx_fill;
+    /// A DMA transfer is running
+    S3P_ATOMIC(bool) tx_busy;
+
+    /// Receive buffer overflows, frames lost
+    uint32_t rx_overruns;
+    /// Frames larger than the wrapped frames buffer
+    uint32_t rx_oversized;
+    /// Frames queued for transmission
+    uint32_t tx_frames;
+} s3p_uart_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * @brief Init the driver and start the reception
+ * @param uart Pointer to driver state
+ * @param hal Port
+ * @param hw Port context
+ * @param rx_buf Receive buffer
+ * @param rx_size Receive buffer size, a power of two of at least two
+ * frames
+ * @param lin_buf Wrapped frames buffer
+ * @param lin_size Wrapped frames buffer size, max frame size
+ * @param tx_buf Transmit buffers, 2 * tx_size bytes
+ * @param tx_size Size of each transmit buffer, at least a frame
+ * @return false if rx_size is not a power of two or the reception could
+ * not be started
+*/
+extern bool s3p_uart_init(s3p_uart_t *uart, const s3p_uart_hal_t *hal,
+        void *hw, uint8_t *rx_buf, const uint16_t rx_size, uint8_t *lin_buf,
+        const uint16_t lin_size, uint8_t *tx_buf, const uint16_t tx_size);
+
+/**
+ * @brief Receive interrupt hook: idle line, half transfer and transfer
+ * complete. Reads the DMA position and records the time of the bytes
+ * received, nothing else
+ * @param uart Pointer to driver state
+ * @param now_us Current time, us, from a free running timer
+ * @return true if bytes were received since the last call, e.g. to wake
+ * the main loop
+*/
+extern bool s3p_uart_rx_event(s3p_uart_t *uart, const uint32_t now_us);
+
+/**
+ * @brief Parse the next received frame for us, as #s3p_link_parse_frame
+ *
+ * To be called from the main loop until it returns false. The frame
+ * reception time is left in rx_us: the time of the idle line interrupt
+ * following its delimiter, whenever the main loop gets to it.
+ *
+ * @param uart Pointer to driver state
+ * @param link Pointer to link state
+ * @param pkt Packet initialized by a call to #s3p_init_pkt
+ * @param dst_id Expected destination id
+ * @return true if pkt holds a packet
+*/
+extern bool s3p_uart_recv(s3p_uart_t *uart, s3p_link_t *link,
+        s3p_packet_t *pkt, const uint8_t dst_id);
+
+/**
+ * @brief Encode a packet into the transmit buffer being filled, as
+ * #s3p_link_make_frame, and start the DMA if idle
+ * @param uart Pointer to driver state
+ * @param link Pointer to link state
+ * @param pkt_out Pointer to packet structure to be encoded
+ * @return Size of the encoded frame, 0 in case of encoding error or if
+ * both transmit buffers are busy (to be retried later)
+*/
+extern uint16_t s3p_uart_send(s3p_uart_t *uart, s3p_link_t *link,
+        const s3p_packet_t *pkt_out);
+
+/**
+ * @brief Transmit complete interrupt hook: starts the other buffer if
+ * frames were queued meanwhile
+ * @param uart Pointer to driver state
+*/
+extern void s3p_uart_tx_done(s3p_uart_t *uart);
+
+/**
+ * @brief Nothing queued nor being sent
+ * @param uart Pointer to driver state
+*/
+extern bool s3p_uart_tx_idle(s3p_uart_t *uart);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif // _S3P_UART_H
@@ -49,9 +49,26 @@ typedef struct {
     value_type_t vt;
 } value_t;
 
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
 extern void value_dump(char *buf, const value_t * const value, const int max_size);
 extern const char *value_type_str(const value_type_t vt);
 extern value_type_t value_type_from_str(const char *str);
+/* Parse str as a vt value into value, 0 on success, -1 if vt is not a
+ * scalar type or str is not a whole, in range, value of it:
+ * - u8/u16/u32: decimal
+ * - i8/i16/i32: decimal, 0x hex or 0 octal, optional sign
+ * - x8/x16/x32: hex, optional 0x
+ * - flt: decimal with optional exponent, inf or nan, correctly rounded
+ * No locale: the decimal point is always '.'.
+ */
+extern int value_parse(value_t *value, const value_type_t vt, const char *str);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
 
 #endif // _VALUE_H
 
@@ -0,0 +1,46 @@
+#ifndef _VALUE_FMT_H
+#define _VALUE_FMT_H
+
+/* value formatting, without printf
+ * version: 1.0
+ * date   : 2026-10-18
+ *
+ * Same text as value_dump() for the integer types, two digits per step
+ * from a lookup table. VT_FLT is formatted with the fewest significant
+ * digits that read back as the same float (Ryu algorithm): fixed point
+ * for exponents -4..8, e.g. "0.1", "-1234.5", otherwise scientific, e.g.
+ * "1.5e-7", "3.4028235e38". No locale: the decimal point is always '.'.
+ *
+ * Every function writes a null terminated string of at most
+ * VALUE_SCALAR_MAX_SIZE bytes, null byte included, and returns its
+ * length.
+ */
+
+#include <stdint.h>
+#include "value.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+extern int value_fmt_u32(char *buf, const uint32_t v);
+extern int value_fmt_i32(char *buf, const int32_t v);
+extern int value_fmt_hex(char *buf, const uint32_t v);
+extern int value_fmt_flt(char *buf, const float v);
+// Scalar types only, "" for the others
+extern int value_fmt(char *buf, const value_type_t vt, const uint32_t raw);
+
+/* Format cnt raw values of types types[] back to back into buf, each
+ * one null terminated, with its length in lens[]. Stops when less than
+ * VALUE_SCALAR_MAX_SIZE bytes are left. Return the values formatted,
+ * all of them if size is at least VALUE_SCALAR_MAX_SIZE * cnt.
+ */
+extern uint16_t value_fmt_batch(char *buf, const uint32_t size,
+        const uint8_t *types, const uint32_t *values, const uint16_t cnt,
+        uint8_t *lens);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif // _VALUE_FMT_H
@@ -0,0 +1,596 @@
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "archive.h"
+
+#define ARC_DBG(...)     printf(__VA_ARGS__)
+#define ARC_HASH(_n, _r) \
+    ((((uint32_t)(_n) << 16 | (_r)) * 2654435761U) % ARC_MAX_SERIES)
+
+// Bit stream, MSB first
+struct bits {
+    uint8_t *buf;
+    uint32_t pos;       // Bits
+    uint32_t end;       // Bits, reader only
+    bool bad;           // Reader went past the end
+};
+
+static void put_le16(uint8_t *p, const uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_le32(uint8_t *p, const uint32_t v)
+{
+    put_le16(p, (uint16_t)v);
+    put_le16(p+2, (uint16_t)(v >> 16));
+}
+
+static void put_le64(uint8_t *p, const uint64_t v)
+{
+    put_le32(p, (uint32_t)v);
+    put_le32(p+4, (uint32_t)(v >> 32));
+}
+
+static uint16_t get_le16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return get_le16(p) | ((uint32_t)get_le16(p+2) << 16);
+}
+
+static uint64_t get_le64(const uint8_t *p)
+{
+    return get_le32(p) | ((uint64_t)get_le32(p+4) << 32);
+}
+
+static int write_all(const int fd, const uint8_t *buf, size_t size)
+{
+    while (size) {
+        ssize_t rc = write(fd, buf, size);
+        if (rc < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += rc;
+        size -= rc;
+    }
+    return 0;
+}
+
+// The buffer is zeroed by the caller, only the 1 bits are set
+static void bits_put(struct bits *b, const uint32_t val, int n)
+{
+    while (n) {
+        const int room = 8 - (b->pos & 7);
+        const int take = n < room ? n : room;
+        const uint8_t chunk = (val >> (n - take)) & ((1U << take) - 1);
+        b->buf[b->pos >> 3] |= chunk << (room - take);
+        b->pos += take;
+        n -= take;
+    }
+}
+
+static uint32_t bits_get(struct bits *b, int n)
+{
+    uint32_t val = 0;
+
+    if (b->pos + n > b->end) {
+        b->bad = true;
+        return 0;
+    }
+    while (n) {
+        const int avail = 8 - (b->pos & 7);
+        const int take = n < avail ? n : avail;
+        const uint8_t byte = b->buf[b->pos >> 3];
+        val = (val << take) | ((byte >> (avail - take)) & ((1U << take) - 1));
+        b->pos += take;
+        n -= take;
+    }
+    return val;
+}
+
+// Leading '1' bits of a prefix code, up to max
+static int bits_prefix(struct bits *b, const int max)
+{
+    int n = 0;
+
+    while (n < max && bits_get(b, 1))
+        n++;
+    return n;
+}
+
+static uint32_t put_varint(uint8_t *p, uint64_t v)
+{
+    uint32_t n = 0;
+
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+static bool get_varint(const uint8_t *p, const uint32_t size, uint32_t *pos,
+        uint64_t *v)
+{
+    *v = 0;
+    for (int shift=0; shift<64 && *pos<size; shift+=7) {
+        const uint8_t byte = p[(*pos)++];
+        *v |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+static uint16_t encode_ts(uint8_t *col, const uint64_t *ts, const uint16_t cnt)
+{
+    struct bits b = { col, 0, 0, false };
+    int64_t prev_delta = 0;
+
+    memset(col, 0x00, ARC_TS_COL_MAX);
+    for (int i=1; i<cnt; i++) {
+        // Chunks span at most ARC_CHUNK_MAX_MS, it fits
+        const int64_t delta = ts[i] - ts[i-1];
+        const int32_t dod = delta - prev_delta;
+        prev_delta = delta;
+        if (dod == 0)
+            bits_put(&b, 0x0, 1);
+        else if (dod >= -7 && dod <= 8) {
+            bits_put(&b, 0x2, 2);
+            bits_put(&b, dod + 7, 4);
+        }
+        else if (dod >= -255 && dod <= 256) {
+            bits_put(&b, 0x6, 3);
+            bits_put(&b, dod + 255, 9);
+        }
+        else if (dod >= -32767 && dod <= 32768) {
+            bits_put(&b, 0xE, 4);
+            bits_put(&b, dod + 32767, 16);
+        }
+        else {
+            bits_put(&b, 0xF, 4);
+            bits_put(&b, (uint32_t)dod, 32);
+        }
+    }
+    return (b.pos + 7) / 8;
+}
+
+static uint16_t encode_int(uint8_t *col, const uint32_t *val, const uint16_t cnt)
+{
+    uint16_t size = 0;
+    uint64_t run = 0;
+
+    for (int i=1; i<cnt; i++) {
+        const int32_t d = val[i] - val[i-1];
+        if (!d) {
+            run++;
+            continue;
+        }
+        if (run)
+            size += put_varint(col + size, run << 1 | 1);
+        run = 0;
+        const uint32_t zz = ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+        size += put_varint(col + size, (uint64_t)zz << 1);
+    }
+    if (run)
+        size += put_varint(col + size, run << 1 | 1);
+    return size;
+}
+
+static uint16_t encode_flt(uint8_t *col, const uint32_t *val, const uint16_t cnt)
+{
+    struct bits b = { col, 0, 0, false };
+    int lead = -1;
+    int trail = 0;
+
+    memset(col, 0x00, ARC_VAL_COL_MAX);
+    for (int i=1; i<cnt; i++) {
+        const uint32_t x = val[i] ^ val[i-1];
+        if (!x) {
+            bits_put(&b, 0x0, 1);
+            continue;
+        }
+        const int l = __builtin_clz(x);
+        const int t = __builtin_ctz(x);
+        if (lead >= 0 && l >= lead && t >= trail) {
+            bits_put(&b, 0x2, 2);
+            bits_put(&b, x >> trail, 32 - lead - trail);
+        }
+        else {
+            lead = l;
+            trail = t;
+            bits_put(&b, 0x3, 2);
+            bits_put(&b, lead, 5);
+            bits_put(&b, 32 - lead - trail - 1, 5);
+            bits_put(&b, x >> trail, 32 - lead - trail);
+        }
+    }
+    return (b.pos + 7) / 8;
+}
+
+static void file_hdr(uint8_t *hdr, const char *magic, const uint8_t node_id,
+        const uint16_t reg_id)
+{
+    memcpy(hdr, magic, 8);
+    put_le16(hdr+8, ARC_VERSION);
+    hdr[10] = node_id;
+    hdr[11] = 0;
+    put_le16(hdr+12, reg_id);
+    put_le16(hdr+14, 0);
+}
+
+// Open for append, adding the header to a new file. Return the file size
+// before the append, -1 on error
+static off_t open_append(int *fd, const char *path, const char *magic,
+        const uint8_t node_id, const uint16_t reg_id)
+{
+    uint8_t hdr[ARC_FILE_HDR_SIZE];
+
+    *fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (*fd < 0)
+        return -1;
+    off_t size = lseek(*fd, 0, SEEK_END);
+    if (size == 0) {
+        file_hdr(hdr, magic, node_id, reg_id);
+        if (write_all(*fd, hdr, sizeof(hdr)) < 0) {
+            close(*fd);
+            return -1;
+        }
+        size = sizeof(hdr);
+    }
+    return size;
+}
+
+static void series_path(char *path, const size_t size, const char *dir,
+        const uint8_t node_id, const uint16_t reg_id, const char *ext)
+{
+    snprintf(path, size, "%s/n%03u_r%05u.%s", dir, node_id, reg_id, ext);
+}
+
+static bool write_chunk(struct arc_struct * const arc,
+        struct arc_series * const s)
+{
+    static uint8_t chunk[ARC_CHUNK_HDR_SIZE + ARC_TS_COL_MAX + ARC_VAL_COL_MAX];
+    uint8_t rec[ARC_IDX_REC_SIZE];
+    char path[sizeof(arc->dir) + 32];
+    int fd;
+
+    if (!s->cnt)
+        return true;
+
+    uint8_t *col = chunk + ARC_CHUNK_HDR_SIZE;
+    const uint16_t ts_size = encode_ts(col, s->ts, s->cnt);
+    col += ts_size;
+    const uint16_t val_size = s->vt == VT_FLT ?
+        encode_flt(col, s->val, s->cnt) : encode_int(col, s->val, s->cnt);
+    put_le16(chunk, ts_size);
+    put_le16(chunk+2, val_size);
+    const uint32_t size = ARC_CHUNK_HDR_SIZE + ts_size + val_size;
+
+    put_le64(rec, s->ts[0]);
+    put_le64(rec+8, s->ts[s->cnt-1]);
+    put_le32(rec+24, s->val[0]);
+    put_le16(rec+28, s->cnt);
+    rec[30] = s->vt;
+    rec[31] = 0;
+    s->cnt = 0;
+
+    // Files are opened on write only: hundreds of registers would take
+    // as many descriptors, and a chunk is written once in minutes
+    series_path(path, sizeof(path), arc->dir, s->node_id, s->reg_id, "dat");
+    const off_t offset = open_append(&fd, path, ARC_MAGIC, s->node_id,
+            s->reg_id);
+    if (offset < 0)
+        return false;
+    bool ok = !write_all(fd, chunk, size);
+    close(fd);
+    if (!ok)
+        return false;
+
+    put_le64(rec+16, offset);
+    series_path(path, sizeof(path), arc->dir, s->node_id, s->reg_id, "idx");
+    if (open_append(&fd, path, ARC_IDX_MAGIC, s->node_id, s->reg_id) < 0)
+        return false;
+    ok = !write_all(fd, rec, sizeof(rec));
+    close(fd);
+
+    arc->chunks++;
+    arc->bytes += size + sizeof(rec);
+    return ok;
+}
+
+// Last time already archived, so that a restart does not go back in time
+static uint64_t series_last_ms(const struct arc_struct * const arc,
+        const uint8_t node_id, const uint16_t reg_id)
+{
+    char path[sizeof(arc->dir) + 32];
+    uint8_t rec[ARC_IDX_REC_SIZE];
+    struct stat st;
+    uint64_t last_ms = 0;
+
+    series_path(path, sizeof(path), arc->dir, node_id, reg_id, "idx");
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 0;
+    if (!fstat(fd, &st) && st.st_size >= ARC_FILE_HDR_SIZE + ARC_IDX_REC_SIZE) {
+        const off_t off = ARC_FILE_HDR_SIZE + ((st.st_size - ARC_FILE_HDR_SIZE)
+                / ARC_IDX_REC_SIZE - 1) * ARC_IDX_REC_SIZE;
+        if (pread(fd, rec, sizeof(rec), off) == sizeof(rec))
+            last_ms = get_le64(rec+8);
+    }
+    close(fd);
+    return last_ms;
+}
+
+static struct arc_series *find_series(struct arc_struct * const arc,
+        const uint8_t node_id, const uint16_t reg_id)
+{
+    const uint32_t h = ARC_HASH(node_id, reg_id);
+    struct arc_series *s;
+
+    for (s=arc->hash[h]; s!=NULL; s=s->next) {
+        if (s->node_id == node_id && s->reg_id == reg_id)
+            return s;
+    }
+
+    if (arc->series >= ARC_MAX_SERIES)
+        return NULL;
+    s = calloc(1, sizeof(struct arc_series));
+    if (s == NULL)
+        return NULL;
+    s->node_id = node_id;
+    s->reg_id = reg_id;
+    s->last_ms = series_last_ms(arc, node_id, reg_id);
+    s->next = arc->hash[h];
+    arc->hash[h] = s;
+    arc->series++;
+    return s;
+}
+
+int arc_open(struct arc_struct * const arc, const char * const dir)
+{
+    struct stat st;
+
+    memset(arc, 0x00, sizeof(struct arc_struct));
+    strncpy(arc->dir, dir, sizeof(arc->dir) - 1);
+    if (mkdir(arc->dir, 0755) && errno != EEXIST) {
+        ARC_DBG("ERROR Can't create archive dir %s (%s)\n", arc->dir,
+                strerror(errno));
+        return -1;
+    }
+    if (stat(arc->dir, &st) || !S_ISDIR(st.st_mode)) {
+        ARC_DBG("ERROR %s is not a directory\n", arc->dir);
+        return -1;
+    }
+    return 0;
+}
+
+void arc_close(struct arc_struct * const arc)
+{
+    for (int i=0; i<ARC_MAX_SERIES; i++) {
+        struct arc_series *s = arc->hash[i];
+        while (s != NULL) {
+            struct arc_series *next = s->next;
+            if (!write_chunk(arc, s))
+                arc->drops++;
+            free(s);
+            s = next;
+        }
+        arc->hash[i] = NULL;
+    }
+}
+
+uint64_t arc_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+bool arc_put(struct arc_struct * const arc, const uint8_t node_id,
+        const uint16_t reg_id, const value_type_t vt, const uint32_t value,
+        uint64_t ts_ms)
+{
+    struct arc_series *s = find_series(arc, node_id, reg_id);
+
+    if (s == NULL || vt == VT_EMPTY || !VALUE_TYPE_IS_SCALAR(vt)) {
+        arc->drops++;
+        return false;
+    }
+    if (ts_ms < s->last_ms)
+        ts_ms = s->last_ms;
+
+    // A chunk has a single type and a bounded time span
+    if (s->cnt && (vt != s->vt || ts_ms - s->ts[0] > ARC_CHUNK_MAX_MS) &&
+            !write_chunk(arc, s))
+        arc->drops++;
+
+    s->vt = vt;
+    s->ts[s->cnt] = ts_ms;
+    s->val[s->cnt] = value;
+    s->cnt++;
+    s->last_ms = ts_ms;
+    arc->samples++;
+
+    if (s->cnt == ARC_CHUNK_SAMPLES && !write_chunk(arc, s)) {
+        arc->drops++;
+        return false;
+    }
+    return true;
+}
+
+static const uint8_t *map_file(const char *path, const char *magic,
+        size_t *size)
+{
+    struct stat st;
+    const int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) || st.st_size < ARC_FILE_HDR_SIZE) {
+        close(fd);
+        return NULL;
+    }
+    *size = st.st_size;
+    const uint8_t *p = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return NULL;
+    if (memcmp(p, magic, 8) || get_le16(p+8) != ARC_VERSION) {
+        munmap((void *)p, *size);
+        return NULL;
+    }
+    return p;
+}
+
+int arc_reader_open(struct arc_reader * const rd, const char * const dir,
+        const uint8_t node_id, const uint16_t reg_id)
+{
+    char path[PATH_MAX];
+
+    memset(rd, 0x00, sizeof(struct arc_reader));
+    series_path(path, sizeof(path), dir, node_id, reg_id, "dat");
+    rd->dat = map_file(path, ARC_MAGIC, &rd->dat_size);
+    if (rd->dat == NULL)
+        return -1;
+    series_path(path, sizeof(path), dir, node_id, reg_id, "idx");
+    rd->idx = map_file(path, ARC_IDX_MAGIC, &rd->idx_size);
+    if (rd->idx == NULL) {
+        arc_reader_close(rd);
+        return -1;
+    }
+    // A partial last record is being written or was lost
+    rd->chunks = (rd->idx_size - ARC_FILE_HDR_SIZE) / ARC_IDX_REC_SIZE;
+    return 0;
+}
+
+void arc_reader_close(struct arc_reader * const rd)
+{
+    if (rd->dat != NULL)
+        munmap((void *)rd->dat, rd->dat_size);
+    if (rd->idx != NULL)
+        munmap((void *)rd->idx, rd->idx_size);
+    rd->dat = NULL;
+    rd->idx = NULL;
+    rd->chunks = 0;
+}
+
+// Decode a chunk, calling cb for the samples within [from_ms, to_ms]
+static uint64_t decode_chunk(const struct arc_reader * const rd,
+        const uint8_t *rec, const uint64_t from_ms, const uint64_t to_ms,
+        arc_sample_cb_t cb, void *ctx)
+{
+    const uint64_t off = get_le64(rec+16);
+    const uint16_t cnt = get_le16(rec+28);
+    const value_type_t vt = rec[30];
+    uint64_t ts = get_le64(rec);
+    uint32_t val = get_le32(rec+24);
+    uint64_t n = 0;
+
+    if (off + ARC_CHUNK_HDR_SIZE > rd->dat_size)
+        return 0;
+    const uint16_t ts_size = get_le16(rd->dat + off);
+    const uint16_t val_size = get_le16(rd->dat + off + 2);
+    if (off + ARC_CHUNK_HDR_SIZE + ts_size + val_size > rd->dat_size)
+        return 0;
+    uint8_t *col = (uint8_t *)rd->dat + off + ARC_CHUNK_HDR_SIZE;
+    struct bits tb = { col, 0, ts_size * 8, false };
+    struct bits vb = { col + ts_size, 0, val_size * 8, false };
+    const uint8_t *vcol = col + ts_size;
+    uint32_t vpos = 0;
+    uint64_t run = 0;
+    int64_t delta = 0;
+    int lead = 0;
+    int trail = 0;
+
+    for (int i=0; i<cnt; i++) {
+        if (i) {
+            int32_t dod;
+            switch (bits_prefix(&tb, 4)) {
+            case 0: dod = 0; break;
+            case 1: dod = (int32_t)bits_get(&tb, 4) - 7; break;
+            case 2: dod = (int32_t)bits_get(&tb, 9) - 255; break;
+            case 3: dod = (int32_t)bits_get(&tb, 16) - 32767; break;
+            default: dod = (int32_t)bits_get(&tb, 32); break;
+            }
+            delta += dod;
+            ts += delta;
+
+            if (vt == VT_FLT) {
+                if (bits_get(&vb, 1)) {
+                    if (bits_get(&vb, 1)) {
+                        lead = bits_get(&vb, 5);
+                        trail = 32 - lead - (bits_get(&vb, 5) + 1);
+                    }
+                    if (trail >= 0)
+                        val ^= bits_get(&vb, 32 - lead - trail) << trail;
+                    else
+                        vb.bad = true;
+                }
+            }
+            else if (run)
+                run--;
+            else {
+                uint64_t tok;
+                if (!get_varint(vcol, val_size, &vpos, &tok))
+                    break;
+                if (tok & 1)
+                    run = (tok >> 1) - 1;
+                else {
+                    const uint32_t zz = tok >> 1;
+                    val += (zz >> 1) ^ -(zz & 1);
+                }
+            }
+            if (tb.bad || vb.bad)
+                break;
+        }
+        if (ts > to_ms)
+            break;
+        if (ts >= from_ms) {
+            cb(ctx, ts, vt, val);
+            n++;
+        }
+    }
+    return n;
+}
+
+uint64_t arc_query(const struct arc_reader * const rd, const uint64_t from_ms,
+        const uint64_t to_ms, arc_sample_cb_t cb, void *ctx)
+{
+    const uint8_t *recs = rd->idx + ARC_FILE_HDR_SIZE;
+    uint32_t lo = 0;
+    uint32_t hi = rd->chunks;
+    uint64_t n = 0;
+
+    // First chunk ending at or after from_ms
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if (get_le64(recs + mid * ARC_IDX_REC_SIZE + 8) < from_ms)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    for (uint32_t i=lo; i<rd->chunks; i++) {
+        const uint8_t *rec = recs + i * ARC_IDX_REC_SIZE;
+        if (get_le64(rec) > to_ms)
+            break;
+        n += decode_chunk(rd, rec, from_ms, to_ms, cb, ctx);
+    }
+    return n;
+}
@@ -0,0 +1,135 @@
+#ifndef _ARCHIVE_H
+#define _ARCHIVE_H
+
+/* Register time-series archive
+ *
+ * Register samples are appended to a directory with two files per node
+ * and register, n<node>_r<reg>.dat (the samples) and n<node>_r<reg>.idx
+ * (the block index). Samples are buffered in memory and written as
+ * chunks of up to ARC_CHUNK_SAMPLES samples, each chunk made of a
+ * timestamp column followed by a value column:
+ *
+ *   - timestamps, ms: delta-of-delta, bit packed
+ *       '0'                 same interval as the previous sample
+ *       '10'   + 4 bits     -7 .. 8
+ *       '110'  + 9 bits     -255 .. 256
+ *       '1110' + 16 bits    -32767 .. 32768
+ *       '1111' + 32 bits    any other
+ *   - integer types: delta of the raw 32 bits value, zigzag, as varint
+ *     tokens: (zz << 1) for one sample, (n << 1 | 1) for n samples with
+ *     the same value
+ *   - VT_FLT: XOR with the previous value, bit packed
+ *       '0'                 same value
+ *       '10'   + bits       meaningful bits within the previous window
+ *       '11'   + 5 bits leading zeros + 5 bits length - 1 + bits
+ *
+ * Bits are packed MSB first. Timestamps never go back within a register:
+ * an earlier time (e.g. clock step) is stored as the last one, so chunks
+ * are sorted and the index can be searched with a bisection.
+ *
+ * Data file (all fields little endian):
+ *
+ *   File header, ARC_FILE_HDR_SIZE bytes
+ *     magic[8]   "S3PARC\0\0"
+ *     u16        version (ARC_VERSION)
+ *     u8         node id
+ *     u8         reserved
+ *     u16        register id
+ *     u16        reserved
+ *
+ *   Chunks, repeated
+ *     u16        timestamp column size, bytes
+ *     u16        value column size, bytes
+ *     u8[]       timestamp column
+ *     u8[]       value column
+ *
+ * Index file: the same file header with magic "S3PAIX\0\0", then one
+ * ARC_IDX_REC_SIZE bytes record per chunk, written after the chunk:
+ *     u64        first sample time, ms since the epoch
+ *     u64        last sample time, ms since the epoch
+ *     u64        chunk offset in the data file
+ *     u32        first sample value, raw
+ *     u16        samples
+ *     u8         value type (value_type_t)
+ *     u8         reserved
+ *
+ * A chunk without index record (e.g. after a crash) is ignored.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "value.h"
+
+#define ARC_MAGIC               "S3PARC\0\0"
+#define ARC_IDX_MAGIC           "S3PAIX\0\0"
+#define ARC_VERSION             1
+#define ARC_FILE_HDR_SIZE       16
+#define ARC_IDX_REC_SIZE        32
+#define ARC_CHUNK_HDR_SIZE      4
+#define ARC_CHUNK_SAMPLES       1024
+// A chunk is also written once it spans this time, so that the samples
+// of a slow register don't stay in memory for hours
+#define ARC_CHUNK_MAX_MS        (10 * 60 * 1000)
+#define ARC_MAX_SERIES          4096
+// Worst case column sizes of a full chunk
+#define ARC_TS_COL_MAX          ((ARC_CHUNK_SAMPLES * 36 + 7) / 8)
+#define ARC_VAL_COL_MAX         ((ARC_CHUNK_SAMPLES * 44 + 7) / 8)
+
+// One register being archived
+struct arc_series {
+    uint8_t node_id;
+    uint16_t reg_id;
+    uint8_t vt;
+    uint64_t last_ms;   // Last time archived, samples never go back
+    uint16_t cnt;       // Buffered samples
+    uint64_t ts[ARC_CHUNK_SAMPLES];
+    uint32_t val[ARC_CHUNK_SAMPLES];
+    struct arc_series *next;    // Hash chain
+};
+
+struct arc_struct {
+    char dir[256];
+    struct arc_series *hash[ARC_MAX_SERIES];
+    uint32_t series;
+    uint64_t samples;
+    uint64_t chunks;
+    uint64_t bytes;
+    // Samples not archived: too many registers or write error
+    uint32_t drops;
+};
+
+// Query side, the files of one register mapped in memory
+struct arc_reader {
+    const uint8_t *dat;
+    size_t dat_size;
+    const uint8_t *idx;
+    size_t idx_size;
+    uint32_t chunks;
+};
+
+typedef void (*arc_sample_cb_t)(void *ctx, const uint64_t ts_ms,
+        const value_type_t vt, const uint32_t value);
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+extern int arc_open(struct arc_struct * const arc, const char * const dir);
+extern void arc_close(struct arc_struct * const arc);
+extern uint64_t arc_now_ms(void);
+extern bool arc_put(struct arc_struct * const arc, const uint8_t node_id,
+        const uint16_t reg_id, const value_type_t vt, const uint32_t value,
+        const uint64_t ts_ms);
+
+extern int arc_reader_open(struct arc_reader * const rd, const char * const dir,
+        const uint8_t node_id, const uint16_t reg_id);
+extern void arc_reader_close(struct arc_reader * const rd);
+extern uint64_t arc_query(const struct arc_reader * const rd,
+        const uint64_t from_ms, const uint64_t to_ms,
+        arc_sample_cb_t cb, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif // _ARCHIVE_H
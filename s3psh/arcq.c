@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include "archive.h"
+#include "value.h"
+
+/* s3p-arc: time range queries on a register archive recorded with
+ * s3psh -A (see archive.h for the file format).
+ *
+ * The block index is searched by bisection and only the chunks
+ * overlapping the range are decoded, so that a short range of a long
+ * capture takes about as long as a short capture.
+ */
+
+#define VER             "1.00"
+
+typedef struct {
+    bool quiet;
+    uint64_t cnt;
+    uint64_t first_ms;
+    uint64_t last_ms;
+    // Integer types as signed/unsigned per type, VT_FLT as float
+    double min;
+    double max;
+    double sum;
+} query_t;
+
+static void show_usage(char **argv)
+{
+    printf("Usage: %s [-f from] [-t to] [-s] <dir> <node> <reg>\n", argv[0]);
+    printf("\n");
+    printf("Where:\n");
+    printf("  -f from     first time, seconds since the epoch, or negative\n");
+    printf("              seconds before now (default: all)\n");
+    printf("  -t to       last time, same format (default: all)\n");
+    printf("  -s          summary only (samples, min/max/mean)\n");
+    printf("  <dir>       archive directory (s3psh -A dir)\n");
+    printf("  <node>      node id\n");
+    printf("  <reg>       register id\n");
+    printf("\n");
+}
+
+static double value_num(const value_type_t vt, const uint32_t raw)
+{
+    value_t value;
+
+    value.vt = vt;
+    value.val.u32 = raw;
+    switch (vt) {
+    case VT_I8:  return value.val.i8;
+    case VT_I16: return value.val.i16;
+    case VT_I32: return value.val.i32;
+    case VT_U8:
+    case VT_X8:  return value.val.u8;
+    case VT_U16:
+    case VT_X16: return value.val.u16;
+    case VT_FLT: return value.val.flt;
+    default:     return value.val.u32;
+    }
+}
+
+static void sample_cb(void *ctx, const uint64_t ts_ms, const value_type_t vt,
+        const uint32_t raw)
+{
+    query_t *q = ctx;
+    const double num = value_num(vt, raw);
+
+    if (!q->cnt) {
+        q->first_ms = ts_ms;
+        q->min = num;
+        q->max = num;
+    }
+    q->last_ms = ts_ms;
+    q->cnt++;
+    q->sum += num;
+    if (num < q->min)
+        q->min = num;
+    if (num > q->max)
+        q->max = num;
+
+    if (!q->quiet) {
+        char value_str[VALUE_SCALAR_MAX_SIZE];
+        value_t value;
+        value.vt = vt;
+        value.val.u32 = raw;
+        value_dump(value_str, &value, sizeof(value_str));
+        printf("%llu.%03u %4s %s\n", (unsigned long long)(ts_ms / 1000),
+                (unsigned)(ts_ms % 1000), value_type_str(vt), value_str);
+    }
+}
+
+// Seconds since the epoch, or before now if negative, as ms
+static uint64_t parse_time(const char *str)
+{
+    const double secs = atof(str);
+
+    if (secs < 0)
+        return time(NULL) * 1000ULL + (int64_t)(secs * 1000);
+    return (uint64_t)(secs * 1000);
+}
+
+static double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t from_ms = 0;
+    uint64_t to_ms = UINT64_MAX;
+    struct arc_reader rd;
+    query_t q;
+    int opt;
+
+    memset(&q, 0x00, sizeof(q));
+    while ((opt = getopt(argc, argv, "f:t:s")) != -1) {
+        switch (opt) {
+        case 'f': from_ms = parse_time(optarg); break;
+        case 't': to_ms = parse_time(optarg); break;
+        case 's': q.quiet = true; break;
+        default:
+            show_usage(argv);
+            return -1;
+        }
+    }
+    if (optind + 3 > argc) {
+        show_usage(argv);
+        return -1;
+    }
+    const char *dir = argv[optind];
+    const int node_id = atoi(argv[optind+1]);
+    const int reg_id = atoi(argv[optind+2]);
+
+    if (arc_reader_open(&rd, dir, node_id, reg_id)) {
+        printf("No archive of node %d register %d in '%s'\n", node_id,
+                reg_id, dir);
+        return -1;
+    }
+
+    const double start_ms = now_ms();
+    arc_query(&rd, from_ms, to_ms, sample_cb, &q);
+    const double elapsed_ms = now_ms() - start_ms;
+
+    if (q.cnt) {
+        printf("%llu samples from %llu.%03u to %llu.%03u, min %g max %g "
+                "mean %g\n", (unsigned long long)q.cnt,
+                (unsigned long long)(q.first_ms / 1000),
+                (unsigned)(q.first_ms % 1000),
+                (unsigned long long)(q.last_ms / 1000),
+                (unsigned)(q.last_ms % 1000), q.min, q.max, q.sum / q.cnt);
+    }
+    else
+        printf("No samples\n");
+    printf("%u chunks, %zu bytes, query %.3f ms\n", rd.chunks,
+            rd.dat_size + rd.idx_size, elapsed_ms);
+    arc_reader_close(&rd);
+
+    return 0;
+}
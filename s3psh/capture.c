@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include "capture.h"
+
+#define CAP_DBG(...)     printf(__VA_ARGS__)
+#define CAP_RING_MASK    (CAP_RING_SIZE - 1)
+#define CAP_IDLE_NS      1000000L // 1ms
+
+static void put_le16(uint8_t *p, const uint16_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_le32(uint8_t *p, const uint32_t v)
+{
+    put_le16(p, (uint16_t)v);
+    put_le16(p+2, (uint16_t)(v >> 16));
+}
+
+static void put_le64(uint8_t *p, const uint64_t v)
+{
+    put_le32(p, (uint32_t)v);
+    put_le32(p+4, (uint32_t)(v >> 32));
+}
+
+static int write_all(const int fd, const uint8_t *buf, size_t size)
+{
+    while (size) {
+        ssize_t rc = write(fd, buf, size);
+        if (rc < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += rc;
+        size -= rc;
+    }
+    return 0;
+}
+
+// Copy into the ring at free running position pos, wrapping around
+static void ring_put(struct cap_struct * const cap, const uint32_t pos,
+        const uint8_t *src, const uint32_t size)
+{
+    const uint32_t off = pos & CAP_RING_MASK;
+    const uint32_t first = size < CAP_RING_SIZE - off ? size : CAP_RING_SIZE - off;
+
+    memcpy(cap->ring + off, src, first);
+    memcpy(cap->ring, src + first, size - first);
+}
+
+static void *cap_writer(void *arg)
+{
+    struct cap_struct * const cap = arg;
+    const struct timespec idle = { 0, CAP_IDLE_NS };
+    uint32_t tail = atomic_load_explicit(&cap->tail, memory_order_relaxed);
+
+    while (1) {
+        const uint32_t head = atomic_load_explicit(&cap->head,
+                memory_order_acquire);
+        if (head == tail) {
+            if (atomic_load_explicit(&cap->stop, memory_order_acquire))
+                break;
+            nanosleep(&idle, NULL);
+            continue;
+        }
+        // Write up to the end of the ring, the rest on the next round
+        const uint32_t off = tail & CAP_RING_MASK;
+        uint32_t size = head - tail;
+        if (size > CAP_RING_SIZE - off)
+            size = CAP_RING_SIZE - off;
+        if (write_all(cap->fd, cap->ring + off, size) < 0) {
+            CAP_DBG("Capture write error (%s), capture stopped\n",
+                    strerror(errno));
+            break;
+        }
+        tail += size;
+        atomic_store_explicit(&cap->tail, tail, memory_order_release);
+    }
+
+    return NULL;
+}
+
+uint64_t cap_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+static void put_rec_hdr(uint8_t *hdr, const uint64_t ts_ns, const uint8_t dir,
+        const uint16_t len, const s3p_packet_t *pkt)
+{
+    put_le32(hdr, CAP_REC_HDR_SIZE - 4 + len);
+    put_le64(hdr+4, ts_ns);
+    hdr[12] = dir;
+    if (pkt != NULL) {
+        hdr[13] = CAP_F_HDR;
+        hdr[14] = pkt->src_id;
+        hdr[15] = pkt->dst_id;
+        hdr[16] = pkt->flags_seq;
+        hdr[17] = pkt->type;
+        put_le16(hdr+18, pkt->data_len);
+    }
+    else
+        memset(hdr+13, 0x00, 7);
+    put_le16(hdr+20, len);
+}
+
+// Session record: time base of the records that follow
+static int write_session(const int fd)
+{
+    uint8_t rec[CAP_REC_HDR_SIZE + CAP_SESSION_SIZE];
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    put_rec_hdr(rec, cap_now_ns(), CAP_DIR_SESSION, CAP_SESSION_SIZE, NULL);
+    memcpy(rec + CAP_REC_HDR_SIZE, CAP_SESSION_MAGIC, 8);
+    put_le64(rec + CAP_REC_HDR_SIZE + 8,
+            (uint64_t)ts.tv_sec*1000000000ULL + ts.tv_nsec);
+
+    return write_all(fd, rec, sizeof(rec));
+}
+
+int cap_open(struct cap_struct * const cap, const char * const file,
+        const uint32_t baud)
+{
+    uint8_t hdr[CAP_FILE_HDR_SIZE];
+
+    memset(cap, 0x00, sizeof(struct cap_struct));
+    cap->fd = open(file, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (cap->fd == -1) {
+        CAP_DBG("ERROR Can't open capture file %s (%s)\n",
+                file, strerror(errno));
+        return -1;
+    }
+
+    // New or empty file, add the file header
+    if (lseek(cap->fd, 0, SEEK_END) == 0) {
+        memcpy(hdr, CAP_MAGIC, 8);
+        put_le16(hdr+8, CAP_VERSION);
+        put_le16(hdr+10, 0);
+        put_le32(hdr+12, baud);
+        if (write_all(cap->fd, hdr, sizeof(hdr)) < 0) {
+            close(cap->fd);
+            cap->fd = -1;
+            return -1;
+        }
+    }
+    // New time base, whatever the sessions before
+    if (write_session(cap->fd) < 0) {
+        close(cap->fd);
+        cap->fd = -1;
+        return -1;
+    }
+
+    cap->ring = malloc(CAP_RING_SIZE);
+    if (cap->ring == NULL) {
+        close(cap->fd);
+        cap->fd = -1;
+        return -1;
+    }
+
+    if (pthread_create(&cap->writer, NULL, cap_writer, cap)) {
+        free(cap->ring);
+        cap->ring = NULL;
+        close(cap->fd);
+        cap->fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+void cap_close(struct cap_struct * const cap)
+{
+    if (cap->ring == NULL)
+        return;
+
+    // Writer drains the ring before exiting
+    atomic_store_explicit(&cap->stop, true, memory_order_release);
+    pthread_join(cap->writer, NULL);
+    close(cap->fd);
+    free(cap->ring);
+    cap->ring = NULL;
+    cap->fd = -1;
+}
+
+bool cap_frame(struct cap_struct * const cap, const uint64_t ts_ns,
+        const uint8_t dir, const uint8_t *frame, const uint16_t len,
+        const s3p_packet_t *pkt)
+{
+    uint8_t hdr[CAP_REC_HDR_SIZE];
+
+    if (cap->ring == NULL)
+        return false;
+
+    const uint32_t head = atomic_load_explicit(&cap->head, memory_order_relaxed);
+    const uint32_t tail = atomic_load_explicit(&cap->tail, memory_order_acquire);
+    const uint32_t size = CAP_REC_HDR_SIZE + len;
+    if (size > CAP_RING_SIZE - (head - tail)) {
+        cap->drops++;
+        return false;
+    }
+
+    put_rec_hdr(hdr, ts_ns, dir, len, pkt);
+
+    ring_put(cap, head, hdr, CAP_REC_HDR_SIZE);
+    ring_put(cap, head + CAP_REC_HDR_SIZE, frame, len);
+    atomic_store_explicit(&cap->head, head + size, memory_order_release);
+    cap->records++;
+
+    return true;
+}
@@ -0,0 +1,92 @@
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+
+/* Frame capture recorder
+ *
+ * Every TX/RX frame is copied into a lock-free single producer/single
+ * consumer ring and written to file by a background thread, so the
+ * serial path never blocks on disk I/O. If the ring is full the record
+ * is dropped and counted.
+ *
+ * File format (all fields little endian):
+ *
+ *   File header, CAP_FILE_HDR_SIZE bytes
+ *     magic[8]   "S3PCAP\0\0"
+ *     u16        version (CAP_VERSION)
+ *     u16        reserved
+ *     u32        baud rate of the link
+ *
+ *   Records, repeated until EOF
+ *     u32        record length, i.e. bytes following this field
+ *     u64        CLOCK_MONOTONIC timestamp, ns
+ *     u8         direction (CAP_DIR_TX/CAP_DIR_RX/CAP_DIR_SESSION)
+ *     u8         flags (CAP_F_*)
+ *     u8         src_id    \
+ *     u8         dst_id     |
+ *     u8         flags_seq  | decoded header, valid if CAP_F_HDR
+ *     u8         type       |
+ *     u16        data_len  /
+ *     u16        frame length
+ *     u8[]       raw COBS frame, delimiter included
+ *
+ * Captures are appended to existing files: each open starts with a
+ * session record (CAP_DIR_SESSION), whose frame is CAP_SESSION_SIZE bytes
+ *     magic[8]   "S3PSESS\0"
+ *     u64        CLOCK_REALTIME at the record timestamp, ns
+ * The timestamps of the records that follow, up to the next session
+ * record, share its CLOCK_MONOTONIC time base. A session that crashed may
+ * end with a torn record: readers resync on the next valid record.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "s3p.h"
+
+#define CAP_MAGIC               "S3PCAP\0\0"
+#define CAP_VERSION             2       // Session records since 2
+#define CAP_FILE_HDR_SIZE       16
+#define CAP_REC_HDR_SIZE        22      // Record length field included
+#define CAP_RING_SIZE           (1U << 20)
+
+#define CAP_DIR_TX              0
+#define CAP_DIR_RX              1
+#define CAP_DIR_SESSION         2
+
+#define CAP_SESSION_MAGIC       "S3PSESS\0"
+#define CAP_SESSION_SIZE        16
+
+#define CAP_F_NONE              0x00
+#define CAP_F_HDR               0x01    // Header fields are valid
+
+struct cap_struct {
+    int fd;
+    uint8_t *ring;
+    // Producer and consumer positions, free running
+    _Atomic uint32_t head;
+    _Atomic uint32_t tail;
+    _Atomic bool stop;
+    pthread_t writer;
+    // Records dropped because the ring was full
+    uint32_t drops;
+    uint32_t records;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+extern int cap_open(struct cap_struct * const cap, const char * const file,
+        const uint32_t baud);
+extern void cap_close(struct cap_struct * const cap);
+extern uint64_t cap_now_ns(void);
+extern bool cap_frame(struct cap_struct * const cap, const uint64_t ts_ns,
+        const uint8_t dir, const uint8_t *frame, const uint16_t len,
+        const s3p_packet_t *pkt);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif // _CAPTURE_H
@@ -0,0 +1,258 @@
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "ser.h"
+#include "value.h"
+#include "s3p_co.hpp"
+
+/* s3p-co: s3p::co demo, concurrent procedures over one or more links.
+ *
+ * For every node given: download the register table (PT_S3P_INFO, then
+ * PT_REG_INFO from the first register to the last), read all the
+ * registers and, with -i, increment one of them (read, modify, write,
+ * read back). Each node is a procedure of its own, the procedures of the
+ * nodes sharing a link interleave on the wire and links run in parallel,
+ * all from one thread.
+ */
+
+#define VER             "1.00"
+#define DEF_MANAGER_ID  1
+#define DEF_BAUD        230400
+
+using s3p::co::task;
+
+struct node_run {
+    s3p::co::link *link;
+    std::string dev;
+    uint8_t node_id;
+    double elapsed_ms;
+    bool ok;
+};
+
+static int inc_reg = -1;
+
+static double now_ms(void)
+{
+    return std::chrono::duration<double, std::milli>(
+            s3p::co::clock::now().time_since_epoch()).count();
+}
+
+static void show_usage(char **argv)
+{
+    printf("\n");
+    printf("Usage: %s [-m id] [-b baud] [-t ms] [-r retries] [-w window] "
+            "[-i reg] <dev> <node>[,<node>...] [<dev> <node>...]\n", argv[0]);
+    printf("\n");
+    printf("Where:\n");
+    printf("  -m id       manager id (default %u)\n", DEF_MANAGER_ID);
+    printf("  -b baud     serial baud rate (default %u)\n", DEF_BAUD);
+    printf("  -t ms       response timeout (default 500)\n");
+    printf("  -r retries  retries on timeout (default 2)\n");
+    printf("  -w window   requests in flight per node (default 1)\n");
+    printf("  -i reg      increment register reg of every node\n");
+    printf("  <dev>       serial device or s3pd socket\n");
+    printf("  <node>      node ids on that link\n");
+    printf("\n");
+}
+
+// Integer registers only
+static bool value_inc(value_t *value)
+{
+    switch (value->vt) {
+    case VT_U8: case VT_X8:   value->val.u8++;  return true;
+    case VT_I8:               value->val.i8++;  return true;
+    case VT_U16: case VT_X16: value->val.u16++; return true;
+    case VT_I16:              value->val.i16++; return true;
+    case VT_U32: case VT_X32: value->val.u32++; return true;
+    case VT_I32:              value->val.i32++; return true;
+    default:                  return false;
+    }
+}
+
+// Read, increment, write, read back
+static task<bool> increment(s3p::co::link &link, const uint8_t node_id,
+        const uint16_t reg_id)
+{
+    auto rd = co_await link.read_regs(node_id, reg_id, 1);
+    if (!rd || rd.value.empty()) {
+        printf("[%u] read %u: %s\n", node_id, reg_id,
+                rd ? "no register" : s3p::co::err_str(rd.code));
+        co_return false;
+    }
+    const value_t before = rd.value[0].value;
+    value_t value = before;
+    if (!value_inc(&value)) {
+        printf("[%u] register %u is not an integer\n", node_id, reg_id);
+        co_return false;
+    }
+    const auto wr = co_await link.write_reg(node_id, reg_id, value);
+    if (!wr) {
+        printf("[%u] write %u: %s\n", node_id, reg_id,
+                s3p::co::err_str(wr.code));
+        co_return false;
+    }
+    rd = co_await link.read_regs(node_id, reg_id, 1);
+    if (!rd || rd.value.empty()) {
+        printf("[%u] read back %u: %s\n", node_id, reg_id,
+                s3p::co::err_str(rd.code));
+        co_return false;
+    }
+    char before_str[VALUE_SCALAR_MAX_SIZE], after_str[VALUE_SCALAR_MAX_SIZE];
+    value_dump(before_str, &before, sizeof(before_str));
+    value_dump(after_str, &rd.value[0].value, sizeof(after_str));
+    printf("[%u] register %u: %s -> %s\n", node_id, reg_id, before_str,
+            after_str);
+    co_return true;
+}
+
+static task<> node_proc(node_run &run)
+{
+    s3p::co::link &link = *run.link;
+    const uint8_t node_id = run.node_id;
+    const double start_ms = now_ms();
+    std::vector<s3p::co::reg_entry> table;
+
+    const auto info = co_await link.info(node_id);
+    if (!info) {
+        printf("[%u] info: %s\n", node_id, s3p::co::err_str(info.code));
+        co_return;
+    }
+    uint16_t reg_id = info.value.reg_min_id;
+    while (reg_id && table.size() < info.value.regs_cnt) {
+        auto reg = co_await link.reg_info(node_id, reg_id);
+        if (!reg) {
+            printf("[%u] reg info %u: %s\n", node_id, reg_id,
+                    s3p::co::err_str(reg.code));
+            co_return;
+        }
+        reg_id = reg.value.next_id;
+        table.push_back(std::move(reg.value));
+    }
+    const auto regs = co_await link.read_regs(node_id,
+            info.value.reg_min_id,
+            info.value.reg_max_id - info.value.reg_min_id + 1);
+    if (!regs) {
+        printf("[%u] read: %s\n", node_id, s3p::co::err_str(regs.code));
+        co_return;
+    }
+    run.ok = inc_reg < 0 || co_await increment(link, node_id, inc_reg);
+    run.elapsed_ms = now_ms() - start_ms;
+
+    // One block per node, procedures interleave but printf() does not
+    printf("[%u] %s: %zu registers, %.1f ms\n", node_id, run.dev.c_str(),
+            table.size(), run.elapsed_ms);
+    for (const s3p::co::reg_value &rv : regs.value) {
+        char value_str[VALUE_SCALAR_MAX_SIZE];
+        const char *name = "";
+        for (const s3p::co::reg_entry &reg : table) {
+            if (reg.id == rv.id)
+                name = reg.name.c_str();
+        }
+        value_dump(value_str, &rv.value, sizeof(value_str));
+        printf("[%u]   %5u %-20s %4s %12s\n", node_id, rv.id, name,
+                value_type_str(rv.value.vt), value_str);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uint8_t manager_id = DEF_MANAGER_ID;
+    int baud = DEF_BAUD;
+    int timeout_ms = 500;
+    int retries = 2;
+    int window = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:b:t:r:w:i:")) != -1) {
+        switch (opt) {
+        case 'm': manager_id = atoi(optarg); break;
+        case 'b': baud = atoi(optarg); break;
+        case 't': timeout_ms = atoi(optarg); break;
+        case 'r': retries = atoi(optarg); break;
+        case 'w': window = atoi(optarg); break;
+        case 'i': inc_reg = atoi(optarg); break;
+        default:
+            show_usage(argv);
+            return -1;
+        }
+    }
+    if (optind + 2 > argc || (argc - optind) % 2) {
+        show_usage(argv);
+        return -1;
+    }
+
+    printf("s3p-co v%s\n", VER);
+    s3p::co::reactor reactor;
+    if (!reactor.ok()) {
+        printf("Error creating the reactor\n");
+        return -1;
+    }
+
+    const int links_cnt = (argc - optind) / 2;
+    std::vector<struct ser_struct> sers(links_cnt);
+    std::vector<std::unique_ptr<s3p::co::link>> links;
+    std::vector<node_run> runs;
+    for (int i=0; i<links_cnt; i++) {
+        const char *dev = argv[optind + 2 * i];
+        struct stat st;
+        int res;
+        if (!stat(dev, &st) && S_ISSOCK(st.st_mode))
+            res = ser_open_unix(&sers[i], dev, baud);
+        else
+            res = ser_open(&sers[i], dev, baud, 'N', 8, 1, true);
+        if (res) {
+            printf("Error opening '%s'\n", dev);
+            return -1;
+        }
+        ser_discard(&sers[i]);
+        links.push_back(std::make_unique<s3p::co::link>(reactor, sers[i].fd,
+                    manager_id));
+        s3p::co::link &link = *links.back();
+        if (!link.ok()) {
+            printf("Error watching '%s'\n", dev);
+            return -1;
+        }
+        link.set_timeout(std::chrono::milliseconds(timeout_ms));
+        link.set_retries(retries);
+        link.set_window(window);
+        // Node list
+        char *save = NULL;
+        for (char *tok = strtok_r(argv[optind + 2 * i + 1], ",", &save);
+                tok; tok = strtok_r(NULL, ",", &save))
+            runs.push_back({ &link, dev, uint8_t(atoi(tok)), 0, false });
+    }
+
+    const double start_ms = now_ms();
+    for (node_run &run : runs)
+        reactor.spawn(node_proc(run));
+    reactor.run();
+    const double elapsed_ms = now_ms() - start_ms;
+
+    double sum_ms = 0;
+    int ok = 0;
+    for (const node_run &run : runs) {
+        sum_ms += run.elapsed_ms;
+        ok += run.ok;
+    }
+    uint32_t tx = 0, rx = 0;
+    for (const auto &link : links) {
+        tx += link->frames_tx();
+        rx += link->frames_rx();
+    }
+    printf("%d/%zu nodes ok, %.1f ms (%.1f ms one after the other), "
+            "%u frames out, %u in\n", ok, runs.size(), elapsed_ms, sum_ms,
+            tx, rx);
+
+    links.clear();
+    for (struct ser_struct &ser : sers)
+        ser_close(&ser);
+
+    return ok == int(runs.size()) ? 0 : -1;
+}
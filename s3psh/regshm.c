@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "regshm.h"
+
+#define REGSHM_DBG(...)     printf(__VA_ARGS__)
+
+_Static_assert(sizeof(struct regshm_hdr) == REGSHM_HDR_SIZE,
+        "regshm header size");
+
+static size_t regshm_size(const uint16_t regs)
+{
+    return REGSHM_HDR_SIZE +
+        (size_t)REGSHM_NODES * regs * sizeof(struct regshm_entry);
+}
+
+static int regshm_map(struct regshm_struct * const shm, const int prot)
+{
+    void *p = mmap(NULL, shm->size, prot, MAP_SHARED, shm->fd, 0);
+
+    if (p == MAP_FAILED) {
+        REGSHM_DBG("ERROR Can't map '%s' (%s)\n", shm->name, strerror(errno));
+        close(shm->fd);
+        shm->fd = -1;
+        return -1;
+    }
+    shm->hdr = p;
+    shm->entries = (struct regshm_entry *)((uint8_t *)p + REGSHM_HDR_SIZE);
+    return 0;
+}
+
+// Create (or take over) the segment as its single writer. The entries
+// start empty: the pages of a new segment read as zeros, i.e. VT_EMPTY
+int regshm_create(struct regshm_struct * const shm, const char * const name,
+        const uint16_t regs)
+{
+    memset(shm, 0x00, sizeof(struct regshm_struct));
+    strncpy(shm->name, name, sizeof(shm->name) - 1);
+    shm->writer = true;
+    shm->size = regshm_size(regs);
+
+    // Recreated, so that readers of a previous run keep their own copy
+    // instead of seeing a layout change under their feet
+    shm_unlink(shm->name);
+    shm->fd = shm_open(shm->name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (shm->fd < 0) {
+        REGSHM_DBG("ERROR Can't create '%s' (%s)\n", shm->name,
+                strerror(errno));
+        return -1;
+    }
+    // Sparse: only the pages of the registers actually read take memory
+    if (ftruncate(shm->fd, shm->size)) {
+        REGSHM_DBG("ERROR Can't size '%s' (%s)\n", shm->name,
+                strerror(errno));
+        close(shm->fd);
+        shm_unlink(shm->name);
+        shm->fd = -1;
+        return -1;
+    }
+    if (regshm_map(shm, PROT_READ | PROT_WRITE)) {
+        shm_unlink(shm->name);
+        return -1;
+    }
+
+    shm->hdr->version = REGSHM_VERSION;
+    shm->hdr->entry_size = sizeof(struct regshm_entry);
+    shm->hdr->nodes = REGSHM_NODES;
+    shm->hdr->regs = regs;
+    shm->hdr->pid = getpid();
+    // Magic last, readers check it first
+    atomic_thread_fence(memory_order_release);
+    memcpy(shm->hdr->magic, REGSHM_MAGIC, sizeof(shm->hdr->magic));
+
+    return 0;
+}
+
+// Attach a reader, read only
+int regshm_attach(struct regshm_struct * const shm, const char * const name)
+{
+    struct stat st;
+    struct regshm_hdr hdr;
+
+    memset(shm, 0x00, sizeof(struct regshm_struct));
+    strncpy(shm->name, name, sizeof(shm->name) - 1);
+
+    shm->fd = shm_open(shm->name, O_RDONLY, 0);
+    if (shm->fd < 0) {
+        REGSHM_DBG("ERROR Can't open '%s' (%s)\n", shm->name, strerror(errno));
+        return -1;
+    }
+    if (fstat(shm->fd, &st) || st.st_size < REGSHM_HDR_SIZE ||
+            pread(shm->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+            memcmp(hdr.magic, REGSHM_MAGIC, sizeof(hdr.magic)) ||
+            hdr.version != REGSHM_VERSION ||
+            hdr.entry_size != sizeof(struct regshm_entry) ||
+            hdr.nodes != REGSHM_NODES ||
+            (size_t)st.st_size < regshm_size(hdr.regs)) {
+        REGSHM_DBG("ERROR '%s' is not a register store\n", shm->name);
+        close(shm->fd);
+        shm->fd = -1;
+        return -1;
+    }
+    shm->size = regshm_size(hdr.regs);
+
+    return regshm_map(shm, PROT_READ);
+}
+
+void regshm_close(struct regshm_struct * const shm)
+{
+    if (shm->fd < 0)
+        return;
+    // The segment outlives the writer, readers may still want the values
+    if (shm->writer)
+        shm->hdr->pid = 0;
+    munmap(shm->hdr, shm->size);
+    close(shm->fd);
+    shm->fd = -1;
+}
+
+uint64_t regshm_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+bool regshm_put(struct regshm_struct * const shm, const uint8_t node_id,
+        const uint16_t reg_id, const value_type_t vt, const uint32_t value,
+        const uint64_t ts_us)
+{
+    if (shm->fd < 0 || !shm->writer)
+        return false;
+    if (reg_id >= shm->hdr->regs) {
+        shm->drops++;
+        return false;
+    }
+
+    struct regshm_entry * const e =
+        &shm->entries[(uint32_t)node_id * shm->hdr->regs + reg_id];
+    // Single writer: nobody else changes the lock meanwhile
+    const uint32_t lock = atomic_load_explicit(&e->lock, memory_order_relaxed);
+
+    atomic_store_explicit(&e->lock, lock + 1, memory_order_relaxed);
+    // The odd lock is visible before any field changes
+    atomic_thread_fence(memory_order_release);
+    e->vt = vt;
+    e->node_id = node_id;
+    e->reg_id = reg_id;
+    e->value = value;
+    e->seq++;
+    e->ts_us = ts_us;
+    atomic_store_explicit(&e->lock, lock + 2, memory_order_release);
+    atomic_fetch_add_explicit(&shm->hdr->updates, 1, memory_order_relaxed);
+
+    return true;
+}
+
+// Consistent copy of an entry, false if out of range or never written
+bool regshm_get(const struct regshm_struct * const shm, const uint8_t node_id,
+        const uint16_t reg_id, struct regshm_entry * const entry)
+{
+    if (shm->fd < 0 || reg_id >= shm->hdr->regs)
+        return false;
+
+    const struct regshm_entry * const e =
+        &shm->entries[(uint32_t)node_id * shm->hdr->regs + reg_id];
+    uint32_t lock;
+
+    do {
+        lock = atomic_load_explicit(&e->lock, memory_order_acquire);
+        if (lock & 1)
+            continue;
+        entry->vt = e->vt;
+        entry->node_id = e->node_id;
+        entry->reg_id = e->reg_id;
+        entry->value = e->value;
+        entry->seq = e->seq;
+        entry->ts_us = e->ts_us;
+        // Fields are read before the lock is checked again
+        atomic_thread_fence(memory_order_acquire);
+    } while ((lock & 1) ||
+            lock != atomic_load_explicit(&e->lock, memory_order_relaxed));
+    atomic_init(&entry->lock, lock);
+
+    return entry->vt != VT_EMPTY;
+}
@@ -0,0 +1,101 @@
+#ifndef _REGSHM_H
+#define _REGSHM_H
+
+/* Shared memory register store
+ *
+ * The manager publishes the last value of every register it reads (reads,
+ * group reads, telemetry) into a POSIX shared memory segment, so that any
+ * number of local processes can use them without going through s3psh.
+ *
+ * The segment is a header followed by a flat array of entries indexed by
+ * node id and register id:
+ *
+ *   entry = entries[node_id * regs + reg_id]
+ *
+ * Each entry is guarded by a seqlock: the single writer makes the entry
+ * sequence odd while updating it and even when done. Readers copy the
+ * entry and retry if the sequence was odd or changed meanwhile, so they
+ * never block the writer nor each other. regshm_get() does just that.
+ *
+ * Segment layout (host endianness, the segment is local):
+ *
+ *   Header, REGSHM_HDR_SIZE bytes
+ *     magic[8]   "S3PRSHM\0"
+ *     u16        version (REGSHM_VERSION)
+ *     u16        entry size (sizeof(struct regshm_entry))
+ *     u16        nodes, always REGSHM_NODES
+ *     u16        registers per node, ids above are not stored
+ *     u32        writer pid, 0 once closed
+ *     u32        reserved
+ *     u64        updates, all entries
+ *     u64        reserved
+ *
+ *   Entries, nodes * regs
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "value.h"
+
+#define REGSHM_MAGIC            "S3PRSHM\0"
+#define REGSHM_VERSION          1
+#define REGSHM_HDR_SIZE         40
+#define REGSHM_NODES            256
+#define REGSHM_DEF_REGS         1024
+
+struct regshm_hdr {
+    char magic[8];
+    uint16_t version;
+    uint16_t entry_size;
+    uint16_t nodes;
+    uint16_t regs;
+    uint32_t pid;
+    uint32_t reserved;
+    _Atomic uint64_t updates;
+    uint64_t reserved2;
+};
+
+struct regshm_entry {
+    _Atomic uint32_t lock;      // Seqlock, odd while being written
+    uint8_t vt;                 // value_type_t, VT_EMPTY if never read
+    uint8_t node_id;
+    uint16_t reg_id;
+    uint32_t value;             // Raw value, as on the wire
+    uint32_t seq;               // Updates of this entry
+    uint64_t ts_us;             // CLOCK_REALTIME of the update, us
+};
+
+struct regshm_struct {
+    int fd;
+    bool writer;
+    char name[64];
+    struct regshm_hdr *hdr;
+    struct regshm_entry *entries;
+    size_t size;
+    // Registers not stored, id out of range
+    uint32_t drops;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+extern int regshm_create(struct regshm_struct * const shm,
+        const char * const name, const uint16_t regs);
+extern int regshm_attach(struct regshm_struct * const shm,
+        const char * const name);
+extern void regshm_close(struct regshm_struct * const shm);
+extern uint64_t regshm_now_us(void);
+extern bool regshm_put(struct regshm_struct * const shm, const uint8_t node_id,
+        const uint16_t reg_id, const value_type_t vt, const uint32_t value,
+        const uint64_t ts_us);
+extern bool regshm_get(const struct regshm_struct * const shm,
+        const uint8_t node_id, const uint16_t reg_id,
+        struct regshm_entry * const entry);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif // _REGSHM_H
@@ -0,0 +1,544 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <termios.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "s3p.h"
+#include "capture.h"
+
+/* s3p-replay: offline analysis and pty re-injection of capture files
+ * recorded with s3psh -c (see capture.h for the file format).
+ *
+ * Records are indexed with a single pass over the length prefixes,
+ * resyncing on the next valid record after a corrupted or truncated one
+ * (e.g. the tail of a session that crashed), then
+ * decoded (COBS + CRC) in parallel chunks, one per thread. Statistics
+ * that depend on frame ordering (RTT pairing, sequence gaps) are then
+ * computed on the compact decoded entries. Each capture session appended
+ * to the file restarts the time base: requests pending at its start are
+ * lost, and the replay goes on without the gap between sessions.
+ */
+
+#define VER             "1.00"
+#define MAX_THREADS     64
+#define DEF_BITS        10      // 8N1
+#define M_MIN(_x,_y)    ( ( (_x) > (_y) ) ? (_y) : (_x) )
+#define IS_EQUAL(_cmd, _c)      (!strcmp(_cmd, _c))
+
+// Decoded record, kept small since there is one per captured frame
+typedef struct {
+    uint64_t ts_ns;
+    uint16_t frame_len;
+    uint8_t dir;        // CAP_DIR_SESSION: new time base, no frame
+    uint8_t status;     // s3p_frame_status_t
+    uint8_t src_id;
+    uint8_t dst_id;
+    uint8_t flags_seq;
+    uint8_t type;
+} entry_t;
+
+typedef struct {
+    const uint8_t *map;
+    const uint64_t *offs;
+    entry_t *entries;
+    uint64_t first;
+    uint64_t last;
+} chunk_t;
+
+typedef struct {
+    uint64_t reqs;
+    uint64_t resps;
+    uint64_t lost;
+    uint64_t seq_gaps;
+    uint8_t last_seq;
+    bool has_seq;
+    // Extended (8 bits) sequence seen in requests
+    bool ext_seq;
+    uint32_t *rtt_us;
+    uint64_t rtt_cnt;
+    uint64_t rtt_max_cnt;
+} node_stats_t;
+
+static int threads;
+
+static uint16_t get_le16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return get_le16(p) | ((uint32_t)get_le16(p+2) << 16);
+}
+
+static uint64_t get_le64(const uint8_t *p)
+{
+    return get_le32(p) | ((uint64_t)get_le32(p+4) << 32);
+}
+
+static void show_usage(char **argv)
+{
+    printf("\n");
+    printf("Usage: %s [-j n] [-b baud] <capture>\n", argv[0]);
+    printf("       %s -p [-x speed] [-d rx|tx|all] <capture>\n", argv[0]);
+    printf("\n");
+    printf("Where:\n");
+    printf("  -j n        decoding threads (default: online cpus)\n");
+    printf("  -b baud     override the baud rate stored in the capture\n");
+    printf("  -p          re-inject frames into a new pty instead of\n");
+    printf("              analysing them\n");
+    printf("  -x speed    replay speed factor, 0 for no delay (default 1)\n");
+    printf("  -d dir      frames to re-inject (default rx, i.e. node\n");
+    printf("              responses as seen by the manager)\n");
+    printf("\n\n");
+}
+
+// Consistent lengths and content: a COBS frame, i.e. no delimiter but
+// the last byte (missing in oversized frames), or a session record
+static bool rec_valid(const uint8_t *map, const uint64_t size,
+        const uint64_t off)
+{
+    if (off + CAP_REC_HDR_SIZE > size)
+        return false;
+    const uint32_t rec_len = get_le32(map + off);
+    const uint16_t frame_len = get_le16(map + off + 20);
+    const uint8_t *frame = map + off + CAP_REC_HDR_SIZE;
+    if (rec_len != CAP_REC_HDR_SIZE - 4 + frame_len ||
+            off + 4 + rec_len > size)
+        return false;
+
+    switch (map[off + 12]) {
+    case CAP_DIR_TX:
+    case CAP_DIR_RX:
+        return frame_len &&
+            memchr(frame, S3P_COBS_DELIM, frame_len - 1) == NULL;
+    case CAP_DIR_SESSION:
+        return frame_len == CAP_SESSION_SIZE &&
+            !memcmp(frame, CAP_SESSION_MAGIC, 8);
+    default:
+        return false;
+    }
+}
+
+// Single pass over the length prefixes, returns the records count and
+// the bytes skipped to resync
+static uint64_t index_records(const uint8_t *map, const uint64_t size,
+        uint64_t **offs, uint64_t *skipped)
+{
+    uint64_t cnt = 0;
+    uint64_t max_cnt = 1 << 16;
+    uint64_t off = CAP_FILE_HDR_SIZE;
+
+    *skipped = 0;
+    *offs = malloc(max_cnt * sizeof(uint64_t));
+    while (*offs != NULL && off < size) {
+        if (!rec_valid(map, size, off)) {
+            const uint64_t bad_off = off;
+            while (++off < size && !rec_valid(map, size, off))
+                ;
+            printf("Truncated or corrupted record at offset %" PRIu64
+                    ", %" PRIu64 " bytes skipped\n", bad_off, off - bad_off);
+            *skipped += off - bad_off;
+            continue;
+        }
+        if (cnt == max_cnt) {
+            max_cnt *= 2;
+            uint64_t *tmp = realloc(*offs, max_cnt * sizeof(uint64_t));
+            if (tmp == NULL) {
+                free(*offs);
+                *offs = NULL;
+                break;
+            }
+            *offs = tmp;
+        }
+        (*offs)[cnt++] = off;
+        off += 4 + get_le32(map + off);
+    }
+
+    return *offs != NULL ? cnt : 0;
+}
+
+static void *decode_chunk(void *arg)
+{
+    chunk_t *chunk = arg;
+    uint8_t pkt_buf[S3P_JUMBO_PKT_SIZE];
+    s3p_packet_t pkt;
+    // Captures may hold negotiated jumbo frames
+    const s3p_link_t jumbo = { .frame_size = S3P_JUMBO_FRAME_SIZE };
+
+    // No s3p_init_pkt(), s3p_link_decode_frame() sets all the fields
+    pkt.buf = pkt_buf;
+    for (uint64_t i=chunk->first; i<chunk->last; i++) {
+        const uint8_t *rec = chunk->map + chunk->offs[i];
+        const uint16_t frame_len = get_le16(rec + 20);
+        entry_t *e = &chunk->entries[i];
+
+        e->ts_ns = get_le64(rec + 4);
+        e->dir = rec[12];
+        e->frame_len = frame_len;
+        if (e->dir == CAP_DIR_SESSION) {
+            e->status = S3P_FRAME_OK;
+            continue;
+        }
+        // Strip the delimiter
+        e->status = s3p_link_decode_frame(&jumbo, &pkt, rec + CAP_REC_HDR_SIZE,
+                frame_len ? frame_len - 1 : 0);
+        e->src_id = pkt.src_id;
+        e->dst_id = pkt.dst_id;
+        e->flags_seq = pkt.flags_seq;
+        e->type = pkt.type;
+    }
+
+    return NULL;
+}
+
+static void decode_all(const uint8_t *map, const uint64_t *offs,
+        entry_t *entries, const uint64_t cnt)
+{
+    pthread_t tid[MAX_THREADS];
+    bool running[MAX_THREADS] = { false };
+    chunk_t chunks[MAX_THREADS];
+    const uint64_t per_thread = (cnt + threads - 1) / threads;
+
+    for (int t=0; t<threads; t++) {
+        chunks[t].map = map;
+        chunks[t].offs = offs;
+        chunks[t].entries = entries;
+        chunks[t].first = M_MIN(t * per_thread, cnt);
+        chunks[t].last = M_MIN(chunks[t].first + per_thread, cnt);
+        // Main thread takes the first chunk
+        if (t == 0)
+            continue;
+        if (!pthread_create(&tid[t], NULL, decode_chunk, &chunks[t]))
+            running[t] = true;
+        else
+            decode_chunk(&chunks[t]);
+    }
+    decode_chunk(&chunks[0]);
+    for (int t=1; t<threads; t++) {
+        if (running[t])
+            pthread_join(tid[t], NULL);
+    }
+}
+
+static int rtt_compare(const void *r1, const void *r2)
+{
+    const uint32_t a = *(const uint32_t *)r1;
+    const uint32_t b = *(const uint32_t *)r2;
+    return (a > b) - (a < b);
+}
+
+static void rtt_add(node_stats_t *ns, const uint32_t rtt_us)
+{
+    if (ns->rtt_cnt == ns->rtt_max_cnt) {
+        const uint64_t max_cnt = ns->rtt_max_cnt ? ns->rtt_max_cnt * 2 : 1024;
+        uint32_t *tmp = realloc(ns->rtt_us, max_cnt * sizeof(uint32_t));
+        if (tmp == NULL)
+            return;
+        ns->rtt_us = tmp;
+        ns->rtt_max_cnt = max_cnt;
+    }
+    ns->rtt_us[ns->rtt_cnt++] = rtt_us;
+}
+
+static uint32_t pct(const node_stats_t *ns, const unsigned p)
+{
+    return ns->rtt_us[(ns->rtt_cnt - 1) * p / 100];
+}
+
+// Requests without a response at the end of a session are lost
+static void end_session(node_stats_t *nodes, uint64_t pending[256][256])
+{
+    for (int id=0; id<256; id++) {
+        for (int seq=0; seq<256; seq++) {
+            nodes[id].lost += pending[id][seq] != 0;
+            pending[id][seq] = 0;
+        }
+        nodes[id].has_seq = false;
+    }
+}
+
+static void analyse(const entry_t *entries, const uint64_t cnt,
+        const uint32_t baud)
+{
+    static node_stats_t nodes[256];
+    // Pending request timestamp by [node][flags_seq], 0 if none
+    static uint64_t pending[256][256];
+    uint64_t status_cnt[S3P_FRAME_CRC_ERR+1] = { 0 };
+    uint64_t bytes[2] = { 0 };
+    uint64_t frames[2] = { 0 };
+    uint64_t sessions = 0;
+    // Sum of the sessions durations, first and last frame of the current one
+    uint64_t dur_ns = 0;
+    uint64_t first_ns = 0;
+    uint64_t last_ns = 0;
+    bool has_ts = false;
+
+    for (uint64_t i=0; i<cnt; i++) {
+        const entry_t *e = &entries[i];
+        const uint8_t dir = e->dir == CAP_DIR_TX ? CAP_DIR_TX : CAP_DIR_RX;
+
+        if (e->dir == CAP_DIR_SESSION) {
+            sessions++;
+            if (has_ts)
+                dur_ns += last_ns - first_ns;
+            has_ts = false;
+            end_session(nodes, pending);
+            continue;
+        }
+        if (!has_ts)
+            first_ns = e->ts_ns;
+        last_ns = e->ts_ns;
+        has_ts = true;
+
+        frames[dir]++;
+        bytes[dir] += e->frame_len;
+        status_cnt[e->status]++;
+        if (e->status != S3P_FRAME_OK)
+            continue;
+
+        if (dir == CAP_DIR_TX) {
+            node_stats_t *ns = &nodes[e->dst_id];
+            ns->reqs++;
+            if (e->flags_seq & ~S3P_SEQ_MASKED(0xFF))
+                ns->ext_seq = true;
+            if (pending[e->dst_id][e->flags_seq])
+                ns->lost++;
+            pending[e->dst_id][e->flags_seq] = e->ts_ns;
+        }
+        else {
+            node_stats_t *ns = &nodes[e->src_id];
+            const uint8_t mask = ns->ext_seq ? S3P_SEQ_EXT_MASK :
+                S3P_SEQ_MASKED(0xFF);
+            const uint8_t seq = e->flags_seq & mask;
+            ns->resps++;
+            if (ns->has_seq)
+                ns->seq_gaps += (uint8_t)(seq - ns->last_seq - 1) & mask;
+            ns->last_seq = seq;
+            ns->has_seq = true;
+            uint64_t *req_ts = &pending[e->src_id][e->flags_seq];
+            if (*req_ts) {
+                rtt_add(ns, (uint32_t)((e->ts_ns - *req_ts) / 1000));
+                *req_ts = 0;
+            }
+        }
+    }
+
+    if (has_ts)
+        dur_ns += last_ns - first_ns;
+    end_session(nodes, pending);
+
+    const uint64_t nframes = frames[CAP_DIR_TX] + frames[CAP_DIR_RX];
+    const uint64_t bad = nframes - status_cnt[S3P_FRAME_OK];
+    const double dur_s = dur_ns / 1e9;
+    printf("Frames        : %" PRIu64 " (tx %" PRIu64 ", rx %" PRIu64
+            ") in %.3f s, %" PRIu64 " sessions\n", nframes,
+            frames[CAP_DIR_TX], frames[CAP_DIR_RX], dur_s, sessions);
+    printf("Errors        : cobs %" PRIu64 ", size %" PRIu64 ", crc %" PRIu64
+            " (%.4f%%)\n",
+            status_cnt[S3P_FRAME_COBS_ERR], status_cnt[S3P_FRAME_SIZE_ERR],
+            status_cnt[S3P_FRAME_CRC_ERR],
+            nframes ? 100.0 * bad / nframes : 0.0);
+    if (dur_s > 0 && baud) {
+        const double cap_bytes = dur_s * baud / DEF_BITS;
+        printf("Bus usage     : tx %.2f%%, rx %.2f%% (%u baud)\n",
+                100.0 * bytes[CAP_DIR_TX] / cap_bytes,
+                100.0 * bytes[CAP_DIR_RX] / cap_bytes, baud);
+    }
+    printf("\n");
+    printf(" node |     reqs |    resps |     lost | seq gaps |  rtt min |  rtt p50 |"
+            "  rtt p90 |  rtt p99 |  rtt max (us)\n");
+    printf("------+----------+----------+----------+----------+----------+----------+"
+            "----------+----------+-------------\n");
+    for (int id=0; id<256; id++) {
+        node_stats_t *ns = &nodes[id];
+        if (!ns->reqs && !ns->resps)
+            continue;
+        printf("  %3d | %8" PRIu64 " | %8" PRIu64 " | %8" PRIu64 " | %8" PRIu64
+                " ", id, ns->reqs, ns->resps, ns->lost, ns->seq_gaps);
+        if (ns->rtt_cnt) {
+            qsort(ns->rtt_us, ns->rtt_cnt, sizeof(uint32_t), rtt_compare);
+            printf("| %8u | %8u | %8u | %8u | %8u\n", ns->rtt_us[0],
+                    pct(ns, 50), pct(ns, 90), pct(ns, 99),
+                    ns->rtt_us[ns->rtt_cnt-1]);
+        }
+        else
+            printf("|        - |        - |        - |        - |        -\n");
+        free(ns->rtt_us);
+    }
+}
+
+static void sleep_until_ns(const uint64_t deadline_ns)
+{
+    struct timespec ts;
+    ts.tv_sec = deadline_ns / 1000000000ULL;
+    ts.tv_nsec = deadline_ns % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+static int replay(const uint8_t *map, const uint64_t *offs, const uint64_t cnt,
+        const double speed, const int dir)
+{
+    struct termios tios;
+    char line[16];
+    uint64_t sent = 0;
+
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (fd == -1 || grantpt(fd) || unlockpt(fd)) {
+        printf("Can't create pty (%s)\n", strerror(errno));
+        return -1;
+    }
+    tcgetattr(fd, &tios);
+    cfmakeraw(&tios);
+    tcsetattr(fd, TCSANOW, &tios);
+
+    printf("Connect the manager to %s and press enter to start\n", ptsname(fd));
+    if (fgets(line, sizeof(line), stdin) == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    const uint64_t start_ns = cap_now_ns();
+    // Replay time of the first frame of the session, and its timestamp
+    uint64_t base_ns = start_ns;
+    uint64_t first_ts = 0;
+    bool rebase = true;
+    for (uint64_t i=0; i<cnt; i++) {
+        const uint8_t *rec = map + offs[i];
+        const uint64_t ts_ns = get_le64(rec + 4);
+        const uint16_t frame_len = get_le16(rec + 20);
+        // New time base, the next session goes on right away
+        if (rec[12] == CAP_DIR_SESSION) {
+            rebase = true;
+            continue;
+        }
+        if (dir >= 0 && rec[12] != dir)
+            continue;
+        if (rebase) {
+            base_ns = sent ? cap_now_ns() : start_ns;
+            first_ts = ts_ns;
+            rebase = false;
+        }
+        if (speed > 0)
+            sleep_until_ns(base_ns + (uint64_t)((ts_ns - first_ts) / speed));
+        if (write(fd, rec + CAP_REC_HDR_SIZE, frame_len) != frame_len) {
+            printf("Write error (%s)\n", strerror(errno));
+            break;
+        }
+        sent++;
+    }
+
+    printf("Replayed %" PRIu64 " frames in %.3f s\n", sent,
+            (cap_now_ns() - start_ns) / 1e9);
+    // Let the manager read the last frames before hanging up
+    tcdrain(fd);
+    close(fd);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    bool pty = false;
+    double speed = 1.0;
+    int dir = CAP_DIR_RX;
+    uint32_t baud = 0;
+    struct stat st;
+    uint64_t *offs;
+    uint64_t skipped;
+    int opt;
+
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+    while ((opt = getopt(argc, argv, "j:b:px:d:")) != -1) {
+        switch (opt) {
+        case 'j': threads = atoi(optarg); break;
+        case 'b': baud = atoi(optarg); break;
+        case 'p': pty = true; break;
+        case 'x': speed = atof(optarg); break;
+        case 'd':
+            if (IS_EQUAL(optarg, "tx"))
+                dir = CAP_DIR_TX;
+            else if (IS_EQUAL(optarg, "all"))
+                dir = -1;
+            else
+                dir = CAP_DIR_RX;
+            break;
+        default:
+            show_usage(argv);
+            return -1;
+        }
+    }
+    if (optind >= argc) {
+        show_usage(argv);
+        return -1;
+    }
+    if (threads < 1)
+        threads = 1;
+    if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
+
+    const char *file = argv[optind];
+    int fd = open(file, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st)) {
+        printf("Can't open capture '%s' (%s)\n", file, strerror(errno));
+        return -1;
+    }
+    if (st.st_size < CAP_FILE_HDR_SIZE) {
+        printf("'%s' is not a capture file\n", file);
+        return -1;
+    }
+    const uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("Can't map capture '%s' (%s)\n", file, strerror(errno));
+        return -1;
+    }
+    // Version 1 files have no session records
+    if (memcmp(map, CAP_MAGIC, 8) || !get_le16(map+8) ||
+            get_le16(map+8) > CAP_VERSION) {
+        printf("'%s' is not a capture file or has unsupported version\n", file);
+        return -1;
+    }
+    if (!baud)
+        baud = get_le32(map+12);
+    madvise((void *)map, st.st_size, MADV_SEQUENTIAL);
+
+    const uint64_t cnt = index_records(map, st.st_size, &offs, &skipped);
+    if (!cnt) {
+        printf("No records found\n");
+        return -1;
+    }
+
+    if (pty)
+        return replay(map, offs, cnt, speed, dir);
+
+    entry_t *entries = malloc(cnt * sizeof(entry_t));
+    if (entries == NULL) {
+        printf("Failed to allocate %" PRIu64 " entries\n", cnt);
+        return -1;
+    }
+    const uint64_t start_ns = cap_now_ns();
+    decode_all(map, offs, entries, cnt);
+    const uint64_t decode_ns = cap_now_ns() - start_ns;
+
+    printf("Capture       : %s (%lld bytes, %" PRIu64 " skipped)\n", file,
+            (long long)st.st_size, skipped);
+    printf("Decoded in    : %.3f s (%d threads)\n", decode_ns / 1e9, threads);
+    analyse(entries, cnt, baud);
+
+    free(entries);
+    free(offs);
+    munmap((void *)map, st.st_size);
+    return 0;
+}
@@ -0,0 +1,758 @@
+#ifndef _S3P_CO_HPP
+#define _S3P_CO_HPP
+
+/* s3p::co: C++20 coroutine S3P client on an epoll reactor, header only.
+ *
+ * One thread, one reactor owning the serial (or s3pd socket) descriptors.
+ * Procedures are coroutines awaiting requests:
+ *
+ *     s3p::co::task<> dump(s3p::co::link &link, uint8_t node)
+ *     {
+ *         auto regs = co_await link.read_regs(node, 1, 10);
+ *         ...
+ *     }
+ *     reactor.spawn(dump(link, 42));
+ *     reactor.spawn(dump(link, 43));
+ *     reactor.run();
+ *
+ * A request suspends its procedure until the response, or the timeout
+ * after the retries, while the others go on: requests of procedures
+ * addressing different nodes interleave on the wire, those to the same
+ * node are sent one at a time (window of 1, configurable). Responses are
+ * matched by source node and sequence, owned by the link.
+ */
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include "s3p.hpp"
+
+namespace s3p::co {
+
+using clock = std::chrono::steady_clock;
+
+/*****************************************************************************
+ * Tasks
+ ****************************************************************************/
+
+template <typename T = void>
+class task;
+
+namespace detail {
+
+struct promise_base {
+    // Resumed when the task ends, the awaiting coroutine
+    std::coroutine_handle<> cont = std::noop_coroutine();
+
+    struct final_awaiter {
+        bool await_ready() noexcept { return false; }
+        template <typename P>
+        std::coroutine_handle<> await_suspend(
+                std::coroutine_handle<P> h) noexcept
+        {
+            return h.promise().cont;
+        }
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    final_awaiter final_suspend() noexcept { return {}; }
+    // Built without exceptions in mind: a throwing procedure is a bug
+    void unhandled_exception() noexcept { std::terminate(); }
+};
+
+template <typename T>
+struct promise : promise_base {
+    std::optional<T> value;
+
+    task<T> get_return_object() noexcept;
+    void return_value(T v) { value.emplace(std::move(v)); }
+};
+
+template <>
+struct promise<void> : promise_base {
+    task<void> get_return_object() noexcept;
+    void return_void() noexcept {}
+};
+
+} // namespace detail
+
+// Lazy coroutine: starts when awaited (or spawned), resumes its awaiter
+// when done
+template <typename T>
+class task {
+public:
+    using promise_type = detail::promise<T>;
+
+    explicit task(std::coroutine_handle<promise_type> h) noexcept : h_(h) {}
+    task(task &&other) noexcept : h_(std::exchange(other.h_, nullptr)) {}
+    task(const task &) = delete;
+    task &operator=(const task &) = delete;
+    ~task()
+    {
+        if (h_)
+            h_.destroy();
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller)
+        noexcept
+    {
+        h_.promise().cont = caller;
+        return h_;
+    }
+    T await_resume()
+    {
+        if constexpr (!std::is_void_v<T>)
+            return std::move(*h_.promise().value);
+    }
+
+private:
+    std::coroutine_handle<promise_type> h_;
+};
+
+namespace detail {
+
+template <typename T>
+task<T> promise<T>::get_return_object() noexcept
+{
+    return task<T>(std::coroutine_handle<promise<T>>::from_promise(*this));
+}
+
+inline task<void> promise<void>::get_return_object() noexcept
+{
+    return task<void>(std::coroutine_handle<promise<void>>::from_promise(
+                *this));
+}
+
+// Eager, self destroying coroutine running a spawned task
+struct detached {
+    struct promise_type {
+        detached get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+} // namespace detail
+
+/*****************************************************************************
+ * Reactor
+ ****************************************************************************/
+
+class reactor {
+public:
+    // epoll events of a descriptor (EPOLLIN, EPOLLOUT, EPOLLERR...)
+    using handler = std::function<void(uint32_t events)>;
+
+    reactor() : epfd_(epoll_create1(EPOLL_CLOEXEC)) {}
+    ~reactor()
+    {
+        if (epfd_ >= 0)
+            close(epfd_);
+    }
+    reactor(const reactor &) = delete;
+    reactor &operator=(const reactor &) = delete;
+
+    bool ok() const noexcept { return epfd_ >= 0; }
+
+    // Watch fd, not owned: the caller closes it after remove()
+    bool add(const int fd, const uint32_t events, handler h)
+    {
+        struct epoll_event ev = {};
+        ev.events = events;
+        ev.data.fd = fd;
+        if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev))
+            return false;
+        fds_[fd] = std::move(h);
+        return true;
+    }
+
+    bool modify(const int fd, const uint32_t events)
+    {
+        struct epoll_event ev = {};
+        ev.events = events;
+        ev.data.fd = fd;
+        return !epoll_ctl(epfd_, EPOLL_CTL_MOD, fd, &ev);
+    }
+
+    void remove(const int fd)
+    {
+        epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+        fds_.erase(fd);
+    }
+
+    // Call cb at when, from run(). Returns an id for cancel_timer()
+    uint64_t add_timer(const clock::time_point when, std::function<void()> cb)
+    {
+        const uint64_t id = next_timer_++;
+        timers_.emplace(std::make_pair(when, id), std::move(cb));
+        timer_ids_.emplace(id, when);
+        return id;
+    }
+
+    void cancel_timer(const uint64_t id)
+    {
+        const auto it = timer_ids_.find(id);
+        if (it == timer_ids_.end())
+            return;
+        timers_.erase(std::make_pair(it->second, id));
+        timer_ids_.erase(it);
+    }
+
+    // co_await reactor.sleep_for(100ms)
+    auto sleep_for(const clock::duration d)
+    {
+        struct awaiter {
+            reactor &r;
+            clock::duration d;
+            bool await_ready() const noexcept { return d <= d.zero(); }
+            void await_suspend(std::coroutine_handle<> h)
+            {
+                r.add_timer(clock::now() + d, [h] { h.resume(); });
+            }
+            void await_resume() const noexcept {}
+        };
+        return awaiter{ *this, d };
+    }
+
+    // Start a procedure, run() returns once all of them are done
+    void spawn(task<void> t)
+    {
+        run_detached(*this, std::move(t));
+    }
+
+    // Dispatch events and timers until every spawned procedure is done or
+    // stop() is called. false on epoll error
+    bool run()
+    {
+        std::array<struct epoll_event, 16> evs;
+
+        stop_ = false;
+        while (!stop_ && active_) {
+            int timeout_ms = -1;
+            if (!timers_.empty()) {
+                const auto left = timers_.begin()->first.first - clock::now();
+                timeout_ms = left <= left.zero() ? 0 : int(std::chrono::ceil<
+                        std::chrono::milliseconds>(left).count());
+            }
+            const int n = epoll_wait(epfd_, evs.data(), int(evs.size()),
+                    timeout_ms);
+            if (n < 0 && errno != EINTR)
+                return false;
+            for (int i=0; i<n; i++) {
+                // Handlers may remove descriptors
+                const auto it = fds_.find(evs[i].data.fd);
+                if (it == fds_.end())
+                    continue;
+                const handler h = it->second;
+                h(evs[i].events);
+            }
+            // Timers due now, one at a time as callbacks may add others
+            const auto now = clock::now();
+            while (!timers_.empty() && timers_.begin()->first.first <= now) {
+                const auto it = timers_.begin();
+                const std::function<void()> cb = std::move(it->second);
+                timer_ids_.erase(it->first.second);
+                timers_.erase(it);
+                cb();
+            }
+        }
+        return true;
+    }
+
+    void stop() noexcept { stop_ = true; }
+
+private:
+    static detail::detached run_detached(reactor &r, task<void> t)
+    {
+        r.active_++;
+        co_await t;
+        r.active_--;
+    }
+
+    int epfd_;
+    std::unordered_map<int, handler> fds_;
+    std::map<std::pair<clock::time_point, uint64_t>, std::function<void()>>
+        timers_;
+    std::unordered_map<uint64_t, clock::time_point> timer_ids_;
+    uint64_t next_timer_ = 1;
+    int active_ = 0;
+    bool stop_ = false;
+};
+
+/*****************************************************************************
+ * Link
+ ****************************************************************************/
+
+// Local result codes, beside the S3P_ERR_* of the node
+enum : uint8_t {
+    // No response after the retries
+    ERR_TIMEOUT = 0xF0,
+    // Response too short or malformed
+    ERR_RESP    = 0xF1,
+    // Write error on the link
+    ERR_LINK    = 0xF2,
+};
+
+inline const char *err_str(const uint8_t code)
+{
+    switch (code) {
+    case ERR_TIMEOUT: return "Timeout";
+    case ERR_RESP:    return "Malformed response";
+    case ERR_LINK:    return "Link error";
+    default:          return s3p_err_str(code);
+    }
+}
+
+// Result code (S3P_ERR_NONE on success) and value
+template <typename T = void>
+struct result {
+    uint8_t code = S3P_ERR_NONE;
+    T value{};
+
+    explicit operator bool() const noexcept { return code == S3P_ERR_NONE; }
+};
+
+template <>
+struct result<void> {
+    uint8_t code = S3P_ERR_NONE;
+
+    explicit operator bool() const noexcept { return code == S3P_ERR_NONE; }
+};
+
+// Received packet with its own buffer. Movable, the packet keeps
+// pointing to the buffer
+struct response {
+    std::vector<uint8_t> buf;
+    s3p_packet_t pkt;
+
+    response() : buf(S3P_JUMBO_PKT_SIZE)
+    {
+        s3p_init_pkt(&pkt, buf.data(), S3P_ID_NONE, S3P_ID_NONE,
+                S3P_SEQ_NONE);
+    }
+    response(response &&) = default;
+    response &operator=(response &&) = default;
+    response(const response &) = delete;
+    response &operator=(const response &) = delete;
+
+    packet_view view() noexcept { return packet_view(pkt, buf.size()); }
+};
+
+struct reg_value {
+    uint16_t id;
+    value_t value;
+};
+
+// PT_S3P_INFO_RESP
+struct node_info {
+    uint16_t version;
+    uint16_t reg_min_id;
+    uint16_t reg_max_id;
+    uint16_t regs_cnt;
+    uint8_t vmem_rows;
+};
+
+// PT_REG_INFO_RESP
+struct reg_entry {
+    uint16_t id;
+    uint16_t next_id;
+    value_type_t vt;
+    uint8_t group_id;
+    uint16_t flags;
+    std::string name;
+};
+
+class link {
+public:
+    // Request awaiter, see request()
+    struct op {
+        link &l;
+        uint8_t node_id;
+        uint8_t type;
+        std::vector<uint8_t> data;
+        uint8_t seq = 0;
+        int tries = 0;
+        uint64_t timer = 0;
+        std::vector<uint8_t> frame;
+        std::coroutine_handle<> waiter;
+        std::optional<response> resp;
+
+        op(link &l_, const uint8_t node_id_, const uint8_t type_,
+                std::vector<uint8_t> data_) :
+            l(l_), node_id(node_id_), type(type_), data(std::move(data_)) {}
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            waiter = h;
+            l.submit(this);
+        }
+        std::optional<response> await_resume() { return std::move(resp); }
+    };
+
+    // fd: non blocking descriptor of a serial port or s3pd socket, owned
+    // by the caller
+    link(reactor &r, const int fd, const uint8_t manager_id) :
+        r_(r), fd_(fd), manager_id_(manager_id)
+    {
+        s3p_link_.frame_size = S3P_JUMBO_FRAME_SIZE;
+        rx_.reserve(S3P_JUMBO_FRAME_SIZE);
+        ok_ = r_.add(fd_, EPOLLIN | EPOLLRDHUP, [this](const uint32_t ev) {
+            on_events(ev);
+        });
+    }
+    ~link()
+    {
+        if (ok_)
+            r_.remove(fd_);
+    }
+    link(const link &) = delete;
+    link &operator=(const link &) = delete;
+
+    bool ok() const noexcept { return ok_; }
+    void set_timeout(const clock::duration d) noexcept { timeout_ = d; }
+    void set_retries(const int retries) noexcept { retries_ = retries; }
+    // Requests in flight per node, up to 15 (4 bits sequence)
+    void set_window(const uint8_t window) noexcept
+    {
+        window_ = window < 1 ? 1 : window > 15 ? 15 : window;
+    }
+    // Called with unsolicited packets to the manager, e.g. PT_TELEMETRY
+    void on_unsolicited(std::function<void(const s3p_packet_t &)> cb)
+    {
+        unsolicited_ = std::move(cb);
+    }
+    // Frames sent, retries included, and received for us
+    uint32_t frames_tx() const noexcept { return frames_tx_; }
+    uint32_t frames_rx() const noexcept { return frames_rx_; }
+
+    // Send a request and wait for its response (type + 1 from node_id),
+    // nothing on timeout or link error
+    op request(const uint8_t node_id, const uint8_t type,
+            std::vector<uint8_t> data = {})
+    {
+        return op{ *this, node_id, type, std::move(data) };
+    }
+
+    task<result<std::vector<reg_value>>> read_regs(const uint8_t node_id,
+            const uint16_t first_id, const uint16_t cnt)
+    {
+        result<std::vector<reg_value>> res;
+        // Payload built out of the co_await: g++ 12 can not keep an
+        // initializer_list across a suspension point
+        std::vector<uint8_t> data{ uint8_t(first_id >> 8), uint8_t(first_id),
+            uint8_t(cnt >> 8), uint8_t(cnt) };
+        auto resp = co_await request(node_id, PT_READ_REGS, std::move(data));
+        if (!check(resp, res.code))
+            co_return res;
+        const item_list items = resp->view().items();
+        if (!items.valid()) {
+            res.code = ERR_RESP;
+            co_return res;
+        }
+        res.value.reserve(items.size());
+        for (const item_view item : items) {
+            reg_value rv;
+            rv.id = item.id();
+            rv.value.vt = item.vt();
+            rv.value.val.u32 = item.raw();
+            res.value.push_back(rv);
+        }
+        co_return res;
+    }
+
+    task<result<>> write_reg(const uint8_t node_id, const uint16_t id,
+            const value_t value)
+    {
+        result<> res;
+        const uint32_t raw = value.val.u32;
+        std::vector<uint8_t> data{ uint8_t(id >> 8), uint8_t(id),
+            uint8_t(value.vt), uint8_t(raw >> 24), uint8_t(raw >> 16),
+            uint8_t(raw >> 8), uint8_t(raw) };
+        auto resp = co_await request(node_id, PT_WRITE_REG, std::move(data));
+        check(resp, res.code);
+        co_return res;
+    }
+
+    task<result<node_info>> info(const uint8_t node_id)
+    {
+        result<node_info> res;
+        auto resp = co_await request(node_id, PT_S3P_INFO);
+        if (!check(resp, res.code))
+            co_return res;
+        const packet_view v = resp->view();
+        const auto vmem_rows = v.get<uint8_t>(9);
+        if (!vmem_rows) {
+            res.code = ERR_RESP;
+            co_return res;
+        }
+        res.value.version = *v.get<uint16_t>(1);
+        res.value.reg_min_id = *v.get<uint16_t>(3);
+        res.value.reg_max_id = *v.get<uint16_t>(5);
+        res.value.regs_cnt = *v.get<uint16_t>(7);
+        res.value.vmem_rows = *vmem_rows;
+        co_return res;
+    }
+
+    task<result<reg_entry>> reg_info(const uint8_t node_id,
+            const uint16_t id)
+    {
+        result<reg_entry> res;
+        std::vector<uint8_t> data{ uint8_t(id >> 8), uint8_t(id) };
+        auto resp = co_await request(node_id, PT_REG_INFO, std::move(data));
+        if (!check(resp, res.code))
+            co_return res;
+        const packet_view v = resp->view();
+        const auto flags = v.get<uint16_t>(7);
+        if (!flags) {
+            res.code = ERR_RESP;
+            co_return res;
+        }
+        res.value.id = *v.get<uint16_t>(1);
+        res.value.next_id = *v.get<uint16_t>(3);
+        res.value.vt = value_type_t(*v.get<uint8_t>(5));
+        res.value.group_id = *v.get<uint8_t>(6);
+        res.value.flags = *flags;
+        const auto name = v.data().subspan(9);
+        res.value.name.assign(reinterpret_cast<const char *>(name.data()),
+                strnlen(reinterpret_cast<const char *>(name.data()),
+                    std::min<std::size_t>(name.size(), S3P_MAX_NAME_SIZE)));
+        co_return res;
+    }
+
+private:
+    struct node_state {
+        uint8_t next_seq = 0;
+        std::vector<op *> in_flight;
+        std::deque<op *> queued;
+    };
+
+    // Response present and with a S3P_ERR_NONE result code
+    bool check(const std::optional<response> &resp, uint8_t &code) const
+    {
+        if (!resp)
+            code = ok_ ? ERR_TIMEOUT : ERR_LINK;
+        else if (!resp->pkt.data_len)
+            code = ERR_RESP;
+        else
+            code = resp->pkt.data[0];
+        return code == S3P_ERR_NONE;
+    }
+
+    void submit(op *o)
+    {
+        node_state &ns = nodes_[o->node_id];
+        if (ns.in_flight.size() < window_)
+            start(o);
+        else
+            ns.queued.push_back(o);
+    }
+
+    void start(op *o)
+    {
+        node_state &ns = nodes_[o->node_id];
+
+        // First sequence not in flight to this node
+        for (;;) {
+            o->seq = ns.next_seq;
+            ns.next_seq = S3P_LINK_SEQ_NEXT(&s3p_link_, ns.next_seq);
+            bool used = false;
+            for (const op *other : ns.in_flight)
+                used |= other->seq == o->seq;
+            if (!used)
+                break;
+        }
+        ns.in_flight.push_back(o);
+
+        packet<S3P_JUMBO_PKT_SIZE> pkt(manager_id_, o->node_id, o->seq);
+        pkt.pkt.type = o->type;
+        pkt.pkt.data_len = uint16_t(o->data.size());
+        std::memcpy(pkt.pkt.data, o->data.data(), o->data.size());
+        o->frame.resize(S3P_JUMBO_FRAME_SIZE);
+        o->frame.resize(make_frame(s3p_link_, o->frame, pkt.pkt));
+        send(o);
+    }
+
+    void send(op *o)
+    {
+        if (!ok_ || o->frame.empty() || !write_frame(o->frame)) {
+            fail(o);
+            return;
+        }
+        o->tries++;
+        o->timer = r_.add_timer(clock::now() + timeout_, [this, o] {
+            if (o->tries <= retries_)
+                send(o);
+            else
+                finish(o, std::nullopt);
+        });
+    }
+
+    // Resumed from the reactor, not from within await_suspend()
+    void fail(op *o)
+    {
+        r_.cancel_timer(o->timer);
+        o->timer = r_.add_timer(clock::now(), [this, o] {
+            finish(o, std::nullopt);
+        });
+    }
+
+    void finish(op *o, std::optional<response> resp)
+    {
+        node_state &ns = nodes_[o->node_id];
+
+        r_.cancel_timer(o->timer);
+        std::erase(ns.in_flight, o);
+        o->resp = std::move(resp);
+        if (!ns.queued.empty()) {
+            op *next = ns.queued.front();
+            ns.queued.pop_front();
+            start(next);
+        }
+        o->waiter.resume();
+    }
+
+    // Queue a frame, written as soon as the descriptor accepts it
+    bool write_frame(const std::vector<uint8_t> &frame)
+    {
+        const bool idle = tx_.empty();
+        tx_.insert(tx_.end(), frame.begin(), frame.end());
+        frames_tx_++;
+        return idle ? flush() : true;
+    }
+
+    bool flush()
+    {
+        while (!tx_.empty()) {
+            const ssize_t n = write(fd_, tx_.data(), tx_.size());
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && errno == EAGAIN)
+                break;
+            if (n <= 0) {
+                tx_.clear();
+                if (ok_)
+                    closed();
+                return false;
+            }
+            tx_.erase(tx_.begin(), tx_.begin() + n);
+        }
+        r_.modify(fd_, EPOLLIN | EPOLLRDHUP | (tx_.empty() ? 0u : uint32_t(EPOLLOUT)));
+        return true;
+    }
+
+    void on_events(const uint32_t events)
+    {
+        if (events & EPOLLOUT)
+            flush();
+        const bool hup = events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP);
+        if (!(events & EPOLLIN) && !hup)
+            return;
+
+        // Serial ports are set up with VMIN = VTIME = 0: read() returns 0,
+        // not EAGAIN, once drained. End of file is told by epoll instead
+        std::array<uint8_t, 4096> buf;
+        ssize_t n;
+        while ((n = read(fd_, buf.data(), buf.size())) != 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && errno == EAGAIN)
+                break;
+            if (n < 0) {
+                closed();
+                return;
+            }
+            for (ssize_t i=0; i<n; i++) {
+                if (buf[i] != S3P_COBS_DELIM) {
+                    // Oversized frames are dropped at the delimiter
+                    if (rx_.size() < S3P_JUMBO_FRAME_SIZE)
+                        rx_.push_back(buf[i]);
+                    else
+                        rx_overflow_ = true;
+                    continue;
+                }
+                if (!rx_.empty() && !rx_overflow_)
+                    on_frame();
+                rx_.clear();
+                rx_overflow_ = false;
+            }
+        }
+        if (hup)
+            closed();
+    }
+
+    // Closed (s3pd gone, USB adapter unplugged): stop watching it and fail
+    // the requests in flight, then the others as they start, with ERR_LINK
+    void closed()
+    {
+        r_.remove(fd_);
+        ok_ = false;
+        for (auto &[node_id, ns] : nodes_) {
+            for (op *o : ns.in_flight)
+                fail(o);
+        }
+    }
+
+    void on_frame()
+    {
+        response resp;
+        if (decode_frame(s3p_link_, resp.pkt, rx_) != S3P_FRAME_OK ||
+                resp.pkt.dst_id != manager_id_)
+            return;
+        frames_rx_++;
+        resp.pkt.seq = resp.pkt.flags_seq & S3P_LINK_SEQ_MASK(&s3p_link_);
+
+        const auto it = nodes_.find(resp.pkt.src_id);
+        if (it != nodes_.end()) {
+            for (op *o : it->second.in_flight) {
+                if (o->seq == resp.pkt.seq && o->type + 1 == resp.pkt.type) {
+                    finish(o, std::move(resp));
+                    return;
+                }
+            }
+        }
+        // Late duplicate of a retried request, or unsolicited
+        if (resp.pkt.type == PT_TELEMETRY && unsolicited_)
+            unsolicited_(resp.pkt);
+    }
+
+    reactor &r_;
+    int fd_;
+    uint8_t manager_id_;
+    bool ok_;
+    // Jumbo frames accepted whatever the node, 4 bits sequence
+    s3p_link_t s3p_link_ = {};
+    clock::duration timeout_ = std::chrono::milliseconds(500);
+    int retries_ = 2;
+    uint8_t window_ = 1;
+    std::unordered_map<uint8_t, node_state> nodes_;
+    std::vector<uint8_t> tx_;
+    std::vector<uint8_t> rx_;
+    bool rx_overflow_ = false;
+    std::function<void(const s3p_packet_t &)> unsolicited_;
+    uint32_t frames_tx_ = 0;
+    uint32_t frames_rx_ = 0;
+};
+
+} // namespace s3p::co
+
+#endif // _S3P_CO_HPP
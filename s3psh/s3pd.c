@@ -0,0 +1,628 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "ser.h"
+#include "s3p.h"
+#include "s3p_txq.h"
+#include "s3psh_utils.h"
+#include "s3p_dbg.h"
+
+/* s3pd: serial link gateway, sharing one S3P link between local clients.
+ *
+ * Clients connect to a Unix domain socket and exchange plain S3P frames
+ * (COBS encoded, delimiter terminated), as on the serial line: s3psh
+ * connects to it when given the socket path instead of the device.
+ *
+ * Requests of all clients are interleaved on the wire, each one with a
+ * sequence number owned by the daemon, so that responses are routed back
+ * whatever the order, with the client own sequence restored. Requests
+ * identical to a read still in flight are not sent again: the response
+ * is delivered to every requester. A client retransmission of a request
+ * still in flight (same client sequence and type) goes out again with the
+ * same wire sequence, so that nodes recognize it and do not execute it
+ * twice. Telemetry packets go to the clients that used the destination
+ * manager id.
+ *
+ * On half-duplex links (-485) responses would collide with each other and
+ * with the next requests: the requests are queued, and sent one at a time
+ * in arrival order once the previous one completed or expired.
+ */
+
+#define VER             "1.00"
+#define DEF_SOCK_PATH   "/tmp/s3pd.sock"
+#define DEF_BAUD        230400
+#define MAX_CLIENTS     16
+#define MAX_PENDING     64
+#define MAX_WAITERS     8
+#define MERGE_DATA_SIZE 16      // Largest request data compared for merging
+#define PENDING_TO_MS   3000    // Clients retry on their own timeout
+// Node side operations over VMEM ranges, beyond the s3psh LONG_OP_TO_MS
+#define LONG_OP_TO_MS   6000
+#define POLL_MS         100
+#define TXQ_SIZE        (4 * S3P_JUMBO_FRAME_SIZE)
+#define M_MIN(_x,_y)    ( ( (_x) > (_y) ) ? (_y) : (_x) )
+
+typedef struct {
+    int fd;             // -1 if free
+    uint32_t gen;       // Incremented on close, invalidates waiters
+    uint8_t rx[S3P_JUMBO_FRAME_SIZE];
+    uint16_t rx_len;
+    uint8_t ids[32];    // Bitmap of the manager ids used by the client
+    uint32_t reqs;
+} client_t;
+
+// Requester of an in flight request
+typedef struct {
+    uint8_t client;
+    uint32_t gen;
+    uint8_t src_id;
+    uint8_t flags_seq;
+} waiter_t;
+
+// In flight request, by destination node and wire sequence
+typedef struct {
+    bool busy;
+    bool sent;          // Half-duplex: false while queued
+    bool mergeable;
+    uint8_t node_id;    // S3P_ID_BROADCAST for group reads
+    uint8_t seq;
+    uint32_t sent_ms;   // Queued at, until sent
+    uint32_t order;     // Half-duplex queue order
+    uint8_t waiters_cnt;
+    waiter_t waiters[MAX_WAITERS];
+    // Request as sent on the wire, for the retransmissions
+    s3p_packet_t pkt;
+    uint8_t pkt_buf[S3P_JUMBO_PKT_SIZE];
+} pending_t;
+
+static struct ser_struct ser;
+// Jumbo frames whatever the node, 4 bits wire sequence
+static s3p_link_t s3p_link = { .frame_size = S3P_JUMBO_FRAME_SIZE };
+static s3p_txq_t txq;
+static uint8_t txq_buf[TXQ_SIZE];
+static uint8_t pkt_buf[S3P_JUMBO_PKT_SIZE];
+static uint8_t frame_buf[S3P_JUMBO_FRAME_SIZE];
+static uint8_t ser_rx[S3P_JUMBO_FRAME_SIZE];
+static uint16_t ser_rx_len;
+static client_t clients[MAX_CLIENTS];
+static pending_t pending[MAX_PENDING];
+static uint32_t pending_order;
+static uint8_t next_seq[256];
+static bool en_rs485;
+static volatile sig_atomic_t quit;
+
+static struct {
+    uint32_t reqs;
+    uint32_t merged;
+    uint32_t retrans;
+    uint32_t resps;
+    uint32_t stale;
+    uint32_t timeouts;
+    uint32_t unsolicited;
+    uint32_t busy;
+    uint32_t bad;
+} cnt;
+
+static void show_usage(char **argv)
+{
+    printf("\n");
+    printf("Usage: %s [-d[d]] [-s path] [-b baud] [-485] [-L] <ser_dev>\n",
+            argv[0]);
+    printf("\n");
+    printf("Where:\n");
+    printf("  -d[d]       enable debug. More verbose with -dd\n");
+    printf("  -s path     client socket path (default %s)\n", DEF_SOCK_PATH);
+    printf("  -b baud     serial baud rate (default %u)\n", DEF_BAUD);
+    printf("  -485        half-duplex RS485, driver or RTS controlled DE\n");
+    printf("  -L          keep the driver latency settings\n");
+    printf("  <ser_dev>   serial device (e.g. /dev/ttyUSB0)\n");
+    printf("\n");
+}
+
+static void catch_signal(int sig)
+{
+    quit = 1;
+}
+
+static bool txq_write(void *ctx, const uint8_t *buf, const uint32_t len)
+{
+    return ser_write(ctx, buf, len) == (int)len;
+}
+
+static bool is_mergeable(const uint8_t type)
+{
+    switch (type) {
+    case PT_READ_REGS:
+    case PT_READ_VMEM:
+    case PT_READ_STR_REG:
+    case PT_VMEM_CRC:
+    case PT_VMEM_HASHES:
+    case PT_READ_VMEM_LZ:
+    case PT_S3P_INFO:
+    case PT_REG_INFO:
+    case PT_VMEM_INFO:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void client_close(const int idx)
+{
+    client_t *c = &clients[idx];
+
+    DBG(1, "Client %d disconnected, %u requests\n", idx, c->reqs);
+    close(c->fd);
+    c->fd = -1;
+    c->gen++;
+}
+
+// A client that can't take a whole frame is too slow: drop it rather than
+// stall the link
+static void client_send(const int idx, const uint8_t *buf, const uint16_t len)
+{
+    if (send(clients[idx].fd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT) !=
+            (ssize_t)len)
+        client_close(idx);
+}
+
+static pending_t *pending_alloc(const uint8_t node_id)
+{
+    pending_t *p = NULL;
+
+    for (int i=0; i<MAX_PENDING; i++) {
+        if (!pending[i].busy) {
+            p = &pending[i];
+            break;
+        }
+    }
+    if (p == NULL)
+        return NULL;
+
+    // First sequence not in flight to this node
+    for (int n=0; n<=S3P_LINK_SEQ_MASK(&s3p_link); n++) {
+        const uint8_t seq = next_seq[node_id];
+        bool used = false;
+        next_seq[node_id] = S3P_LINK_SEQ_NEXT(&s3p_link, seq);
+        for (int i=0; i<MAX_PENDING && !used; i++) {
+            used = pending[i].busy && pending[i].seq == seq &&
+                (pending[i].node_id == node_id ||
+                 pending[i].node_id == S3P_ID_BROADCAST ||
+                 node_id == S3P_ID_BROADCAST);
+        }
+        if (!used) {
+            p->node_id = node_id;
+            p->seq = seq;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+// Request of a waiter sent again by its client, unchanged
+static pending_t *pending_find(const waiter_t *w, const s3p_packet_t *pkt)
+{
+    for (int i=0; i<MAX_PENDING; i++) {
+        pending_t *p = &pending[i];
+        if (!p->busy || p->node_id != pkt->dst_id ||
+                p->pkt.type != pkt->type || p->pkt.data_len != pkt->data_len ||
+                memcmp(p->pkt.data, pkt->data, pkt->data_len))
+            continue;
+        for (int j=0; j<p->waiters_cnt; j++) {
+            const waiter_t *pw = &p->waiters[j];
+            if (pw->client == w->client && pw->gen == w->gen &&
+                    pw->src_id == w->src_id && pw->flags_seq == w->flags_seq)
+                return p;
+        }
+    }
+    return NULL;
+}
+
+static bool pending_send(pending_t *p)
+{
+    p->sent = true;
+    p->sent_ms = client_utils_get_ms();
+    if (!s3p_txq_push(&txq, &s3p_link, &p->pkt, p->sent_ms, NULL)) {
+        cnt.bad++;
+        p->busy = false;
+        return false;
+    }
+    return true;
+}
+
+static void client_request(const int idx, const uint8_t *frame,
+        const uint16_t len)
+{
+    client_t *c = &clients[idx];
+    s3p_packet_t pkt;
+    pending_t *p;
+
+    s3p_init_pkt(&pkt, pkt_buf, S3P_ID_NONE, S3P_ID_NONE, S3P_SEQ_NONE);
+    if (s3p_link_decode_frame(&s3p_link, &pkt, frame, len) != S3P_FRAME_OK) {
+        cnt.bad++;
+        return;
+    }
+    c->ids[pkt.src_id >> 3] |= 1 << (pkt.src_id & 7);
+    c->reqs++;
+    cnt.reqs++;
+    const waiter_t w = { idx, c->gen, pkt.src_id, pkt.flags_seq };
+
+    // Retransmission: same wire sequence, the node may recognize it
+    p = pending_find(&w, &pkt);
+    if (p != NULL) {
+        cnt.retrans++;
+        DBG(2, "Client %d: %s retransmitted, seq 0x%02X\n", idx,
+                s3p_type_str(pkt.type), p->seq);
+        // Still queued, goes out once anyway
+        if (p->sent)
+            pending_send(p);
+        return;
+    }
+
+    // Same read already in flight
+    const bool mergeable = is_mergeable(pkt.type) &&
+        pkt.data_len <= MERGE_DATA_SIZE && pkt.dst_id != S3P_ID_BROADCAST;
+    for (int i=0; i<MAX_PENDING && mergeable; i++) {
+        p = &pending[i];
+        if (p->busy && p->mergeable && p->node_id == pkt.dst_id &&
+                p->pkt.type == pkt.type && p->pkt.data_len == pkt.data_len &&
+                !memcmp(p->pkt.data, pkt.data, pkt.data_len) &&
+                p->waiters_cnt < MAX_WAITERS) {
+            p->waiters[p->waiters_cnt++] = w;
+            cnt.merged++;
+            DBG(2, "Client %d: %s merged\n", idx, s3p_type_str(pkt.type));
+            return;
+        }
+    }
+
+    p = pending_alloc(pkt.dst_id);
+    if (p == NULL) {
+        // Dropped, the client retries on timeout
+        cnt.busy++;
+        return;
+    }
+    s3p_init_pkt(&p->pkt, p->pkt_buf, pkt.src_id, pkt.dst_id, p->seq);
+    p->pkt.type = pkt.type;
+    p->pkt.data_len = pkt.data_len;
+    memcpy(p->pkt.data, pkt.data, pkt.data_len);
+    // Only mergeable requests are compared
+    p->mergeable = mergeable;
+    p->waiters[0] = w;
+    p->waiters_cnt = 1;
+
+    p->busy = true;
+    if (en_rs485) {
+        // Sent by pending_next()
+        p->sent = false;
+        p->sent_ms = client_utils_get_ms();
+        p->order = pending_order++;
+    } else if (!pending_send(p))
+        return;
+    DBG(2, "Client %d: %s to %u, seq 0x%02X -> 0x%02X\n", idx,
+            s3p_type_str(pkt.type), pkt.dst_id, w.flags_seq, p->seq);
+}
+
+static void node_frame(const uint8_t *frame, const uint16_t len)
+{
+    s3p_packet_t pkt;
+    pending_t *p = NULL;
+    uint16_t size;
+
+    s3p_init_pkt(&pkt, pkt_buf, S3P_ID_NONE, S3P_ID_NONE, S3P_SEQ_NONE);
+    if (s3p_link_decode_frame(&s3p_link, &pkt, frame, len) != S3P_FRAME_OK) {
+        cnt.bad++;
+        return;
+    }
+
+    if (pkt.type == PT_TELEMETRY) {
+        cnt.unsolicited++;
+        // The received frame lacks its delimiter: encoded again, as the
+        // responses
+        size = s3p_link_make_frame(&s3p_link, frame_buf, &pkt);
+        for (int i=0; i<MAX_CLIENTS && size; i++) {
+            const client_t *c = &clients[i];
+            if (c->fd >= 0 && (c->ids[pkt.dst_id >> 3] & (1 << (pkt.dst_id & 7))))
+                client_send(i, frame_buf, size);
+        }
+        return;
+    }
+
+    pkt.seq = pkt.flags_seq & S3P_LINK_SEQ_MASK(&s3p_link);
+    for (int i=0; i<MAX_PENDING; i++) {
+        if (pending[i].busy && pending[i].sent && pending[i].seq == pkt.seq &&
+                (pending[i].node_id == pkt.src_id ||
+                 pending[i].node_id == S3P_ID_BROADCAST)) {
+            p = &pending[i];
+            break;
+        }
+    }
+    if (p == NULL) {
+        cnt.stale++;
+        return;
+    }
+
+    cnt.resps++;
+    for (int i=0; i<p->waiters_cnt; i++) {
+        const waiter_t *w = &p->waiters[i];
+        if (clients[w->client].fd < 0 || clients[w->client].gen != w->gen)
+            continue;
+        pkt.dst_id = w->src_id;
+        pkt.flags_seq = w->flags_seq;
+        size = s3p_link_make_frame(&s3p_link, frame_buf, &pkt);
+        if (size)
+            client_send(w->client, frame_buf, size);
+    }
+    // Group reads collect responses until the timeout
+    if (p->node_id != S3P_ID_BROADCAST)
+        p->busy = false;
+}
+
+// Append the bytes up to the next delimiter to the frame being received.
+// Return the bytes consumed, *end set if the delimiter was reached
+static int rx_split(uint8_t *buf, uint16_t *buf_len, const uint8_t *data,
+        const int len, bool *end)
+{
+    for (int i=0; i<len; i++) {
+        if (data[i] == S3P_COBS_DELIM) {
+            *end = true;
+            return i + 1;
+        }
+        // Oversized frames are truncated, then discarded by the CRC
+        if (*buf_len < S3P_JUMBO_FRAME_SIZE)
+            buf[(*buf_len)++] = data[i];
+    }
+    *end = false;
+    return len;
+}
+
+static void node_rx_bytes(const uint8_t *data, const int len)
+{
+    bool end;
+
+    for (int i=0; i<len; ) {
+        i += rx_split(ser_rx, &ser_rx_len, &data[i], len - i, &end);
+        if (!end)
+            break;
+        if (ser_rx_len)
+            node_frame(ser_rx, ser_rx_len);
+        ser_rx_len = 0;
+    }
+}
+
+static void client_rx_bytes(const int idx, const uint8_t *data, const int len)
+{
+    client_t *c = &clients[idx];
+    bool end;
+
+    for (int i=0; i<len; ) {
+        i += rx_split(c->rx, &c->rx_len, &data[i], len - i, &end);
+        if (!end)
+            break;
+        if (c->rx_len)
+            client_request(idx, c->rx, c->rx_len);
+        c->rx_len = 0;
+        // Client dropped while sending to it
+        if (c->fd < 0)
+            return;
+    }
+}
+
+// Response deadline, at least as long as the client one
+static uint32_t pending_to_ms(const uint8_t type)
+{
+    switch (type) {
+    case PT_VMEM_CRC:
+    case PT_VMEM_HASHES:
+        return LONG_OP_TO_MS;
+    default:
+        return PENDING_TO_MS;
+    }
+}
+
+static void expire_pending(void)
+{
+    for (int i=0; i<MAX_PENDING; i++) {
+        pending_t *p = &pending[i];
+        if (p->busy && client_utils_elapsed_ms(p->sent_ms) >=
+                pending_to_ms(p->pkt.type)) {
+            p->busy = false;
+            if (p->node_id != S3P_ID_BROADCAST)
+                cnt.timeouts++;
+        }
+    }
+}
+
+// Half-duplex: send the oldest queued request once none is on the wire.
+// Group reads hold the line until they expire, as their response slots
+static void pending_next(void)
+{
+    for (;;) {
+        pending_t *next = NULL;
+        for (int i=0; i<MAX_PENDING; i++) {
+            pending_t *p = &pending[i];
+            if (!p->busy)
+                continue;
+            if (p->sent)
+                return;
+            if (next == NULL || (int32_t)(p->order - next->order) < 0)
+                next = p;
+        }
+        if (next == NULL || pending_send(next))
+            return;
+    }
+}
+
+static int open_socket(const char *path)
+{
+    struct sockaddr_un addr;
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+
+    if (fd < 0)
+        return -1;
+    memset(&addr, 0x00, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+            listen(fd, MAX_CLIENTS)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void accept_client(const int lfd)
+{
+    const int fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK);
+
+    if (fd < 0)
+        return;
+    for (int i=0; i<MAX_CLIENTS; i++) {
+        client_t *c = &clients[i];
+        if (c->fd < 0) {
+            c->fd = fd;
+            c->rx_len = 0;
+            c->reqs = 0;
+            memset(c->ids, 0x00, sizeof(c->ids));
+            DBG(1, "Client %d connected\n", i);
+            return;
+        }
+    }
+    DBG(0, "Too many clients\n");
+    close(fd);
+}
+
+int main(int argc, char **argv)
+{
+    const char *sock_path = DEF_SOCK_PATH;
+    int baud = DEF_BAUD;
+    bool low_latency = true;
+    struct pollfd pfds[2 + MAX_CLIENTS];
+    int client_idx[MAX_CLIENTS];
+    uint8_t buf[SER_RX_BUF_SIZE];
+    int opt;
+
+    // "-485" reads as the -4 option with "85" as argument
+    while ((opt = getopt(argc, argv, "ds:b:4:L")) != -1) {
+        switch (opt) {
+        case 'd': _dbg_lvl++; break;
+        case 's': sock_path = optarg; break;
+        case 'b': baud = atoi(optarg); break;
+        case '4':
+            if (strcmp(optarg, "85")) {
+                show_usage(argv);
+                return -1;
+            }
+            en_rs485 = true;
+            break;
+        case 'L': low_latency = false; break;
+        default:
+            show_usage(argv);
+            return -1;
+        }
+    }
+    if (optind >= argc) {
+        show_usage(argv);
+        return -1;
+    }
+
+    printf("S3P Link Gateway\n");
+    printf("================\n");
+    printf("Version %s - build %s %s\n", VER, __DATE__, __TIME__);
+
+    s3p_set_debug_level(_dbg_lvl);
+    if (ser_open(&ser, argv[optind], baud, 'N', 8, 1, low_latency)) {
+        printf("Error opening serial port '%s'\n", argv[optind]);
+        return -1;
+    }
+    ser_discard(&ser);
+    if (en_rs485 && ser_set_rs485(&ser, true)) {
+        printf("Error enabling half-duplex mode\n");
+        return -1;
+    }
+    s3p_txq_init(&txq, txq_buf, sizeof(txq_buf), 0, 0, txq_write, &ser);
+
+    const int lfd = open_socket(sock_path);
+    if (lfd < 0) {
+        printf("Can't listen on '%s' (%s)\n", sock_path, strerror(errno));
+        return -1;
+    }
+    for (int i=0; i<MAX_CLIENTS; i++)
+        clients[i].fd = -1;
+    printf("Listening on '%s'\n", sock_path);
+
+    signal(SIGINT, catch_signal);
+    signal(SIGTERM, catch_signal);
+    while (!quit) {
+        int nfds = 0;
+        pfds[nfds].fd = lfd;
+        pfds[nfds++].events = POLLIN;
+        // Also re-arms the backend read if needed
+        const int ser_pending = ser.be->pending(&ser);
+        pfds[nfds].fd = ser.be->poll_fd(&ser);
+        pfds[nfds++].events = POLLIN;
+        for (int i=0; i<MAX_CLIENTS; i++) {
+            if (clients[i].fd < 0)
+                continue;
+            client_idx[nfds - 2] = i;
+            pfds[nfds].fd = clients[i].fd;
+            pfds[nfds++].events = POLLIN;
+        }
+
+        if (poll(pfds, nfds, ser_pending ? 0 : POLL_MS) < 0 && errno != EINTR)
+            break;
+
+        if (ser_pending || (pfds[1].revents & POLLIN)) {
+            int nbytes;
+            while ((nbytes = ser_read(&ser, buf, sizeof(buf))) > 0)
+                node_rx_bytes(buf, nbytes);
+        }
+        for (int n=2; n<nfds; n++) {
+            const int i = client_idx[n - 2];
+            if (!(pfds[n].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            const ssize_t nbytes = recv(clients[i].fd, buf, sizeof(buf), 0);
+            if (nbytes <= 0) {
+                if (nbytes == 0 || (errno != EAGAIN && errno != EINTR))
+                    client_close(i);
+                continue;
+            }
+            client_rx_bytes(i, buf, nbytes);
+        }
+        if (pfds[0].revents & POLLIN)
+            accept_client(lfd);
+
+        expire_pending();
+        if (en_rs485)
+            pending_next();
+        // Doorbell: the requests of this round go out with a single write
+        if (!s3p_txq_flush(&txq))
+            DBG(0, "Ser write error!\n");
+    }
+
+    printf("\nRequests %u (merged %u, retransmitted %u, dropped %u), "
+            "responses %u, timeouts %u\n", cnt.reqs, cnt.merged, cnt.retrans,
+            cnt.busy, cnt.resps, cnt.timeouts);
+    printf("Stale responses %u, telemetry %u, bad frames %u\n",
+            cnt.stale, cnt.unsolicited, cnt.bad);
+    for (int i=0; i<MAX_CLIENTS; i++) {
+        if (clients[i].fd >= 0)
+            close(clients[i].fd);
+    }
+    close(lfd);
+    unlink(sock_path);
+    ser_close(&ser);
+
+    return 0;
+}
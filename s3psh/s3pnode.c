@@ -0,0 +1,288 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <termios.h>
+#include "ser.h"
+#include "s3p.h"
+#include "s3p_regs.h"
+#include "s3p_uart.h"
+#include "uart_posix.h"
+#include "s3psh_utils.h"
+#include "s3p_dbg.h"
+
+/* s3p-node: S3P node emulator on the DMA UART driver (s3p_uart.h)
+ *
+ * Runs the node firmware path off-target: the uart_posix stand-in plays
+ * the DMA and its interrupts, the main loop parses the frames in place
+ * in the receive buffer and serves the register requests from a s3p_regs
+ * store, while a sampler thread updates a block of registers at 1 kHz
+ * as an ADC interrupt would.
+ *
+ * Serves a serial device, or with -p a new pseudo terminal whose name is
+ * printed, for s3psh or s3p-co to connect to.
+ */
+
+#define VER             "1.00"
+#define DEF_BAUD        230400
+#define DEF_NODE_ID     1
+#define SAMPLE_US       1000
+
+// Receive buffer: the bytes received while the main loop is busy plus a
+// frame being assembled, a power of two
+#define RX_BUF_SIZE     (4 * S3P_MAX_FRAME_SIZE)
+
+static uint8_t rx_buf[RX_BUF_SIZE];
+static uint8_t lin_buf[S3P_MAX_FRAME_SIZE];
+static uint8_t tx_buf[2 * 2 * S3P_MAX_FRAME_SIZE];
+static uint8_t pkt_in_buf[S3P_MAX_PKT_SIZE];
+static uint8_t pkt_out_buf[S3P_MAX_PKT_SIZE];
+
+static s3p_uart_t uart;
+static struct uart_posix up;
+// Group reads advertised in the info response
+static s3p_link_t s3p_link = { .group_read = true };
+static uint8_t node_id = DEF_NODE_ID;
+static volatile sig_atomic_t quit;
+static _Atomic bool sampler_stop;
+
+enum {
+    REG_UPTIME = 0,
+    REG_COUNTER,
+    REG_SAMPLES,
+    REG_ACC_X,
+    REG_ACC_Y,
+    REG_ACC_Z,
+    REGS_CNT
+};
+
+static const s3p_reg_desc_t reg_desc[REGS_CNT] = {
+    { 1, VT_U32, 0, S3P_REG_F_NONE, S3P_REGS_NO_BLOCK, "uptime_ms" },
+    { 2, VT_U32, 0, S3P_REG_F_MUTABLE, S3P_REGS_NO_BLOCK, "counter" },
+    { 3, VT_U32, 1, S3P_REG_F_NONE, 0, "samples" },
+    { 10, VT_I32, 1, S3P_REG_F_NONE, 0, "acc_x" },
+    { 11, VT_I32, 1, S3P_REG_F_NONE, 0, "acc_y" },
+    { 12, VT_I32, 1, S3P_REG_F_NONE, 0, "acc_z" },
+};
+static s3p_reg_val_t reg_vals[REGS_CNT];
+static s3p_reg_block_t reg_blocks[1];
+static s3p_regs_t regs;
+
+static void show_usage(char **argv)
+{
+    printf("\n");
+    printf("Usage: %s [-d[d]] [-i node_id] [-b baud] <-p | ser_dev>\n",
+            argv[0]);
+    printf("\n");
+    printf("Where:\n");
+    printf("  -d[d]       enable debug. More verbose with -dd\n");
+    printf("  -i node_id  node id (default %u)\n", DEF_NODE_ID);
+    printf("  -b baud     serial baud rate (default %u)\n", DEF_BAUD);
+    printf("  -p          serve a new pseudo terminal\n");
+    printf("  <ser_dev>   serial device (e.g. /dev/ttyUSB0)\n");
+    printf("\n");
+}
+
+static void catch_signal(int sig)
+{
+    quit = 1;
+}
+
+// The ADC interrupt: samples, acceleration and its sample count updated
+// as one block
+static void *sampler(void *arg)
+{
+    uint32_t samples = 0;
+    uint32_t raw[4];
+
+    while (!atomic_load_explicit(&sampler_stop, memory_order_relaxed)) {
+        samples++;
+        raw[0] = samples;
+        raw[1] = (int32_t)(samples % 2000) - 1000;
+        raw[2] = (int32_t)(samples % 500) - 250;
+        raw[3] = 1000;
+        s3p_regs_set_block(&regs, 0, raw);
+        s3p_regs_set(&regs, REG_UPTIME, client_utils_get_ms());
+        usleep(SAMPLE_US);
+    }
+
+    return NULL;
+}
+
+// Pseudo terminal master, the peer connecting to the printed slave
+static int open_pty(void)
+{
+    struct termios tios;
+
+    const int fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd == -1 || grantpt(fd) || unlockpt(fd)) {
+        printf("Can't create a pseudo terminal (%s)\n", strerror(errno));
+        return -1;
+    }
+    // Raw until the peer sets its own attributes, not echoing our frames
+    const int sfd = open(ptsname(fd), O_RDWR | O_NOCTTY);
+    if (sfd != -1 && !tcgetattr(sfd, &tios)) {
+        cfmakeraw(&tios);
+        tcsetattr(sfd, TCSANOW, &tios);
+    }
+    // The slave is left open: the master does not hang up between peers
+    printf("Pseudo terminal '%s'\n", ptsname(fd));
+
+    return fd;
+}
+
+static void info_resp(const s3p_packet_t *pkt_in, s3p_packet_t *pkt_out)
+{
+    const uint16_t caps = S3P_CAP_GROUP_READ;
+    const uint16_t frame = S3P_LINK_FRAME_SIZE(&s3p_link);
+    uint8_t *data = pkt_out->data;
+    uint16_t n = 0;
+
+    data[n++] = S3P_ERR_NONE;
+    data[n++] = (uint8_t)(S3P_VERSION >> 8);
+    data[n++] = (uint8_t)S3P_VERSION;
+    data[n++] = (uint8_t)(reg_desc[0].id >> 8);
+    data[n++] = (uint8_t)reg_desc[0].id;
+    data[n++] = (uint8_t)(reg_desc[REGS_CNT - 1].id >> 8);
+    data[n++] = (uint8_t)reg_desc[REGS_CNT - 1].id;
+    data[n++] = 0;
+    data[n++] = REGS_CNT;
+    // No VMEM
+    data[n++] = 0;
+    data[n++] = (uint8_t)(caps >> 8);
+    data[n++] = (uint8_t)caps;
+    data[n++] = (uint8_t)(frame >> 8);
+    data[n++] = (uint8_t)frame;
+
+    pkt_out->src_id = node_id;
+    pkt_out->dst_id = pkt_in->src_id;
+    pkt_out->flags_seq = pkt_in->flags_seq;
+    pkt_out->seq = pkt_in->seq;
+    pkt_out->type = PT_S3P_INFO_RESP;
+    pkt_out->data_len = n;
+}
+
+// rx_us: time of the receive interrupt, i.e. end of the request frame
+static void serve(const s3p_packet_t *pkt_in, const uint32_t rx_us)
+{
+    s3p_packet_t pkt_out;
+    uint32_t delay_us;
+
+    s3p_init_pkt(&pkt_out, pkt_out_buf, node_id, pkt_in->src_id,
+            pkt_in->flags_seq);
+    if (pkt_in->type == PT_S3P_INFO)
+        info_resp(pkt_in, &pkt_out);
+    else if (!s3p_regs_handle(&regs, node_id, pkt_in, &pkt_out,
+                S3P_DATA_SIZE(S3P_LINK_FRAME_SIZE(&s3p_link)), &delay_us)) {
+        DBG(1, "Unsupported request %s (0x%02X)\n",
+                s3p_type_str(pkt_in->type), pkt_in->type);
+        return;
+    }
+    // PT_GROUP_READ response slot, the firmware would arm a timer
+    const uint32_t elapsed_us = client_utils_get_us() - rx_us;
+    if (delay_us > elapsed_us)
+        usleep(delay_us - elapsed_us);
+
+    // Both buffers busy: the DMA drains one in a frame time
+    for (int i=0; !s3p_uart_send(&uart, &s3p_link, &pkt_out); i++) {
+        if (i == 1000) {
+            DBG(0, "Response to %s dropped\n", s3p_type_str(pkt_in->type));
+            return;
+        }
+        usleep(100);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct ser_struct ser;
+    bool use_pty = false;
+    int baud = DEF_BAUD;
+    pthread_t sampler_thr;
+    s3p_packet_t pkt_in;
+    int fd;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "di:b:p")) != -1) {
+        switch (opt) {
+        case 'd': _dbg_lvl++; break;
+        case 'i': node_id = atoi(optarg); break;
+        case 'b': baud = atoi(optarg); break;
+        case 'p': use_pty = true; break;
+        default:
+            show_usage(argv);
+            return -1;
+        }
+    }
+    if (!use_pty && optind >= argc) {
+        show_usage(argv);
+        return -1;
+    }
+
+    printf("S3P Node Emulator\n");
+    printf("=================\n");
+    printf("Version %s - build %s %s\n", VER, __DATE__, __TIME__);
+
+    s3p_set_debug_level(_dbg_lvl);
+    if (use_pty) {
+        fd = open_pty();
+        if (fd < 0)
+            return -1;
+    } else {
+        if (ser_open(&ser, argv[optind], baud, 'N', 8, 1, false)) {
+            printf("Error opening serial port '%s'\n", argv[optind]);
+            return -1;
+        }
+        fd = ser.fd;
+    }
+
+    if (!s3p_regs_init(&regs, reg_desc, reg_vals, REGS_CNT, reg_blocks, 1)) {
+        printf("Invalid register table\n");
+        return -1;
+    }
+    if (uart_posix_init(&up, fd, &uart))
+        return -1;
+    if (!s3p_uart_init(&uart, &uart_posix_hal, &up, rx_buf, sizeof(rx_buf),
+                lin_buf, sizeof(lin_buf), tx_buf, sizeof(tx_buf) / 2)) {
+        printf("Can't start the UART driver\n");
+        return -1;
+    }
+    pthread_create(&sampler_thr, NULL, sampler, NULL);
+    printf("Node %u ready\n", node_id);
+    fflush(stdout);
+
+    signal(SIGINT, catch_signal);
+    signal(SIGTERM, catch_signal);
+    while (!quit) {
+        // The firmware sleeps until the next interrupt
+        uart_posix_wait(&up, 100);
+        s3p_init_pkt(&pkt_in, pkt_in_buf, S3P_ID_NONE, S3P_ID_NONE,
+                S3P_SEQ_NONE);
+        while (s3p_uart_recv(&uart, &s3p_link, &pkt_in, node_id)) {
+            DBG(1, "%s from %u\n", s3p_type_str(pkt_in.type), pkt_in.src_id);
+            serve(&pkt_in, uart.rx_us);
+        }
+    }
+
+    atomic_store_explicit(&sampler_stop, true, memory_order_relaxed);
+    pthread_join(sampler_thr, NULL);
+    uart_posix_close(&up);
+    printf("\nFrames sent %u (DMA transfers %u, write errors %u)\n",
+            uart.tx_frames, up.tx_xfers, up.tx_errors);
+    printf("RX overruns %u, oversized frames %u\n", uart.rx_overruns,
+            uart.rx_oversized);
+    if (use_pty)
+        close(fd);
+    else
+        ser_close(&ser);
+
+    return 0;
+}
@@ -1,19 +1,33 @@
 #include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <stdbool.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/stat.h>
 #include <termios.h>
 #include <stdlib.h>
 #include <signal.h>
 #include <time.h>
+#include <pthread.h>
 #include "ser.h"
 #include "s3p.h"
+#include "s3p_rto.h"
+#include "s3p_stats.h"
+#include "s3p_lz.h"
+#include "s3p_telem.h"
+#include "s3p_txq.h"
+#include "s3p_items.h"
+#include "crc32.h"
 #include "value.h"
+#include "value_fmt.h"
 #include "s3psh_utils.h"
+#include "capture.h"
+#include "regshm.h"
+#include "archive.h"
 #include "s3p_dbg.h"
 #include "colors.h"
 
@@ -22,12 +36,18 @@
 
 #define USE_READLINE
 
-#define VER             "1.12"
+#define VER             "1.35"
 #define M_MIN(_x,_y)    ( ( (_x) > (_y) ) ? (_y) : (_x) )
-#define BYTE_DELAY      10000UL // 10ms
+#define M_MAX(_x,_y)    ( ( (_x) > (_y) ) ? (_x) : (_y) )
 #define DEF_MANAGER_ID  0x6A
 #define DEF_NODE_ID     0x2A
-#define RESP_TO_MS      10000
+#define LONG_OP_TO_MS   5000    // Node side operations over VMEM ranges
+#define DUP_MAX_THREADS 64
+#define LZ_CHUNK_SIZE   16384   // Raw bytes per compressed VMEM request
+#define GREAD_GUARD_US  500     // Group read slot guard (turnaround, jitter)
+#define TELEM_MAX_SUBS  16
+#define PIPE_MAX_WINDOW 16      // Max requests in flight, pipelined download
+#define TXQ_SIZE        (4 * S3P_JUMBO_FRAME_SIZE)
 #define PROMPT_OK       C_GRN "\ns3psh> " C_NRM
 #define PROMPT_ERR      C_RED "\ns3psh> " C_NRM
 #define CSEP            C_FNT "|" C_NRM
@@ -97,13 +117,62 @@ static vmem_t *vmem_table = NULL;
 
 struct ser_struct ser = { 0 };
 // Frame buffer
-static uint8_t frame_buf[S3P_MAX_FRAME_SIZE];
+static uint8_t frame_buf[S3P_JUMBO_FRAME_SIZE];
+// Bytes of the frame being received, kept across read_frame() calls so
+// that a timeout never cuts a frame in two
+static uint16_t frame_rx_len;
 // Decoded packet in buffer
-static uint8_t pkt_in_buf[S3P_MAX_PKT_SIZE];
+static uint8_t pkt_in_buf[S3P_JUMBO_PKT_SIZE];
 // Unencoded packet out buffer
-static uint8_t pkt_out_buf[S3P_MAX_PKT_SIZE];
+static uint8_t pkt_out_buf[S3P_JUMBO_PKT_SIZE];
+// Request frames are encoded in place and sent in batches
+static uint8_t txq_buf[TXQ_SIZE];
+static s3p_txq_t txq;
+static uint8_t pipe_window = 1;
 static uint8_t seq_num;
+static s3p_rto_t rto;
+static uint8_t retries = S3P_RTO_DEF_RETRIES;
+static s3p_stats_t stats;
+static s3p_link_t s3p_link = { .stats = &stats };
+static struct cap_struct cap = { .fd = -1 };
+// Telemetry subscriptions, by node and subscription id
+typedef struct {
+    uint8_t node_id;
+    uint8_t sub_id;
+    uint16_t next_seq;
+    uint32_t samples;
+    uint32_t lost;
+    uint32_t last_node_ms;
+    uint32_t last_rx_ms;
+} telem_sub_t;
+static telem_sub_t telem_subs[TELEM_MAX_SUBS];
+static bool telem_show;
+static const char *cap_file;
+// Register store published to the other local processes, if any
+static const char *shm_name;
+static struct regshm_struct shm = { .fd = -1 };
+// Register samples archive directory, if any
+static const char *arc_dir;
+static struct arc_struct arc;
+// Registers of the last response, decoded
+static uint16_t item_ids[S3P_ITEMS_MAX(S3P_JUMBO_FRAME_SIZE)];
+static uint8_t item_types[S3P_ITEMS_MAX(S3P_JUMBO_FRAME_SIZE)];
+static uint32_t item_values[S3P_ITEMS_MAX(S3P_JUMBO_FRAME_SIZE)];
+static s3p_items_t items = { item_ids, item_types, item_values,
+    S3P_ITEMS_MAX(S3P_JUMBO_FRAME_SIZE) };
+// ... and their values as text, back to back
+static char item_strs[S3P_ITEMS_MAX(S3P_JUMBO_FRAME_SIZE) *
+    VALUE_SCALAR_MAX_SIZE];
+static uint8_t item_lens[S3P_ITEMS_MAX(S3P_JUMBO_FRAME_SIZE)];
 static uint8_t node_id = DEF_NODE_ID;
+// Remote capabilities (S3P_CAP_*), -1 if not yet known
+static int32_t node_caps = -1;
+static bool en_lz = true;
+static bool en_rs485;
+static bool en_low_latency = true;
+// Frame size ceiling for the negotiation with the node
+static uint16_t max_frame = S3P_JUMBO_FRAME_SIZE;
+static s3p_lz_enc_t lz_enc;
 static uint8_t manager_id = DEF_MANAGER_ID;
 static bool en_adv_cmds;
 
@@ -123,14 +192,33 @@ static void dump_ts(void)
 static void show_usage(char **argv)
 {
     DBG(0, "\n");
-    DBG(0, "Usage: %s [-a] [-d[d]] [-i id] [-m id] <ser_dev>\n", argv[0]);
+    DBG(0, "Usage: %s [-a] [-d[d]] [-i id] [-m id] [-r n] [-c file] [-z] [-f size]\n"
+            "       [-485] [-L] [-w n] [-S name]\n"
+            "       [-A dir] <ser_dev>\n",
+            argv[0]);
     DBG(0, "\n");
     DBG(0, "Where:\n");
     DBG(0, "  -a          enable advanced/debug commands\n");
     DBG(0, "  -d[d]       enable debug. More verbose with -dd\n");
     DBG(0, "  -i id       id/serial address of the remote node\n");
     DBG(0, "  -m id       id/serial address of the manager (this app)\n");
-    DBG(0, "  <ser_dev>   serial device (e.g. /dev/ttyUSB0\n");
+    DBG(0, "  -r n        retries after a response timeout (default %u)\n",
+            S3P_RTO_DEF_RETRIES);
+    DBG(0, "  -c file     append all TX/RX frames to a capture file\n");
+    DBG(0, "  -z          disable compressed VMEM transfers\n");
+    DBG(0, "  -f size     max frame size to negotiate with the node, %u to %u\n",
+            S3P_MAX_FRAME_SIZE, S3P_JUMBO_FRAME_SIZE);
+    DBG(0, "              (default %u)\n", S3P_JUMBO_FRAME_SIZE);
+    DBG(0, "  -485        half-duplex RS485, driver or RTS controlled DE\n");
+    DBG(0, "  -w n        pipelined download, up to n requests in flight (default\n");
+    DBG(0, "              1, max %u)\n", PIPE_MAX_WINDOW);
+    DBG(0, "  -L          keep the driver latency settings (no low latency\n");
+    DBG(0, "              flag, USB latency timer untouched)\n");
+    DBG(0, "  -S name     publish the registers read to the shared memory\n");
+    DBG(0, "              register store name (e.g. /s3p_regs)\n");
+    DBG(0, "  -A dir      archive the registers read, one time series per\n");
+    DBG(0, "              register (query with s3p-arc)\n");
+    DBG(0, "  <ser_dev>   serial device (e.g. /dev/ttyUSB0) or s3pd socket\n");
     DBG(0, "\n\n");
 }
 
@@ -151,6 +239,15 @@ static void show_help(void)
     DBG(0, "  reboot                                    - reboot remote node\n");
     DBG(0, "  get <1st_reg(d)>[+nregs(d)]               - read nregs starting from first_reg\n");
     DBG(0, "  get <reg(d)> [reg(d)] .. [reg(d)]         - read a space separated list of regs\n");
+    DBG(0, "  sub <id(d)> <1st_reg(d)>+<nregs(d)> <period_ms(d)> [change]\n");
+    DBG(0, "                                            - subscribe to periodic telemetry,\n");
+    DBG(0, "                                              [change] only if values changed\n");
+    DBG(0, "  unsub <id(d)>                             - cancel a telemetry subscription\n");
+    DBG(0, "  telem [secs(d)]                           - show telemetry subscriptions, or\n");
+    DBG(0, "                                              samples for secs seconds\n");
+    DBG(0, "  gget <1st_reg(d)>+<nregs(d)> <1st_node(d)>+<nnodes(d)> [guard_us(d)]\n");
+    DBG(0, "                                            - read nregs from nnodes with a single\n");
+    DBG(0, "                                              broadcast, time slotted responses\n");
     DBG(0, "  set <reg(d)> <vt(s)> <value>              - write reg value with of type vt\n");
     DBG(0, "  sget <reg(d)>                             - read string register\n");
     DBG(0, "  sset <reg(d)> <string(s)>                 - write string register\n");
@@ -161,6 +258,11 @@ static void show_help(void)
     DBG(0, "                                              if needed, [refresh] forces download\n");
     DBG(0, "  down[load] <addr(h)> <size(d)> <file(s)>  - download to a file from vmem\n");
     DBG(0, "  up[load]   <addr(h)> <file(s)>            - upload a file to vmem\n");
+    DBG(0, "  dup[load]  <addr(h)> <file(s)>            - delta upload, send only the blocks\n");
+    DBG(0, "                                              that differ, then verify\n");
+    DBG(0, "  verify <addr(h)> <size(d)> <file(s)>      - compare vmem with a file by CRC32\n");
+    DBG(0, "  stats [reset]                             - show or clear link counters and\n");
+    DBG(0, "                                              latency percentiles\n");
     DBG(0, "\n");
     if (en_adv_cmds) {
         DBG(0, "Advanced Commands:\n");
@@ -246,49 +348,232 @@ static uint16_t get_reg_id_by_name(const char *name)
 
 static uint8_t seq_inc(void)
 {
-    seq_num++;
-    seq_num = S3P_SEQ_MASKED(seq_num);
+    seq_num = S3P_LINK_SEQ_NEXT(&s3p_link, seq_num);
     return seq_num;
 }
 
 static bool check_seq(const s3p_packet_t *pkt_in)
 {
-    const uint8_t seq_in = S3P_SEQ_MASKED(pkt_in->flags_seq);
+    const uint8_t seq_in = pkt_in->seq;
     if (seq_in != seq_num) {
+        stats.cnt.seq_err++;
         DBG(1, "RESP: wrong seq, exp=0x%02X, recv=0x%02X\n", seq_num, seq_in);
         return false;
     }
     return true;
 }
 
-static bool wait_response(s3p_packet_t *pkt_in)
+static void handle_telemetry(const s3p_packet_t *pkt_in);
+
+// Read a frame, return 1 if parsed, 0 if discarded, -1 on timeout.
+// Telemetry frames are handed to the telemetry handler and skipped
+static int read_frame(s3p_packet_t *pkt_in, const uint32_t timeout_ms,
+        uint16_t *frame_len)
 {
     uint32_t last_ms;
-    bool timeout;
+    uint32_t elapsed_ms;
     int nbytes;
     uint8_t byt;
-    uint16_t rx_len = 0;
 
     last_ms = client_utils_get_ms();
-    while (! (timeout=client_utils_is_elapsed_ms(last_ms, RESP_TO_MS)) ) {
+    while ((elapsed_ms=client_utils_elapsed_ms(last_ms)) < timeout_ms) {
         nbytes = ser_read(&ser, &byt, 1);
-        if (!nbytes) {
-            usleep(BYTE_DELAY);
+        if (nbytes <= 0) {
+            // Sleep until data is available or the timeout expires
+            ser_poll(&ser, timeout_ms - elapsed_ms);
             continue;
         }
-        if (rx_len < S3P_MAX_FRAME_SIZE)
-            frame_buf[rx_len++] = byt;
+        if (frame_rx_len < S3P_LINK_FRAME_SIZE(&s3p_link))
+            frame_buf[frame_rx_len++] = byt;
 
         if (byt == S3P_COBS_DELIM) {
+            const uint64_t ts_ns = cap_file ? cap_now_ns() : 0;
+            const uint16_t rx_len = frame_rx_len;
+            frame_rx_len = 0;
+            *frame_len = rx_len;
             s3p_init_pkt(pkt_in, pkt_in_buf, S3P_ID_NONE, S3P_ID_NONE,
                     S3P_SEQ_NONE);
-            bool res = s3p_parse_frame(pkt_in, manager_id, frame_buf,
-                    rx_len-1);
+            bool res = s3p_link_parse_frame(&s3p_link, pkt_in, manager_id,
+                    frame_buf, rx_len-1);
+            if (cap_file)
+                cap_frame(&cap, ts_ns, CAP_DIR_RX, frame_buf, rx_len,
+                        res ? pkt_in : NULL);
+            if (res && pkt_in->type == PT_TELEMETRY) {
+                handle_telemetry(pkt_in);
+                continue;
+            }
             return res;
         }
     }
-    if (timeout)
-        DBG(0, "Response timeout\n");
+    return -1;
+}
+
+static bool wait_response(s3p_packet_t *pkt_in, const uint32_t timeout_ms,
+        uint16_t *frame_len)
+{
+    const int res = read_frame(pkt_in, timeout_ms, frame_len);
+
+    if (res < 0) {
+        DBG(1, "Response timeout (%u ms)\n", timeout_ms);
+        stats.cnt.timeouts++;
+    }
+    return res > 0;
+}
+
+static bool telem_active(void)
+{
+    for (int i=0; i<TELEM_MAX_SUBS; i++) {
+        if (telem_subs[i].node_id != S3P_ID_NONE)
+            return true;
+    }
+    return false;
+}
+
+// Drop the bytes received before a new command: stale responses, line
+// noise. With subscriptions the frames are read instead, not to lose the
+// samples received while idle
+static void discard_rx(void)
+{
+    s3p_packet_t pkt_in;
+    uint16_t rx_len;
+
+    if (telem_active()) {
+        while (read_frame(&pkt_in, 1, &rx_len) >= 0)
+            ;
+        return;
+    }
+    ser_discard(&ser);
+    frame_rx_len = 0;
+}
+
+static uint32_t link_data_size(void)
+{
+    return S3P_DATA_SIZE(S3P_LINK_FRAME_SIZE(&s3p_link));
+}
+
+static uint32_t link_chunk_size(void)
+{
+    return S3P_CHUNK_SIZE(S3P_LINK_FRAME_SIZE(&s3p_link));
+}
+
+// Expected response frame length, used for the timeout computation
+static uint16_t resp_len_hint(const s3p_packet_t *pkt_out)
+{
+    uint32_t data_len;
+
+    switch (pkt_out->type) {
+    case PT_READ_REGS:
+        data_len = 1 + S3P_SER_ITEM_SIZE *
+            ((pkt_out->data[2] << 8) | pkt_out->data[3]);
+        break;
+    case PT_READ_VMEM:
+    case PT_READ_VMEM_LZ:
+        data_len = 1 + ((pkt_out->data[4] << 8) | pkt_out->data[5]);
+        break;
+    default:
+        data_len = S3P_MAX_NAME_SIZE + 16;
+        break;
+    }
+    return S3P_FRAME_LEN(M_MIN(data_len, link_data_size()));
+}
+
+static bool txq_write(void *ctx, const uint8_t *buf, const uint32_t len)
+{
+    return ser_write(ctx, buf, len) == (int)len;
+}
+
+// Queue a request frame, to be sent on the next flush. Return the frame
+// size, 0 on error
+static uint16_t queue_frame(const s3p_packet_t *pkt_out)
+{
+    const uint8_t *frame;
+    const uint16_t size = s3p_txq_push(&txq, &s3p_link, pkt_out,
+            client_utils_get_ms(), &frame);
+
+    if (size && cap_file)
+        cap_frame(&cap, cap_now_ns(), CAP_DIR_TX, frame, size, pkt_out);
+    return size;
+}
+
+// Requests without side effects on the node, safe to execute again
+static bool is_idempotent(const uint8_t type)
+{
+    switch (type) {
+    case PT_READ_REGS:
+    case PT_READ_VMEM:
+    case PT_READ_STR_REG:
+    case PT_VMEM_CRC:
+    case PT_VMEM_HASHES:
+    case PT_READ_VMEM_LZ:
+    case PT_GROUP_READ:
+    case PT_S3P_INFO:
+    case PT_REG_INFO:
+    case PT_VMEM_INFO:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Send a request and wait for its response, retransmitting on timeout
+// or corrupted response up to the configured retry budget
+static bool transact(s3p_packet_t *pkt_out, s3p_packet_t *pkt_in)
+{
+    const uint16_t exp_len = resp_len_hint(pkt_out);
+    // Requests with side effects only to nodes recognizing the
+    // retransmissions, executed twice otherwise. Caps as last known, the
+    // info request would reuse the packet buffers
+    const uint8_t retries = is_idempotent(pkt_out->type) ||
+        (node_caps >= 0 && (node_caps & S3P_CAP_DEDUP)) ? rto.retries : 0;
+    uint32_t start_us;
+    uint32_t start_ms;
+    uint32_t elapsed_ms;
+    uint32_t to_ms;
+    uint16_t size;
+    uint16_t rx_len;
+
+    for (uint8_t attempt=0; attempt<=retries && !ctrlc; attempt++) {
+        if (attempt) {
+            // Reads get a new sequence, so that a late response to the
+            // previous attempt is not mistaken for this one. Requests with
+            // side effects keep theirs: the node recognizes the
+            // retransmission and does not execute it twice (spec,
+            // Retransmissions)
+            if (is_idempotent(pkt_out->type))
+                pkt_out->flags_seq = seq_inc();
+            stats.cnt.retries++;
+            DBG(1, "Retry %u of %u\n", attempt, retries);
+        }
+        size = queue_frame(pkt_out);
+        if (!size)
+            return false;
+
+        to_ms = s3p_rto_timeout_ms(&rto, pkt_out->dst_id, size, exp_len,
+                attempt);
+        // Node processing time depends on the range size, not on the RTT
+        if ((pkt_out->type == PT_VMEM_CRC || pkt_out->type == PT_VMEM_HASHES)
+                && to_ms < LONG_OP_TO_MS)
+            to_ms = LONG_OP_TO_MS;
+        start_us = client_utils_get_us();
+        start_ms = client_utils_get_ms();
+        if (!s3p_txq_flush(&txq)) {
+            DBG(1, "Ser write error!\n");
+            return false;
+        }
+
+        while ((elapsed_ms=client_utils_elapsed_ms(start_ms)) < to_ms) {
+            if (!wait_response(pkt_in, to_ms - elapsed_ms, &rx_len))
+                break;
+            // Skip stale responses to previous attempts
+            if (check_seq(pkt_in)) {
+                const uint32_t rtt_us = client_utils_get_us() - start_us;
+                s3p_rto_update(&rto, pkt_out->dst_id, rtt_us, size, rx_len);
+                s3p_stats_latency(&stats, pkt_out->type, rtt_us);
+                return true;
+            }
+        }
+    }
+    DBG(0, "Response timeout\n");
     return false;
 }
 
@@ -297,7 +582,6 @@ static bool exec_cmd(const uint8_t cmd_id, const uint32_t arg)
     s3p_packet_t pkt_out;
     s3p_packet_t pkt_in;
     int data_len = 0;
-    uint16_t size;
     uint8_t code;
 
     s3p_init_pkt(&pkt_out, pkt_out_buf, manager_id, node_id, seq_inc());
@@ -311,14 +595,7 @@ static bool exec_cmd(const uint8_t cmd_id, const uint32_t arg)
     // Header
     pkt_out.data_len = data_len;
     pkt_out.type = PT_EXEC_CMD;
-    size = s3p_make_frame(frame_buf, &pkt_out);
-    if (!size)
-        return false;
-
-    ser_write(&ser, frame_buf, size);
-    if (!wait_response(&pkt_in))
-        return false;
-    if (!check_seq(&pkt_in))
+    if (!transact(&pkt_out, &pkt_in))
         return false;
 
     code = pkt_in.data[0];
@@ -337,7 +614,6 @@ static bool exec_ping(void)
     s3p_packet_t pkt_out;
     s3p_packet_t pkt_in;
     int data_len = 0;
-    uint16_t size;
     uint8_t code;
     uint32_t start_ms;
 
@@ -349,15 +625,8 @@ static bool exec_ping(void)
     // Header
     pkt_out.data_len = data_len;
     pkt_out.type = PT_EXEC_CMD;
-    size = s3p_make_frame(frame_buf, &pkt_out);
-    if (!size)
-        return false;
-
-    ser_write(&ser, frame_buf, size);
     start_ms = client_utils_get_ms();
-    if (!wait_response(&pkt_in))
-        return false;
-    if (!check_seq(&pkt_in))
+    if (!transact(&pkt_out, &pkt_in))
         return false;
 
     code = pkt_in.data[0];
@@ -398,18 +667,71 @@ static void rlist_down_tip(void)
     }
 }
 
+// Decode the registers of a PT_READ_REGS_RESP like response, starting at
+// data offset size, into items, then publish them to the shared memory
+// register store and the archive. Return the registers count, -1 if the
+// item list is malformed
+static int32_t decode_regs(const s3p_packet_t *pkt_in, uint16_t size)
+{
+    const int32_t cnt = s3p_items_decode_pkt(&items, pkt_in, size);
+
+    if (cnt < 0) {
+        DBG(0, "Malformed register list (%u bytes)\n",
+                pkt_in->data_len - size);
+        return -1;
+    }
+    if (shm.fd < 0 && arc_dir == NULL)
+        return cnt;
+
+    const uint64_t ts_us = regshm_now_us();
+    for (int32_t i=0; i<cnt; i++) {
+        regshm_put(&shm, pkt_in->src_id, items.ids[i], items.types[i],
+                items.values[i], ts_us);
+        if (arc_dir != NULL)
+            arc_put(&arc, pkt_in->src_id, items.ids[i], items.types[i],
+                    items.values[i], ts_us / 1000);
+    }
+    return cnt;
+}
+
+// Show the first cnt decoded registers
+static void dump_regs(const int32_t cnt)
+{
+    const char *value_str = item_strs;
+    const char *name;
+
+    if (cnt <= 0)
+        return;
+    // Non scalar types are formatted as ""
+    value_fmt_batch(item_strs, sizeof(item_strs), items.types, items.values,
+            cnt, item_lens);
+    for (int32_t i=0; i<cnt; i++) {
+        const uint16_t id = items.ids[i];
+        const value_type_t vt = items.types[i];
+        name = get_reg_name_by_id(id);
+        if (VALUE_TYPE_IS_SCALAR(vt)) {
+            DBG(0, C_FNT "[%3u] " C_NRM CSEP  C_YLW " %3u " C_NRM CSEP \
+                    C_GRN " %-20s " C_NRM CSEP  C_BLU " %4s " C_NRM \
+                    CSEP " %10s\n", i + 1, id, name,
+                    value_type_str(vt), value_str);
+        }
+        else {
+            DBG(0, C_FNT "[%3u] " C_NRM CSEP  C_YLW " %3u " C_NRM CSEP \
+                    C_GRN " %-20s " C_NRM CSEP C_BLU " %4s " C_NRM \
+                    "NOT_SCALAR\n", i + 1, id, name,
+                    value_type_str(vt));
+        }
+        value_str += item_lens[i] + 1;
+    }
+}
+
 static bool exec_rregs(const uint16_t reg_id, const uint16_t regs_cnt)
 {
     s3p_packet_t pkt_out;
     s3p_packet_t pkt_in;
-    char value_str[VALUE_SCALAR_MAX_SIZE];
     int data_len = 0;
-    uint16_t cnt;
     uint16_t size;
-    uint16_t id;
     uint8_t code;
-    value_t value;
-    const char *name;
 
     s3p_init_pkt(&pkt_out, pkt_out_buf, manager_id, node_id, seq_inc());
     // Start reg id
@@ -421,18 +743,10 @@ static bool exec_rregs(const uint16_t reg_id, const uint16_t regs_cnt)
     // Header
     pkt_out.data_len = data_len;
     pkt_out.type = PT_READ_REGS;
-    size = s3p_make_frame(frame_buf, &pkt_out);
-    if (!size)
-        return false;
-
-    ser_write(&ser, frame_buf, size);
-    if (!wait_response(&pkt_in))
-        return false;
-    if (!check_seq(&pkt_in))
+    if (!transact(&pkt_out, &pkt_in))
         return false;
 
     size = 0;
-    cnt = 0;
     code = pkt_in.data[size++];
     DBG(1, "READ REGS RESP: data_len=%u, res_code=%u\n",
             pkt_in.data_len, code);
@@ -441,37 +755,170 @@ static bool exec_rregs(const uint16_t reg_id, const uint16_t regs_cnt)
         return false;
     }
 
-    while (size+S3P_SER_ITEM_SIZE <= pkt_in.data_len) {
-        // This is safe becaus size of union value.val is > 4
-        // Note that buf is not guaranteed to be 4 bytes aligned
-        // ID
-        id = ((uint16_t)pkt_in.data[size++]) << 8;
-        id |= (uint16_t)pkt_in.data[size++];
-        // Type
-        value.vt = ((uint8_t)pkt_in.data[size++]);
-        // Value
-        value.val.u32 = 0;
-        value.val.u32 |= ((uint32_t)pkt_in.data[size++]) << 24;
-        value.val.u32 |= ((uint32_t)pkt_in.data[size++]) << 16;
-        value.val.u32 |= ((uint32_t)pkt_in.data[size++]) << 8;
-        value.val.u32 |= (uint32_t)pkt_in.data[size++];
-        cnt++;
-        name = get_reg_name_by_id(id);
-        if (VALUE_TYPE_IS_SCALAR(value.vt)) {
-            value_dump(value_str, &value, VALUE_SCALAR_MAX_SIZE);
-            DBG(0, C_FNT "[%3u] " C_NRM CSEP  C_YLW " %3u " C_NRM CSEP \
-                    C_GRN " %-20s " C_NRM CSEP  C_BLU " %4s " C_NRM \
-                    CSEP " %10s\n", cnt, id, name,
-                    value_type_str(value.vt), value_str);
+    const int32_t cnt = decode_regs(&pkt_in, size);
+    dump_regs(cnt);
+    return cnt >= 0;
+}
+
+static telem_sub_t *find_telem_sub(const uint8_t node, const uint8_t sub_id,
+        const bool add)
+{
+    telem_sub_t *free_sub = NULL;
+
+    for (int i=0; i<TELEM_MAX_SUBS; i++) {
+        telem_sub_t *sub = &telem_subs[i];
+        if (sub->node_id == node && sub->sub_id == sub_id)
+            return sub;
+        if (sub->node_id == S3P_ID_NONE && free_sub == NULL)
+            free_sub = sub;
+    }
+    if (!add || free_sub == NULL)
+        return NULL;
+    memset(free_sub, 0x00, sizeof(telem_sub_t));
+    free_sub->node_id = node;
+    free_sub->sub_id = sub_id;
+    return free_sub;
+}
+
+// Unsolicited samples, outside of the request/response path
+static void handle_telemetry(const s3p_packet_t *pkt_in)
+{
+    if (pkt_in->data_len < S3P_TELEM_HDR_SIZE)
+        return;
+    const uint8_t sub_id = pkt_in->data[0];
+    const uint16_t seq = ((uint16_t)pkt_in->data[1] << 8) | pkt_in->data[2];
+    const uint32_t node_ms = ((uint32_t)pkt_in->data[3] << 24) |
+        ((uint32_t)pkt_in->data[4] << 16) | ((uint32_t)pkt_in->data[5] << 8) |
+        (uint32_t)pkt_in->data[6];
+    // Also subscriptions made before this session
+    telem_sub_t *sub = find_telem_sub(pkt_in->src_id, sub_id, true);
+    if (sub == NULL)
+        return;
+
+    if (sub->samples && seq != sub->next_seq)
+        sub->lost += (uint16_t)(seq - sub->next_seq);
+    sub->next_seq = seq + 1;
+    sub->samples++;
+    sub->last_node_ms = node_ms;
+    sub->last_rx_ms = client_utils_get_ms();
+    const int32_t cnt = decode_regs(pkt_in, S3P_TELEM_HDR_SIZE);
+
+    if (telem_show) {
+        DBG(0, C_YLW "Node %u" C_NRM " sub %u sample %u, node time %u ms\n",
+                pkt_in->src_id, sub_id, seq, node_ms);
+        dump_regs(cnt);
+    }
+}
+
+// Read the same registers from a range of nodes with a single broadcast
+// request, every node replies in its own time slot
+static bool exec_gread(const uint16_t reg_id, const uint16_t regs_cnt,
+        const uint8_t first_id, const uint8_t nodes_cnt, const uint32_t guard_us)
+{
+    s3p_packet_t pkt_out;
+    s3p_packet_t pkt_in;
+    bool replied[256] = { false };
+    int data_len = 0;
+    uint16_t size;
+    uint16_t rx_len;
+    uint8_t code;
+    uint16_t replies = 0;
+    uint32_t elapsed_ms;
+    uint32_t margin_ms = 0;
+
+    if (!nodes_cnt || first_id == S3P_ID_NONE ||
+            first_id + nodes_cnt > S3P_ID_BROADCAST) {
+        DBG(0, "Invalid nodes range\n");
+        return false;
+    }
+    // Nodes may not support jumbo frames
+    if (!regs_cnt || 1 + S3P_SER_ITEM_SIZE * regs_cnt > S3P_MAX_DATA_SIZE) {
+        DBG(0, "Invalid registers count\n");
+        return false;
+    }
+    // Response on the wire, plus guard time
+    const uint16_t resp_len = S3P_FRAME_LEN(1 + S3P_SER_ITEM_SIZE * regs_cnt);
+    const uint32_t slot = (s3p_rto_wire_us(&rto, resp_len) + guard_us +
+            S3P_SLOT_UNIT_US - 1) / S3P_SLOT_UNIT_US;
+    if (slot > 0xFFFF) {
+        DBG(0, "Slot time too long\n");
+        return false;
+    }
+
+    s3p_init_pkt(&pkt_out, pkt_out_buf, manager_id, S3P_ID_BROADCAST,
+            seq_inc());
+    // Start reg id
+    pkt_out.data[data_len++] = (uint8_t)(reg_id >> 8);
+    pkt_out.data[data_len++] = (uint8_t)reg_id;
+    // Regs count
+    pkt_out.data[data_len++] = (uint8_t)(regs_cnt >> 8);
+    pkt_out.data[data_len++] = (uint8_t)regs_cnt;
+    // Nodes range
+    pkt_out.data[data_len++] = first_id;
+    pkt_out.data[data_len++] = nodes_cnt;
+    // Slot time
+    pkt_out.data[data_len++] = (uint8_t)(slot >> 8);
+    pkt_out.data[data_len++] = (uint8_t)slot;
+    // Header
+    pkt_out.data_len = data_len;
+    pkt_out.type = PT_GROUP_READ;
+
+    size = queue_frame(&pkt_out);
+    if (!size)
+        return false;
+    // Collection window: request and all the slots on the wire, plus the
+    // worst processing time of the addressed nodes
+    for (uint16_t id=first_id; id<first_id+nodes_cnt; id++)
+        margin_ms = M_MAX(margin_ms, s3p_rto_timeout_ms(&rto, id, 0, 0, 0));
+    const uint32_t window_ms = margin_ms + (s3p_rto_wire_us(&rto, size) +
+            (uint32_t)nodes_cnt * slot * S3P_SLOT_UNIT_US) / 1000;
+    DBG(1, "Group read: slot %u us, window %u ms\n",
+            slot * S3P_SLOT_UNIT_US, window_ms);
+
+    const uint32_t start_us = client_utils_get_us();
+    const uint32_t start_ms = client_utils_get_ms();
+    if (!s3p_txq_flush(&txq)) {
+        DBG(1, "Ser write error!\n");
+        return false;
+    }
+
+    ctrlc = 0;
+    while (!ctrlc && replies < nodes_cnt &&
+            (elapsed_ms=client_utils_elapsed_ms(start_ms)) < window_ms) {
+        const int res = read_frame(&pkt_in, window_ms - elapsed_ms, &rx_len);
+        if (res < 0)
+            break;
+        if (!res || pkt_in.type != PT_GROUP_READ_RESP || !check_seq(&pkt_in))
+            continue;
+        const uint8_t id = pkt_in.src_id;
+        if (id < first_id || id - first_id >= nodes_cnt || replied[id])
+            continue;
+        replied[id] = true;
+        replies++;
+        s3p_stats_latency(&stats, PT_GROUP_READ,
+                client_utils_get_us() - start_us);
+
+        code = pkt_in.data[0];
+        DBG(0, C_YLW "Node %u" C_NRM " (slot %u)\n", id, id - first_id);
+        if (code != S3P_ERR_NONE) {
+            DBG(0, "Read error: %s (%u)\n", s3p_err_str(code), code);
+            continue;
         }
-        else {
-            DBG(0, C_FNT "[%3u] " C_NRM CSEP  C_YLW " %3u " C_NRM CSEP \
-                    C_GRN " %-20s " C_NRM CSEP C_BLU " %4s " C_NRM \
-                    "NOT_SCALAR\n", cnt, id, name,
-                    value_type_str(value.vt));
+        dump_regs(decode_regs(&pkt_in, 1));
+    }
+
+    DBG(0, "%u of %u nodes replied in %u us\n", replies, nodes_cnt,
+            client_utils_get_us() - start_us);
+    if (replies < nodes_cnt) {
+        stats.cnt.timeouts++;
+        DBG(0, "Missing:");
+        for (uint16_t id=first_id; id<first_id+nodes_cnt; id++) {
+            if (!replied[id])
+                DBG(0, " %u", id);
         }
+        DBG(0, "\n");
     }
-    return true;
+    return replies == nodes_cnt;
 }
 
 static bool exec_wreg(const uint16_t reg_id, const value_t *value)
@@ -496,14 +943,7 @@ static bool exec_wreg(const uint16_t reg_id, const value_t *value)
     // Header
     pkt_out.data_len = data_len;
     pkt_out.type = PT_WRITE_REG;
-    size = s3p_make_frame(frame_buf, &pkt_out);
-    if (!size)
-        return false;
-
-    ser_write(&ser, frame_buf, size);
-    if (!wait_response(&pkt_in))
-        return false;
-    if (!check_seq(&pkt_in))
+    if (!transact(&pkt_out, &pkt_in))
         return false;
 
     size = 0;
@@ -537,14 +977,7 @@ static bool exec_rstr(const uint16_t reg_id)
     // Header
     pkt_out.data_len = data_len;
     pkt_out.type = PT_READ_STR_REG;
-    size = s3p_make_frame(frame_buf, &pkt_out);
-    if (!size)
-        return false;
-
-    ser_write(&ser, frame_buf, size);
-    if (!wait_response(&pkt_in))
-        return false;
-    if (!check_seq(&pkt_in))
+    if (!transact(&pkt_out, &pkt_in))
         return false;
 
     size = 0;
@@ -571,6 +1004,25 @@ static bool exec_rstr(const uint16_t reg_id)
     return true;
 }
 
+// Parse the v1.01 PT_S3P_INFO_RESP fields, missing on older nodes:
+// capabilities and max frame size, negotiating the link frame size and
+// sequence width
+static void parse_info_ext(const s3p_packet_t *pkt_in)
+{
+    uint16_t frame = S3P_MAX_FRAME_SIZE;
+
+    node_caps = 0;
+    if (pkt_in->data_len >= 12)
+        node_caps = ((uint16_t)pkt_in->data[10] << 8) | pkt_in->data[11];
+    if (pkt_in->data_len >= 14)
+        frame = ((uint16_t)pkt_in->data[12] << 8) | pkt_in->data[13];
+    frame = M_MIN(frame, max_frame);
+    s3p_link.frame_size = frame > S3P_MAX_FRAME_SIZE ? frame : 0;
+    s3p_link.ext_seq = node_caps & S3P_CAP_EXT_SEQ;
+    DBG(1, "Node caps: 0x%04X, frame size: %u, seq mask: 0x%02X\n", node_caps,
+            S3P_LINK_FRAME_SIZE(&s3p_link), S3P_LINK_SEQ_MASK(&s3p_link));
+}
+
 static bool exec_info(void)
 {
     s3p_packet_t pkt_out;
@@ -588,14 +1040,7 @@ static bool exec_info(void)
     // Header
     pkt_out.data_len = data_len;
     pkt_out.type = PT_S3P_INFO;
-    size = s3p_make_frame(frame_buf, &pkt_out);
-    if (!size)
-        return false;
-
-    ser_write(&ser, frame_buf, size);
-    if (!wait_response(&pkt_in))
-        return false;
-    if (!check_seq(&pkt_in))
+    if (!transact(&pkt_out, &pkt_in))
         return false;
 
     size = 0;
@@ -620,6 +1065,7 @@ static bool exec_info(void)
     regs_cnt |= (uint16_t)pkt_in.data[size++];
     // VMEM rows
     vmem_rows = (uint16_t)pkt_in.data[size++];
+    parse_info_ext(&pkt_in);
     // Info
     DBG(0, "Remote node S3P info:\n");
     DBG(0, "  S3P ver  : %2u.%02u (local: %2u.%02u)\n", ver>>8,
@@ -628,6 +1074,16 @@ static bool exec_info(void)
     DBG(0, "  reg max  : %3u\n", reg_max_id);
     DBG(0, "  regs cnt : %3u\n", regs_cnt);
     DBG(0, "  vmem maps: %3u %s\n", vmem_rows, vmem_rows?"":"(NOT SUPPORTED)");
+    DBG(0, "  caps     : 0x%04X%s%s%s%s%s%s%s\n", node_caps,
+            node_caps & S3P_CAP_VMEM_CRC ? " vmem_crc" : "",
+            node_caps & S3P_CAP_VMEM_HASHES ? " vmem_hashes" : "",
+            node_caps & S3P_CAP_VMEM_LZ ? " vmem_lz" : "",
+            node_caps & S3P_CAP_EXT_SEQ ? " ext_seq" : "",
+            node_caps & S3P_CAP_GROUP_READ ? " group_read" : "",
+            node_caps & S3P_CAP_TELEMETRY ? " telemetry" : "",
+            node_caps & S3P_CAP_DEDUP ? " dedup" : "");
+    DBG(0, "  frame    : %4u (chunk %u)\n", S3P_LINK_FRAME_SIZE(&s3p_link),
+            link_chunk_size());
 
     return true;
 }
@@ -653,14 +1109,7 @@ static bool exec_rinfo(const uint16_t reg_id)
     // Header
     pkt_out.data_len = data_len;
     pkt_out.type = PT_REG_INFO;
-    size = s3p_make_frame(frame_buf, &pkt_out);
-    if (!size)
-        return false;
-
-    ser_write(&ser, frame_buf, size);
-    if (!wait_response(&pkt_in))
-        return false;
-    if (!check_seq(&pkt_in))
+    if (!transact(&pkt_out, &pkt_in))
         return false;
 
     size = 0;
@@ -725,17 +1174,10 @@ static bool exec_rlist(void)
     // Header
     pkt_out.data_len = data_len;
     pkt_out.type = PT_S3P_INFO;
-    uint16_t size = s3p_make_frame(frame_buf, &pkt_out);
-    if (!size)
-        return false;
-
-    ser_write(&ser, frame_buf, size);
-    if (!wait_response(&pkt_in))
-        return false;
-    if (!check_seq(&pkt_in))
+    if (!transact(&pkt_out, &pkt_in))
         return false;
 
-    size = 0;
+    uint16_t size = 0;
     code = pkt_in.data[size++];
     DBG(1, "S3P INFO RESP: data_len=%u, res_code=%u\n",
             pkt_in.data_len, code);
@@ -786,20 +1228,8 @@ static bool exec_rlist(void)
         // Header
         pkt_out.data_len = data_len;
         pkt_out.type = PT_REG_INFO;
-        uint16_t size = s3p_make_frame(frame_buf, &pkt_out);
-        if (!size)
-            break;
-        // Send msg
-        if (ser_write(&ser, frame_buf, size) < 0) {
-            DBG(1, "Ser write error!\n");
-            break;
-        }
-
         memset(&pkt_in, 0x00, sizeof(s3p_packet_t));
-        //ser_discard(&ser);
-        if (!wait_response(&pkt_in))
-            break;
-        if (!check_seq(&pkt_in))
+        if (!transact(&pkt_out, &pkt_in))
             break;
 
         size = 0;
@@ -897,17 +1327,10 @@ static bool exec_vlist(void)
     // Header
     pkt_out.data_len = data_len;
     pkt_out.type = PT_S3P_INFO;
-    uint16_t size = s3p_make_frame(frame_buf, &pkt_out);
-    if (!size)
-        return false;
-
-    ser_write(&ser, frame_buf, size);
-    if (!wait_response(&pkt_in))
-        return false;
-    if (!check_seq(&pkt_in))
+    if (!transact(&pkt_out, &pkt_in))
         return false;
 
-    size = 0;
+    uint16_t size = 0;
     code = pkt_in.data[size++];
     DBG(1, "VMEM INFO RESP: data_len=%u, res_code=%u\n",
             pkt_in.data_len, code);
@@ -956,20 +1379,8 @@ static bool exec_vlist(void)
         // Header
         pkt_out.data_len = data_len;
         pkt_out.type = PT_VMEM_INFO;
-        size = s3p_make_frame(frame_buf, &pkt_out);
-        if (!size)
-            break;
-        // Send msg
-        if (ser_write(&ser, frame_buf, size) < 0) {
-            DBG(1, "Ser write error!\n");
-            break;
-        }
-
         memset(&pkt_in, 0x00, sizeof(s3p_packet_t));
-        //ser_discard(&ser);
-        if (!wait_response(&pkt_in))
-            break;
-        if (!check_seq(&pkt_in))
+        if (!transact(&pkt_out, &pkt_in))
             break;
 
         size = 0;
@@ -1079,14 +1490,7 @@ static bool exec_wstr(const uint16_t reg_id, const char *str)
     // Header
     pkt_out.data_len = data_len;
     pkt_out.type = PT_WRITE_STR_REG;
-    size = s3p_make_frame(frame_buf, &pkt_out);
-    if (!size)
-        return false;
-
-    ser_write(&ser, frame_buf, size);
-    if (!wait_response(&pkt_in))
-        return false;
-    if (!check_seq(&pkt_in))
+    if (!transact(&pkt_out, &pkt_in))
         return false;
 
     size = 0;
@@ -1101,100 +1505,410 @@ static bool exec_wstr(const uint16_t reg_id, const char *str)
     return true;
 }
 
-static bool exec_down(uint32_t addr, const uint32_t tot_size, const char *file)
+// Remote capabilities, cached until the node id changes
+static uint16_t get_caps(void)
 {
     s3p_packet_t pkt_out;
-    s3p_packet_t pkt_in = { 0 };
-    uint16_t size;
-    size_t nbytes;
-    uint32_t rsize = 0;
-    uint32_t rbytes = 0;
-    uint8_t vmem_buf[S3P_MAX_CHUNK_SIZE];
-    uint8_t code;
-    uint32_t wsize;
+    s3p_packet_t pkt_in;
 
-    DBG(0, "Download %u bytes to file '%s' from address 0x%08X\n",
-            tot_size, file, addr);
+    if (node_caps >= 0)
+        return (uint16_t)node_caps;
 
-    FILE *fp = fopen(file, "w");
-    if (fp == NULL) {
-        DBG(0, "Can't open file '%s' for writing\n", file);
-        return false;
-    }
+    s3p_init_pkt(&pkt_out, pkt_out_buf, manager_id, node_id, seq_inc());
+    // Header
+    pkt_out.data_len = 0;
+    pkt_out.type = PT_S3P_INFO;
+    if (!transact(&pkt_out, &pkt_in) || pkt_in.data[0] != S3P_ERR_NONE)
+        return 0;
 
-    ctrlc = 0;
-    while (!ctrlc && rbytes<tot_size) {
-        int data_len = 0;
-        s3p_init_pkt(&pkt_out, pkt_out_buf, manager_id, node_id, seq_inc());
-        // Address
-        pkt_out.data[data_len++] = (uint8_t)(addr >> 24);
-        pkt_out.data[data_len++] = (uint8_t)(addr >> 16);
-        pkt_out.data[data_len++] = (uint8_t)(addr >> 8);
-        pkt_out.data[data_len++] = (uint8_t)addr;
-        // Read size
-        rsize = M_MIN(S3P_MAX_CHUNK_SIZE, tot_size-rbytes);
-        pkt_out.data[data_len++] = (uint8_t)(rsize >> 8);
-        pkt_out.data[data_len++] = (uint8_t)rsize;
-        // Header
-        pkt_out.data_len = data_len;
-        pkt_out.type = PT_READ_VMEM;
+    parse_info_ext(&pkt_in);
 
-        DBG(1, "\nCHUNK REQ: rsize=%u, rbytes=%u\n", rsize, rbytes);
-        size = s3p_make_frame(frame_buf, &pkt_out);
-        if (!size)
-            return false;
+    return (uint16_t)node_caps;
+}
 
-        memset(&pkt_in, 0x00, sizeof(s3p_packet_t));
-        ser_write(&ser, frame_buf, size);
-        //ser_discard(&ser);
-        if (!wait_response(&pkt_in))
-            return false;
-        if (!check_seq(&pkt_in))
-            return false;
+static bool use_lz(void)
+{
+    // Also negotiates the frame size
+    return (get_caps() & S3P_CAP_VMEM_LZ) && en_lz;
+}
 
-        // Code
-        code = pkt_in.data[0];
-        wsize = M_MIN(pkt_in.data_len-1, rsize);
-        DBG(1, "CHUNK: code=0x%02X, data_len=%u, wsize=%u\n",
-                code, pkt_in.data_len, wsize);
-        if (code == 0) {
-            memcpy(vmem_buf, pkt_in.data+1, wsize);
-            nbytes = fwrite(vmem_buf, 1, wsize, fp);
-            rbytes += nbytes;
-            DBG(2, "[0x%08X] +%4lu (%4u)\n", addr, nbytes, rbytes);
-            addr += nbytes;
-            DBG(0, "Received %6u of %6u (%3u%%)\r", rbytes, tot_size, (rbytes*100)/tot_size);
-            fflush(stdout);
-        }
-        else {
-            DBG(0, "\nError: %s (%u)\n", s3p_err_str(code), code);
-            break;
-        }
-    }
+// Build a VMEM chunk read request
+static void read_vmem_req(s3p_packet_t *pkt_out, const uint32_t addr,
+        const uint32_t size, const bool lz)
+{
+    int data_len = 0;
 
-    fclose(fp);
-    DBG(0, "\nDownload complete: got %u bytes of %u\n", rbytes, tot_size);
-    if (rbytes != tot_size) {
-        DBG(0, "File download error\n");
-        return false;
+    s3p_init_pkt(pkt_out, pkt_out_buf, manager_id, node_id, seq_inc());
+    // Address
+    pkt_out->data[data_len++] = (uint8_t)(addr >> 24);
+    pkt_out->data[data_len++] = (uint8_t)(addr >> 16);
+    pkt_out->data[data_len++] = (uint8_t)(addr >> 8);
+    pkt_out->data[data_len++] = (uint8_t)addr;
+    // Read size
+    pkt_out->data[data_len++] = (uint8_t)(size >> 8);
+    pkt_out->data[data_len++] = (uint8_t)size;
+    if (lz) {
+        // Max stream size, fitting the negotiated frame size
+        const uint16_t max_stream = link_data_size() - 3;
+        pkt_out->data[data_len++] = (uint8_t)(max_stream >> 8);
+        pkt_out->data[data_len++] = (uint8_t)max_stream;
     }
-
-    DBG(0, "File download ok\n");
-    return true;
+    // Header
+    pkt_out->data_len = data_len;
+    pkt_out->type = lz ? PT_READ_VMEM_LZ : PT_READ_VMEM;
 }
 
-static bool exec_up(uint32_t addr, const char *file)
+// Copy a VMEM chunk read response to buf, return the bytes read, -1 on
+// error
+static int32_t read_vmem_resp(const s3p_packet_t *pkt_in, uint8_t *buf,
+        const uint32_t size, const bool lz)
 {
-    s3p_packet_t pkt_out;
-    s3p_packet_t pkt_in = { 0 };
-    int data_len;
-    uint16_t size;
-    uint8_t code;
-    size_t nbytes;
-    uint32_t wbytes = 0;
-    uint8_t vmem_buf[S3P_MAX_CHUNK_SIZE];
+    const uint8_t code = pkt_in->data[0];
+    int32_t rsize;
 
-    DBG(0, "Upload file '%s' to address 0x%08X\n", file, addr);
+    DBG(1, "CHUNK: code=0x%02X, data_len=%u\n", code, pkt_in->data_len);
+    if (code != S3P_ERR_NONE) {
+        DBG(0, "\nError: %s (%u)\n", s3p_err_str(code), code);
+        return -1;
+    }
+    if (!lz) {
+        rsize = M_MIN(pkt_in->data_len-1, size);
+        memcpy(buf, pkt_in->data+1, rsize);
+        return rsize;
+    }
+
+    if (pkt_in->data_len < 3) {
+        DBG(0, "\nInvalid compressed chunk\n");
+        return -1;
+    }
+    const uint16_t raw = ((uint16_t)pkt_in->data[1] << 8) | pkt_in->data[2];
+    rsize = s3p_lz_decode_buf(pkt_in->data+3, pkt_in->data_len-3, buf,
+            M_MIN(raw, size));
+    if (rsize != raw) {
+        DBG(0, "\nCompressed chunk decode error\n");
+        return -1;
+    }
+    DBG(1, "CHUNK: %u compressed bytes, %u raw\n", pkt_in->data_len-3, raw);
+    return rsize;
+}
+
+// Read a single chunk from VMEM, return the bytes read, -1 on error
+static int32_t read_vmem(const uint32_t addr, uint8_t *buf,
+        const uint32_t size, const bool lz)
+{
+    s3p_packet_t pkt_out;
+    s3p_packet_t pkt_in = { 0 };
+
+    read_vmem_req(&pkt_out, addr, size, lz);
+    DBG(1, "\nCHUNK REQ: rsize=%u%s\n", size, lz ? " (lz)" : "");
+    if (!transact(&pkt_out, &pkt_in))
+        return -1;
+    return read_vmem_resp(&pkt_in, buf, size, lz);
+}
+
+// Pipelined read: up to window chunk requests in flight, sent in batches
+// of frames with a single write. Chunks lost or read short are requested
+// again. Return the bytes read, -1 on error
+static int32_t read_vmem_pipe(const uint32_t addr, uint8_t *buf,
+        const uint32_t tot_size, const uint32_t chunk_size, const bool lz,
+        uint8_t window)
+{
+    struct {
+        uint32_t off;
+        uint32_t len;
+        uint32_t sent_ms;
+        uint32_t sent_us;
+        uint32_t to_ms;
+        uint8_t seq;
+        uint8_t attempt;
+        bool busy;
+    } slots[PIPE_MAX_WINDOW] = { 0 };
+    // Ranges to request again: lost or short responses
+    struct { uint32_t off; uint32_t len; uint8_t attempt; } redo[PIPE_MAX_WINDOW];
+    uint8_t redo_cnt = 0;
+    uint32_t next_off = 0;
+    uint32_t rbytes = 0;
+    uint8_t inflight = 0;
+    s3p_packet_t pkt_out;
+    s3p_packet_t pkt_in;
+    uint16_t rx_len;
+
+    // Responses are told apart by sequence only
+    window = M_MIN(window, M_MIN(PIPE_MAX_WINDOW,
+                (S3P_LINK_SEQ_MASK(&s3p_link) + 1) / 2));
+    ctrlc = 0;
+    while (!ctrlc && rbytes < tot_size) {
+        // Refill the window once half of it is free, so that requests go
+        // out in batches
+        if (inflight <= window / 2) {
+            for (int i=0; i<window; i++) {
+                if (slots[i].busy)
+                    continue;
+                uint32_t off, len;
+                uint8_t attempt = 0;
+                if (redo_cnt) {
+                    redo_cnt--;
+                    off = redo[redo_cnt].off;
+                    len = redo[redo_cnt].len;
+                    attempt = redo[redo_cnt].attempt;
+                }
+                else if (next_off < tot_size) {
+                    off = next_off;
+                    len = M_MIN(chunk_size, tot_size - next_off);
+                    next_off += len;
+                }
+                else
+                    break;
+                read_vmem_req(&pkt_out, addr + off, len, lz);
+                const uint16_t size = queue_frame(&pkt_out);
+                if (!size)
+                    return -1;
+                slots[i].off = off;
+                slots[i].len = len;
+                slots[i].seq = pkt_out.seq;
+                slots[i].attempt = attempt;
+                slots[i].sent_ms = client_utils_get_ms();
+                slots[i].sent_us = client_utils_get_us();
+                // Also the wire time of the requests and responses ahead
+                slots[i].to_ms = s3p_rto_timeout_ms(&rto, node_id, size,
+                        resp_len_hint(&pkt_out), attempt) +
+                    (window * s3p_rto_wire_us(&rto, size +
+                        resp_len_hint(&pkt_out))) / 1000;
+                slots[i].busy = true;
+                inflight++;
+            }
+            if (!s3p_txq_flush(&txq)) {
+                DBG(1, "Ser write error!\n");
+                return -1;
+            }
+        }
+
+        // Wait up to the nearest deadline
+        uint32_t wait_ms = S3P_RTO_MAX_MS;
+        for (int i=0; i<window; i++) {
+            if (!slots[i].busy)
+                continue;
+            const uint32_t elapsed_ms = client_utils_elapsed_ms(slots[i].sent_ms);
+            wait_ms = M_MIN(wait_ms, elapsed_ms < slots[i].to_ms ?
+                    slots[i].to_ms - elapsed_ms : 0);
+        }
+        const int res = read_frame(&pkt_in, wait_ms, &rx_len);
+        if (res > 0) {
+            int i;
+            for (i=0; i<window; i++) {
+                if (slots[i].busy && slots[i].seq == pkt_in.seq)
+                    break;
+            }
+            // Stale response to a timed out request
+            if (i == window) {
+                stats.cnt.seq_err++;
+                continue;
+            }
+            s3p_stats_latency(&stats, lz ? PT_READ_VMEM_LZ : PT_READ_VMEM,
+                    client_utils_get_us() - slots[i].sent_us);
+            slots[i].busy = false;
+            inflight--;
+            const int32_t rsize = read_vmem_resp(&pkt_in, buf + slots[i].off,
+                    slots[i].len, lz);
+            if (rsize <= 0)
+                return -1;
+            rbytes += rsize;
+            if ((uint32_t)rsize < slots[i].len) {
+                redo[redo_cnt].off = slots[i].off + rsize;
+                redo[redo_cnt].len = slots[i].len - rsize;
+                redo[redo_cnt].attempt = 0;
+                redo_cnt++;
+            }
+            DBG(0, "Received %6u of %6u (%3u%%)\r", rbytes, tot_size,
+                    (uint32_t)((uint64_t)rbytes*100/tot_size));
+            fflush(stdout);
+            continue;
+        }
+        if (res == -1)
+            stats.cnt.timeouts++;
+
+        // Expired requests go again, with a new sequence
+        for (int i=0; i<window; i++) {
+            if (!slots[i].busy ||
+                    client_utils_elapsed_ms(slots[i].sent_ms) < slots[i].to_ms)
+                continue;
+            slots[i].busy = false;
+            inflight--;
+            if (slots[i].attempt >= rto.retries) {
+                DBG(0, "\nResponse timeout\n");
+                return -1;
+            }
+            stats.cnt.retries++;
+            redo[redo_cnt].off = slots[i].off;
+            redo[redo_cnt].len = slots[i].len;
+            redo[redo_cnt].attempt = slots[i].attempt + 1;
+            redo_cnt++;
+        }
+    }
+
+    return ctrlc ? -1 : (int32_t)rbytes;
+}
+
+static bool exec_down(uint32_t addr, const uint32_t tot_size, const char *file)
+{
+    size_t nbytes;
+    int32_t rsize;
+    uint32_t rbytes = 0;
+    uint8_t vmem_buf[LZ_CHUNK_SIZE];
+    const bool lz = use_lz();
+    const uint32_t chunk_size = lz ? LZ_CHUNK_SIZE : link_chunk_size();
+
+    DBG(0, "Download %u bytes to file '%s' from address 0x%08X%s\n",
+            tot_size, file, addr, lz ? " (compressed)" : "");
+
+    FILE *fp = fopen(file, "w");
+    if (fp == NULL) {
+        DBG(0, "Can't open file '%s' for writing\n", file);
+        return false;
+    }
+
+    if (pipe_window > 1 && tot_size) {
+        uint8_t *buf = malloc(tot_size);
+        if (buf == NULL) {
+            fclose(fp);
+            DBG(0, "Out of memory\n");
+            return false;
+        }
+        rsize = read_vmem_pipe(addr, buf, tot_size, chunk_size, lz,
+                pipe_window);
+        if (rsize > 0)
+            rbytes = fwrite(buf, 1, rsize, fp);
+        free(buf);
+    }
+
+    ctrlc = 0;
+    while (!ctrlc && rbytes<tot_size && pipe_window <= 1) {
+        rsize = read_vmem(addr, vmem_buf, M_MIN(chunk_size, tot_size-rbytes),
+                lz);
+        if (rsize <= 0)
+            break;
+        nbytes = fwrite(vmem_buf, 1, rsize, fp);
+        rbytes += nbytes;
+        DBG(2, "[0x%08X] +%4lu (%4u)\n", addr, nbytes, rbytes);
+        addr += nbytes;
+        DBG(0, "Received %6u of %6u (%3u%%)\r", rbytes, tot_size, (rbytes*100)/tot_size);
+        fflush(stdout);
+    }
+
+    fclose(fp);
+    DBG(0, "\nDownload complete: got %u bytes of %u\n", rbytes, tot_size);
+    if (rbytes != tot_size) {
+        DBG(0, "File download error\n");
+        return false;
+    }
+
+    DBG(0, "File download ok\n");
+    return true;
+}
+
+// Write a single chunk to VMEM
+static bool write_vmem(const uint32_t addr, const uint8_t *buf,
+        const uint32_t size)
+{
+    s3p_packet_t pkt_out;
+    s3p_packet_t pkt_in = { 0 };
+    int data_len = 0;
+    uint8_t code;
+
+    s3p_init_pkt(&pkt_out, pkt_out_buf, manager_id, node_id, seq_inc());
+    // Address
+    pkt_out.data[data_len++] = (uint8_t)(addr >> 24);
+    pkt_out.data[data_len++] = (uint8_t)(addr >> 16);
+    pkt_out.data[data_len++] = (uint8_t)(addr >> 8);
+    pkt_out.data[data_len++] = (uint8_t)addr;
+    // Data
+    memcpy(pkt_out.data+data_len, buf, size);
+    data_len += size;
+    // Header
+    pkt_out.data_len = data_len;
+    pkt_out.type = PT_WRITE_VMEM;
+
+    if (!transact(&pkt_out, &pkt_in))
+        return false;
+
+    // Code
+    code = pkt_in.data[0];
+    if (code != S3P_ERR_NONE) {
+        DBG(0, "\nError: %s (%u)\n", s3p_err_str(code), code);
+        return false;
+    }
+    return true;
+}
+
+// Write a compressed chunk to VMEM, as much of buf as fits in a single
+// packet. Return the raw bytes written, -1 on error
+static int32_t write_vmem_lz(const uint32_t addr, const uint8_t *buf,
+        const uint32_t size)
+{
+    s3p_packet_t pkt_out;
+    s3p_packet_t pkt_in = { 0 };
+    int data_len = 0;
+    uint8_t code;
+    uint16_t raw;
+
+    s3p_init_pkt(&pkt_out, pkt_out_buf, manager_id, node_id, seq_inc());
+    // Address
+    pkt_out.data[data_len++] = (uint8_t)(addr >> 24);
+    pkt_out.data[data_len++] = (uint8_t)(addr >> 16);
+    pkt_out.data[data_len++] = (uint8_t)(addr >> 8);
+    pkt_out.data[data_len++] = (uint8_t)addr;
+    // Data, raw size filled after encoding
+    data_len += 2;
+    data_len += s3p_lz_encode(&lz_enc, buf, M_MIN(size, LZ_CHUNK_SIZE),
+            pkt_out.data+data_len, link_data_size() - 6, &raw);
+    pkt_out.data[4] = (uint8_t)(raw >> 8);
+    pkt_out.data[5] = (uint8_t)raw;
+    // Header
+    pkt_out.data_len = data_len;
+    pkt_out.type = PT_WRITE_VMEM_LZ;
+
+    DBG(1, "\n[0x%08X] +%4u (lz %u)\n", addr, raw, data_len-6);
+    if (!transact(&pkt_out, &pkt_in))
+        return -1;
+
+    // Code
+    code = pkt_in.data[0];
+    if (code != S3P_ERR_NONE) {
+        DBG(0, "\nError: %s (%u)\n", s3p_err_str(code), code);
+        return -1;
+    }
+    return raw;
+}
+
+// Write a buffer to VMEM, compressed if supported by the node
+static bool write_vmem_any(uint32_t addr, const uint8_t *buf, uint32_t size,
+        const bool lz)
+{
+    while (size && !ctrlc) {
+        int32_t wsize = M_MIN(size, link_chunk_size());
+        if (lz)
+            wsize = write_vmem_lz(addr, buf, size);
+        else if (!write_vmem(addr, buf, wsize))
+            wsize = -1;
+        if (wsize <= 0)
+            return false;
+        addr += wsize;
+        buf += wsize;
+        size -= wsize;
+    }
+    return !size;
+}
+
+static bool exec_up(uint32_t addr, const char *file)
+{
+    size_t nbytes;
+    uint32_t wbytes = 0;
+    uint8_t vmem_buf[LZ_CHUNK_SIZE];
+    const bool lz = use_lz();
+    const uint32_t chunk_size = lz ? LZ_CHUNK_SIZE : link_chunk_size();
+
+    DBG(0, "Upload file '%s' to address 0x%08X%s\n", file, addr,
+            lz ? " (compressed)" : "");
 
     FILE *fp = fopen(file, "r");
     if (fp == NULL) {
@@ -1206,47 +1920,15 @@ static bool exec_up(uint32_t addr, const char *file)
     fseek(fp, 0L, SEEK_SET);
 
     ctrlc = 0;
-    while (!ctrlc && (nbytes = fread(vmem_buf, 1, S3P_MAX_CHUNK_SIZE, fp)) > 0) {
+    while (!ctrlc && (nbytes = fread(vmem_buf, 1, chunk_size, fp)) > 0) {
         DBG(1, "\n[0x%08X] +%4lu\n", addr, nbytes);
 
-        data_len = 0;
-        s3p_init_pkt(&pkt_out, pkt_out_buf, manager_id, node_id, seq_inc());
-        // Address
-        pkt_out.data[data_len++] = (uint8_t)(addr >> 24);
-        pkt_out.data[data_len++] = (uint8_t)(addr >> 16);
-        pkt_out.data[data_len++] = (uint8_t)(addr >> 8);
-        pkt_out.data[data_len++] = (uint8_t)addr;
-        // Data
-        memcpy(pkt_out.data+data_len, vmem_buf, nbytes);
-        data_len += nbytes;
-        // Header
-        pkt_out.data_len = data_len;
-        pkt_out.type = PT_WRITE_VMEM;
-
-        size = s3p_make_frame(frame_buf, &pkt_out);
-        if (!size)
-            return false;
-
-        memset(&pkt_in, 0x00, sizeof(s3p_packet_t));
-        ser_write(&ser, frame_buf, size);
-        //ser_discard(&ser);
-        if (!wait_response(&pkt_in))
-            return false;
-        if (!check_seq(&pkt_in))
-            return false;
-
-        // Code
-        code = pkt_in.data[0];
-        if (code == S3P_ERR_NONE) {
-            addr += nbytes;
-            wbytes += nbytes;
-            DBG(0, "Sent %6u of %6u (%3u%%)\r", wbytes, tot_size, (wbytes*100)/tot_size);
-            fflush(stdout);
-        }
-        else {
-            DBG(0, "\nError: %s (%u)\n", s3p_err_str(code), code);
+        if (!write_vmem_any(addr, vmem_buf, nbytes, lz))
             break;
-        }
+        addr += nbytes;
+        wbytes += nbytes;
+        DBG(0, "Sent %6u of %6u (%3u%%)\r", wbytes, tot_size, (wbytes*100)/tot_size);
+        fflush(stdout);
     }
 
     DBG(0, "\nUpload complete: sent %u bytes of %u\n", wbytes, tot_size);
@@ -1261,6 +1943,452 @@ static bool exec_up(uint32_t addr, const char *file)
     return true;
 }
 
+// Get the CRC32 of a VMEM range computed by the node
+static bool vmem_crc(const uint32_t addr, const uint32_t tot_size,
+        uint32_t *crc)
+{
+    s3p_packet_t pkt_out;
+    s3p_packet_t pkt_in;
+    int data_len = 0;
+    uint8_t code;
+
+    s3p_init_pkt(&pkt_out, pkt_out_buf, manager_id, node_id, seq_inc());
+    // Address
+    pkt_out.data[data_len++] = (uint8_t)(addr >> 24);
+    pkt_out.data[data_len++] = (uint8_t)(addr >> 16);
+    pkt_out.data[data_len++] = (uint8_t)(addr >> 8);
+    pkt_out.data[data_len++] = (uint8_t)addr;
+    // Size
+    pkt_out.data[data_len++] = (uint8_t)(tot_size >> 24);
+    pkt_out.data[data_len++] = (uint8_t)(tot_size >> 16);
+    pkt_out.data[data_len++] = (uint8_t)(tot_size >> 8);
+    pkt_out.data[data_len++] = (uint8_t)tot_size;
+    // Digest type
+    pkt_out.data[data_len++] = S3P_DIGEST_CRC32;
+    // Header
+    pkt_out.data_len = data_len;
+    pkt_out.type = PT_VMEM_CRC;
+    if (!transact(&pkt_out, &pkt_in))
+        return false;
+
+    code = pkt_in.data[0];
+    DBG(1, "VMEM CRC RESP: data_len=%u, res_code=%u\n", pkt_in.data_len, code);
+    if (code != S3P_ERR_NONE) {
+        DBG(0, "Digest error: %s (%u)\n", s3p_err_str(code), code);
+        return false;
+    }
+    if (pkt_in.data_len < 6 || pkt_in.data[1] != S3P_DIGEST_CRC32) {
+        DBG(0, "Invalid digest response\n");
+        return false;
+    }
+    *crc = ((uint32_t)pkt_in.data[2]) << 24;
+    *crc |= ((uint32_t)pkt_in.data[3]) << 16;
+    *crc |= ((uint32_t)pkt_in.data[4]) << 8;
+    *crc |= (uint32_t)pkt_in.data[5];
+
+    return true;
+}
+
+// CRC32 of a VMEM range read back, for nodes without PT_VMEM_CRC
+static bool vmem_read_crc(const uint32_t addr, const uint32_t tot_size,
+        uint32_t *crc)
+{
+    int32_t rsize;
+    uint32_t rbytes = 0;
+    const bool lz = use_lz();
+    const uint32_t chunk_size = lz ? LZ_CHUNK_SIZE : link_chunk_size();
+
+    uint8_t *buf = malloc(tot_size + 1);
+    if (buf == NULL) {
+        DBG(0, "Out of memory\n");
+        return false;
+    }
+    if (pipe_window > 1 && tot_size) {
+        rsize = read_vmem_pipe(addr, buf, tot_size, chunk_size, lz,
+                pipe_window);
+        if (rsize > 0)
+            rbytes = rsize;
+    }
+    ctrlc = 0;
+    while (!ctrlc && rbytes < tot_size && pipe_window <= 1) {
+        rsize = read_vmem(addr + rbytes, buf + rbytes,
+                M_MIN(chunk_size, tot_size - rbytes), lz);
+        if (rsize <= 0)
+            break;
+        rbytes += rsize;
+    }
+    *crc = crc32_ieee(buf, rbytes, CRC32_START);
+    free(buf);
+    if (rbytes != tot_size) {
+        DBG(0, "Read back error: got %u bytes of %u\n", rbytes, tot_size);
+        return false;
+    }
+    return true;
+}
+
+// CRC32 of a VMEM range, computed by the node if supported
+static bool range_crc(const uint32_t addr, const uint32_t tot_size,
+        uint32_t *crc)
+{
+    if (get_caps() & S3P_CAP_VMEM_CRC)
+        return vmem_crc(addr, tot_size, crc);
+    DBG(0, "Node %u without VMEM CRC support, reading the range back\n",
+            node_id);
+    return vmem_read_crc(addr, tot_size, crc);
+}
+
+static bool exec_verify(const uint32_t addr, const uint32_t tot_size,
+        const char *file)
+{
+    uint8_t buf[4096];
+    size_t nbytes;
+    uint32_t rbytes = 0;
+    uint32_t crc = CRC32_START;
+    uint32_t remote_crc;
+
+    DBG(0, "Verify %u bytes at address 0x%08X against file '%s'\n",
+            tot_size, addr, file);
+
+    FILE *fp = fopen(file, "r");
+    if (fp == NULL) {
+        DBG(0, "Can't open file '%s' for reading\n", file);
+        return false;
+    }
+    while (rbytes < tot_size &&
+            (nbytes = fread(buf, 1, M_MIN(sizeof(buf), tot_size-rbytes), fp)) > 0) {
+        crc = crc32_ieee(buf, nbytes, crc);
+        rbytes += nbytes;
+    }
+    fclose(fp);
+    if (rbytes != tot_size) {
+        DBG(0, "File '%s' is shorter than %u bytes\n", file, tot_size);
+        return false;
+    }
+
+    if (!range_crc(addr, tot_size, &remote_crc))
+        return false;
+
+    DBG(0, "CRC32 local 0x%08X, remote 0x%08X: %s\n", crc, remote_crc,
+            crc == remote_crc ? C_GRN "MATCH" C_NRM : C_RED "MISMATCH" C_NRM);
+    return crc == remote_crc;
+}
+
+typedef struct {
+    const uint8_t *buf;
+    uint32_t size;
+    uint32_t *crcs;
+    uint32_t first;
+    uint32_t last;
+} hash_job_t;
+
+static void *hash_blocks(void *arg)
+{
+    hash_job_t *job = arg;
+    for (uint32_t i=job->first; i<job->last; i++) {
+        const uint32_t off = i * S3P_MAX_CHUNK_SIZE;
+        job->crcs[i] = crc32_ieee(job->buf + off,
+                M_MIN(S3P_MAX_CHUNK_SIZE, job->size - off), CRC32_START);
+    }
+    return NULL;
+}
+
+// Local block hashes, spread across all cores
+static void hash_file_blocks(const uint8_t *buf, const uint32_t size,
+        uint32_t *crcs, const uint32_t blocks)
+{
+    pthread_t tid[DUP_MAX_THREADS];
+    hash_job_t jobs[DUP_MAX_THREADS];
+    bool running[DUP_MAX_THREADS] = { false };
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    threads = threads < 1 ? 1 : M_MIN(threads, DUP_MAX_THREADS);
+    const uint32_t per_thread = (blocks + threads - 1) / threads;
+    for (int t=0; t<threads; t++) {
+        jobs[t].buf = buf;
+        jobs[t].size = size;
+        jobs[t].crcs = crcs;
+        jobs[t].first = M_MIN(t * per_thread, blocks);
+        jobs[t].last = M_MIN(jobs[t].first + per_thread, blocks);
+        if (t && !pthread_create(&tid[t], NULL, hash_blocks, &jobs[t]))
+            running[t] = true;
+        else if (t)
+            hash_blocks(&jobs[t]);
+    }
+    hash_blocks(&jobs[0]);
+    for (int t=1; t<threads; t++) {
+        if (running[t])
+            pthread_join(tid[t], NULL);
+    }
+}
+
+// Get remote CRC32 of cnt blocks of bsize bytes each, starting at addr
+static bool vmem_hashes(const uint32_t addr, const uint16_t bsize,
+        const uint16_t cnt, uint32_t *crcs)
+{
+    s3p_packet_t pkt_out;
+    s3p_packet_t pkt_in;
+    int data_len = 0;
+    uint8_t code;
+
+    s3p_init_pkt(&pkt_out, pkt_out_buf, manager_id, node_id, seq_inc());
+    // Address
+    pkt_out.data[data_len++] = (uint8_t)(addr >> 24);
+    pkt_out.data[data_len++] = (uint8_t)(addr >> 16);
+    pkt_out.data[data_len++] = (uint8_t)(addr >> 8);
+    pkt_out.data[data_len++] = (uint8_t)addr;
+    // Block size
+    pkt_out.data[data_len++] = (uint8_t)(bsize >> 8);
+    pkt_out.data[data_len++] = (uint8_t)bsize;
+    // Blocks count
+    pkt_out.data[data_len++] = (uint8_t)(cnt >> 8);
+    pkt_out.data[data_len++] = (uint8_t)cnt;
+    // Digest type
+    pkt_out.data[data_len++] = S3P_DIGEST_CRC32;
+    // Header
+    pkt_out.data_len = data_len;
+    pkt_out.type = PT_VMEM_HASHES;
+    if (!transact(&pkt_out, &pkt_in))
+        return false;
+
+    code = pkt_in.data[0];
+    DBG(1, "VMEM HASHES RESP: data_len=%u, res_code=%u\n", pkt_in.data_len,
+            code);
+    if (code != S3P_ERR_NONE) {
+        DBG(0, "Block hashes error: %s (%u)\n", s3p_err_str(code), code);
+        return false;
+    }
+    if (pkt_in.data_len != 2 + 4*cnt || pkt_in.data[1] != S3P_DIGEST_CRC32) {
+        DBG(0, "Invalid block hashes response\n");
+        return false;
+    }
+    for (uint16_t i=0; i<cnt; i++) {
+        const uint8_t *p = &pkt_in.data[2 + 4*i];
+        crcs[i] = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+            ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+    }
+    return true;
+}
+
+static bool exec_dup(const uint32_t addr, const char *file)
+{
+    uint32_t remote[(S3P_DATA_SIZE(S3P_JUMBO_FRAME_SIZE) - 2) / 4];
+    uint32_t sent = 0;
+    uint32_t done = 0;
+    uint32_t remote_crc;
+    bool res = false;
+
+    const bool lz = use_lz();
+    const uint32_t max_hashes = (link_data_size() - 2) / 4;
+
+    DBG(0, "Delta upload file '%s' to address 0x%08X\n", file, addr);
+
+    FILE *fp = fopen(file, "r");
+    if (fp == NULL) {
+        DBG(0, "Can't open file '%s' for reading\n", file);
+        return false;
+    }
+    fseek(fp, 0L, SEEK_END);
+    const uint32_t tot_size = (uint32_t)ftell(fp);
+    fseek(fp, 0L, SEEK_SET);
+    const uint32_t blocks = (tot_size + S3P_MAX_CHUNK_SIZE - 1) / S3P_MAX_CHUNK_SIZE;
+    uint8_t *buf = malloc(tot_size + 1);
+    uint32_t *crcs = malloc((blocks + 1) * sizeof(uint32_t));
+    if (buf == NULL || crcs == NULL ||
+            fread(buf, 1, tot_size, fp) != tot_size) {
+        DBG(0, "Can't read file '%s'\n", file);
+        goto out;
+    }
+
+    hash_file_blocks(buf, tot_size, crcs, blocks);
+
+    ctrlc = 0;
+    // Nothing to compare against: send all the blocks
+    if (!(get_caps() & S3P_CAP_VMEM_HASHES)) {
+        DBG(0, "Node %u without VMEM hashes support, uploading the whole file\n",
+                node_id);
+        if (!write_vmem_any(addr, buf, tot_size, lz))
+            goto out;
+        sent = done = blocks;
+    }
+    while (!ctrlc && done < blocks) {
+        const uint32_t baddr = addr + done * S3P_MAX_CHUNK_SIZE;
+        // A trailing partial block is hashed on its own
+        const uint32_t full = tot_size / S3P_MAX_CHUNK_SIZE - M_MIN(done,
+                tot_size / S3P_MAX_CHUNK_SIZE);
+        const uint16_t bsize = full ? S3P_MAX_CHUNK_SIZE :
+            tot_size - done * S3P_MAX_CHUNK_SIZE;
+        const uint16_t cnt = full ? M_MIN(full, max_hashes) : 1;
+
+        if (!vmem_hashes(baddr, bsize, cnt, remote))
+            goto out;
+        for (uint16_t i=0; i<cnt && !ctrlc; i++) {
+            const uint32_t b = done + i;
+            if (remote[i] == crcs[b])
+                continue;
+            DBG(1, "\nBlock %u differs, local 0x%08X remote 0x%08X\n", b,
+                    crcs[b], remote[i]);
+            if (!write_vmem_any(addr + b * S3P_MAX_CHUNK_SIZE,
+                        buf + b * S3P_MAX_CHUNK_SIZE, b < blocks-1 ?
+                        S3P_MAX_CHUNK_SIZE : bsize, lz))
+                goto out;
+            sent++;
+        }
+        done += cnt;
+        DBG(0, "Checked %5u of %5u blocks, sent %5u (%3u%%)\r", done, blocks,
+                sent, (done*100)/blocks);
+        fflush(stdout);
+    }
+    if (ctrlc)
+        goto out;
+
+    DBG(0, "\nDelta upload complete: sent %u blocks of %u (%u bytes)\n",
+            sent, blocks, tot_size);
+    // Final whole range verify
+    if (!range_crc(addr, tot_size, &remote_crc))
+        goto out;
+    if (remote_crc != crc32_ieee(buf, tot_size, CRC32_START)) {
+        DBG(0, "Verify " C_RED "MISMATCH" C_NRM ", file upload error\n");
+        goto out;
+    }
+    DBG(0, "Verify " C_GRN "MATCH" C_NRM ", file upload ok\n");
+    res = true;
+
+out:
+    fclose(fp);
+    free(buf);
+    free(crcs);
+    return res;
+}
+
+static bool exec_sub(const uint8_t sub_id, const uint16_t reg_id,
+        const uint16_t regs_cnt, const uint16_t period_ms, const uint8_t flags)
+{
+    s3p_packet_t pkt_out;
+    s3p_packet_t pkt_in;
+    int data_len = 0;
+    uint8_t code;
+
+    // Unsolicited node frames would collide with the requests
+    if (en_rs485 && period_ms) {
+        DBG(0, "Telemetry needs a full-duplex link, not available with -485\n");
+        return false;
+    }
+    if (!(get_caps() & S3P_CAP_TELEMETRY)) {
+        DBG(0, "Telemetry not supported by node %u\n", node_id);
+        return false;
+    }
+
+    s3p_init_pkt(&pkt_out, pkt_out_buf, manager_id, node_id, seq_inc());
+    // Subscription id
+    pkt_out.data[data_len++] = sub_id;
+    // Start reg id
+    pkt_out.data[data_len++] = (uint8_t)(reg_id >> 8);
+    pkt_out.data[data_len++] = (uint8_t)reg_id;
+    // Regs count
+    pkt_out.data[data_len++] = (uint8_t)(regs_cnt >> 8);
+    pkt_out.data[data_len++] = (uint8_t)regs_cnt;
+    // Period
+    pkt_out.data[data_len++] = (uint8_t)(period_ms >> 8);
+    pkt_out.data[data_len++] = (uint8_t)period_ms;
+    // Flags
+    pkt_out.data[data_len++] = flags;
+    // Header
+    pkt_out.data_len = data_len;
+    pkt_out.type = PT_SUBSCRIBE;
+    if (!transact(&pkt_out, &pkt_in))
+        return false;
+
+    code = pkt_in.data[0];
+    if (code != S3P_ERR_NONE) {
+        DBG(0, "Subscribe error: %s (%u)\n", s3p_err_str(code), code);
+        return false;
+    }
+
+    telem_sub_t *sub = find_telem_sub(node_id, sub_id, period_ms);
+    if (!period_ms && sub != NULL)
+        sub->node_id = S3P_ID_NONE;
+    else if (sub != NULL)
+        memset(&sub->next_seq, 0x00, sizeof(telem_sub_t) -
+                offsetof(telem_sub_t, next_seq));
+    DBG(0, "Subscription %u %s\n", sub_id, period_ms ? "active" : "cancelled");
+    return true;
+}
+
+// Show the samples for secs seconds, or only the subscriptions table if 0
+static void exec_telem(const uint32_t secs)
+{
+    s3p_packet_t pkt_in;
+    uint16_t rx_len;
+
+    if (secs) {
+        const uint32_t start_ms = client_utils_get_ms();
+        uint32_t elapsed_ms;
+
+        telem_show = true;
+        ctrlc = 0;
+        while (!ctrlc && (elapsed_ms=client_utils_elapsed_ms(start_ms)) <
+                secs * 1000)
+            read_frame(&pkt_in, secs * 1000 - elapsed_ms, &rx_len);
+        telem_show = false;
+    }
+    else {
+        // Drain the samples received while idle
+        while (read_frame(&pkt_in, 1, &rx_len) >= 0)
+            ;
+    }
+
+    DBG(0, C_FNT " node | sub |  samples |     lost | node time (ms) | age (ms)\n");
+    DBG(0, "------+-----+----------+----------+----------------+---------\n" C_NRM);
+    for (int i=0; i<TELEM_MAX_SUBS; i++) {
+        const telem_sub_t *sub = &telem_subs[i];
+        if (sub->node_id == S3P_ID_NONE)
+            continue;
+        DBG(0, C_YLW " %4u " C_NRM CSEP " %3u " CSEP " %8u " CSEP " %8u " CSEP \
+                " %14u " CSEP " %8u\n", sub->node_id, sub->sub_id,
+                sub->samples, sub->lost, sub->last_node_ms,
+                sub->samples ? client_utils_elapsed_ms(sub->last_rx_ms) : 0);
+    }
+}
+
+static void show_stats(void)
+{
+    const s3p_counters_t *c = &stats.cnt;
+
+    DBG(0, "Link counters:\n");
+    DBG(0, "  frames tx/rx : %u / %u\n", c->frames_tx, c->frames_rx);
+    DBG(0, "  bytes tx/rx  : %llu / %llu\n",
+            (unsigned long long)c->bytes_tx, (unsigned long long)c->bytes_rx);
+    DBG(0, "  cobs errors  : %u (null %u, overflow %u, zero %u, short %u)\n",
+            c->cobs_err[0] + c->cobs_err[1] + c->cobs_err[2] + c->cobs_err[3],
+            c->cobs_err[0], c->cobs_err[1], c->cobs_err[2], c->cobs_err[3]);
+    DBG(0, "  size errors  : %u\n", c->size_err);
+    DBG(0, "  crc errors   : %u\n", c->crc_err);
+    DBG(0, "  dst mismatch : %u\n", c->dst_err);
+    DBG(0, "  timeouts     : %u\n", c->timeouts);
+    DBG(0, "  seq errors   : %u\n", c->seq_err);
+    DBG(0, "  retries      : %u\n", c->retries);
+    DBG(0, "  tx writes    : %u\n", txq.writes);
+    if (ser.hd_mode != SER_HD_OFF) {
+        const struct ser_turn_struct *t = &ser.turn;
+        DBG(0, "  turnaround   : %u / %u / %u / %u us (last/min/avg/max)\n",
+                t->last_us, t->min_us,
+                t->cnt ? (uint32_t)(t->sum_us / t->cnt) : 0, t->max_us);
+    }
+    DBG(0, "\n");
+    DBG(0, C_FNT " request       |  count |    min |    p50 |    p90 |    p99 |    max (us)\n");
+    DBG(0, "---------------+--------+--------+--------+--------+--------+---------\n" C_NRM);
+    for (int t=0; t<S3P_STATS_TYPES; t++) {
+        const s3p_hist_t *h = &stats.lat[t];
+        if (!h->cnt)
+            continue;
+        DBG(0, C_GRN " %-13s " C_NRM CSEP " %6u " CSEP " %6u " CSEP " %6u " CSEP \
+                " %6u " CSEP " %6u " CSEP " %6u\n", s3p_type_str(t << 1),
+                h->cnt, h->min_us, s3p_hist_percentile(h, 50),
+                s3p_hist_percentile(h, 90), s3p_hist_percentile(h, 99),
+                h->max_us);
+    }
+}
+
 static bool manage_cmd(const char *cmd, const char *args)
 {
     bool res = true;
@@ -1271,6 +2399,9 @@ static bool manage_cmd(const char *cmd, const char *args)
         int args_cnt = sscanf(args, "%hhu", &id);
         if (args_cnt == 1) {
             node_id = id;
+            node_caps = -1;
+            s3p_link.frame_size = 0;
+            s3p_link.ext_seq = false;
         }
         DBG(0, "Node id=0x%02X %u\n", node_id, node_id);
     }
@@ -1290,6 +2421,47 @@ static bool manage_cmd(const char *cmd, const char *args)
     else if (IS_EQUAL(cmd, "reboot")) {
         return exec_cmd(CT_REBOOT, 0);
     }
+    else if (IS_EQUAL(cmd, "sub")) {
+        uint8_t sub_id;
+        uint16_t reg_id, regs_cnt, period_ms;
+        char mode[16] = "";
+        int args_cnt = sscanf(args, "%hhu %hu+%hu %hu %15s", &sub_id, &reg_id,
+                &regs_cnt, &period_ms, mode);
+        if (args_cnt < 4 || !period_ms) {
+            DBG(0, "Arg(s) missing or wrong\n");
+            return false;
+        }
+        return exec_sub(sub_id, reg_id, regs_cnt, period_ms,
+                IS_EQUAL(mode, "change") ? S3P_TELEM_F_ON_CHANGE : 0);
+    }
+    else if (IS_EQUAL(cmd, "unsub")) {
+        uint8_t sub_id;
+        if (sscanf(args, "%hhu", &sub_id) != 1) {
+            DBG(0, "Arg(s) missing or wrong\n");
+            return false;
+        }
+        return exec_sub(sub_id, 0, 0, 0, 0);
+    }
+    else if (IS_EQUAL(cmd, "telem")) {
+        uint32_t secs = 0;
+        sscanf(args, "%u", &secs);
+        exec_telem(secs);
+    }
+    else if (IS_EQUAL(cmd, "gget")) {
+        uint16_t reg_id, regs_cnt;
+        uint8_t first_id, nodes_cnt;
+        uint32_t guard_us = GREAD_GUARD_US;
+        int args_cnt = sscanf(args, "%hu+%hu %hhu+%hhu %u", &reg_id, &regs_cnt,
+                &first_id, &nodes_cnt, &guard_us);
+        if (args_cnt < 4) {
+            DBG(0, "Arg(s) missing or wrong\n");
+            return false;
+        }
+        reg_header();
+        res = exec_gread(reg_id, regs_cnt, first_id, nodes_cnt, guard_us);
+        rlist_down_tip();
+        return res;
+    }
     else if (IS_EQUAL(cmd, "get")) {
         uint16_t reg_id, regs_cnt;
         char reg_name[32] = "";
@@ -1356,26 +2528,16 @@ static bool manage_cmd(const char *cmd, const char *args)
             return false;
         }
         value_t value;
-        value.vt = value_type_from_str(vt_str);
-        if (value.vt == VT_EMPTY) {
+        const value_type_t vt = value_type_from_str(vt_str);
+        if (vt == VT_EMPTY) {
             DBG(0, "Unknown value type: %s\n", vt_str);
             return false;
         }
         DBG(1, "WREG: type='%s', reg_id=%u, value_str='%s'\n",
-                value_type_str(value.vt), reg_id, value_str);
-        if (value.vt == VT_U8)  { args_cnt = sscanf(value_str, "%hhu", &(value.val.u8)) ; }
-        if (value.vt == VT_I8)  { args_cnt = sscanf(value_str, "%hhi", &(value.val.i8)) ; }
-        if (value.vt == VT_X8)  { args_cnt = sscanf(value_str, "%hhx", &(value.val.u8)) ; }
-        if (value.vt == VT_U16) { args_cnt = sscanf(value_str, "%hu",  &(value.val.u16)); }
-        if (value.vt == VT_I16) { args_cnt = sscanf(value_str, "%hi",  &(value.val.i16)); }
-        if (value.vt == VT_X16) { args_cnt = sscanf(value_str, "%hx",  &(value.val.u16)); }
-        if (value.vt == VT_U32) { args_cnt = sscanf(value_str, "%u",   &(value.val.u32)); }
-        if (value.vt == VT_I32) { args_cnt = sscanf(value_str, "%i",   &(value.val.i32)); }
-        if (value.vt == VT_X32) { args_cnt = sscanf(value_str, "%x",   &(value.val.u32)); }
-        if (value.vt == VT_FLT) { args_cnt = sscanf(value_str, "%f",   &(value.val.flt)); }
-
-        if (args_cnt != 1) {
-            DBG(0, "Arg(s) missing or wrong\n");
+                value_type_str(vt), reg_id, value_str);
+        if (value_parse(&value, vt, value_str)) {
+            DBG(0, "Wrong or out of range %s value: %s\n",
+                    value_type_str(vt), value_str);
             return false;
         }
         return exec_wreg(reg_id, &value);
@@ -1473,6 +2635,39 @@ static bool manage_cmd(const char *cmd, const char *args)
         }
         return exec_up(addr, file);
     }
+    else if (IS_EQUAL(cmd, "dup") || IS_EQUAL(cmd, "dupload")) {
+        uint32_t addr;
+        char file[256];
+        int args_cnt = sscanf(args, "%x %s", &addr, file);
+        if (args_cnt != 2) {
+            DBG(0, "Arg(s) missing or wrong\n");
+            return false;
+        }
+        return exec_dup(addr, file);
+    }
+    else if (IS_EQUAL(cmd, "verify")) {
+        uint32_t addr;
+        uint32_t tot_size = 0;
+        char file[256];
+        int args_cnt = sscanf(args, "%x %u %s", &addr, &tot_size, file);
+        if (args_cnt != 3) {
+            DBG(0, "Arg(s) missing or wrong\n");
+            return false;
+        }
+        return exec_verify(addr, tot_size, file);
+    }
+    else if (IS_EQUAL(cmd, "stats")) {
+        char str[32];
+        int args_cnt = sscanf(args, "%s", str);
+        if (args_cnt == 1 && IS_EQUAL(str, "reset")) {
+            s3p_stats_init(&stats);
+            memset(&ser.turn, 0x00, sizeof(ser.turn));
+            txq.writes = 0;
+            DBG(0, "Stats cleared\n");
+        }
+        else
+            show_stats();
+    }
     else if (IS_EQUAL(cmd, "h") || IS_EQUAL(cmd, "help") || IS_EQUAL(cmd, "?")) {
         show_help();
     }
@@ -1572,6 +2767,60 @@ int main(int argc, char **argv)
             argc--;
             argc--;
         }
+        if (argc>2 && !strcmp(argv[1], "-c")) {
+            cap_file = argv[2];
+            argv = &argv[2];
+            argc--;
+            argc--;
+        }
+        if (argc>1 && !strcmp(argv[1], "-485")) {
+            en_rs485 = true;
+            argv = &argv[1];
+            argc--;
+        }
+        if (argc>1 && !strcmp(argv[1], "-L")) {
+            en_low_latency = false;
+            argv = &argv[1];
+            argc--;
+        }
+        if (argc>1 && !strcmp(argv[1], "-z")) {
+            en_lz = false;
+            argv = &argv[1];
+            argc--;
+        }
+        if (argc>2 && !strcmp(argv[1], "-f")) {
+            const int size = atoi(argv[2]);
+            max_frame = size < S3P_MAX_FRAME_SIZE ? S3P_MAX_FRAME_SIZE :
+                M_MIN(size, S3P_JUMBO_FRAME_SIZE);
+            argv = &argv[2];
+            argc--;
+            argc--;
+        }
+        if (argc>2 && !strcmp(argv[1], "-w")) {
+            const int window = atoi(argv[2]);
+            pipe_window = window < 1 ? 1 : M_MIN(window, PIPE_MAX_WINDOW);
+            argv = &argv[2];
+            argc--;
+            argc--;
+        }
+        if (argc>2 && !strcmp(argv[1], "-A")) {
+            arc_dir = argv[2];
+            argv = &argv[2];
+            argc--;
+            argc--;
+        }
+        if (argc>2 && !strcmp(argv[1], "-S")) {
+            shm_name = argv[2];
+            argv = &argv[2];
+            argc--;
+            argc--;
+        }
+        if (argc>2 && !strcmp(argv[1], "-r")) {
+            retries = (uint8_t)atoi(argv[2]);
+            argv = &argv[2];
+            argc--;
+            argc--;
+        }
     }
 
     if (argc < 2) {
@@ -1585,13 +2834,25 @@ int main(int argc, char **argv)
             node_id==DEF_NODE_ID?"DEFAULT":"CUSTOM");
     DBG(0, "Manager id (us) : 0x%02X %3u (%s)\n", manager_id, manager_id,
             manager_id==DEF_MANAGER_ID?"DEFAULT":"CUSTOM");
+    DBG(0, "Retries         : %u\n", retries);
+    DBG(0, "Download window : %u\n", pipe_window);
+    DBG(0, "Capture file    : %s\n", cap_file ? cap_file : "NONE");
+    DBG(0, "Register store  : %s\n", shm_name ? shm_name : "NONE");
+    DBG(0, "Archive dir     : %s\n", arc_dir ? arc_dir : "NONE");
 
     // Set debug level
     s3p_set_debug_level(_dbg_lvl);
 
-    // Open port
-    DBG(0, "Opening serial port '%s'\n", argv[1]);
-    int res = ser_open(&ser, argv[1], 230400, 'N', 8, 1);
+    // Open port, or connect to a s3pd gateway socket
+    struct stat st;
+    int res;
+    if (!stat(argv[1], &st) && S_ISSOCK(st.st_mode)) {
+        DBG(0, "Connecting to gateway '%s'\n", argv[1]);
+        res = ser_open_unix(&ser, argv[1], 230400);
+    } else {
+        DBG(0, "Opening serial port '%s'\n", argv[1]);
+        res = ser_open(&ser, argv[1], 230400, 'N', 8, 1, en_low_latency);
+    }
     if (res) {
         DBG(0, "Error opening serial port, res=%d\n", res);
         return -1;
@@ -1599,6 +2860,35 @@ int main(int argc, char **argv)
 
     ser_discard(&ser);
 
+    // Failures from here on restore the port settings on the way out
+    res = -1;
+    if (en_rs485 && ser_set_rs485(&ser, true)) {
+        DBG(0, "Error enabling half-duplex mode\n");
+        goto close_ser;
+    }
+    DBG(0, "Half-duplex     : %s\n", ser_hd_mode_str(ser.hd_mode));
+
+    s3p_txq_init(&txq, txq_buf, sizeof(txq_buf), 0, 0, txq_write, &ser);
+
+    // Timeouts are derived from the line speed and the measured RTT
+    s3p_rto_init(&rto, ser.baud, 1 + ser.data_bit + (ser.parity != 'N') +
+            ser.stop_bit, retries);
+
+    if (cap_file && cap_open(&cap, cap_file, ser.baud)) {
+        DBG(0, "Error opening capture file '%s'\n", cap_file);
+        goto close_ser;
+    }
+
+    if (shm_name && regshm_create(&shm, shm_name, REGSHM_DEF_REGS)) {
+        DBG(0, "Error creating register store '%s'\n", shm_name);
+        goto close_cap;
+    }
+
+    if (arc_dir && arc_open(&arc, arc_dir)) {
+        DBG(0, "Error opening archive dir '%s'\n", arc_dir);
+        goto close_shm;
+    }
+
     //DBG("\nInteractive console. Press CTRL-C to exit\n");
     //signal(SIGTERM, catch_signal);
     signal(SIGINT, catch_signal);
@@ -1665,7 +2955,7 @@ int main(int argc, char **argv)
         args_off++;
         ctrlc = 0;
         while (!ctrlc) {
-            ser_discard(&ser);
+            discard_rx();
             if (repeat) {
                 if (clean) {
                     printf("\e[1;1H\e[2J");
@@ -1691,7 +2981,30 @@ exit:
 #ifdef USE_READLINE
     write_history(HISTORY_FILE);
 #endif
+    res = 0;
+    if (arc_dir) {
+        // Writes the buffered samples
+        arc_close(&arc);
+        DBG(0, "Archived %llu samples of %u registers, %llu chunks, "
+                "%llu bytes (%u dropped)\n", (unsigned long long)arc.samples,
+                arc.series, (unsigned long long)arc.chunks,
+                (unsigned long long)arc.bytes, arc.drops);
+    }
+close_shm:
+    if (shm_name) {
+        DBG(0, "Register store: %llu updates (%u ids out of range)\n",
+                (unsigned long long)shm.hdr->updates, shm.drops);
+        regshm_close(&shm);
+    }
+close_cap:
+    if (cap_file) {
+        cap_close(&cap);
+        DBG(0, "Captured %u frames (%u dropped)\n", cap.records, cap.drops);
+    }
+close_ser:
+    // Also restores the driver latency settings
+    ser_close(&ser);
 
-    return 0;
+    return res;
 }
 
@@ -2,6 +2,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <sys/time.h>
+#include <time.h>
 
 uint32_t client_utils_get_ms(void)
 {
@@ -11,6 +12,14 @@ uint32_t client_utils_get_ms(void)
     return tv.tv_sec*1000U + tv.tv_usec/1000U;
 }
 
+uint32_t client_utils_get_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec*1000000U + ts.tv_nsec/1000U;
+}
+
 uint32_t client_utils_elapsed_ms(const uint32_t last_ms)
 {
     return (uint32_t)(client_utils_get_ms() - last_ms);
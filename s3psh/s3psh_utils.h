@@ -5,6 +5,7 @@
 #include <stdbool.h>
 
 uint32_t client_utils_get_ms(void);
+uint32_t client_utils_get_us(void);
 uint32_t client_utils_elapsed_ms(const uint32_t last_ms);
 bool client_utils_is_elapsed_ms(const uint32_t last_ms, const uint32_t period_ms);
 
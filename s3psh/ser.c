@@ -2,10 +2,18 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <string.h>
+#include <stdlib.h>
+#include <libgen.h>
+#include <limits.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <sys/time.h>
+#include <time.h>
+#include <poll.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <linux/serial.h>
 #include "ser.h"
 
 #define termios asmtermios
@@ -21,9 +29,130 @@
 //#include "s3p_dbg.h"
 //#define SER_DBG(...)     DBG(0, __VA_ARGS__)
 
+static const struct ser_backend posix_backend;
+
+#define USB_LATENCY_PATH "/sys/bus/usb-serial/devices/%s/latency_timer"
+
+// Latency timer sysfs attribute of USB serial (e.g. FTDI) adapters
+static bool usb_latency_path(const struct ser_struct * const ser, char *path,
+        const size_t size)
+{
+    char real[PATH_MAX];
+
+    // Also for /dev/serial/by-id/ links
+    if (realpath(ser->device, real) == NULL)
+        return false;
+    snprintf(path, size, USB_LATENCY_PATH, basename(real));
+    return access(path, F_OK) == 0;
+}
+
+static int usb_latency_get(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    int ms = -1;
+
+    if (fp == NULL)
+        return -1;
+    if (fscanf(fp, "%d", &ms) != 1)
+        ms = -1;
+    fclose(fp);
+    return ms;
+}
+
+static int usb_latency_set(const char *path, const int ms)
+{
+    FILE *fp = fopen(path, "w");
+    int rc;
+
+    if (fp == NULL)
+        return -1;
+    rc = fprintf(fp, "%d", ms) < 0 ? -1 : 0;
+    if (fclose(fp))
+        rc = -1;
+    return rc;
+}
+
+// Low latency profile: no driver side RX batching. Failures only leave the
+// default latency, so they are reported but not fatal
+static void ser_set_low_latency(struct ser_struct * const ser)
+{
+    struct serial_struct ss;
+    char path[PATH_MAX + 64];
+    bool low_lat = false;
+    int usb_ms = -1;
+
+    if (!ioctl(ser->fd, TIOCGSERIAL, &ss)) {
+        low_lat = ss.flags & ASYNC_LOW_LATENCY;
+        if (!low_lat) {
+            const int old_flags = ss.flags;
+            ss.flags |= ASYNC_LOW_LATENCY;
+            if (!ioctl(ser->fd, TIOCSSERIAL, &ss)) {
+                ser->old_serial_flags = old_flags;
+                low_lat = true;
+            }
+            else
+                SER_DBG("WARNING Can't set ASYNC_LOW_LATENCY on %s (%s)\n",
+                        ser->device, strerror(errno));
+        }
+    }
+
+    if (usb_latency_path(ser, path, sizeof(path))) {
+        usb_ms = usb_latency_get(path);
+        if (usb_ms > SER_USB_LATENCY_MS) {
+            if (!usb_latency_set(path, SER_USB_LATENCY_MS)) {
+                ser->old_usb_latency_ms = usb_ms;
+                usb_ms = SER_USB_LATENCY_MS;
+            }
+            else
+                SER_DBG("WARNING Can't set %s (%s)\n", path, strerror(errno));
+        }
+    }
+
+    // A received byte waits at most the USB latency timer, if any
+    ser->byte_lat_us = ser_wire_us(ser, 1) + (usb_ms > 0 ? usb_ms * 1000 : 0);
+    SER_DBG("Low latency %s, USB latency timer ", low_lat ? "ON" : "OFF");
+    if (usb_ms < 0)
+        SER_DBG("N/A");
+    else
+        SER_DBG("%d ms", usb_ms);
+    SER_DBG(", byte latency %u us\n", ser->byte_lat_us);
+}
+
+static void ser_restore_latency(struct ser_struct * const ser)
+{
+    struct serial_struct ss;
+    char path[PATH_MAX + 64];
+
+    if (ser->old_serial_flags >= 0 && !ioctl(ser->fd, TIOCGSERIAL, &ss)) {
+        ss.flags = ser->old_serial_flags;
+        ioctl(ser->fd, TIOCSSERIAL, &ss);
+    }
+    if (ser->old_usb_latency_ms >= 0 &&
+            usb_latency_path(ser, path, sizeof(path)))
+        usb_latency_set(path, ser->old_usb_latency_ms);
+    ser->old_serial_flags = -1;
+    ser->old_usb_latency_ms = -1;
+}
+
+static void ser_init_state(struct ser_struct * const ser)
+{
+    ser->busy = 0;
+    ser->is_sock = false;
+    ser->hd_mode = SER_HD_OFF;
+    ser->old_serial_flags = -1;
+    ser->old_usb_latency_ms = -1;
+    ser->byte_lat_us = 0;
+    ser->rx_pos = 0;
+    ser->rx_cnt = 0;
+    ser->be = &posix_backend;
+    ser->be_ctx = NULL;
+    memset(&ser->turn, 0x00, sizeof(ser->turn));
+}
+
 int ser_open(struct ser_struct * const ser,
         const char * const device, const int baud, const char parity,
-        const uint8_t data_bit, const uint8_t stop_bit)
+        const uint8_t data_bit, const uint8_t stop_bit,
+        const bool low_latency)
 {
     struct termios tios;
     speed_t speed;
@@ -39,7 +168,8 @@ int ser_open(struct ser_struct * const ser,
     ser->data_bit = data_bit;
     ser->stop_bit = stop_bit;
     ser->parity = parity;
-    ser->busy = 0;
+    ser->low_latency = low_latency;
+    ser_init_state(ser);
 
     SER_DBG("Opening %s at %d bauds (%c, %d, %d)\n",
             ser->device, ser->baud, ser->parity,
@@ -134,6 +264,10 @@ int ser_open(struct ser_struct * const ser,
     tios.c_iflag &= ~(IGNBRK | BRKINT | PARMRK );
     tios.c_iflag &= ~(ISTRIP | INLCR | IGNCR | ICRNL);
     tios.c_oflag &= ~(OPOST | ONLCR);
+    // The fd is non blocking and reads are driven by select(), so VMIN and
+    // VTIME are not used: ser_read() reads ahead whatever is available
+    // instead, a whole frame in a single read at most
+    //
     // VMIN = 0, VTIME = 0: No blocking, return immediately with what is
     // available
     // VMIN > 0, VTIME = 0: This will make read() always wait for bytes
@@ -161,88 +295,309 @@ int ser_open(struct ser_struct * const ser,
         return -1;
     }
 
+    if (ser->low_latency)
+        ser_set_low_latency(ser);
+
     // Flush any stale character
     tcflush(ser->fd, TCIOFLUSH);
 
+#ifdef USE_URING
+    if (ser_uring_attach(ser))
+        SER_DBG("WARNING io_uring not available, using termios reads\n");
+#endif
+    SER_DBG("RX backend: %s\n", ser->be->name);
+
     ser->busy = 1;
     return 0;
 }
 
+int ser_open_unix(struct ser_struct * const ser, const char * const path,
+        const int baud)
+{
+    struct sockaddr_un addr;
+
+    // Shorter than device too, not truncated
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        SER_DBG("ERROR Socket path too long: %s\n", path);
+        return -1;
+    }
+    snprintf(ser->device, MAX_DEVICE_SIZE, "%s", path);
+    ser->baud = baud;
+    ser->data_bit = 8;
+    ser->stop_bit = 1;
+    ser->parity = 'N';
+    ser->low_latency = false;
+    ser_init_state(ser);
+    ser->is_sock = true;
+
+    SER_DBG("Connecting to %s\n", ser->device);
+
+    ser->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (ser->fd == -1)
+        return -1;
+    memset(&addr, 0x00, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, strlen(path));
+    if (connect(ser->fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        SER_DBG("ERROR Can't connect to %s (%s)\n", path, strerror(errno));
+        close(ser->fd);
+        ser->fd = -1;
+        return -1;
+    }
+    SER_DBG("RX backend: %s\n", ser->be->name);
+
+    return 0;
+}
+
+static uint64_t ser_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static int ser_set_rts(struct ser_struct * const ser, const bool on)
+{
+    int bits = TIOCM_RTS;
+
+    return ioctl(ser->fd, on ? TIOCMBIS : TIOCMBIC, &bits);
+}
+
+// The fd is non blocking: the whole frame must be queued before draining
+static int ser_write_all(struct ser_struct * const ser, const uint8_t *buf,
+        int size)
+{
+    struct pollfd pfd = { .fd = ser->fd, .events = POLLOUT };
+    int done = 0;
+
+    while (done < size) {
+        const int rc = write(ser->fd, buf + done, size - done);
+        if (rc > 0) {
+            done += rc;
+            continue;
+        }
+        if (rc < 0 && errno != EAGAIN && errno != EINTR)
+            return -1;
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+            return -1;
+    }
+    return done;
+}
+
+uint32_t ser_wire_us(const struct ser_struct * const ser, const int size)
+{
+    const uint32_t char_bits = 1 + ser->data_bit + (ser->parity != 'N') +
+        ser->stop_bit;
+
+    return (uint32_t)((uint64_t)size * char_bits * 1000000ULL / ser->baud);
+}
+
+const char *ser_hd_mode_str(const enum ser_hd_mode mode)
+{
+    switch (mode) {
+        case SER_HD_OFF: return "OFF";
+        case SER_HD_KERNEL: return "RS485 (kernel)";
+        case SER_HD_RTS: return "RS485 (RTS)";
+    }
+    return "?";
+}
+
+// Use the driver RS485 support if any, else toggle RTS around tcdrain()
+int ser_set_rs485(struct ser_struct * const ser, const bool enable)
+{
+    struct serial_rs485 rs485;
+    int bits;
+
+    memset(&rs485, 0x00, sizeof(rs485));
+    if (!enable) {
+        if (ser->hd_mode == SER_HD_KERNEL)
+            ioctl(ser->fd, TIOCSRS485, &rs485);
+        ser->hd_mode = SER_HD_OFF;
+        return 0;
+    }
+
+    // DE asserted only while sending, no delays: the driver switches back
+    // right after the last stop bit
+    rs485.flags = SER_RS485_ENABLED | SER_RS485_RTS_ON_SEND;
+    rs485.delay_rts_before_send = 0;
+    rs485.delay_rts_after_send = 0;
+    if (!ioctl(ser->fd, TIOCSRS485, &rs485)) {
+        ser->hd_mode = SER_HD_KERNEL;
+        return 0;
+    }
+
+    // No driver support, the port must at least have modem lines
+    if (ioctl(ser->fd, TIOCMGET, &bits) < 0 || ser_set_rts(ser, false) < 0) {
+        SER_DBG("ERROR No RS485 or RTS control on %s (%s)\n",
+                ser->device, strerror(errno));
+        return -1;
+    }
+    ser->hd_mode = SER_HD_RTS;
+    return 0;
+}
+
 int ser_write(struct ser_struct * const ser, const uint8_t *buf,
         int size)
 {
-    return write(ser->fd, buf, size);
+    if (ser->hd_mode == SER_HD_OFF)
+        return ser_write_all(ser, buf, size);
+
+    const uint64_t start_us = ser_now_us();
+    int rc;
+
+    if (ser->hd_mode == SER_HD_RTS && ser_set_rts(ser, true) < 0)
+        return -1;
+    rc = ser_write_all(ser, buf, size);
+    // Back to receive as soon as the UART shift register is empty
+    tcdrain(ser->fd);
+    if (ser->hd_mode == SER_HD_RTS && ser_set_rts(ser, false) < 0)
+        rc = -1;
+    if (rc < 0)
+        return rc;
+
+    const uint64_t tx_us = ser_now_us() - start_us;
+    const uint32_t wire_us = ser_wire_us(ser, size);
+    struct ser_turn_struct *t = &ser->turn;
+    t->last_us = tx_us > wire_us ? (uint32_t)(tx_us - wire_us) : 0;
+    if (!t->cnt || t->last_us < t->min_us)
+        t->min_us = t->last_us;
+    if (t->last_us > t->max_us)
+        t->max_us = t->last_us;
+    t->sum_us += t->last_us;
+    t->cnt++;
+    return rc;
+}
+
+static int posix_read(struct ser_struct * const ser, uint8_t *buf, int size)
+{
+    if (ser->rx_pos == ser->rx_cnt) {
+        // Large reads go straight to the caller
+        if (size >= SER_RX_BUF_SIZE)
+            return read(ser->fd, buf, size);
+        const int rc = read(ser->fd, ser->rx_buf, SER_RX_BUF_SIZE);
+        if (rc <= 0)
+            return rc;
+        ser->rx_pos = 0;
+        ser->rx_cnt = rc;
+    }
+
+    if (size > ser->rx_cnt - ser->rx_pos)
+        size = ser->rx_cnt - ser->rx_pos;
+    memcpy(buf, ser->rx_buf + ser->rx_pos, size);
+    ser->rx_pos += size;
+    return size;
+}
+
+static int posix_pending(struct ser_struct * const ser)
+{
+    return ser->rx_pos < ser->rx_cnt;
+}
+
+static int posix_poll_fd(const struct ser_struct * const ser)
+{
+    return ser->fd;
+}
+
+static void posix_discard(struct ser_struct * const ser)
+{
+    ser->rx_pos = 0;
+    ser->rx_cnt = 0;
 }
 
+static const struct ser_backend posix_backend = {
+    .name = "termios",
+    .read = posix_read,
+    .pending = posix_pending,
+    .poll_fd = posix_poll_fd,
+    .discard = posix_discard,
+    .close = NULL,
+};
+
 int ser_read(struct ser_struct * const ser, uint8_t *buf, int size)
 {
-    return read(ser->fd, buf, size);
+    return ser->be->read(ser, buf, size);
 }
 
 int ser_discard(struct ser_struct * const ser)
 {
-    return tcflush(ser->fd, TCIOFLUSH);
+    uint8_t buf[SER_RX_BUF_SIZE];
+    int rc = 0;
+
+    if (ser->is_sock) {
+        // Nothing to flush on a socket, just drop what was received
+        while (read(ser->fd, buf, sizeof(buf)) > 0)
+            ;
+    } else {
+        rc = tcflush(ser->fd, TCIOFLUSH);
+    }
+    // After the flush, so that no stale data is left in the backend
+    ser->be->discard(ser);
+    return rc;
 }
 
 void ser_close(struct ser_struct * const ser)
 {
     // Flush
     ser_discard(ser);
+    ser_restore_latency(ser);
+    if (ser->be->close != NULL)
+        ser->be->close(ser);
+    ser->be = &posix_backend;
+    ser->be_ctx = NULL;
     // Restore previous settings
-    tcsetattr(ser->fd, TCSANOW, &(ser->old_tios));
+    if (!ser->is_sock)
+        tcsetattr(ser->fd, TCSANOW, &(ser->old_tios));
     close(ser->fd);
     ser->busy = 0;
 }
 
-// TODO: rivedere codici di errore e di ritorno
-static int ser_select(struct ser_struct * const ser, fd_set *rfds,
-        struct timeval *tv, int length_to_read)
+// poll(), unlike select(), works with any descriptor number
+static int ser_wait_rx(struct ser_struct * const ser, const int32_t timeout_ms)
 {
-    int s_rc;
-    while ((s_rc = select(ser->fd+1, rfds, NULL, NULL, tv)) == -1) {
-        if (errno == EINTR) {
+    struct pollfd pfd;
+    int rc;
+
+    if (ser->be->pending(ser))
+        return 1;
+
+    pfd.fd = ser->be->poll_fd(ser);
+    pfd.events = POLLIN;
+    while ((rc = poll(&pfd, 1, timeout_ms)) == -1) {
+        if (errno == EINTR)
             SER_DBG("A non blocked signal was caught\n");
-            // Necessary after an error
-            FD_ZERO(rfds);
-            FD_SET(ser->fd, rfds);
-        }
         else
             return -1;
     }
 
-    if (s_rc == 0) {
+    if (rc == 0) {
         errno = ETIMEDOUT;
         return -1;
     }
 
-    return s_rc;
+    return rc;
+}
+
+int ser_poll(struct ser_struct * const ser, const int32_t timeout_ms)
+{
+    const int rc = ser_wait_rx(ser, timeout_ms);
+
+    if (rc == -1 && errno == ETIMEDOUT)
+        return 0;
+    return rc;
 }
 
 int ser_wait_msg(struct ser_struct * const ser, uint8_t *buf,
         int size, const int32_t timeout_ms)
 {
     int rc;
-    fd_set rfds;
-    struct timeval tv;
-    struct timeval *p_tv;
     int rx_len = 0;
 
-    // Add a file descriptor to the set
-    FD_ZERO(&rfds);
-    FD_SET(ser->fd, &rfds);
-
-    if (timeout_ms) {
-        tv.tv_sec = timeout_ms/1000;
-        tv.tv_usec = (timeout_ms%1000)*1000;
-        p_tv = &tv;
-    }
-    else
-        p_tv = NULL;
-
     while (size != 0) {
-        rc = ser_select(ser, &rfds, p_tv, size);
+        // No timeout waits forever
+        rc = ser_wait_rx(ser, timeout_ms ? timeout_ms : -1);
         if (rc == -1) {
-            //SER_DBG("Error select\n");
+            //SER_DBG("Error poll\n");
             return -1;
         }
 
@@ -253,6 +608,9 @@ int ser_wait_msg(struct ser_struct * const ser, uint8_t *buf,
         }
 
         if (rc == -1) {
+            // Backend data used up, wait again
+            if (errno == EAGAIN)
+                continue;
             //SER_DBG("Error read\n");
             return -1;
         }
@@ -291,7 +649,7 @@ int main(void)
     uint8_t rx_buf[1024];
     int nbytes;
 
-    int res = ser_open(&ser, "/dev/ttyUSB0", 115200, 'N', 8, 1);
+    int res = ser_open(&ser, "/dev/ttyUSB0", 115200, 'N', 8, 1, false);
     if (res) {
         SER_DBG("Error opening serial port, res=%d\n", res);
         return -1;
@@ -2,6 +2,41 @@
 #include <termios.h>
 
 #define MAX_DEVICE_SIZE     256
+#define SER_RX_BUF_SIZE     1024
+// USB serial latency timer set by the low latency profile, ms
+#define SER_USB_LATENCY_MS  1
+
+// Half-duplex (RS485) direction control
+enum ser_hd_mode {
+    SER_HD_OFF = 0,     // Full-duplex, no direction control
+    SER_HD_KERNEL,      // Driver toggles RTS/DE (TIOCSRS485)
+    SER_HD_RTS,         // RTS/DE toggled here, around tcdrain()
+};
+
+// TX turnaround: time spent by a write beyond the frame wire time, i.e.
+// until the transceiver is back in receive
+struct ser_turn_struct {
+    uint32_t last_us;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t sum_us;
+    uint32_t cnt;
+};
+
+struct ser_struct;
+
+// RX backend: termios reads, or io_uring if built with USE_URING and
+// supported by the kernel. Writes are write() calls for both
+struct ser_backend {
+    const char *name;
+    int (*read)(struct ser_struct * const ser, uint8_t *buf, int size);
+    // Non zero if read() returns data without waiting
+    int (*pending)(struct ser_struct * const ser);
+    // Descriptor to poll for read data
+    int (*poll_fd)(const struct ser_struct * const ser);
+    void (*discard)(struct ser_struct * const ser);
+    void (*close)(struct ser_struct * const ser);
+};
 
 struct ser_struct {
     char device[MAX_DEVICE_SIZE];
@@ -12,6 +47,20 @@ struct ser_struct {
     int fd;         // File descriptor
     struct termios old_tios;
     bool busy;
+    bool is_sock;   // Unix socket to a gateway, no termios
+    // Low latency profile, restored on close
+    bool low_latency;
+    int old_serial_flags;       // -1 if not changed
+    int old_usb_latency_ms;     // -1 if not changed
+    uint32_t byte_lat_us;       // Worst case single byte delivery latency
+    // Read ahead, so that a frame takes a few reads instead of one per byte
+    uint8_t rx_buf[SER_RX_BUF_SIZE];
+    int rx_pos;
+    int rx_cnt;
+    const struct ser_backend *be;
+    void *be_ctx;
+    enum ser_hd_mode hd_mode;
+    struct ser_turn_struct turn;
 };
 
 #ifdef __cplusplus
@@ -20,15 +69,26 @@ extern "C" {
 
 extern int ser_open(struct ser_struct * const ser,
         const char * const device, const int baud,
-        const char parity, const uint8_t data_bit, const uint8_t stop_bit);
+        const char parity, const uint8_t data_bit, const uint8_t stop_bit,
+        const bool low_latency);
+extern int ser_open_unix(struct ser_struct * const ser,
+        const char * const path, const int baud);
 extern int ser_is_busy(const struct ser_struct * const ser);
 extern int ser_read(struct ser_struct * const ser, uint8_t *buf,
         int size);
 extern int ser_write(struct ser_struct * const ser,
         const uint8_t *buf, int size);
+#ifdef USE_URING
+extern int ser_uring_attach(struct ser_struct * const ser);
+#endif
+extern int ser_set_rs485(struct ser_struct * const ser, const bool enable);
+extern const char *ser_hd_mode_str(const enum ser_hd_mode mode);
+extern uint32_t ser_wire_us(const struct ser_struct * const ser,
+        const int size);
 extern int ser_discard(struct ser_struct * const ser);
 extern void ser_close(struct ser_struct * const ser);
 extern int ser_flush(struct ser_struct * const ser);
+extern int ser_poll(struct ser_struct * const ser, const int32_t timeout_ms);
 extern int ser_wait_msg(struct ser_struct * const ser,
         uint8_t *buf, int size, const int timeout_ms);
 
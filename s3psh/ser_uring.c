@@ -0,0 +1,331 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "ser.h"
+
+// io_uring RX backend, raw syscalls (no liburing). A single multishot read
+// stays armed on the port: the kernel picks a buffer from a provided
+// buffer ring for every read and posts a completion, so that data is
+// collected from the shared rings without a syscall per read, and the
+// ring fd can be polled together with any number of other descriptors
+
+#define SER_DBG(...)     printf(__VA_ARGS__)
+
+#define URING_ENTRIES   4
+#define URING_BUFS      16      // Power of 2
+#define URING_BUF_SIZE  1024
+#define URING_BGID      0
+// Not in older uapi headers, since kernel 6.7
+#define URING_OP_READ_MULTISHOT  49
+
+struct uring_ctx {
+    int ring_fd;
+    // Submission queue
+    void *sq_ptr;
+    size_t sq_size;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    // Completion queue, may share the SQ mapping
+    void *cq_ptr;
+    size_t cq_size;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    // Provided buffers
+    struct io_uring_buf_ring *br;
+    size_t br_size;
+    uint8_t *bufs;
+    uint16_t br_tail;
+    // Buffer being consumed, -1 if none
+    int cur_bid;
+    int cur_len;
+    int cur_pos;
+    // Multishot read active
+    bool armed;
+};
+
+static int uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned to_submit)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, 0, 0, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned opcode, void *arg, unsigned nr)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr);
+}
+
+static bool uring_op_supported(const int ring_fd, const uint8_t op)
+{
+    const size_t size = sizeof(struct io_uring_probe) +
+        256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    bool res = false;
+
+    if (probe == NULL)
+        return false;
+    if (!uring_register(ring_fd, IORING_REGISTER_PROBE, probe, 256))
+        res = op < probe->ops_len &&
+            (probe->ops[op].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    return res;
+}
+
+// Give a buffer back to the kernel
+static void uring_buf_add(struct uring_ctx *ctx, const uint16_t bid)
+{
+    struct io_uring_buf *buf = &ctx->br->bufs[ctx->br_tail & (URING_BUFS - 1)];
+
+    buf->addr = (uint64_t)(uintptr_t)(ctx->bufs + bid * URING_BUF_SIZE);
+    buf->len = URING_BUF_SIZE;
+    buf->bid = bid;
+    ctx->br_tail++;
+    __atomic_store_n(&ctx->br->tail, ctx->br_tail, __ATOMIC_RELEASE);
+}
+
+static int uring_arm(struct ser_struct * const ser)
+{
+    struct uring_ctx *ctx = ser->be_ctx;
+    const unsigned tail = *ctx->sq_tail;
+    const unsigned idx = tail & *ctx->sq_mask;
+    struct io_uring_sqe *sqe = &ctx->sqes[idx];
+
+    memset(sqe, 0x00, sizeof(*sqe));
+    sqe->opcode = URING_OP_READ_MULTISHOT;
+    sqe->fd = ser->fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = 1;
+    ctx->sq_array[idx] = idx;
+    __atomic_store_n(ctx->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    if (uring_enter(ctx->ring_fd, 1) != 1)
+        return -1;
+    ctx->armed = true;
+    return 0;
+}
+
+// Take the next completion, return 1 if one was reaped, 0 if none, -1 on
+// read error
+static int uring_reap(struct ser_struct * const ser)
+{
+    struct uring_ctx *ctx = ser->be_ctx;
+    const unsigned head = *ctx->cq_head;
+
+    if (head == __atomic_load_n(ctx->cq_tail, __ATOMIC_ACQUIRE))
+        return 0;
+    const struct io_uring_cqe *cqe = &ctx->cqes[head & *ctx->cq_mask];
+    const int res = cqe->res;
+    const uint32_t flags = cqe->flags;
+    __atomic_store_n(ctx->cq_head, head + 1, __ATOMIC_RELEASE);
+
+    if (!(flags & IORING_CQE_F_MORE))
+        ctx->armed = false;
+    if (flags & IORING_CQE_F_BUFFER) {
+        const uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        if (res > 0) {
+            ctx->cur_bid = bid;
+            ctx->cur_len = res;
+            ctx->cur_pos = 0;
+        }
+        else
+            uring_buf_add(ctx, bid);
+    }
+    // Out of buffers: re-armed once the buffers are given back
+    if (res < 0 && res != -ENOBUFS) {
+        errno = -res;
+        return -1;
+    }
+    return 1;
+}
+
+static int uring_read(struct ser_struct * const ser, uint8_t *buf, int size)
+{
+    struct uring_ctx *ctx = ser->be_ctx;
+
+    while (ctx->cur_bid < 0) {
+        const int rc = uring_reap(ser);
+        if (rc < 0)
+            return -1;
+        if (rc == 0) {
+            if (!ctx->armed && uring_arm(ser))
+                return -1;
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+
+    if (size > ctx->cur_len - ctx->cur_pos)
+        size = ctx->cur_len - ctx->cur_pos;
+    memcpy(buf, ctx->bufs + ctx->cur_bid * URING_BUF_SIZE + ctx->cur_pos,
+            size);
+    ctx->cur_pos += size;
+    if (ctx->cur_pos == ctx->cur_len) {
+        uring_buf_add(ctx, ctx->cur_bid);
+        ctx->cur_bid = -1;
+    }
+    return size;
+}
+
+static int uring_pending(struct ser_struct * const ser)
+{
+    struct uring_ctx *ctx = ser->be_ctx;
+
+    if (ctx->cur_bid >= 0 ||
+            *ctx->cq_head != __atomic_load_n(ctx->cq_tail, __ATOMIC_ACQUIRE))
+        return 1;
+    // Nothing would wake up the poll otherwise
+    if (!ctx->armed && uring_arm(ser))
+        return 1;
+    return 0;
+}
+
+static int uring_poll_fd(const struct ser_struct * const ser)
+{
+    const struct uring_ctx *ctx = ser->be_ctx;
+
+    return ctx->ring_fd;
+}
+
+static void uring_discard(struct ser_struct * const ser)
+{
+    struct uring_ctx *ctx = ser->be_ctx;
+
+    if (ctx->cur_bid >= 0) {
+        uring_buf_add(ctx, ctx->cur_bid);
+        ctx->cur_bid = -1;
+    }
+    while (uring_reap(ser)) {
+        if (ctx->cur_bid >= 0) {
+            uring_buf_add(ctx, ctx->cur_bid);
+            ctx->cur_bid = -1;
+        }
+    }
+}
+
+static void uring_free(struct uring_ctx *ctx)
+{
+    // Also cancels the pending read
+    if (ctx->ring_fd >= 0)
+        close(ctx->ring_fd);
+    if (ctx->sqes != NULL && ctx->sqes != MAP_FAILED)
+        munmap(ctx->sqes, ctx->sqes_size);
+    if (ctx->cq_ptr != NULL && ctx->cq_ptr != MAP_FAILED &&
+            ctx->cq_ptr != ctx->sq_ptr)
+        munmap(ctx->cq_ptr, ctx->cq_size);
+    if (ctx->sq_ptr != NULL && ctx->sq_ptr != MAP_FAILED)
+        munmap(ctx->sq_ptr, ctx->sq_size);
+    if (ctx->br != NULL && ctx->br != MAP_FAILED)
+        munmap(ctx->br, ctx->br_size);
+    free(ctx->bufs);
+    free(ctx);
+}
+
+static void uring_close(struct ser_struct * const ser)
+{
+    uring_free(ser->be_ctx);
+    ser->be_ctx = NULL;
+}
+
+static const struct ser_backend uring_backend = {
+    .name = "io_uring",
+    .read = uring_read,
+    .pending = uring_pending,
+    .poll_fd = uring_poll_fd,
+    .discard = uring_discard,
+    .close = uring_close,
+};
+
+int ser_uring_attach(struct ser_struct * const ser)
+{
+    struct io_uring_params p;
+    struct io_uring_buf_reg reg;
+    struct uring_ctx *ctx = calloc(1, sizeof(struct uring_ctx));
+
+    if (ctx == NULL)
+        return -1;
+    ctx->cur_bid = -1;
+
+    memset(&p, 0x00, sizeof(p));
+    ctx->ring_fd = uring_setup(URING_ENTRIES, &p);
+    if (ctx->ring_fd < 0) {
+        free(ctx);
+        return -1;
+    }
+    if (!uring_op_supported(ctx->ring_fd, URING_OP_READ_MULTISHOT))
+        goto error;
+
+    ctx->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ctx->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ctx->cq_size > ctx->sq_size)
+            ctx->sq_size = ctx->cq_size;
+    }
+    ctx->sq_ptr = mmap(NULL, ctx->sq_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ctx->ring_fd, IORING_OFF_SQ_RING);
+    if (ctx->sq_ptr == MAP_FAILED)
+        goto error;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        ctx->cq_ptr = ctx->sq_ptr;
+    else {
+        ctx->cq_ptr = mmap(NULL, ctx->cq_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, ctx->ring_fd, IORING_OFF_CQ_RING);
+        if (ctx->cq_ptr == MAP_FAILED)
+            goto error;
+    }
+    ctx->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ctx->sqes = mmap(NULL, ctx->sqes_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ctx->ring_fd, IORING_OFF_SQES);
+    if (ctx->sqes == MAP_FAILED)
+        goto error;
+
+    ctx->sq_tail = (unsigned *)((uint8_t *)ctx->sq_ptr + p.sq_off.tail);
+    ctx->sq_mask = (unsigned *)((uint8_t *)ctx->sq_ptr + p.sq_off.ring_mask);
+    ctx->sq_array = (unsigned *)((uint8_t *)ctx->sq_ptr + p.sq_off.array);
+    ctx->cq_head = (unsigned *)((uint8_t *)ctx->cq_ptr + p.cq_off.head);
+    ctx->cq_tail = (unsigned *)((uint8_t *)ctx->cq_ptr + p.cq_off.tail);
+    ctx->cq_mask = (unsigned *)((uint8_t *)ctx->cq_ptr + p.cq_off.ring_mask);
+    ctx->cqes = (struct io_uring_cqe *)((uint8_t *)ctx->cq_ptr + p.cq_off.cqes);
+
+    // Buffer ring, page aligned
+    ctx->br_size = URING_BUFS * sizeof(struct io_uring_buf);
+    ctx->br = mmap(NULL, ctx->br_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ctx->bufs = malloc(URING_BUFS * URING_BUF_SIZE);
+    if (ctx->br == MAP_FAILED || ctx->bufs == NULL)
+        goto error;
+    memset(&reg, 0x00, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)ctx->br;
+    reg.ring_entries = URING_BUFS;
+    reg.bgid = URING_BGID;
+    if (uring_register(ctx->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1))
+        goto error;
+    for (uint16_t bid=0; bid<URING_BUFS; bid++)
+        uring_buf_add(ctx, bid);
+
+    ser->be_ctx = ctx;
+    if (uring_arm(ser)) {
+        SER_DBG("WARNING io_uring read submit error (%s)\n", strerror(errno));
+        ser->be_ctx = NULL;
+        goto error;
+    }
+    ser->be = &uring_backend;
+    return 0;
+
+error:
+    uring_free(ctx);
+    return -1;
+}
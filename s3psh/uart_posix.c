@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include "uart_posix.h"
+#include "s3psh_utils.h"
+
+#define UART_DBG(...)           printf(__VA_ARGS__)
+
+// RX thread poll period, bounds the stop latency
+#define RX_POLL_MS              100
+
+static bool hal_rx_start(void *hw, uint8_t *buf, const uint16_t size);
+static uint16_t hal_rx_pos(void *hw);
+static bool hal_tx_start(void *hw, const uint8_t *buf, const uint16_t len);
+
+const s3p_uart_hal_t uart_posix_hal = {
+    .rx_start = hal_rx_start,
+    .rx_pos = hal_rx_pos,
+    .tx_start = hal_tx_start,
+};
+
+static bool stopping(struct uart_posix * const up)
+{
+    return atomic_load_explicit(&up->stop, memory_order_acquire);
+}
+
+// The circular DMA and its interrupts: each read ends when the line goes
+// idle (the tty returns what it has), and never spans more than half the
+// buffer, as the half transfer interrupt
+static void *rx_thread(void *arg)
+{
+    struct uart_posix * const up = arg;
+    struct pollfd pfd = { .fd = up->fd, .events = POLLIN };
+    const uint64_t one = 1;
+
+    while (!stopping(up)) {
+        const int res = poll(&pfd, 1, RX_POLL_MS);
+        if (res <= 0)
+            continue;
+        if (!(pfd.revents & POLLIN)) {
+            // Hung up (pty without a peer yet): as a silent line
+            usleep(RX_POLL_MS * 1000);
+            continue;
+        }
+
+        const uint16_t pos = atomic_load_explicit(&up->rx_pos,
+                memory_order_relaxed);
+        int n = up->rx_size - pos;
+        if (n > up->rx_size / 2)
+            n = up->rx_size / 2;
+        n = read(up->fd, &up->rx_buf[pos], n);
+        if (n <= 0)
+            continue;
+        atomic_store_explicit(&up->rx_pos, (pos + n) & (up->rx_size - 1),
+                memory_order_release);
+        if (s3p_uart_rx_event(up->uart, client_utils_get_us()) &&
+                write(up->evfd, &one, sizeof(one)) < 0)
+            UART_DBG("ERROR Can't wake the main loop (%s)\n", strerror(errno));
+    }
+
+    return NULL;
+}
+
+static bool write_all(const int fd, const uint8_t *buf, int len)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLOUT };
+
+    while (len > 0) {
+        const int n = write(fd, buf, len);
+        if (n > 0) {
+            buf += n;
+            len -= n;
+            continue;
+        }
+        if (n < 0 && errno != EAGAIN && errno != EINTR)
+            return false;
+        poll(&pfd, 1, RX_POLL_MS);
+    }
+
+    return true;
+}
+
+// The DMA transmit and its transfer complete interrupt
+static void *tx_thread(void *arg)
+{
+    struct uart_posix * const up = arg;
+
+    pthread_mutex_lock(&up->tx_lock);
+    for (;;) {
+        while (!up->tx_len && !stopping(up))
+            pthread_cond_wait(&up->tx_cond, &up->tx_lock);
+        if (stopping(up))
+            break;
+        const uint8_t *buf = up->tx_ptr;
+        const uint16_t len = up->tx_len;
+        pthread_mutex_unlock(&up->tx_lock);
+
+        // A failed write loses the frames, as a line error
+        if (!write_all(up->fd, buf, len))
+            up->tx_errors++;
+        up->tx_xfers++;
+
+        pthread_mutex_lock(&up->tx_lock);
+        up->tx_len = 0;
+        pthread_mutex_unlock(&up->tx_lock);
+        // May start the next transfer, i.e. take tx_lock
+        s3p_uart_tx_done(up->uart);
+        pthread_mutex_lock(&up->tx_lock);
+    }
+    pthread_mutex_unlock(&up->tx_lock);
+
+    return NULL;
+}
+
+static bool hal_rx_start(void *hw, uint8_t *buf, const uint16_t size)
+{
+    struct uart_posix * const up = hw;
+
+    up->rx_buf = buf;
+    up->rx_size = size;
+    atomic_store_explicit(&up->rx_pos, 0, memory_order_relaxed);
+
+    if (pthread_create(&up->rx_thr, NULL, rx_thread, up))
+        return false;
+    if (pthread_create(&up->tx_thr, NULL, tx_thread, up)) {
+        atomic_store_explicit(&up->stop, true, memory_order_release);
+        pthread_join(up->rx_thr, NULL);
+        return false;
+    }
+    up->started = true;
+
+    return true;
+}
+
+static uint16_t hal_rx_pos(void *hw)
+{
+    struct uart_posix * const up = hw;
+
+    return atomic_load_explicit(&up->rx_pos, memory_order_acquire);
+}
+
+static bool hal_tx_start(void *hw, const uint8_t *buf, const uint16_t len)
+{
+    struct uart_posix * const up = hw;
+    bool res = false;
+
+    pthread_mutex_lock(&up->tx_lock);
+    // The driver starts a transfer only once the previous one is done
+    if (!up->tx_len) {
+        up->tx_ptr = buf;
+        up->tx_len = len;
+        pthread_cond_signal(&up->tx_cond);
+        res = true;
+    }
+    pthread_mutex_unlock(&up->tx_lock);
+
+    return res;
+}
+
+int uart_posix_init(struct uart_posix * const up, const int fd,
+        s3p_uart_t *uart)
+{
+    memset(up, 0x00, sizeof(struct uart_posix));
+    up->fd = fd;
+    up->uart = uart;
+    atomic_init(&up->stop, false);
+    atomic_init(&up->rx_pos, 0);
+    up->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (up->evfd == -1) {
+        UART_DBG("ERROR Can't create eventfd (%s)\n", strerror(errno));
+        return -1;
+    }
+    pthread_mutex_init(&up->tx_lock, NULL);
+    pthread_cond_init(&up->tx_cond, NULL);
+
+    return 0;
+}
+
+int uart_posix_wait(struct uart_posix * const up, const int32_t timeout_ms)
+{
+    struct pollfd pfd = { .fd = up->evfd, .events = POLLIN };
+    uint64_t cnt;
+
+    if (poll(&pfd, 1, timeout_ms) <= 0)
+        return 0;
+    // Reset the wake ups, the driver looks for every frame anyway
+    if (read(up->evfd, &cnt, sizeof(cnt)) < 0)
+        return 0;
+
+    return 1;
+}
+
+void uart_posix_close(struct uart_posix * const up)
+{
+    if (up->evfd == -1)
+        return;
+
+    if (up->started) {
+        atomic_store_explicit(&up->stop, true, memory_order_release);
+        pthread_mutex_lock(&up->tx_lock);
+        pthread_cond_broadcast(&up->tx_cond);
+        pthread_mutex_unlock(&up->tx_lock);
+        pthread_join(up->rx_thr, NULL);
+        pthread_join(up->tx_thr, NULL);
+        up->started = false;
+    }
+    pthread_cond_destroy(&up->tx_cond);
+    pthread_mutex_destroy(&up->tx_lock);
+    close(up->evfd);
+    up->evfd = -1;
+}
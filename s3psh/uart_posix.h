@@ -0,0 +1,78 @@
+#ifndef _UART_POSIX_H
+#define _UART_POSIX_H
+
+/* Linux stand-in of a DMA UART port (s3p_uart.h)
+ *
+ * Runs the node side driver off-target, on a tty, pty or socket fd:
+ *
+ * - The RX thread plays the circular DMA and the idle line interrupt: it
+ *   reads the fd straight into the driver receive buffer, wrapping around,
+ *   moves the DMA position and calls s3p_uart_rx_event() after each read,
+ *   i.e. when the line goes idle or half a buffer was received, with the
+ *   time the read returned.
+ * - The TX thread plays the DMA transmit and the transfer complete
+ *   interrupt: it writes the buffer given by the driver, then calls
+ *   s3p_uart_tx_done().
+ *
+ * As the DMA, the RX thread reuses the buffer with no handshake with the
+ * main loop: thread sanitizers report it, the driver detects the actual
+ * overruns.
+ *
+ * The main loop waits for received bytes with uart_posix_wait(), as the
+ * firmware would sleep until an interrupt.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "s3p_uart.h"
+
+struct uart_posix {
+    int fd;
+    s3p_uart_t *uart;
+    // Main loop wake up, written by the RX thread
+    int evfd;
+    _Atomic bool stop;
+    bool started;
+
+    // RX "DMA"
+    uint8_t *rx_buf;
+    uint16_t rx_size;
+    _Atomic uint16_t rx_pos;
+    pthread_t rx_thr;
+
+    // TX "DMA", transfer guarded by tx_lock
+    pthread_mutex_t tx_lock;
+    pthread_cond_t tx_cond;
+    const uint8_t *tx_ptr;
+    uint16_t tx_len;
+    pthread_t tx_thr;
+    // Transfers and write errors
+    uint32_t tx_xfers;
+    uint32_t tx_errors;
+};
+
+// Port to give to s3p_uart_init(), with the uart_posix as context
+extern const s3p_uart_hal_t uart_posix_hal;
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+// Bind to an open fd and to the driver it will serve. The threads are
+// started by s3p_uart_init() (rx_start)
+extern int uart_posix_init(struct uart_posix * const up, const int fd,
+        s3p_uart_t *uart);
+// Wait for received bytes, up to timeout_ms (-1 forever). Returns 1 if
+// bytes were received, 0 on timeout
+extern int uart_posix_wait(struct uart_posix * const up,
+        const int32_t timeout_ms);
+// Stop the threads, the fd is left open
+extern void uart_posix_close(struct uart_posix * const up);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif // _UART_POSIX_H
@@ -7,6 +7,7 @@
 #include "crc16.h"
 #include "cobs.h"
 #include "s3p.h"
+#include "s3p_stats.h"
 #include "s3p_dbg.h"
 
 void s3p_set_debug_level(const int level)
@@ -14,23 +15,31 @@ void s3p_set_debug_level(const int level)
     _dbg_lvl = level;
 }
 
-bool s3p_parse_frame(s3p_packet_t *pkt, const uint8_t dst_id,
-        const uint8_t *frame_buf, uint16_t len)
+static s3p_frame_status_t decode_frame(s3p_packet_t *pkt,
+        const uint8_t *frame_buf, uint16_t len, const uint16_t max_pkt,
+        cobs_decode_status *cobs_status)
 {
     DBG(1, "New msg rx: len=%u\n", len);
 
-    cobs_decode_result res = cobs_decode(pkt->buf, S3P_MAX_PKT_SIZE,
-            frame_buf, len);
+    cobs_decode_result res = cobs_decode(pkt->buf, max_pkt, frame_buf, len);
+    *cobs_status = res.status;
     if (res.status != COBS_DECODE_OK) {
         DBG(1, "Decode error, res=0x%02X\n", res.status);
-        return false;
+        return S3P_FRAME_COBS_ERR;
     }
 
     DBG(1, "Decode ok: in_len=%u, out_len=%lu\n", len, res.out_len);
 
+    // Header and CRC at least
+    if (res.out_len < 8) {
+        DBG(1, "Frame too short: out_len=%lu\n", res.out_len);
+        return S3P_FRAME_SIZE_ERR;
+    }
+
     pkt->src_id = pkt->buf[0];
     pkt->dst_id = pkt->buf[1];
     pkt->flags_seq = pkt->buf[2];
+    pkt->seq = S3P_SEQ_MASKED(pkt->flags_seq);
     pkt->type = pkt->buf[3];
     pkt->data_len = (pkt->buf[4]<<8) | pkt->buf[5];
     pkt->data = &pkt->buf[6];
@@ -45,19 +54,76 @@ bool s3p_parse_frame(s3p_packet_t *pkt, const uint8_t dst_id,
     // Check CRC
     if (exp != calc) {
         DBG(1, " CRC err: exp=0x%04X  calc=0x%04X\n", exp, calc);
-        return false;
+        return S3P_FRAME_CRC_ERR;
     }
 
-    //Check dst_id
-    if (pkt->dst_id != dst_id) {
+    return S3P_FRAME_OK;
+}
+
+s3p_frame_status_t s3p_decode_frame(s3p_packet_t *pkt,
+        const uint8_t *frame_buf, uint16_t len)
+{
+    cobs_decode_status cobs_status;
+    return decode_frame(pkt, frame_buf, len, S3P_MAX_PKT_SIZE, &cobs_status);
+}
+
+s3p_frame_status_t s3p_link_decode_frame(const s3p_link_t *link,
+        s3p_packet_t *pkt, const uint8_t *frame_buf, uint16_t len)
+{
+    cobs_decode_status cobs_status;
+    return decode_frame(pkt, frame_buf, len,
+            S3P_PKT_SIZE(S3P_LINK_FRAME_SIZE(link)), &cobs_status);
+}
+
+bool s3p_link_parse_frame(s3p_link_t *link, s3p_packet_t *pkt,
+        const uint8_t dst_id, const uint8_t *frame_buf, uint16_t len)
+{
+    cobs_decode_status cobs_status;
+    s3p_stats_t *stats = link->stats;
+    const s3p_frame_status_t res = decode_frame(pkt, frame_buf, len,
+            S3P_PKT_SIZE(S3P_LINK_FRAME_SIZE(link)), &cobs_status);
+
+    if (stats != NULL) {
+        stats->cnt.frames_rx++;
+        // Delimiter included
+        stats->cnt.bytes_rx += len + 1;
+        switch (res) {
+        case S3P_FRAME_COBS_ERR:
+            for (int i=0; i<S3P_STATS_COBS_BITS; i++) {
+                if (cobs_status & (1 << i))
+                    stats->cnt.cobs_err[i]++;
+            }
+            break;
+        case S3P_FRAME_SIZE_ERR: stats->cnt.size_err++; break;
+        case S3P_FRAME_CRC_ERR:  stats->cnt.crc_err++;  break;
+        default: break;
+        }
+    }
+    if (res != S3P_FRAME_OK)
+        return false;
+    pkt->seq = pkt->flags_seq & S3P_LINK_SEQ_MASK(link);
+
+    //Check dst_id, broadcast only for the group reads the node opted in
+    if (pkt->dst_id != dst_id && !(link->group_read &&
+                pkt->dst_id == S3P_ID_BROADCAST &&
+                pkt->type == PT_GROUP_READ)) {
         DBG(1, "Discarding pkt, dst_id=0x%02X != 0x%02X\n",
                 pkt->src_id, dst_id);
+        if (stats != NULL)
+            stats->cnt.dst_err++;
         return false;
     }
 
     return true;
 }
 
+bool s3p_parse_frame(s3p_packet_t *pkt, const uint8_t dst_id,
+        const uint8_t *frame_buf, uint16_t len)
+{
+    s3p_link_t link = { 0 };
+    return s3p_link_parse_frame(&link, pkt, dst_id, frame_buf, len);
+}
+
 void s3p_init_pkt(s3p_packet_t *pkt, uint8_t *pkt_buf,
         const uint8_t src_id, const uint8_t dst_id,
         const uint8_t flags_seq)
@@ -67,12 +133,14 @@ void s3p_init_pkt(s3p_packet_t *pkt, uint8_t *pkt_buf,
     pkt->src_id = src_id;
     pkt->dst_id = dst_id;
     pkt->flags_seq = flags_seq;
+    pkt->seq = flags_seq;
     pkt->type = PT_NONE;
     pkt->data_len = 0;
     pkt->data = &pkt->buf[6];
 }
 
-uint16_t s3p_make_frame(uint8_t *frame_buf, const s3p_packet_t *pkt_out)
+uint16_t s3p_link_make_frame(s3p_link_t *link, uint8_t *frame_buf,
+        const s3p_packet_t *pkt_out)
 {
     uint16_t pkt_size = 0;
 
@@ -96,14 +164,19 @@ uint16_t s3p_make_frame(uint8_t *frame_buf, const s3p_packet_t *pkt_out)
     DBG(2, "         data_len=%u, crc=0x%04X\n",
             pkt_out->data_len, crc);
 
-    cobs_encode_result res = cobs_encode(frame_buf, S3P_MAX_FRAME_SIZE,
-            pkt_out->buf, pkt_size);
+    // Delimiter excluded
+    cobs_encode_result res = cobs_encode(frame_buf,
+            S3P_LINK_FRAME_SIZE(link) - 1, pkt_out->buf, pkt_size);
 
     if (res.status == COBS_ENCODE_OK) {
         DBG(2, "Encode ok: in_len=%u, out_len=%lu\n",
                 pkt_size, res.out_len);
         // Add terminator
         frame_buf[res.out_len] = 0x00;
+        if (link->stats != NULL) {
+            link->stats->cnt.frames_tx++;
+            link->stats->cnt.bytes_tx += res.out_len + 1;
+        }
         return res.out_len + 1;
     }
 
@@ -112,6 +185,28 @@ uint16_t s3p_make_frame(uint8_t *frame_buf, const s3p_packet_t *pkt_out)
     return 0;
 }
 
+uint16_t s3p_make_frame(uint8_t *frame_buf, const s3p_packet_t *pkt_out)
+{
+    s3p_link_t link = { 0 };
+    return s3p_link_make_frame(&link, frame_buf, pkt_out);
+}
+
+bool s3p_group_slot(const s3p_packet_t *pkt_in, const uint8_t node_id,
+        uint32_t *delay_us)
+{
+    // First reg(2), regs count(2), first node(1), nodes count(1), slot(2)
+    if (pkt_in->type != PT_GROUP_READ || pkt_in->data_len < 8)
+        return false;
+
+    const uint8_t idx = node_id - pkt_in->data[4];
+    if (node_id < pkt_in->data[4] || idx >= pkt_in->data[5])
+        return false;
+    const uint16_t slot = ((uint16_t)pkt_in->data[6] << 8) | pkt_in->data[7];
+    *delay_us = (uint32_t)idx * slot * S3P_SLOT_UNIT_US;
+
+    return true;
+}
+
 const char *s3p_err_str(const uint8_t code)
 {
     switch (code) {
@@ -124,8 +219,51 @@ const char *s3p_err_str(const uint8_t code)
         case S3P_ERR_NO_WRITE  : return "NO_WRITE";
         case S3P_ERR_NO_VMEM   : return "NO_VMEM";
         case S3P_ERR_NO_CMD    : return "NO_CMD";
+        case S3P_ERR_BUSY      : return "BUSY";
         default: break;
     }
     return "UNKNOWN";
 }
 
+
+const char *s3p_type_str(const uint8_t type)
+{
+    switch (type) {
+        case PT_NONE              : return "NONE";
+        case PT_EXEC_CMD          : return "EXEC_CMD";
+        case PT_EXEC_CMD_RESP     : return "EXEC_CMD_RESP";
+        case PT_READ_REGS         : return "READ_REGS";
+        case PT_READ_REGS_RESP    : return "READ_REGS_RESP";
+        case PT_WRITE_REG         : return "WRITE_REG";
+        case PT_WRITE_REG_RESP    : return "WRITE_REG_RESP";
+        case PT_READ_VMEM         : return "READ_VMEM";
+        case PT_READ_VMEM_RESP    : return "READ_VMEM_RESP";
+        case PT_WRITE_VMEM        : return "WRITE_VMEM";
+        case PT_WRITE_VMEM_RESP   : return "WRITE_VMEM_RESP";
+        case PT_READ_STR_REG      : return "READ_STR_REG";
+        case PT_READ_STR_REG_RESP : return "READ_STR_REG_RESP";
+        case PT_WRITE_STR_REG     : return "WRITE_STR_REG";
+        case PT_WRITE_STR_REG_RESP: return "WRITE_STR_REG_RESP";
+        case PT_VMEM_CRC          : return "VMEM_CRC";
+        case PT_VMEM_CRC_RESP     : return "VMEM_CRC_RESP";
+        case PT_VMEM_HASHES       : return "VMEM_HASHES";
+        case PT_VMEM_HASHES_RESP  : return "VMEM_HASHES_RESP";
+        case PT_READ_VMEM_LZ      : return "READ_VMEM_LZ";
+        case PT_READ_VMEM_LZ_RESP : return "READ_VMEM_LZ_RESP";
+        case PT_WRITE_VMEM_LZ     : return "WRITE_VMEM_LZ";
+        case PT_WRITE_VMEM_LZ_RESP: return "WRITE_VMEM_LZ_RESP";
+        case PT_GROUP_READ        : return "GROUP_READ";
+        case PT_GROUP_READ_RESP   : return "GROUP_READ_RESP";
+        case PT_SUBSCRIBE         : return "SUBSCRIBE";
+        case PT_SUBSCRIBE_RESP    : return "SUBSCRIBE_RESP";
+        case PT_TELEMETRY         : return "TELEMETRY";
+        case PT_S3P_INFO          : return "S3P_INFO";
+        case PT_S3P_INFO_RESP     : return "S3P_INFO_RESP";
+        case PT_REG_INFO          : return "REG_INFO";
+        case PT_REG_INFO_RESP     : return "REG_INFO_RESP";
+        case PT_VMEM_INFO         : return "VMEM_INFO";
+        case PT_VMEM_INFO_RESP    : return "VMEM_INFO_RESP";
+        default: break;
+    }
+    return "UNKNOWN";
+}
@@ -0,0 +1,140 @@
+/**
+@file s3p_items.c
+@brief S3P register item list batch decoder
+*/
+
+#include <string.h>
+#include "s3p_items.h"
+
+#if !defined(S3P_ITEMS_NO_SIMD) && defined(__GNUC__) && \
+        (defined(__x86_64__) || defined(__i386__))
+#define S3P_ITEMS_SSSE3
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && \
+        __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define LOAD_BE16(_p)   __builtin_bswap16(load_u16(_p))
+#define LOAD_BE32(_p)   __builtin_bswap32(load_u32(_p))
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) && \
+        __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define LOAD_BE16(_p)   load_u16(_p)
+#define LOAD_BE32(_p)   load_u32(_p)
+#else
+#define LOAD_BE16(_p)   ((uint16_t)((_p)[0] << 8 | (_p)[1]))
+#define LOAD_BE32(_p)   ((uint32_t)(_p)[0] << 24 | (uint32_t)(_p)[1] << 16 | \
+        (uint32_t)(_p)[2] << 8 | (uint32_t)(_p)[3])
+#endif
+
+// Unaligned loads, memcpy compiles to a single load where allowed
+static inline uint16_t load_u16(const uint8_t *p)
+{
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t load_u32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static void decode_scalar(s3p_items_t *items, const uint8_t *data,
+        const uint16_t first, const uint16_t cnt)
+{
+    for (uint16_t i=first; i<cnt; i++) {
+        const uint8_t *p = data + i * S3P_SER_ITEM_SIZE;
+        items->ids[i] = LOAD_BE16(p);
+        items->types[i] = p[2];
+        items->values[i] = LOAD_BE32(p + 3);
+    }
+}
+
+#ifdef S3P_ITEMS_SSSE3
+// Decode 4 items per round from two 16 bytes loads, 2 items (14 bytes)
+// each. Returns the items decoded, the caller does the tail
+__attribute__((target("ssse3")))
+static uint16_t decode_ssse3(s3p_items_t *items, const uint8_t *data,
+        const uint16_t cnt)
+{
+    // Per load: ids of the 2 items, byte swapped, to lanes 0..3 (first
+    // load) or 4..7 (second load), same for types (lanes 0..1 or 2..3)
+    // and values (lanes 0..7 or 8..15). -1 clears the lane
+    const __m128i id_lo = _mm_setr_epi8(1, 0, 8, 7, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i id_hi = _mm_setr_epi8(-1, -1, -1, -1, 1, 0, 8, 7,
+            -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i vt_lo = _mm_setr_epi8(2, 9, -1, -1, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i vt_hi = _mm_setr_epi8(-1, -1, 2, 9, -1, -1, -1, -1,
+            -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i val_lo = _mm_setr_epi8(6, 5, 4, 3, 13, 12, 11, 10,
+            -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i val_hi = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+            6, 5, 4, 3, 13, 12, 11, 10);
+    uint16_t i = 0;
+
+    // The second load of a round reads 2 bytes past its items: stop
+    // while a whole 5th item follows
+    for (; i + 5 <= cnt; i += 4) {
+        const uint8_t *p = data + i * S3P_SER_ITEM_SIZE;
+        const __m128i a = _mm_loadu_si128((const __m128i *)p);
+        const __m128i b = _mm_loadu_si128((const __m128i *)(p +
+                    2 * S3P_SER_ITEM_SIZE));
+        const __m128i ids = _mm_or_si128(_mm_shuffle_epi8(a, id_lo),
+                _mm_shuffle_epi8(b, id_hi));
+        const __m128i vts = _mm_or_si128(_mm_shuffle_epi8(a, vt_lo),
+                _mm_shuffle_epi8(b, vt_hi));
+        const __m128i vals = _mm_or_si128(_mm_shuffle_epi8(a, val_lo),
+                _mm_shuffle_epi8(b, val_hi));
+        const uint32_t types = _mm_cvtsi128_si32(vts);
+
+        _mm_storel_epi64((__m128i *)(items->ids + i), ids);
+        memcpy(items->types + i, &types, sizeof(types));
+        _mm_storeu_si128((__m128i *)(items->values + i), vals);
+    }
+    return i;
+}
+
+static int8_t simd = -1;
+#endif
+
+bool s3p_items_simd(void)
+{
+#ifdef S3P_ITEMS_SSSE3
+    if (simd < 0)
+        simd = __builtin_cpu_supports("ssse3") ? 1 : 0;
+    return simd;
+#else
+    return false;
+#endif
+}
+
+int32_t s3p_items_decode(s3p_items_t *items, const uint8_t *data,
+        const uint16_t len)
+{
+    const uint16_t cnt = len / S3P_SER_ITEM_SIZE;
+    uint16_t done = 0;
+
+    if (len % S3P_SER_ITEM_SIZE || cnt > items->size)
+        return -1;
+
+#ifdef S3P_ITEMS_SSSE3
+    if (s3p_items_simd())
+        done = decode_ssse3(items, data, cnt);
+#endif
+    decode_scalar(items, data, done, cnt);
+
+    return cnt;
+}
+
+int32_t s3p_items_decode_pkt(s3p_items_t *items, const s3p_packet_t *pkt,
+        const uint16_t offset)
+{
+    if (offset > pkt->data_len)
+        return -1;
+    return s3p_items_decode(items, pkt->data + offset,
+            pkt->data_len - offset);
+}
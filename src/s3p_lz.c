@@ -0,0 +1,222 @@
+/**
+@file s3p_lz.c
+@brief S3P VMEM compression (RLE + LZ with a 256 bytes window)
+*/
+
+#include <string.h>
+#include "s3p_lz.h"
+
+#define WIN_MASK        (S3P_LZ_WINDOW - 1)
+#define TOK_RUN         0x80
+#define TOK_MATCH       0xC0
+#define TOK_LEN_MASK    0x3F
+
+static uint16_t hash3(const uint8_t *p)
+{
+    const uint32_t v = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+    return (uint16_t)((v * 2654435761U) >> 16) & (S3P_LZ_HASH_SIZE - 1);
+}
+
+// Emit up to n literals, as many as fit in dst
+static uint16_t put_lits(uint8_t *dst, uint16_t *out, const uint16_t dst_size,
+        const uint8_t *src, uint16_t n)
+{
+    if (*out + 1 >= dst_size)
+        return 0;
+    if (n > dst_size - *out - 1)
+        n = dst_size - *out - 1;
+    dst[(*out)++] = (uint8_t)(n - 1);
+    memcpy(dst + *out, src, n);
+    *out += n;
+    return n;
+}
+
+uint16_t s3p_lz_encode(s3p_lz_enc_t *enc, const uint8_t *src,
+        const uint16_t src_len, uint8_t *dst, const uint16_t dst_size,
+        uint16_t *consumed)
+{
+    uint16_t i = 0;
+    uint16_t lit = 0;
+    uint16_t out = 0;
+    bool full = false;
+
+    memset(enc->hash, 0x00, sizeof(enc->hash));
+    while (i < src_len) {
+        uint8_t tok[3];
+        uint8_t tok_size = 0;
+        uint16_t len = 1;
+
+        while (i + len < src_len && len < S3P_LZ_RUN_MAX &&
+                src[i + len] == src[i])
+            len++;
+        if (len >= S3P_LZ_RUN_MIN) {
+            const uint16_t n = len - S3P_LZ_RUN_MIN;
+            tok[0] = TOK_RUN | (uint8_t)(n >> 8);
+            tok[1] = (uint8_t)n;
+            tok[2] = src[i];
+            tok_size = 3;
+        }
+        else if (i + S3P_LZ_MATCH_MIN <= src_len) {
+            const uint16_t h = hash3(src + i);
+            const uint16_t cand = enc->hash[h];
+            enc->hash[h] = i + 1;
+            if (cand && i - (cand - 1) <= S3P_LZ_WINDOW) {
+                const uint8_t *m = src + cand - 1;
+                const uint16_t max = src_len - i < S3P_LZ_MATCH_MAX ?
+                    src_len - i : S3P_LZ_MATCH_MAX;
+                len = 0;
+                while (len < max && m[len] == src[i + len])
+                    len++;
+                if (len >= S3P_LZ_MATCH_MIN) {
+                    tok[0] = TOK_MATCH | (uint8_t)(len - S3P_LZ_MATCH_MIN);
+                    tok[1] = (uint8_t)(i - (cand - 1) - 1);
+                    tok_size = 2;
+                }
+            }
+        }
+
+        if (!tok_size) {
+            i++;
+            if (i - lit < S3P_LZ_LIT_MAX)
+                continue;
+        }
+        // Pending literals go first
+        if (i > lit) {
+            const uint16_t n = put_lits(dst, &out, dst_size, src + lit, i - lit);
+            lit += n;
+            if (lit < i) {
+                full = true;
+                break;
+            }
+        }
+        if (!tok_size)
+            continue;
+        if (out + tok_size > dst_size) {
+            full = true;
+            break;
+        }
+        memcpy(dst + out, tok, tok_size);
+        out += tok_size;
+        i += len;
+        lit = i;
+    }
+    if (!full && i > lit)
+        lit += put_lits(dst, &out, dst_size, src + lit, i - lit);
+
+    *consumed = lit;
+    return out;
+}
+
+static bool dec_flush(s3p_lz_dec_t *dec)
+{
+    const uint16_t n = (uint16_t)(dec->pos - dec->flushed);
+
+    if (!n)
+        return true;
+    const bool res = dec->sink(dec->ctx, dec->flushed,
+            dec->win + (dec->flushed & WIN_MASK), n);
+    dec->flushed = dec->pos;
+    return res;
+}
+
+static bool dec_put(s3p_lz_dec_t *dec, const uint8_t b)
+{
+    dec->win[dec->pos & WIN_MASK] = b;
+    dec->pos++;
+    if (!(dec->pos & WIN_MASK))
+        return dec_flush(dec);
+    return true;
+}
+
+void s3p_lz_dec_init(s3p_lz_dec_t *dec, s3p_lz_sink_t sink, void *ctx)
+{
+    dec->pos = 0;
+    dec->flushed = 0;
+    dec->sink = sink;
+    dec->ctx = ctx;
+}
+
+bool s3p_lz_decode(s3p_lz_dec_t *dec, const uint8_t *src,
+        const uint16_t len, const uint32_t max_out)
+{
+    uint16_t i = 0;
+
+    while (i < len) {
+        const uint8_t c = src[i++];
+        uint16_t n;
+
+        if (c < TOK_RUN) {
+            n = c + 1;
+            if (i + n > len || dec->pos + n > max_out)
+                return false;
+            while (n--) {
+                if (!dec_put(dec, src[i++]))
+                    return false;
+            }
+        }
+        else if (c < TOK_MATCH) {
+            if (i + 2 > len)
+                return false;
+            n = (((uint16_t)(c & TOK_LEN_MASK) << 8) | src[i]) +
+                S3P_LZ_RUN_MIN;
+            const uint8_t v = src[i + 1];
+            i += 2;
+            if (dec->pos + n > max_out)
+                return false;
+            while (n--) {
+                if (!dec_put(dec, v))
+                    return false;
+            }
+        }
+        else {
+            if (i + 1 > len)
+                return false;
+            const uint16_t dist = (uint16_t)src[i++] + 1;
+            n = (c & TOK_LEN_MASK) + S3P_LZ_MATCH_MIN;
+            if (dist > dec->pos || dec->pos + n > max_out)
+                return false;
+            // Byte by byte, the copy may overlap its own output
+            while (n--) {
+                if (!dec_put(dec, dec->win[(dec->pos - dist) & WIN_MASK]))
+                    return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+int32_t s3p_lz_dec_finish(s3p_lz_dec_t *dec)
+{
+    if (!dec_flush(dec))
+        return -1;
+    return (int32_t)dec->pos;
+}
+
+typedef struct {
+    uint8_t *dst;
+    uint32_t size;
+} buf_sink_t;
+
+static bool buf_sink(void *ctx, const uint32_t off, const uint8_t *buf,
+        const uint16_t len)
+{
+    buf_sink_t *bs = ctx;
+
+    if (off + len > bs->size)
+        return false;
+    memcpy(bs->dst + off, buf, len);
+    return true;
+}
+
+int32_t s3p_lz_decode_buf(const uint8_t *src, const uint16_t len,
+        uint8_t *dst, const uint32_t dst_size)
+{
+    s3p_lz_dec_t dec;
+    buf_sink_t bs = { dst, dst_size };
+
+    s3p_lz_dec_init(&dec, buf_sink, &bs);
+    if (!s3p_lz_decode(&dec, src, len, dst_size))
+        return -1;
+    return s3p_lz_dec_finish(&dec);
+}
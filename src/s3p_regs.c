@@ -0,0 +1,298 @@
+/**
+@file s3p_regs.c
+@brief S3P node side lock-free register store
+*/
+
+#include <string.h>
+#include "s3p_regs.h"
+
+static bool in_block(const s3p_regs_t *regs, const uint16_t idx)
+{
+    return regs->desc[idx].block != S3P_REGS_NO_BLOCK;
+}
+
+// Table index of the first register with an id not below id
+static uint16_t lower_bound(const s3p_regs_t *regs, const uint16_t id)
+{
+    uint16_t lo = 0;
+    uint16_t hi = regs->cnt;
+
+    while (lo < hi) {
+        const uint16_t mid = lo + (hi - lo) / 2;
+        if (regs->desc[mid].id < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+static void put_item(uint8_t *buf, const s3p_reg_desc_t *d, const uint32_t raw)
+{
+    buf[0] = (uint8_t)(d->id >> 8);
+    buf[1] = (uint8_t)d->id;
+    buf[2] = d->vt;
+    buf[3] = (uint8_t)(raw >> 24);
+    buf[4] = (uint8_t)(raw >> 16);
+    buf[5] = (uint8_t)(raw >> 8);
+    buf[6] = (uint8_t)raw;
+}
+
+// Latch update of the block registers [from, from + cnt): the readers are
+// moved to copy 1 while copy 0 is written, then back to copy 0 while copy
+// 1 is written. Both copies are equal between updates
+static void block_write(s3p_regs_t *regs, s3p_reg_block_t *blk,
+        const uint16_t from, const uint16_t cnt, const uint32_t *raw)
+{
+    // Single writer: nobody else changes the sequence meanwhile
+    const uint32_t seq = atomic_load_explicit(&blk->seq, memory_order_relaxed);
+
+    for (int copy=0; copy<2; copy++) {
+        // Publishes the copy written last
+        atomic_store_explicit(&blk->seq, seq + 1 + copy, memory_order_release);
+        // The new sequence is visible before this copy changes
+        atomic_thread_fence(memory_order_release);
+        for (uint16_t i=0; i<cnt; i++)
+            atomic_store_explicit(&regs->vals[from + i].v[copy], raw[i],
+                    memory_order_relaxed);
+    }
+}
+
+// Consistent snapshot of the block registers [from, to), serialized as
+// items into buf
+static void block_read(const s3p_regs_t *regs, s3p_reg_block_t *blk,
+        const uint16_t from, const uint16_t to, uint8_t *buf)
+{
+    uint32_t seq;
+
+    do {
+        seq = atomic_load_explicit(&blk->seq, memory_order_acquire);
+        for (uint16_t i=from; i<to; i++)
+            put_item(&buf[(i - from) * S3P_SER_ITEM_SIZE], &regs->desc[i],
+                    atomic_load_explicit(&regs->vals[i].v[seq & 1],
+                        memory_order_relaxed));
+        // Values are read before the sequence is checked again
+        atomic_thread_fence(memory_order_acquire);
+    } while (seq != atomic_load_explicit(&blk->seq, memory_order_relaxed));
+}
+
+bool s3p_regs_init(s3p_regs_t *regs, const s3p_reg_desc_t *desc,
+        s3p_reg_val_t *vals, const uint16_t cnt, s3p_reg_block_t *blocks,
+        const uint8_t blocks_cnt)
+{
+    memset(regs, 0x00, sizeof(s3p_regs_t));
+    regs->desc = desc;
+    regs->vals = vals;
+    regs->cnt = cnt;
+    regs->blocks = blocks;
+    regs->blocks_cnt = blocks_cnt;
+
+    for (uint8_t b=0; b<blocks_cnt; b++) {
+        blocks[b].first = 0;
+        blocks[b].cnt = 0;
+        atomic_init(&blocks[b].seq, 0);
+    }
+    for (uint16_t i=0; i<cnt; i++) {
+        atomic_init(&vals[i].v[0], 0);
+        atomic_init(&vals[i].v[1], 0);
+        if (i && desc[i].id <= desc[i - 1].id)
+            return false;
+        const uint8_t b = desc[i].block;
+        if (b == S3P_REGS_NO_BLOCK)
+            continue;
+        if (b >= blocks_cnt)
+            return false;
+        if (!blocks[b].cnt)
+            blocks[b].first = i;
+        else if (blocks[b].first + blocks[b].cnt != i)
+            return false;
+        blocks[b].cnt++;
+    }
+
+    return true;
+}
+
+int s3p_regs_find(const s3p_regs_t *regs, const uint16_t id)
+{
+    const uint16_t idx = lower_bound(regs, id);
+
+    return idx < regs->cnt && regs->desc[idx].id == id ? idx : -1;
+}
+
+void s3p_regs_set(s3p_regs_t *regs, const uint16_t idx, const uint32_t raw)
+{
+    if (!in_block(regs, idx)) {
+        atomic_store_explicit(&regs->vals[idx].v[0], raw, memory_order_relaxed);
+        return;
+    }
+    block_write(regs, &regs->blocks[regs->desc[idx].block], idx, 1, &raw);
+}
+
+void s3p_regs_set_block(s3p_regs_t *regs, const uint8_t block,
+        const uint32_t *raw)
+{
+    s3p_reg_block_t *blk = &regs->blocks[block];
+
+    block_write(regs, blk, blk->first, blk->cnt, raw);
+}
+
+uint32_t s3p_regs_get(const s3p_regs_t *regs, const uint16_t idx)
+{
+    // One value is atomic: copy 0 holds the old or the new one, both
+    // copies getting every value
+    return atomic_load_explicit(&regs->vals[idx].v[0], memory_order_relaxed);
+}
+
+uint16_t s3p_regs_read(const s3p_regs_t *regs, const uint16_t first_id,
+        const uint16_t regs_cnt, uint8_t *buf, const uint16_t size)
+{
+    const uint32_t last_id = (uint32_t)first_id + regs_cnt;
+    const int max_items = size / S3P_SER_ITEM_SIZE;
+
+    const uint16_t lo = lower_bound(regs, first_id);
+
+    // Registers [lo, end) are in range and fit
+    uint16_t end = lo;
+    while (end < regs->cnt && regs->desc[end].id < last_id &&
+            end - lo < max_items)
+        end++;
+
+    for (uint16_t i=lo; i<end; ) {
+        uint8_t *item = &buf[(i - lo) * S3P_SER_ITEM_SIZE];
+        if (!in_block(regs, i)) {
+            put_item(item, &regs->desc[i], atomic_load_explicit(
+                        &regs->vals[i].v[0], memory_order_relaxed));
+            i++;
+            continue;
+        }
+        // The block registers in range at once
+        s3p_reg_block_t *blk = &regs->blocks[regs->desc[i].block];
+        uint16_t to = blk->first + blk->cnt;
+        if (to > end)
+            to = end;
+        block_read(regs, blk, i, to, item);
+        i = to;
+    }
+
+    return (end - lo) * S3P_SER_ITEM_SIZE;
+}
+
+uint16_t s3p_regs_telem_read(void *ctx, const uint16_t first_reg,
+        const uint16_t regs_cnt, uint8_t *buf, const uint16_t size)
+{
+    return s3p_regs_read((const s3p_regs_t *)ctx, first_reg, regs_cnt, buf,
+            size);
+}
+
+static uint8_t handle_write(s3p_regs_t *regs, const s3p_packet_t *pkt_in)
+{
+    // Reg id(2), value type(1), value(4)
+    if (pkt_in->data_len < 7)
+        return S3P_ERR_SIZE;
+    const uint16_t id = ((uint16_t)pkt_in->data[0] << 8) | pkt_in->data[1];
+    const uint32_t raw = ((uint32_t)pkt_in->data[3] << 24) |
+        ((uint32_t)pkt_in->data[4] << 16) | ((uint32_t)pkt_in->data[5] << 8) |
+        pkt_in->data[6];
+
+    const int idx = s3p_regs_find(regs, id);
+    if (idx < 0)
+        return S3P_ERR_NO_REG;
+    if (!(regs->desc[idx].flags & S3P_REG_F_MUTABLE))
+        return S3P_ERR_NO_WRITE;
+    if (pkt_in->data[2] != regs->desc[idx].vt)
+        return S3P_ERR_TYPE;
+    if (regs->write != NULL) {
+        const uint8_t res = regs->write(regs->ctx, idx, raw);
+        if (res != S3P_ERR_NONE)
+            return res;
+    }
+    s3p_regs_set(regs, idx, raw);
+
+    return S3P_ERR_NONE;
+}
+
+static uint16_t handle_info(const s3p_regs_t *regs, const s3p_packet_t *pkt_in,
+        uint8_t *data, const uint16_t data_size)
+{
+    uint16_t n = 0;
+
+    // Reg id(2)
+    if (pkt_in->data_len < 2) {
+        data[n++] = S3P_ERR_SIZE;
+        return n;
+    }
+    const uint16_t id = ((uint16_t)pkt_in->data[0] << 8) | pkt_in->data[1];
+    const int idx = s3p_regs_find(regs, id);
+    if (idx < 0) {
+        data[n++] = S3P_ERR_NO_REG;
+        return n;
+    }
+
+    const s3p_reg_desc_t *d = &regs->desc[idx];
+    const uint16_t next_id = idx + 1 < regs->cnt ? regs->desc[idx + 1].id : 0;
+    data[n++] = S3P_ERR_NONE;
+    data[n++] = (uint8_t)(d->id >> 8);
+    data[n++] = (uint8_t)d->id;
+    data[n++] = (uint8_t)(next_id >> 8);
+    data[n++] = (uint8_t)next_id;
+    data[n++] = d->vt;
+    data[n++] = d->group_id;
+    data[n++] = (uint8_t)(d->flags >> 8);
+    data[n++] = (uint8_t)d->flags;
+    // Name, null terminated, truncated to fit
+    for (int i=0; d->name != NULL && d->name[i] && i < S3P_MAX_NAME_SIZE - 1 &&
+            n + 1 < data_size; i++)
+        data[n++] = d->name[i];
+    data[n++] = '\0';
+
+    return n;
+}
+
+bool s3p_regs_handle(s3p_regs_t *regs, const uint8_t node_id,
+        const s3p_packet_t *pkt_in, s3p_packet_t *pkt_out,
+        const uint16_t data_size, uint32_t *delay_us)
+{
+    uint8_t *data = pkt_out->data;
+    uint16_t n = 0;
+
+    *delay_us = 0;
+    // Answered by every node at once otherwise
+    if (pkt_in->dst_id == S3P_ID_BROADCAST && pkt_in->type != PT_GROUP_READ)
+        return false;
+    switch (pkt_in->type) {
+    case PT_GROUP_READ:
+        if (!s3p_group_slot(pkt_in, node_id, delay_us))
+            return false;
+        // fall through
+    case PT_READ_REGS:
+        // First reg(2), regs count(2)
+        if (pkt_in->data_len < 4) {
+            data[n++] = S3P_ERR_SIZE;
+            break;
+        }
+        data[n++] = S3P_ERR_NONE;
+        n += s3p_regs_read(regs,
+                ((uint16_t)pkt_in->data[0] << 8) | pkt_in->data[1],
+                ((uint16_t)pkt_in->data[2] << 8) | pkt_in->data[3],
+                &data[n], data_size - n);
+        break;
+    case PT_WRITE_REG:
+        data[n++] = handle_write(regs, pkt_in);
+        break;
+    case PT_REG_INFO:
+        n = handle_info(regs, pkt_in, data, data_size);
+        break;
+    default:
+        return false;
+    }
+
+    pkt_out->src_id = node_id;
+    pkt_out->dst_id = pkt_in->src_id;
+    pkt_out->flags_seq = pkt_in->flags_seq;
+    pkt_out->seq = pkt_in->seq;
+    pkt_out->type = pkt_in->type + 1;
+    pkt_out->data_len = n;
+
+    return true;
+}
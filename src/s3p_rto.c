@@ -0,0 +1,71 @@
+/**
+@file s3p_rto.c
+@brief S3P adaptive response timeout estimator
+*/
+
+#include <string.h>
+#include "s3p_rto.h"
+
+void s3p_rto_init(s3p_rto_t *rto, const uint32_t baud,
+        const uint8_t bits_per_byte, const uint8_t retries)
+{
+    memset(rto, 0x00, sizeof(s3p_rto_t));
+    rto->baud = baud;
+    rto->bits_per_byte = bits_per_byte;
+    rto->retries = retries;
+}
+
+uint32_t s3p_rto_wire_us(const s3p_rto_t *rto, const uint32_t frame_len)
+{
+    if (!rto->baud)
+        return 0;
+    return (uint32_t)(((uint64_t)frame_len * rto->bits_per_byte * 1000000U +
+                rto->baud - 1) / rto->baud);
+}
+
+void s3p_rto_update(s3p_rto_t *rto, const uint8_t node_id,
+        const uint32_t rtt_us, const uint32_t req_len, const uint32_t resp_len)
+{
+    s3p_rto_node_t *node = &rto->nodes[node_id];
+    const uint32_t wire_us = s3p_rto_wire_us(rto, req_len) +
+        s3p_rto_wire_us(rto, resp_len);
+    // Processing and turnaround time only
+    const uint32_t r = rtt_us > wire_us ? rtt_us - wire_us : 0;
+
+    // RFC 6298: alpha = 1/8, beta = 1/4
+    if (!node->valid) {
+        node->srtt_us = r;
+        node->rttvar_us = r / 2;
+        node->valid = 1;
+        return;
+    }
+    const uint32_t err = node->srtt_us > r ? node->srtt_us - r : r - node->srtt_us;
+    node->rttvar_us = node->rttvar_us - node->rttvar_us / 4 + err / 4;
+    node->srtt_us = node->srtt_us - node->srtt_us / 8 + r / 8;
+}
+
+uint32_t s3p_rto_timeout_ms(const s3p_rto_t *rto, const uint8_t node_id,
+        const uint32_t req_len, const uint32_t resp_len, const uint8_t attempt)
+{
+    const s3p_rto_node_t *node = &rto->nodes[node_id];
+    uint64_t to_us = s3p_rto_wire_us(rto, req_len) +
+        s3p_rto_wire_us(rto, resp_len);
+
+    if (node->valid) {
+        const uint32_t var_us = 4 * node->rttvar_us;
+        to_us += node->srtt_us;
+        to_us += var_us > S3P_RTO_GRANULARITY_US ? var_us : S3P_RTO_GRANULARITY_US;
+    }
+    else
+        to_us += S3P_RTO_INIT_MS * 1000U;
+
+    // Exponential backoff on retransmissions
+    to_us <<= attempt < 16 ? attempt : 16;
+
+    uint64_t to_ms = (to_us + 999) / 1000;
+    if (to_ms < S3P_RTO_MIN_MS)
+        to_ms = S3P_RTO_MIN_MS;
+    if (to_ms > S3P_RTO_MAX_MS)
+        to_ms = S3P_RTO_MAX_MS;
+    return (uint32_t)to_ms;
+}
@@ -0,0 +1,119 @@
+/**
+@file s3p_stats.c
+@brief S3P link statistics and latency histograms
+*/
+
+#include <string.h>
+#include "s3p_stats.h"
+
+#define SUB_CNT     (1U << S3P_HIST_SUB_BITS)
+
+static uint8_t msb32(uint32_t v)
+{
+    uint8_t n = 0;
+    while (v >>= 1)
+        n++;
+    return n;
+}
+
+static uint32_t hist_idx(uint32_t us)
+{
+    if (us < SUB_CNT)
+        return us;
+
+    uint8_t msb = msb32(us);
+    if (msb >= S3P_HIST_MAX_BITS)
+        return S3P_HIST_BUCKETS - 1;
+    // Keep the S3P_HIST_SUB_BITS bits below the msb
+    const uint8_t shift = msb - S3P_HIST_SUB_BITS;
+    return ((shift + 1) << S3P_HIST_SUB_BITS) + (us >> shift) - SUB_CNT;
+}
+
+// Highest value accounted in a bucket
+static uint32_t hist_upper(const uint32_t idx)
+{
+    if (idx < SUB_CNT)
+        return idx;
+
+    const uint8_t shift = (idx >> S3P_HIST_SUB_BITS) - 1;
+    const uint32_t sub = SUB_CNT + (idx & (SUB_CNT - 1));
+    return ((sub + 1) << shift) - 1;
+}
+
+void s3p_stats_init(s3p_stats_t *stats)
+{
+    memset(stats, 0x00, sizeof(s3p_stats_t));
+}
+
+void s3p_stats_latency(s3p_stats_t *stats, const uint8_t type,
+        const uint32_t us)
+{
+    s3p_hist_t *hist = &stats->lat[S3P_STATS_TYPE_IDX(type)];
+
+    if (!hist->cnt || us < hist->min_us)
+        hist->min_us = us;
+    if (us > hist->max_us)
+        hist->max_us = us;
+    hist->cnt++;
+    hist->sum_us += us;
+    hist->buckets[hist_idx(us)]++;
+}
+
+void s3p_stats_merge(s3p_stats_t *dst, const s3p_stats_t *src)
+{
+    s3p_counters_t *d = &dst->cnt;
+    const s3p_counters_t *s = &src->cnt;
+
+    d->frames_tx += s->frames_tx;
+    d->frames_rx += s->frames_rx;
+    d->bytes_tx += s->bytes_tx;
+    d->bytes_rx += s->bytes_rx;
+    for (int i=0; i<S3P_STATS_COBS_BITS; i++)
+        d->cobs_err[i] += s->cobs_err[i];
+    d->size_err += s->size_err;
+    d->crc_err += s->crc_err;
+    d->dst_err += s->dst_err;
+    d->timeouts += s->timeouts;
+    d->seq_err += s->seq_err;
+    d->retries += s->retries;
+
+    for (int t=0; t<S3P_STATS_TYPES; t++) {
+        s3p_hist_t *dh = &dst->lat[t];
+        const s3p_hist_t *sh = &src->lat[t];
+        if (!sh->cnt)
+            continue;
+        if (!dh->cnt || sh->min_us < dh->min_us)
+            dh->min_us = sh->min_us;
+        if (sh->max_us > dh->max_us)
+            dh->max_us = sh->max_us;
+        dh->cnt += sh->cnt;
+        dh->sum_us += sh->sum_us;
+        for (int i=0; i<S3P_HIST_BUCKETS; i++)
+            dh->buckets[i] += sh->buckets[i];
+    }
+}
+
+uint32_t s3p_hist_percentile(const s3p_hist_t *hist, const float pct)
+{
+    uint32_t target;
+    uint32_t acc = 0;
+
+    if (!hist->cnt)
+        return 0;
+
+    // Rank of the percentile, rounded up
+    const float rank = hist->cnt * pct / 100.0f;
+    target = (uint32_t)rank;
+    if (target < rank)
+        target++;
+    if (target < 1)
+        target = 1;
+    for (int i=0; i<S3P_HIST_BUCKETS; i++) {
+        acc += hist->buckets[i];
+        if (acc >= target) {
+            const uint32_t upper = hist_upper(i);
+            return upper < hist->max_us ? upper : hist->max_us;
+        }
+    }
+    return hist->max_us;
+}
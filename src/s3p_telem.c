@@ -0,0 +1,112 @@
+/**
+@file s3p_telem.c
+@brief S3P node side periodic telemetry scheduler
+*/
+
+#include <string.h>
+#include "crc16.h"
+#include "s3p_telem.h"
+
+// Wraparound safe "a is at or after b"
+#define TIME_AFTER_EQ(_a, _b)   ((int32_t)((_a) - (_b)) >= 0)
+
+void s3p_telem_init(s3p_telem_t *telem, s3p_telem_read_t read, void *ctx)
+{
+    memset(telem, 0x00, sizeof(s3p_telem_t));
+    telem->read = read;
+    telem->ctx = ctx;
+}
+
+uint8_t s3p_telem_subscribe(s3p_telem_t *telem, const s3p_packet_t *pkt_in,
+        const uint32_t now_ms)
+{
+    s3p_sub_t *sub = NULL;
+    s3p_sub_t *free_sub = NULL;
+
+    // Sub id(1), first reg(2), regs count(2), period(2), flags(1)
+    if (pkt_in->data_len < 8)
+        return S3P_ERR_SIZE;
+    const uint8_t sub_id = pkt_in->data[0];
+    const uint16_t first_reg = ((uint16_t)pkt_in->data[1] << 8) | pkt_in->data[2];
+    const uint16_t regs_cnt = ((uint16_t)pkt_in->data[3] << 8) | pkt_in->data[4];
+    const uint16_t period_ms = ((uint16_t)pkt_in->data[5] << 8) | pkt_in->data[6];
+
+    for (int i=0; i<S3P_TELEM_MAX_SUBS; i++) {
+        s3p_sub_t *s = &telem->subs[i];
+        if (s->dst_id == pkt_in->src_id && s->sub_id == sub_id)
+            sub = s;
+        else if (s->dst_id == S3P_ID_NONE && free_sub == NULL)
+            free_sub = s;
+    }
+
+    // Cancel
+    if (!period_ms) {
+        if (sub != NULL)
+            sub->dst_id = S3P_ID_NONE;
+        return S3P_ERR_NONE;
+    }
+
+    if (!regs_cnt || period_ms < S3P_TELEM_MIN_PERIOD_MS ||
+            S3P_TELEM_HDR_SIZE + regs_cnt * S3P_SER_ITEM_SIZE > S3P_MAX_DATA_SIZE)
+        return S3P_ERR_SIZE;
+    if (sub == NULL)
+        sub = free_sub;
+    if (sub == NULL)
+        return S3P_ERR_BUSY;
+
+    sub->dst_id = pkt_in->src_id;
+    sub->sub_id = sub_id;
+    sub->flags = pkt_in->data[7];
+    sub->first_reg = first_reg;
+    sub->regs_cnt = regs_cnt;
+    sub->period_ms = period_ms;
+    sub->seq = 0;
+    sub->next_ms = now_ms;
+    sub->last_crc = 0;
+
+    return S3P_ERR_NONE;
+}
+
+bool s3p_telem_poll(s3p_telem_t *telem, const uint32_t now_ms,
+        const uint8_t src_id, s3p_packet_t *pkt_out, const uint16_t data_size)
+{
+    for (int i=0; i<S3P_TELEM_MAX_SUBS; i++) {
+        s3p_sub_t *sub = &telem->subs[i];
+        if (sub->dst_id == S3P_ID_NONE || !TIME_AFTER_EQ(now_ms, sub->next_ms))
+            continue;
+
+        // Keep the cadence, skipping the periods missed by a late poll
+        sub->next_ms += sub->period_ms;
+        if (TIME_AFTER_EQ(now_ms, sub->next_ms))
+            sub->next_ms = now_ms + sub->period_ms;
+
+        uint8_t *data = pkt_out->data;
+        const uint16_t items = telem->read(telem->ctx, sub->first_reg,
+                sub->regs_cnt, data + S3P_TELEM_HDR_SIZE,
+                data_size - S3P_TELEM_HDR_SIZE);
+        if (sub->flags & S3P_TELEM_F_ON_CHANGE) {
+            const uint16_t crc = crc16_ccitt(data + S3P_TELEM_HDR_SIZE, items,
+                    CRC_START_CCITT_1D0F);
+            if (sub->seq && crc == sub->last_crc)
+                continue;
+            sub->last_crc = crc;
+        }
+
+        pkt_out->src_id = src_id;
+        pkt_out->dst_id = sub->dst_id;
+        pkt_out->flags_seq = S3P_SEQ_NONE;
+        pkt_out->type = PT_TELEMETRY;
+        data[0] = sub->sub_id;
+        data[1] = (uint8_t)(sub->seq >> 8);
+        data[2] = (uint8_t)sub->seq;
+        data[3] = (uint8_t)(now_ms >> 24);
+        data[4] = (uint8_t)(now_ms >> 16);
+        data[5] = (uint8_t)(now_ms >> 8);
+        data[6] = (uint8_t)now_ms;
+        pkt_out->data_len = S3P_TELEM_HDR_SIZE + items;
+        sub->seq++;
+        return true;
+    }
+
+    return false;
+}
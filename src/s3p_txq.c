@@ -0,0 +1,71 @@
+/**
+@file s3p_txq.c
+@brief S3P transmit queue, batching frames into a single write
+*/
+
+#include <stddef.h>
+#include "s3p_txq.h"
+
+void s3p_txq_init(s3p_txq_t *txq, uint8_t *buf, const uint32_t size,
+        const uint32_t flush_size, const uint32_t flush_ms,
+        s3p_txq_write_t write, void *ctx)
+{
+    txq->buf = buf;
+    txq->size = size;
+    txq->len = 0;
+    txq->frames = 0;
+    txq->flush_size = flush_size;
+    txq->flush_ms = flush_ms;
+    txq->first_ms = 0;
+    txq->write = write;
+    txq->ctx = ctx;
+    txq->writes = 0;
+}
+
+uint16_t s3p_txq_push(s3p_txq_t *txq, s3p_link_t *link,
+        const s3p_packet_t *pkt_out, const uint32_t now_ms,
+        const uint8_t **frame)
+{
+    // Worst case frame size, the encoder needs it all
+    if (txq->len + S3P_LINK_FRAME_SIZE(link) > txq->size &&
+            !s3p_txq_flush(txq))
+        return 0;
+    if (S3P_LINK_FRAME_SIZE(link) > txq->size)
+        return 0;
+
+    uint8_t *tail = txq->buf + txq->len;
+    const uint16_t size = s3p_link_make_frame(link, tail, pkt_out);
+    if (!size)
+        return 0;
+    if (!txq->frames)
+        txq->first_ms = now_ms;
+    txq->len += size;
+    txq->frames++;
+    if (frame != NULL)
+        *frame = tail;
+
+    if (txq->flush_size && txq->len >= txq->flush_size &&
+            !s3p_txq_flush(txq))
+        return 0;
+    return size;
+}
+
+bool s3p_txq_flush(s3p_txq_t *txq)
+{
+    if (!txq->len)
+        return true;
+
+    const bool res = txq->write(txq->ctx, txq->buf, txq->len);
+    txq->writes++;
+    txq->len = 0;
+    txq->frames = 0;
+    return res;
+}
+
+bool s3p_txq_poll(s3p_txq_t *txq, const uint32_t now_ms)
+{
+    if (!txq->frames || !txq->flush_ms ||
+            now_ms - txq->first_ms < txq->flush_ms)
+        return true;
+    return s3p_txq_flush(txq);
+}
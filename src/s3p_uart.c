@@ -0,0 +1,272 @@
+/**
+@file s3p_uart.c
+@brief S3P node side DMA UART driver: circular DMA receive, double buffered
+DMA transmit
+*/
+
+#include <string.h>
+#include "s3p_uart.h"
+
+#define TX_IDX(_fill)       ((_fill) >> 31)
+#define TX_LEN(_fill)       ((_fill) & 0xFFFF)
+// Bytes the DMA may have stored beyond the position it reports (UART and
+// DMA FIFOs)
+#define RX_MARGIN           4
+
+// Bytes written by the DMA so far, published or not yet: the live DMA
+// position past the last one published by #s3p_uart_rx_event, less than
+// a buffer apart thanks to the half transfer interrupt
+static uint32_t rx_written(s3p_uart_t *uart)
+{
+    const uint32_t head = atomic_load_explicit(&uart->rx_head,
+            memory_order_acquire);
+    const uint16_t pos = uart->hal->rx_pos(uart->hw);
+
+    // head & mask is the DMA position of the last event
+    return head + ((pos - head) & (uart->rx_size - 1));
+}
+
+bool s3p_uart_init(s3p_uart_t *uart, const s3p_uart_hal_t *hal, void *hw,
+        uint8_t *rx_buf, const uint16_t rx_size, uint8_t *lin_buf,
+        const uint16_t lin_size, uint8_t *tx_buf, const uint16_t tx_size)
+{
+    memset(uart, 0x00, sizeof(s3p_uart_t));
+    uart->hal = hal;
+    uart->hw = hw;
+    uart->rx_buf = rx_buf;
+    uart->rx_size = rx_size;
+    atomic_init(&uart->rx_head, 0);
+    for (int i=0; i<S3P_UART_RX_STAMPS; i++) {
+        atomic_init(&uart->rx_stamps[i].head, 0);
+        atomic_init(&uart->rx_stamps[i].us, 0);
+    }
+    atomic_init(&uart->rx_stamps_seq, 0);
+    uart->lin_buf = lin_buf;
+    uart->lin_size = lin_size;
+    uart->tx_buf[0] = tx_buf;
+    uart->tx_buf[1] = tx_buf + tx_size;
+    uart->tx_size = tx_size;
+    atomic_init(&uart->tx_fill, 0);
+    atomic_init(&uart->tx_busy, false);
+
+    // Offsets in the buffer are the byte counters masked
+    if (!rx_size || (rx_size & (rx_size - 1)))
+        return false;
+    return hal->rx_start(hw, rx_buf, rx_size);
+}
+
+bool s3p_uart_rx_event(s3p_uart_t *uart, const uint32_t now_us)
+{
+    const uint16_t pos = uart->hal->rx_pos(uart->hw);
+
+    if (pos == uart->rx_dma_pos)
+        return false;
+    // Less than a buffer since the last event, thanks to the half
+    // transfer interrupt
+    const uint16_t delta = (pos - uart->rx_dma_pos) & (uart->rx_size - 1);
+    uart->rx_dma_pos = pos;
+    // Single writer, the interrupt
+    const uint32_t head = atomic_load_explicit(&uart->rx_head,
+            memory_order_relaxed);
+    const uint32_t seq = atomic_load_explicit(&uart->rx_stamps_seq,
+            memory_order_relaxed);
+    const uint16_t k = (seq / 2) & (S3P_UART_RX_STAMPS - 1);
+    atomic_store_explicit(&uart->rx_stamps_seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&uart->rx_stamps[k].head, head + delta,
+            memory_order_relaxed);
+    atomic_store_explicit(&uart->rx_stamps[k].us, now_us,
+            memory_order_relaxed);
+    atomic_store_explicit(&uart->rx_stamps_seq, seq + 2, memory_order_release);
+    atomic_store_explicit(&uart->rx_head, head + delta, memory_order_release);
+
+    return true;
+}
+
+// Time of the first receive interrupt that published the byte before end,
+// i.e. that saw the frame delimiter
+static uint32_t rx_time(s3p_uart_t *uart, const uint32_t end)
+{
+    for (;;) {
+        const uint32_t seq = atomic_load_explicit(&uart->rx_stamps_seq,
+                memory_order_acquire);
+        // Being written by the interrupt, on another core
+        if (seq & 1)
+            continue;
+        const uint32_t n = seq / 2;
+        const uint32_t cnt = n < S3P_UART_RX_STAMPS ? n : S3P_UART_RX_STAMPS;
+        uint32_t us = 0;
+
+        // Oldest first: the frame was published by one of them or before
+        for (uint32_t i=cnt; i>0; i--) {
+            const uint16_t k = (n - i) & (S3P_UART_RX_STAMPS - 1);
+            const uint32_t head = atomic_load_explicit(
+                    &uart->rx_stamps[k].head, memory_order_relaxed);
+            us = atomic_load_explicit(&uart->rx_stamps[k].us,
+                    memory_order_relaxed);
+            if ((int32_t)(head - end) >= 0)
+                break;
+        }
+        // Stamps written meanwhile: read again
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&uart->rx_stamps_seq,
+                    memory_order_relaxed) == seq)
+            return us;
+    }
+}
+
+bool s3p_uart_recv(s3p_uart_t *uart, s3p_link_t *link, s3p_packet_t *pkt,
+        const uint8_t dst_id)
+{
+    const uint16_t mask = uart->rx_size - 1;
+    const uint32_t head = atomic_load_explicit(&uart->rx_head,
+            memory_order_acquire);
+
+    // The DMA wrapped over the frame being received: resync on the first
+    // delimiter still in the buffer, the frames after it are intact
+    if (head - uart->rx_frame > uart->rx_size) {
+        uart->rx_overruns++;
+        uart->rx_tail = head - uart->rx_size;
+        uart->rx_frame = uart->rx_tail;
+        uart->rx_skip = true;
+    }
+
+    while (uart->rx_tail != head) {
+        const uint16_t off = uart->rx_tail & mask;
+        uint32_t n = head - uart->rx_tail;
+        if (n > (uint32_t)uart->rx_size - off)
+            n = uart->rx_size - off;
+
+        const uint8_t *delim = memchr(&uart->rx_buf[off], S3P_COBS_DELIM, n);
+        if (delim == NULL) {
+            uart->rx_tail += n;
+            // No delimiter within a frame size: drop up to the next one
+            if (!uart->rx_skip && uart->rx_tail - uart->rx_frame > uart->lin_size) {
+                uart->rx_oversized++;
+                uart->rx_skip = true;
+            }
+            if (uart->rx_skip)
+                uart->rx_frame = uart->rx_tail;
+            continue;
+        }
+
+        const uint32_t start = uart->rx_frame;
+        const uint32_t len = uart->rx_tail + (delim - &uart->rx_buf[off]) - start;
+        uart->rx_tail = start + len + 1;
+        uart->rx_frame = uart->rx_tail;
+        if (uart->rx_skip) {
+            uart->rx_skip = false;
+            continue;
+        }
+        if (!len)
+            continue;
+        if (len > uart->lin_size) {
+            uart->rx_oversized++;
+            continue;
+        }
+
+        // In place, unless the frame wraps around the buffer end
+        const uint16_t first = start & mask;
+        const uint8_t *frame = &uart->rx_buf[first];
+        if (first + len > uart->rx_size) {
+            const uint16_t part = uart->rx_size - first;
+            memcpy(uart->lin_buf, frame, part);
+            memcpy(uart->lin_buf + part, uart->rx_buf, len - part);
+            frame = uart->lin_buf;
+        }
+        const bool res = s3p_link_parse_frame(link, pkt, dst_id, frame, len);
+        // Overwritten by the DMA while being parsed: the frame is read
+        // before the position is checked
+        atomic_thread_fence(memory_order_acquire);
+        if (rx_written(uart) + RX_MARGIN - start > uart->rx_size) {
+            uart->rx_overruns++;
+            continue;
+        }
+        if (res) {
+            uart->rx_us = rx_time(uart, start + len + 1);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Start the buffer being filled if the DMA is idle, from the main loop or
+// from the transmit complete interrupt. The caller owning tx_busy is the
+// only one swapping the buffers
+static bool tx_kick(s3p_uart_t *uart)
+{
+    for (;;) {
+        bool idle = false;
+        if (!atomic_compare_exchange_strong_explicit(&uart->tx_busy, &idle,
+                    true, memory_order_acq_rel, memory_order_relaxed))
+            return false;
+
+        // Seal the buffer being filled, the other one (sent, the DMA is
+        // idle) becomes the one being filled
+        uint32_t fill = atomic_load_explicit(&uart->tx_fill,
+                memory_order_acquire);
+        while (TX_LEN(fill) && !atomic_compare_exchange_weak_explicit(
+                    &uart->tx_fill, &fill, (TX_IDX(fill) ^ 1) << 31,
+                    memory_order_acq_rel, memory_order_acquire))
+            ;
+        if (TX_LEN(fill)) {
+            if (uart->hal->tx_start(uart->hw, uart->tx_buf[TX_IDX(fill)],
+                        TX_LEN(fill)))
+                return true;
+            // Frames lost, as on a line error
+            atomic_store_explicit(&uart->tx_busy, false, memory_order_release);
+            return false;
+        }
+
+        atomic_store_explicit(&uart->tx_busy, false, memory_order_release);
+        // Frames queued after the check saw the DMA busy, and gave up
+        if (!TX_LEN(atomic_load_explicit(&uart->tx_fill, memory_order_acquire)))
+            return false;
+    }
+}
+
+uint16_t s3p_uart_send(s3p_uart_t *uart, s3p_link_t *link,
+        const s3p_packet_t *pkt_out)
+{
+    uint16_t size;
+
+    for (;;) {
+        uint32_t fill = atomic_load_explicit(&uart->tx_fill,
+                memory_order_acquire);
+        // Worst case frame size, the encoder needs it all
+        if (TX_LEN(fill) + S3P_LINK_FRAME_SIZE(link) > uart->tx_size) {
+            if (TX_LEN(fill) && tx_kick(uart))
+                continue;
+            return 0;
+        }
+
+        // Past the queued bytes: untouched by a transfer of this buffer
+        // started meanwhile
+        size = s3p_link_make_frame(link,
+                uart->tx_buf[TX_IDX(fill)] + TX_LEN(fill), pkt_out);
+        if (!size)
+            return 0;
+        if (atomic_compare_exchange_strong_explicit(&uart->tx_fill, &fill,
+                    fill + size, memory_order_acq_rel, memory_order_acquire))
+            break;
+        // The buffer was sealed and sent meanwhile, encode again into the
+        // other one
+    }
+    uart->tx_frames++;
+    tx_kick(uart);
+
+    return size;
+}
+
+void s3p_uart_tx_done(s3p_uart_t *uart)
+{
+    atomic_store_explicit(&uart->tx_busy, false, memory_order_release);
+    tx_kick(uart);
+}
+
+bool s3p_uart_tx_idle(s3p_uart_t *uart)
+{
+    return !atomic_load_explicit(&uart->tx_busy, memory_order_acquire) &&
+        !TX_LEN(atomic_load_explicit(&uart->tx_fill, memory_order_acquire));
+}
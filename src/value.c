@@ -1,7 +1,9 @@
 #include <stdio.h>
-#include <inttypes.h>
+#include <stdbool.h>
+#include <float.h>
 #include <string.h>
 #include "value.h"
+#include "value_fmt.h"
 
 /* value helper types/funtions source code
  * version: 1.0
@@ -9,26 +11,30 @@
  */
 
 #define VALUE_MIN(_x,_y)        ( ( (_x) > (_y) ) ? (_y) : (_x) )
-#define VALUE_SWITCH_SNPRINTF(_casename, _strtype, _cast, _field) \
-    case _casename: \
-    snprintf(buf, max_size, _strtype, (_cast)value->val._field); \
-    break;
 void value_dump(char *buf, const value_t * const value, const int max_size)
 {
+    char tmp[VALUE_SCALAR_MAX_SIZE];
     int size;
 
     switch (value->vt) {
-        VALUE_SWITCH_SNPRINTF(VT_U8,  "%"PRIu8,    uint8_t,  u8)
-        VALUE_SWITCH_SNPRINTF(VT_I8,  "%"PRId8,    int8_t,   i8)
-        VALUE_SWITCH_SNPRINTF(VT_X8,  "0x%"PRIX8,  uint8_t,  u8)
-        VALUE_SWITCH_SNPRINTF(VT_U16, "%"PRIu16,   uint16_t, u16)
-        VALUE_SWITCH_SNPRINTF(VT_I16, "%"PRId16,   int16_t,  i16)
-        VALUE_SWITCH_SNPRINTF(VT_X16, "0x%"PRIX16, uint16_t, u16)
-        VALUE_SWITCH_SNPRINTF(VT_U32, "%"PRIu32,   uint32_t, u32)
-        VALUE_SWITCH_SNPRINTF(VT_I32, "%"PRId32,   int32_t,  i32)
-        VALUE_SWITCH_SNPRINTF(VT_X32, "0x%"PRIX32, uint32_t, u32)
-        VALUE_SWITCH_SNPRINTF(VT_FLT, "%.3f",      float,    flt)
-
+        case VT_U8:
+        case VT_I8:
+        case VT_X8:
+        case VT_U16:
+        case VT_I16:
+        case VT_X16:
+        case VT_U32:
+        case VT_I32:
+        case VT_X32:
+        case VT_FLT:
+            // Same truncation as snprintf
+            if (max_size <= 0)
+                break;
+            size = VALUE_MIN(value_fmt(tmp, value->vt, value->val.u32),
+                    max_size - 1);
+            memcpy(buf, tmp, size);
+            buf[size] = '\0';
+            break;
         case VT_EMPTY:
             snprintf(buf, max_size, "%s", "EMPTY");
             break;
@@ -62,12 +68,357 @@ const char *value_type_str(const value_type_t vt)
     return "nn";
 }
 
+// Perfect hash of the type names:
+// (5 * (str[0] + str[1]) + (str[2] ? 3 : 2)) % 16, i.e. the length capped
+// at 3 so that it is known without scanning longer strings. VT_CNT for the
+// unused slots
+static const uint8_t vt_hash[16] = {
+    VT_X16, VT_U16, VT_X8,  VT_U8,  VT_EMPTY, VT_I16, VT_STR, VT_I8,
+    VT_CNT, VT_CNT, VT_X32, VT_U32, VT_CNT,   VT_FLT, VT_CNT, VT_I32
+};
+
 value_type_t value_type_from_str(const char *str)
 {
-    for (int id=0; id<VT_CNT; id++) {
-        if (!strcmp(str, value_type_str(id)))
-            return (value_type_t)id;
+    uint8_t vt;
+
+    if (!str[0] || !str[1])
+        return VT_EMPTY;
+    vt = vt_hash[(5 * (str[0] + str[1]) + (str[2] ? 3 : 2)) & 0x0F];
+    if (vt == VT_CNT || strcmp(str, value_type_str(vt)))
+        return VT_EMPTY;
+    return (value_type_t)vt;
+}
+
+static int digit_val(const char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return 99;
+}
+
+// Unsigned integer of the whole string, at most max. Base 0 is 16 with a
+// 0x prefix, 8 with a leading 0, 10 otherwise; base 16 takes an optional
+// 0x prefix
+static int parse_uint(const char *str, unsigned base, const uint32_t max,
+        uint32_t *out)
+{
+    uint32_t v = 0;
+    int d;
+
+    if ((base == 0 || base == 16) && str[0] == '0' &&
+            (str[1] == 'x' || str[1] == 'X') && str[2]) {
+        base = 16;
+        str += 2;
+    }
+    else if (base == 0)
+        base = (str[0] == '0' && str[1]) ? 8 : 10;
+    if (!*str)
+        return -1;
+    for (; *str; str++) {
+        d = digit_val(*str);
+        if (d >= (int)base || v > (max - d) / base)
+            return -1;
+        v = v * base + d;
+    }
+    *out = v;
+    return 0;
+}
+
+// Signed integer in [-max - 1, max], bases as parse_uint()
+static int parse_int(const char *str, const unsigned base, const int32_t max,
+        int32_t *out)
+{
+    const bool neg = str[0] == '-';
+    uint32_t v;
+
+    if (str[0] == '-' || str[0] == '+')
+        str++;
+    if (parse_uint(str, base, (uint32_t)max + neg, &v))
+        return -1;
+    *out = neg ? (int32_t)(0U - v) : (int32_t)v;
+    return 0;
+}
+
+/* Float parsing
+ *
+ * The decimal value is digits * 10^exp. A float operation is exact on
+ * operands below 2^24 and 10^10, so the common short inputs ("12.5",
+ * "-0.001") take one multiply or divide. The others are approximated in
+ * double, good to a few units of 2^-53, which leaves the float at most one
+ * step off: the halfway points to its neighbours are compared with the
+ * decimal value in exact integer arithmetic.
+ */
+
+// Significant digits kept, more than any float halfway point has
+#define FLT_DIGITS_MAX      125
+#define BIG_LIMBS           40
+
+typedef struct {
+    uint32_t d[BIG_LIMBS];
+    uint16_t n;
+} big_t;
+
+static void big_mul(big_t *b, const uint32_t m, uint32_t carry)
+{
+    for (uint16_t i=0; i<b->n; i++) {
+        const uint64_t t = (uint64_t)b->d[i] * m + carry;
+        b->d[i] = (uint32_t)t;
+        carry = t >> 32;
+    }
+    if (carry && b->n < BIG_LIMBS)
+        b->d[b->n++] = carry;
+}
+
+static void big_mul_pow5(big_t *b, int e)
+{
+    static const uint32_t pow5[14] = { 1, 5, 25, 125, 625, 3125, 15625,
+        78125, 390625, 1953125, 9765625, 48828125, 244140625, 1220703125 };
+
+    for (; e >= 13; e -= 13)
+        big_mul(b, pow5[13], 0);
+    if (e)
+        big_mul(b, pow5[e], 0);
+}
+
+static void big_shl(big_t *b, const int bits)
+{
+    const int limbs = bits / 32;
+    const int sh = bits % 32;
+    int i;
+
+    if (!b->n)
+        return;
+    if (sh) {
+        big_mul(b, 1U << sh, 0);
+    }
+    if (!limbs || b->n + limbs > BIG_LIMBS)
+        return;
+    for (i=b->n-1; i>=0; i--)
+        b->d[i + limbs] = b->d[i];
+    for (i=0; i<limbs; i++)
+        b->d[i] = 0;
+    b->n += limbs;
+}
+
+static int big_cmp(const big_t *a, const big_t *b)
+{
+    if (a->n != b->n)
+        return a->n > b->n ? 1 : -1;
+    for (int i=a->n-1; i>=0; i--) {
+        if (a->d[i] != b->d[i])
+            return a->d[i] > b->d[i] ? 1 : -1;
+    }
+    return 0;
+}
+
+typedef struct {
+    // Significant digits, without the decimal point
+    const char *digits;
+    uint16_t cnt;
+    // Digits past FLT_DIGITS_MAX were not all zero
+    bool sticky;
+    int exp;
+} decimal_t;
+
+// Compare the decimal value with the point halfway above the positive
+// float of bits u
+static int decimal_cmp_half(const decimal_t *dec, const uint32_t u)
+{
+    const uint32_t frac = u & 0x7FFFFF;
+    const uint32_t e = u >> 23;
+    // Halfway point m * 2^k
+    const uint32_t m = 2 * (e ? frac | 0x800000 : frac) + 1;
+    const int k = (e ? (int)e - 150 : -149) - 1;
+    big_t a = { { 0 }, 0 };
+    big_t b = { { m }, 1 };
+    int res;
+
+    for (uint16_t i=0; i<dec->cnt; i++) {
+        if (dec->digits[i] == '.')
+            continue;
+        big_mul(&a, 10, dec->digits[i] - '0');
     }
-    return VT_EMPTY;
+    // digits * 5^exp * 2^exp vs m * 2^k
+    if (dec->exp >= 0)
+        big_mul_pow5(&a, dec->exp);
+    else
+        big_mul_pow5(&b, -dec->exp);
+    if (dec->exp > k)
+        big_shl(&a, dec->exp - k);
+    else
+        big_shl(&b, k - dec->exp);
+    res = big_cmp(&a, &b);
+    return (!res && dec->sticky) ? 1 : res;
 }
 
+static int parse_flt(const char *str, float *out)
+{
+    static const double pow10[23] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6,
+        1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18,
+        1e19, 1e20, 1e21, 1e22 };
+    const bool neg = str[0] == '-';
+    decimal_t dec = { NULL, 0, false, 0 };
+    uint64_t w = 0;
+    uint16_t nd = 0;
+    bool any = false, dot = false;
+    uint32_t u;
+
+    if (str[0] == '-' || str[0] == '+')
+        str++;
+    if (!strcmp(str, "inf") || !strcmp(str, "INF")) {
+        *out = neg ? -__builtin_inff() : __builtin_inff();
+        return 0;
+    }
+    if (!strcmp(str, "nan") || !strcmp(str, "NAN")) {
+        *out = neg ? -__builtin_nanf("") : __builtin_nanf("");
+        return 0;
+    }
+
+    // Mantissa: w holds the first 19 significant digits
+    for (; (*str >= '0' && *str <= '9') || (*str == '.' && !dot); str++) {
+        if (*str == '.') {
+            dot = true;
+            continue;
+        }
+        any = true;
+        if (!nd && *str == '0') {
+            if (dot)
+                dec.exp--;
+            continue;
+        }
+        if (!nd)
+            dec.digits = str;
+        if (nd < FLT_DIGITS_MAX) {
+            if (nd < 19)
+                w = w * 10 + (*str - '0');
+            nd++;
+            dec.cnt = str - dec.digits + 1;
+            if (dot)
+                dec.exp--;
+        }
+        else {
+            if (*str != '0')
+                dec.sticky = true;
+            if (!dot)
+                dec.exp++;
+        }
+    }
+    if (!any)
+        return -1;
+    if (*str == 'e' || *str == 'E') {
+        int32_t e;
+        if (parse_int(str + 1, 10, 99999, &e))
+            return -1;
+        dec.exp += e;
+    }
+    else if (*str)
+        return -1;
+
+    if (!nd || nd + dec.exp < -46) {
+        u = 0;
+    }
+    else if (nd + dec.exp > 39) {
+        return -1;
+    }
+#if FLT_EVAL_METHOD == 0
+    else if (nd <= 19 && w <= (1 << 24) && dec.exp >= -10 &&
+            dec.exp <= 10) {
+        const float f = dec.exp < 0 ? (float)w / (float)pow10[-dec.exp] :
+            (float)w * (float)pow10[dec.exp];
+        memcpy(&u, &f, sizeof(u));
+    }
+#endif
+    else {
+        // w * 10^e, e the exponent of the 19th digit
+        int e = dec.exp + (nd > 19 ? nd - 19 : 0);
+        double d = w;
+        for (; e > 22; e -= 22)
+            d *= pow10[22];
+        for (; e < -22; e += 22)
+            d /= pow10[22];
+        d = e < 0 ? d / pow10[-e] : d * pow10[e];
+        const float f = (float)d;
+        memcpy(&u, &f, sizeof(u));
+        u &= 0x7FFFFFFF;
+        // Halfway points rounding to even
+        int res;
+        if (u < 0x7F800000 && ((res = decimal_cmp_half(&dec, u)) > 0 ||
+                    (!res && (u & 1))))
+            u++;
+        else if (u && ((res = decimal_cmp_half(&dec, u - 1)) < 0 ||
+                    (!res && (u & 1))))
+            u--;
+    }
+    if (u >= 0x7F800000)
+        return -1;
+    if (neg)
+        u |= 0x80000000;
+    memcpy(out, &u, sizeof(u));
+    return 0;
+}
+
+int value_parse(value_t *value, const value_type_t vt, const char *str)
+{
+    uint32_t u;
+    int32_t i;
+
+    switch (vt) {
+    case VT_U8:
+        if (parse_uint(str, 10, UINT8_MAX, &u))
+            return -1;
+        value->val.u8 = u;
+        break;
+    case VT_I8:
+        if (parse_int(str, 0, INT8_MAX, &i))
+            return -1;
+        value->val.i8 = i;
+        break;
+    case VT_X8:
+        if (parse_uint(str, 16, UINT8_MAX, &u))
+            return -1;
+        value->val.u8 = u;
+        break;
+    case VT_U16:
+        if (parse_uint(str, 10, UINT16_MAX, &u))
+            return -1;
+        value->val.u16 = u;
+        break;
+    case VT_I16:
+        if (parse_int(str, 0, INT16_MAX, &i))
+            return -1;
+        value->val.i16 = i;
+        break;
+    case VT_X16:
+        if (parse_uint(str, 16, UINT16_MAX, &u))
+            return -1;
+        value->val.u16 = u;
+        break;
+    case VT_U32:
+        if (parse_uint(str, 10, UINT32_MAX, &u))
+            return -1;
+        value->val.u32 = u;
+        break;
+    case VT_I32:
+        if (parse_int(str, 0, INT32_MAX, &i))
+            return -1;
+        value->val.i32 = i;
+        break;
+    case VT_X32:
+        if (parse_uint(str, 16, UINT32_MAX, &u))
+            return -1;
+        value->val.u32 = u;
+        break;
+    case VT_FLT:
+        if (parse_flt(str, &value->val.flt))
+            return -1;
+        break;
+    default:
+        return -1;
+    }
+    value->vt = vt;
+    return 0;
+}
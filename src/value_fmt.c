@@ -0,0 +1,397 @@
+#include <stdbool.h>
+#include <string.h>
+#include "value_fmt.h"
+
+/* value formatting source code
+ * version: 1.0
+ * date   : 2026-10-18
+ */
+
+// "00" to "99"
+static const char digits2[200] = {
+    '0','0','0','1','0','2','0','3','0','4','0','5','0','6','0','7','0','8','0','9',
+    '1','0','1','1','1','2','1','3','1','4','1','5','1','6','1','7','1','8','1','9',
+    '2','0','2','1','2','2','2','3','2','4','2','5','2','6','2','7','2','8','2','9',
+    '3','0','3','1','3','2','3','3','3','4','3','5','3','6','3','7','3','8','3','9',
+    '4','0','4','1','4','2','4','3','4','4','4','5','4','6','4','7','4','8','4','9',
+    '5','0','5','1','5','2','5','3','5','4','5','5','5','6','5','7','5','8','5','9',
+    '6','0','6','1','6','2','6','3','6','4','6','5','6','6','6','7','6','8','6','9',
+    '7','0','7','1','7','2','7','3','7','4','7','5','7','6','7','7','7','8','7','9',
+    '8','0','8','1','8','2','8','3','8','4','8','5','8','6','8','7','8','8','8','9',
+    '9','0','9','1','9','2','9','3','9','4','9','5','9','6','9','7','9','8','9','9',
+};
+
+static const char hex_digits[16] = {
+    '0','1','2','3','4','5','6','7','8','9','A','B','C','D','E','F',
+};
+
+/* Ryu float to shortest decimal, see "Ryu: fast float-to-string
+ * conversion", Ulf Adams, PLDI 2018.
+ *
+ * flt_pow5_inv[q] = floor(2^(pow5bits(q) - 1 + 59) / 5^q) + 1
+ * flt_pow5[i]     = 5^i scaled to 61 bits
+ */
+#define FLT_MANTISSA_BITS       23
+#define FLT_EXPONENT_BITS       8
+#define FLT_BIAS                127
+#define FLT_POW5_INV_BITCOUNT   59
+#define FLT_POW5_BITCOUNT       61
+
+static const uint64_t flt_pow5_inv[31] = {
+    0x0800000000000001, 0x0666666666666667, 0x051EB851EB851EB9,
+    0x04189374BC6A7EFA, 0x068DB8BAC710CB2A, 0x053E2D6238DA3C22,
+    0x0431BDE82D7B634E, 0x06B5FCA6AF2BD216, 0x055E63B88C230E78,
+    0x044B82FA09B5A52D, 0x06DF37F675EF6EAE, 0x057F5FF85E592558,
+    0x0465E6604B7A8447, 0x0709709A125DA071, 0x05A126E1A84AE6C1,
+    0x0480EBE7B9D58567, 0x0734ACA5F6226F0B, 0x05C3BD5191B525A3,
+    0x049C97747490EAE9, 0x0760F253EDB4AB0E, 0x05E72843249088D8,
+    0x04B8ED0283A6D3E0, 0x078E480405D7B966, 0x060B6CD004AC9452,
+    0x04D5F0A66A23A9DB, 0x07BCB43D769F762B, 0x063090312BB2C4EF,
+    0x04F3A68DBC8F03F3, 0x07EC3DAF94180651, 0x065697BFA9ACD1DA,
+    0x051212FFBAF0A7E2
+};
+
+static const uint64_t flt_pow5[48] = {
+    0x1000000000000000, 0x1400000000000000, 0x1900000000000000,
+    0x1F40000000000000, 0x1388000000000000, 0x186A000000000000,
+    0x1E84800000000000, 0x1312D00000000000, 0x17D7840000000000,
+    0x1DCD650000000000, 0x12A05F2000000000, 0x174876E800000000,
+    0x1D1A94A200000000, 0x12309CE540000000, 0x16BCC41E90000000,
+    0x1C6BF52634000000, 0x11C37937E0800000, 0x16345785D8A00000,
+    0x1BC16D674EC80000, 0x1158E460913D0000, 0x15AF1D78B58C4000,
+    0x1B1AE4D6E2EF5000, 0x10F0CF064DD59200, 0x152D02C7E14AF680,
+    0x1A784379D99DB420, 0x108B2A2C28029094, 0x14ADF4B7320334B9,
+    0x19D971E4FE8401E7, 0x1027E72F1F128130, 0x1431E0FAE6D7217C,
+    0x193E5939A08CE9DB, 0x1F8DEF8808B02452, 0x13B8B5B5056E16B3,
+    0x18A6E32246C99C60, 0x1ED09BEAD87C0378, 0x13426172C74D822B,
+    0x1812F9CF7920E2B6, 0x1E17B84357691B64, 0x12CED32A16A1B11E,
+    0x178287F49C4A1D66, 0x1D6329F1C35CA4BF, 0x125DFA371A19E6F7,
+    0x16F578C4E0A060B5, 0x1CB2D6F618C878E3, 0x11EFC659CF7D4B8D,
+    0x166BB7F0435C9E71, 0x1C06A5EC5433C60D, 0x118427B3B4A05BC8
+};
+
+// ceil(log2(5^e)), 1 for e = 0
+static int32_t pow5bits(const int32_t e)
+{
+    return (int32_t)(((uint32_t)e * 1217359) >> 19) + 1;
+}
+
+// floor(log10(2^e))
+static uint32_t log10_pow2(const int32_t e)
+{
+    return ((uint32_t)e * 78913) >> 18;
+}
+
+// floor(log10(5^e))
+static uint32_t log10_pow5(const int32_t e)
+{
+    return ((uint32_t)e * 732923) >> 20;
+}
+
+static uint32_t pow5_factor(uint32_t v)
+{
+    uint32_t cnt = 0;
+
+    while (v % 5 == 0) {
+        v /= 5;
+        cnt++;
+    }
+    return cnt;
+}
+
+// (m * factor) >> shift, shift > 32
+static uint32_t mul_shift(const uint32_t m, const uint64_t factor,
+        const int32_t shift)
+{
+    const uint64_t lo = (uint64_t)m * (uint32_t)factor;
+    const uint64_t hi = (uint64_t)m * (uint32_t)(factor >> 32);
+
+    return (uint32_t)(((lo >> 32) + hi) >> (shift - 32));
+}
+
+// Shortest decimal mantissa and exponent of a finite, non zero float
+static void flt_to_decimal(const uint32_t ieee_m, const uint32_t ieee_e,
+        uint32_t *mantissa, int32_t *exponent)
+{
+    int32_t e2;
+    uint32_t m2;
+
+    if (ieee_e == 0) {
+        e2 = 1 - FLT_BIAS - FLT_MANTISSA_BITS - 2;
+        m2 = ieee_m;
+    }
+    else {
+        e2 = (int32_t)ieee_e - FLT_BIAS - FLT_MANTISSA_BITS - 2;
+        m2 = (1U << FLT_MANTISSA_BITS) | ieee_m;
+    }
+    const bool accept_bounds = (m2 & 1) == 0;
+
+    // Interval of the decimals that read back as this float
+    const uint32_t mv = 4 * m2;
+    const uint32_t mp = 4 * m2 + 2;
+    const uint32_t mm_shift = ieee_m != 0 || ieee_e <= 1;
+    const uint32_t mm = 4 * m2 - 1 - mm_shift;
+
+    uint32_t vr, vp, vm;
+    int32_t e10;
+    bool vm_zeros = false;
+    bool vr_zeros = false;
+    uint8_t last_digit = 0;
+
+    if (e2 >= 0) {
+        const uint32_t q = log10_pow2(e2);
+        const int32_t k = FLT_POW5_INV_BITCOUNT + pow5bits(q) - 1;
+        const int32_t i = -e2 + (int32_t)q + k;
+        e10 = q;
+        vr = mul_shift(mv, flt_pow5_inv[q], i);
+        vp = mul_shift(mp, flt_pow5_inv[q], i);
+        vm = mul_shift(mm, flt_pow5_inv[q], i);
+        if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+            // One removed digit is needed even without removing more
+            const int32_t l = FLT_POW5_INV_BITCOUNT + pow5bits(q - 1) - 1;
+            last_digit = mul_shift(mv, flt_pow5_inv[q - 1],
+                    -e2 + (int32_t)q - 1 + l) % 10;
+        }
+        if (q <= 9) {
+            // Only one of mp, mv, mm can be a multiple of 5
+            if (mv % 5 == 0)
+                vr_zeros = pow5_factor(mv) >= q;
+            else if (accept_bounds)
+                vm_zeros = pow5_factor(mm) >= q;
+            else
+                vp -= pow5_factor(mp) >= q;
+        }
+    }
+    else {
+        const uint32_t q = log10_pow5(-e2);
+        const int32_t i = -e2 - (int32_t)q;
+        const int32_t k = pow5bits(i) - FLT_POW5_BITCOUNT;
+        int32_t j = (int32_t)q - k;
+        e10 = (int32_t)q + e2;
+        vr = mul_shift(mv, flt_pow5[i], j);
+        vp = mul_shift(mp, flt_pow5[i], j);
+        vm = mul_shift(mm, flt_pow5[i], j);
+        if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+            j = (int32_t)q - 1 - (pow5bits(i + 1) - FLT_POW5_BITCOUNT);
+            last_digit = mul_shift(mv, flt_pow5[i + 1], j) % 10;
+        }
+        if (q <= 1) {
+            // mv = 4 * m2 has at least 2 trailing 0 bits
+            vr_zeros = true;
+            if (accept_bounds)
+                vm_zeros = mm_shift == 1;
+            else
+                vp--;
+        }
+        else if (q < 31)
+            vr_zeros = (mv & ((1U << (q - 1)) - 1)) == 0;
+    }
+
+    // Remove the digits while the interval allows it
+    int32_t removed = 0;
+    uint32_t output;
+    if (vm_zeros || vr_zeros) {
+        while (vp / 10 > vm / 10) {
+            vm_zeros &= vm % 10 == 0;
+            vr_zeros &= last_digit == 0;
+            last_digit = vr % 10;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        if (vm_zeros) {
+            while (vm % 10 == 0) {
+                vr_zeros &= last_digit == 0;
+                last_digit = vr % 10;
+                vr /= 10;
+                vp /= 10;
+                vm /= 10;
+                removed++;
+            }
+        }
+        // Exactly halfway: round to even
+        if (vr_zeros && last_digit == 5 && vr % 2 == 0)
+            last_digit = 4;
+        output = vr + ((vr == vm && (!accept_bounds || !vm_zeros)) ||
+                last_digit >= 5);
+    }
+    else {
+        // Common case
+        while (vp / 10 > vm / 10) {
+            last_digit = vr % 10;
+            vr /= 10;
+            vp /= 10;
+            vm /= 10;
+            removed++;
+        }
+        output = vr + (vr == vm || last_digit >= 5);
+    }
+
+    *mantissa = output;
+    *exponent = e10 + removed;
+}
+
+static int dec_len(const uint32_t v)
+{
+    int len = 1;
+
+    for (uint32_t p=10; len<10 && v>=p; p*=10)
+        len++;
+    return len;
+}
+
+// Write the len digits of v ending at end, two at a time
+static void put_digits(char *end, uint32_t v, int len)
+{
+    while (len >= 2) {
+        const uint32_t d = (v % 100) * 2;
+        v /= 100;
+        *--end = digits2[d + 1];
+        *--end = digits2[d];
+        len -= 2;
+    }
+    if (len)
+        *--end = '0' + v;
+}
+
+int value_fmt_u32(char *buf, const uint32_t v)
+{
+    const int len = dec_len(v);
+
+    put_digits(buf + len, v, len);
+    buf[len] = '\0';
+    return len;
+}
+
+int value_fmt_i32(char *buf, const int32_t v)
+{
+    if (v >= 0)
+        return value_fmt_u32(buf, v);
+    buf[0] = '-';
+    return 1 + value_fmt_u32(buf + 1, -(uint32_t)v);
+}
+
+int value_fmt_hex(char *buf, const uint32_t v)
+{
+    int len = 1;
+
+    while (len < 8 && (v >> (4 * len)))
+        len++;
+    buf[0] = '0';
+    buf[1] = 'x';
+    for (int i=0; i<len; i++)
+        buf[2 + i] = hex_digits[(v >> (4 * (len - 1 - i))) & 0xF];
+    buf[2 + len] = '\0';
+    return 2 + len;
+}
+
+int value_fmt_flt(char *buf, const float v)
+{
+    uint32_t bits;
+    uint32_t m;
+    int32_t e;
+    char *p = buf;
+
+    memcpy(&bits, &v, sizeof(bits));
+    const uint32_t ieee_m = bits & ((1U << FLT_MANTISSA_BITS) - 1);
+    const uint32_t ieee_e = (bits >> FLT_MANTISSA_BITS) &
+        ((1U << FLT_EXPONENT_BITS) - 1);
+
+    if (ieee_e == (1U << FLT_EXPONENT_BITS) - 1 && ieee_m) {
+        memcpy(buf, "nan", 4);
+        return 3;
+    }
+    if (bits >> 31)
+        *p++ = '-';
+    if (ieee_e == (1U << FLT_EXPONENT_BITS) - 1) {
+        memcpy(p, "inf", 4);
+        return p - buf + 3;
+    }
+    if (!ieee_e && !ieee_m) {
+        memcpy(p, "0", 2);
+        return p - buf + 1;
+    }
+
+    flt_to_decimal(ieee_m, ieee_e, &m, &e);
+    const int len = dec_len(m);
+    // Exponent of the first digit, as in d.ddd x 10^x
+    const int32_t x = e + len - 1;
+
+    if (x >= 0 && x < 9) {
+        if (e >= 0) {
+            // Integer, e.g. 1200
+            put_digits(p + len, m, len);
+            memset(p + len, '0', e);
+            p += len + e;
+        }
+        else {
+            // e.g. 12.5
+            put_digits(p + len + 1, m, len);
+            memmove(p, p + 1, x + 1);
+            p[x + 1] = '.';
+            p += len + 1;
+        }
+    }
+    else if (x < 0 && x >= -4) {
+        // e.g. 0.00125
+        const int zeros = -x - 1;
+        p[0] = '0';
+        p[1] = '.';
+        memset(p + 2, '0', zeros);
+        put_digits(p + 2 + zeros + len, m, len);
+        p += 2 + zeros + len;
+    }
+    else {
+        // e.g. 1.25e-7
+        put_digits(p + len + 1, m, len);
+        p[0] = p[1];
+        if (len > 1) {
+            p[1] = '.';
+            p += len + 1;
+        }
+        else
+            p++;
+        *p++ = 'e';
+        p += value_fmt_i32(p, x);
+    }
+    *p = '\0';
+    return p - buf;
+}
+
+int value_fmt(char *buf, const value_type_t vt, const uint32_t raw)
+{
+    value_t value;
+
+    value.vt = vt;
+    value.val.u32 = raw;
+    switch (vt) {
+    case VT_U8:  return value_fmt_u32(buf, value.val.u8);
+    case VT_I8:  return value_fmt_i32(buf, value.val.i8);
+    case VT_X8:  return value_fmt_hex(buf, value.val.u8);
+    case VT_U16: return value_fmt_u32(buf, value.val.u16);
+    case VT_I16: return value_fmt_i32(buf, value.val.i16);
+    case VT_X16: return value_fmt_hex(buf, value.val.u16);
+    case VT_U32: return value_fmt_u32(buf, value.val.u32);
+    case VT_I32: return value_fmt_i32(buf, value.val.i32);
+    case VT_X32: return value_fmt_hex(buf, value.val.u32);
+    case VT_FLT: return value_fmt_flt(buf, value.val.flt);
+    default:
+        buf[0] = '\0';
+        return 0;
+    }
+}
+
+uint16_t value_fmt_batch(char *buf, const uint32_t size,
+        const uint8_t *types, const uint32_t *values, const uint16_t cnt,
+        uint8_t *lens)
+{
+    uint32_t pos = 0;
+    uint16_t i;
+
+    for (i=0; i<cnt && pos+VALUE_SCALAR_MAX_SIZE<=size; i++) {
+        lens[i] = value_fmt(buf + pos, types[i], values[i]);
+        pos += lens[i] + 1;
+    }
+    return i;
+}